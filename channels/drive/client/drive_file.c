@@ -32,9 +32,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include <winpr/wtypes.h>
 #include <winpr/crt.h>
+#include <winpr/assert.h>
 #include <winpr/string.h>
 #include <winpr/path.h>
 #include <winpr/file.h>
@@ -337,6 +339,8 @@ DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 Pat
 	file->CreateDisposition = CreateDisposition;
 	file->CreateOptions = CreateOptions;
 	file->SharedAccess = SharedAccess;
+	/* Other handles of the client may write the file behind our back otherwise */
+	file->read_ahead_allowed = (SharedAccess & FILE_SHARE_WRITE) == 0;
 	drive_file_set_fullpath(file, drive_file_combine_fullpath(base_path, path, PathWCharLength));
 
 	if (!drive_file_init(file))
@@ -383,59 +387,215 @@ BOOL drive_file_free(DRIVE_FILE* file)
 	rc = TRUE;
 fail:
 	DEBUG_WSTR("Free %s", file->fullpath);
+	free(file->read_ahead);
 	free(file->fullpath);
 	free(file);
 	return rc;
 }
 
-BOOL drive_file_seek(DRIVE_FILE* file, UINT64 Offset)
+static void drive_file_discard_read_ahead(DRIVE_FILE* file)
 {
-	LARGE_INTEGER loffset;
+	WINPR_ASSERT(file);
 
-	if (!file)
+	file->read_ahead_offset = 0;
+	file->read_ahead_length = 0;
+}
+
+/* Whole second modification times miss rewrites within the same second, compare at the
+ * resolution the platform offers instead */
+static BOOL drive_file_get_stamp(DRIVE_FILE* file, DRIVE_FILE_STAMP* stamp)
+{
+	WINPR_ASSERT(file);
+	WINPR_ASSERT(stamp);
+
+#if defined(_WIN32)
+	FILE_BASIC_INFO basic = { 0 };
+	FILE_STANDARD_INFO standard = { 0 };
+
+	if (!GetFileInformationByHandleEx(file->file_handle, FileBasicInfo, &basic, sizeof(basic)) ||
+	    !GetFileInformationByHandleEx(file->file_handle, FileStandardInfo, &standard,
+	                                  sizeof(standard)))
 		return FALSE;
 
-	if (Offset > INT64_MAX)
+	stamp->size = (UINT64)standard.EndOfFile.QuadPart;
+	stamp->mtime = (UINT64)basic.LastWriteTime.QuadPart;
+	stamp->ctime = (UINT64)basic.ChangeTime.QuadPart;
+#else
+	struct stat st = { 0 };
+	char* path = ConvertWCharToUtf8Alloc(file->fullpath, NULL);
+
+	if (!path)
 		return FALSE;
 
-	loffset.QuadPart = (LONGLONG)Offset;
-	return SetFilePointerEx(file->file_handle, loffset, NULL, FILE_BEGIN);
+	const int rc = stat(path, &st);
+	free(path);
+	if (rc != 0)
+		return FALSE;
+
+	stamp->size = (UINT64)st.st_size;
+#if defined(__APPLE__)
+	stamp->mtime = (UINT64)st.st_mtimespec.tv_sec * 1000000000ull + st.st_mtimespec.tv_nsec;
+	stamp->ctime = (UINT64)st.st_ctimespec.tv_sec * 1000000000ull + st.st_ctimespec.tv_nsec;
+#else
+	stamp->mtime = (UINT64)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+	stamp->ctime = (UINT64)st.st_ctim.tv_sec * 1000000000ull + st.st_ctim.tv_nsec;
+#endif
+#endif
+	return TRUE;
 }
 
-BOOL drive_file_read(DRIVE_FILE* file, BYTE* buffer, UINT32* Length)
+/* Drop data read ahead of time if the file was modified through another handle since */
+static void drive_file_validate_read_ahead(DRIVE_FILE* file)
+{
+	DRIVE_FILE_STAMP stamp = { 0 };
+
+	WINPR_ASSERT(file);
+
+	if (file->read_ahead_length == 0)
+		return;
+
+	if (!drive_file_get_stamp(file, &stamp) ||
+	    (stamp.size != file->read_ahead_stamp.size) ||
+	    (stamp.mtime != file->read_ahead_stamp.mtime) ||
+	    (stamp.ctime != file->read_ahead_stamp.ctime))
+		drive_file_discard_read_ahead(file);
+}
+
+static BOOL drive_file_read_at(DRIVE_FILE* file, UINT64 Offset, BYTE* buffer, UINT32* Length)
 {
 	DWORD read = 0;
+	OVERLAPPED overlapped = { 0 };
+
+	if (Offset > INT64_MAX)
+		return FALSE;
+
+	overlapped.Offset = Offset & 0xFFFFFFFF;
+	overlapped.OffsetHigh = Offset >> 32;
+
+	if (!ReadFile(file->file_handle, buffer, *Length, &read, &overlapped))
+	{
+		if (GetLastError() != ERROR_HANDLE_EOF)
+			return FALSE;
+
+		read = 0;
+	}
+
+	*Length = read;
+	return TRUE;
+}
+
+BOOL drive_file_read(DRIVE_FILE* file, UINT64 Offset, BYTE* buffer, UINT32* Length)
+{
+	UINT32 cached = 0;
 
 	if (!file || !buffer || !Length)
 		return FALSE;
 
 	DEBUG_WSTR("Read file %s", file->fullpath);
 
-	if (ReadFile(file->file_handle, buffer, *Length, &read, NULL))
+	drive_file_validate_read_ahead(file);
+
+	/* Serve the start of the range from data read ahead of time */
+	if ((Offset >= file->read_ahead_offset) &&
+	    (Offset < file->read_ahead_offset + file->read_ahead_length))
+	{
+		const UINT64 skip = Offset - file->read_ahead_offset;
+
+		cached = (UINT32)MIN(*Length, file->read_ahead_length - skip);
+		CopyMemory(buffer, &file->read_ahead[skip], cached);
+	}
+
+	if (cached < *Length)
 	{
-		*Length = read;
+		UINT32 remaining = *Length - cached;
+
+		if (!drive_file_read_at(file, Offset + cached, &buffer[cached], &remaining))
+			return FALSE;
+
+		cached += remaining;
+	}
+
+	/* A read continuing the previous one, the first read of a file is never sequential */
+	file->sequential = (file->next_length > 0) && (Offset == file->next_offset);
+	file->next_offset = Offset + cached;
+	file->next_length = *Length;
+	*Length = cached;
+	return TRUE;
+}
+
+BOOL drive_file_read_ahead(DRIVE_FILE* file)
+{
+	UINT32 length = 0;
+	DRIVE_FILE_STAMP stamp = { 0 };
+
+	if (!file)
+		return FALSE;
+
+	if (!file->read_ahead_allowed || !file->sequential || (file->next_length == 0) ||
+	    (file->next_length > DRIVE_FILE_READ_AHEAD_MAX))
+		return TRUE;
+
+	/* Still holding the data the next read asks for */
+	if ((file->next_offset >= file->read_ahead_offset) &&
+	    (file->next_offset + file->next_length <=
+	     file->read_ahead_offset + file->read_ahead_length))
 		return TRUE;
+
+	drive_file_discard_read_ahead(file);
+
+	if (file->read_ahead_size < file->next_length)
+	{
+		BYTE* tmp = realloc(file->read_ahead, file->next_length);
+
+		if (!tmp)
+			return FALSE;
+
+		file->read_ahead = tmp;
+		file->read_ahead_size = file->next_length;
 	}
 
-	return FALSE;
+	/* Stamp before reading, a write racing with the read then invalidates the buffer */
+	if (!drive_file_get_stamp(file, &stamp))
+		return FALSE;
+
+	length = file->next_length;
+
+	if (!drive_file_read_at(file, file->next_offset, file->read_ahead, &length))
+		return FALSE;
+
+	file->read_ahead_offset = file->next_offset;
+	file->read_ahead_length = length;
+	file->read_ahead_stamp = stamp;
+	return TRUE;
 }
 
-BOOL drive_file_write(DRIVE_FILE* file, const BYTE* buffer, UINT32 Length)
+BOOL drive_file_write(DRIVE_FILE* file, UINT64 Offset, const BYTE* buffer, UINT32 Length)
 {
 	DWORD written = 0;
 
 	if (!file || !buffer)
 		return FALSE;
 
+	if (Offset > INT64_MAX)
+		return FALSE;
+
 	DEBUG_WSTR("Write file %s", file->fullpath);
 
+	drive_file_discard_read_ahead(file);
+
 	while (Length > 0)
 	{
-		if (!WriteFile(file->file_handle, buffer, Length, &written, NULL))
+		OVERLAPPED overlapped = { 0 };
+
+		overlapped.Offset = Offset & 0xFFFFFFFF;
+		overlapped.OffsetHigh = Offset >> 32;
+
+		if (!WriteFile(file->file_handle, buffer, Length, &written, &overlapped))
 			return FALSE;
 
 		Length -= written;
 		buffer += written;
+		Offset += written;
 	}
 
 	return TRUE;
@@ -715,6 +875,7 @@ BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UIN
 			}
 
 			liSize.QuadPart = size;
+			drive_file_discard_read_ahead(file);
 
 			if (!SetFilePointerEx(file->file_handle, liSize, NULL, FILE_BEGIN))
 			{
@@ -32,6 +32,15 @@
 
 #define TAG CHANNELS_TAG("drive.client")
 
+#define DRIVE_FILE_READ_AHEAD_MAX (4 * 1024 * 1024)
+
+typedef struct
+{
+	UINT64 size;
+	UINT64 mtime;
+	UINT64 ctime;
+} DRIVE_FILE_STAMP;
+
 typedef struct
 {
 	UINT32 id;
@@ -47,6 +56,18 @@ typedef struct
 	UINT32 DesiredAccess;
 	UINT32 CreateDisposition;
 	UINT32 CreateOptions;
+
+	/* Sequential read detection and read-ahead buffer, the buffer is only valid while the file
+	 * keeps the size, modification and change time it had when the buffer was filled */
+	BOOL read_ahead_allowed;
+	BOOL sequential;
+	UINT64 next_offset;
+	UINT32 next_length;
+	BYTE* read_ahead;
+	UINT32 read_ahead_size;
+	UINT64 read_ahead_offset;
+	UINT32 read_ahead_length;
+	DRIVE_FILE_STAMP read_ahead_stamp;
 } DRIVE_FILE;
 
 DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 PathWCharLength,
@@ -55,9 +76,9 @@ DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 Pat
 BOOL drive_file_free(DRIVE_FILE* file);
 
 BOOL drive_file_open(DRIVE_FILE* file);
-BOOL drive_file_seek(DRIVE_FILE* file, UINT64 Offset);
-BOOL drive_file_read(DRIVE_FILE* file, BYTE* buffer, UINT32* Length);
-BOOL drive_file_write(DRIVE_FILE* file, const BYTE* buffer, UINT32 Length);
+BOOL drive_file_read(DRIVE_FILE* file, UINT64 Offset, BYTE* buffer, UINT32* Length);
+BOOL drive_file_read_ahead(DRIVE_FILE* file);
+BOOL drive_file_write(DRIVE_FILE* file, UINT64 Offset, const BYTE* buffer, UINT32 Length);
 BOOL drive_file_query_information(DRIVE_FILE* file, UINT32 FsInformationClass, wStream* output);
 BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UINT32 Length,
                                 wStream* input);
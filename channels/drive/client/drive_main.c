@@ -46,6 +46,15 @@
 
 #include "drive_file.h"
 
+#define DRIVE_MAX_WORKERS 4
+
+typedef struct
+{
+	DEVICE* device;
+	HANDLE thread;
+	wMessageQueue* IrpQueue;
+} DRIVE_WORKER;
+
 typedef struct
 {
 	DEVICE device;
@@ -55,8 +64,8 @@ typedef struct
 	UINT32 PathLength;
 	wListDictionary* files;
 
-	HANDLE thread;
-	wMessageQueue* IrpQueue;
+	/* All IRPs of a file are processed by the same worker, in the order they arrived */
+	DRIVE_WORKER workers[DRIVE_MAX_WORKERS];
 
 	DEVMAN* devman;
 
@@ -179,7 +188,7 @@ static UINT drive_process_irp_create(DRIVE_DEVICE* drive, IRP* irp)
 		return ERROR_INVALID_DATA;
 
 	path = Stream_ConstPointer(irp->input);
-	FileId = irp->devman->id_sequence++;
+	FileId = irp->FileId; /* allocated by drive_irp_request */
 	file = drive_file_new(drive->path, path, PathLength / sizeof(WCHAR), FileId, DesiredAccess,
 	                      CreateDisposition, CreateOptions, FileAttributes, SharedAccess);
 
@@ -285,11 +294,6 @@ static UINT drive_process_irp_read(DRIVE_DEVICE* drive, IRP* irp)
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 		Length = 0;
 	}
-	else if (!drive_file_seek(file, Offset))
-	{
-		irp->IoStatus = drive_map_windows_err(GetLastError());
-		Length = 0;
-	}
 
 	if (!Stream_EnsureRemainingCapacity(irp->output, Length + 4))
 	{
@@ -302,7 +306,7 @@ static UINT drive_process_irp_read(DRIVE_DEVICE* drive, IRP* irp)
 	{
 		BYTE* buffer = Stream_PointerAs(irp->output, BYTE) + sizeof(UINT32);
 
-		if (!drive_file_read(file, buffer, &Length))
+		if (!drive_file_read(file, Offset, buffer, &Length))
 		{
 			irp->IoStatus = drive_map_windows_err(GetLastError());
 			Stream_Write_UINT32(irp->output, 0);
@@ -314,7 +318,13 @@ static UINT drive_process_irp_read(DRIVE_DEVICE* drive, IRP* irp)
 		}
 	}
 
-	return irp->Complete(irp);
+	const UINT error = irp->Complete(irp);
+
+	/* While the response is on its way fetch what a sequential reader asks for next */
+	if (!error && file)
+		drive_file_read_ahead(file);
+
+	return error;
 }
 
 /**
@@ -347,12 +357,7 @@ static UINT drive_process_irp_write(DRIVE_DEVICE* drive, IRP* irp)
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 		Length = 0;
 	}
-	else if (!drive_file_seek(file, Offset))
-	{
-		irp->IoStatus = drive_map_windows_err(GetLastError());
-		Length = 0;
-	}
-	else if (!drive_file_write(file, ptr, Length))
+	else if (!drive_file_write(file, Offset, ptr, Length))
 	{
 		irp->IoStatus = drive_map_windows_err(GetLastError());
 		Length = 0;
@@ -745,25 +750,28 @@ static DWORD WINAPI drive_thread_func(LPVOID arg)
 {
 	IRP* irp = NULL;
 	wMessage message = { 0 };
-	DRIVE_DEVICE* drive = (DRIVE_DEVICE*)arg;
+	DRIVE_WORKER* worker = (DRIVE_WORKER*)arg;
+	DRIVE_DEVICE* drive = NULL;
 	UINT error = CHANNEL_RC_OK;
 
-	if (!drive)
+	if (!worker)
 	{
 		error = ERROR_INVALID_PARAMETER;
 		goto fail;
 	}
 
+	drive = (DRIVE_DEVICE*)worker->device;
+
 	while (1)
 	{
-		if (!MessageQueue_Wait(drive->IrpQueue))
+		if (!MessageQueue_Wait(worker->IrpQueue))
 		{
 			WLog_ERR(TAG, "MessageQueue_Wait failed!");
 			error = ERROR_INTERNAL_ERROR;
 			break;
 		}
 
-		if (!MessageQueue_Peek(drive->IrpQueue, &message, TRUE))
+		if (!MessageQueue_Peek(worker->IrpQueue, &message, TRUE))
 		{
 			WLog_ERR(TAG, "MessageQueue_Peek failed!");
 			error = ERROR_INTERNAL_ERROR;
@@ -802,11 +810,21 @@ fail:
 static UINT drive_irp_request(DEVICE* device, IRP* irp)
 {
 	DRIVE_DEVICE* drive = (DRIVE_DEVICE*)device;
+	DRIVE_WORKER* worker = NULL;
 
-	if (!drive)
+	if (!drive || !irp || !irp->devman)
 		return ERROR_INVALID_PARAMETER;
 
-	if (!MessageQueue_Post(drive->IrpQueue, NULL, 0, (void*)irp, NULL))
+	/*
+	 * IRPs arrive on a single thread, allocate the id of a new file here as creates are
+	 * processed concurrently. The file is then bound to the worker handling its create.
+	 */
+	if (irp->MajorFunction == IRP_MJ_CREATE)
+		irp->FileId = irp->devman->id_sequence++;
+
+	worker = &drive->workers[irp->FileId % DRIVE_MAX_WORKERS];
+
+	if (!MessageQueue_Post(worker->IrpQueue, NULL, 0, (void*)irp, NULL))
 	{
 		WLog_ERR(TAG, "MessageQueue_Post failed!");
 		return ERROR_INTERNAL_ERROR;
@@ -815,6 +833,34 @@ static UINT drive_irp_request(DEVICE* device, IRP* irp)
 	return CHANNEL_RC_OK;
 }
 
+static UINT drive_stop_workers(DRIVE_DEVICE* drive)
+{
+	UINT error = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(drive);
+
+	for (size_t x = 0; x < DRIVE_MAX_WORKERS; x++)
+	{
+		DRIVE_WORKER* worker = &drive->workers[x];
+
+		if (!worker->thread)
+			continue;
+
+		if (MessageQueue_PostQuit(worker->IrpQueue, 0) &&
+		    (WaitForSingleObject(worker->thread, INFINITE) == WAIT_FAILED))
+		{
+			error = GetLastError();
+			WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", error);
+			continue;
+		}
+
+		CloseHandle(worker->thread);
+		worker->thread = NULL;
+	}
+
+	return error;
+}
+
 static UINT drive_free_int(DRIVE_DEVICE* drive)
 {
 	UINT error = CHANNEL_RC_OK;
@@ -822,9 +868,12 @@ static UINT drive_free_int(DRIVE_DEVICE* drive)
 	if (!drive)
 		return ERROR_INVALID_PARAMETER;
 
-	CloseHandle(drive->thread);
+	drive_stop_workers(drive);
+
+	for (size_t x = 0; x < DRIVE_MAX_WORKERS; x++)
+		MessageQueue_Free(drive->workers[x].IrpQueue);
+
 	ListDictionary_Free(drive->files);
-	MessageQueue_Free(drive->IrpQueue);
 	Stream_Free(drive->device.data, TRUE);
 	free(drive->path);
 	free(drive);
@@ -844,13 +893,8 @@ static UINT drive_free(DEVICE* device)
 	if (!drive)
 		return ERROR_INVALID_PARAMETER;
 
-	if (MessageQueue_PostQuit(drive->IrpQueue, 0) &&
-	    (WaitForSingleObject(drive->thread, INFINITE) == WAIT_FAILED))
-	{
-		error = GetLastError();
-		WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", error);
+	if ((error = drive_stop_workers(drive)))
 		return error;
-	}
 
 	return drive_free_int(drive);
 }
@@ -969,18 +1013,25 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 		}
 
 		ListDictionary_ValueObject(drive->files)->fnObjectFree = drive_file_objfree;
-		drive->IrpQueue = MessageQueue_New(NULL);
 
-		if (!drive->IrpQueue)
+		for (size_t x = 0; x < DRIVE_MAX_WORKERS; x++)
 		{
-			WLog_ERR(TAG, "ListDictionary_New failed!");
-			error = CHANNEL_RC_NO_MEMORY;
-			goto out_error;
-		}
+			DRIVE_WORKER* worker = &drive->workers[x];
 
-		wObject* obj = MessageQueue_Object(drive->IrpQueue);
-		WINPR_ASSERT(obj);
-		obj->fnObjectFree = drive_message_free;
+			worker->device = &drive->device;
+			worker->IrpQueue = MessageQueue_New(NULL);
+
+			if (!worker->IrpQueue)
+			{
+				WLog_ERR(TAG, "MessageQueue_New failed!");
+				error = CHANNEL_RC_NO_MEMORY;
+				goto out_error;
+			}
+
+			wObject* obj = MessageQueue_Object(worker->IrpQueue);
+			WINPR_ASSERT(obj);
+			obj->fnObjectFree = drive_message_free;
+		}
 
 		if ((error = pEntryPoints->RegisterDevice(pEntryPoints->devman, (DEVICE*)drive)))
 		{
@@ -988,14 +1039,19 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 			goto out_error;
 		}
 
-		if (!(drive->thread =
-		          CreateThread(NULL, 0, drive_thread_func, drive, CREATE_SUSPENDED, NULL)))
+		for (size_t x = 0; x < DRIVE_MAX_WORKERS; x++)
 		{
-			WLog_ERR(TAG, "CreateThread failed!");
-			goto out_error;
-		}
+			DRIVE_WORKER* worker = &drive->workers[x];
 
-		ResumeThread(drive->thread);
+			if (!(worker->thread = CreateThread(NULL, 0, drive_thread_func, worker,
+			                                    CREATE_SUSPENDED, NULL)))
+			{
+				WLog_ERR(TAG, "CreateThread failed!");
+				goto out_error;
+			}
+
+			ResumeThread(worker->thread);
+		}
 	}
 
 	return CHANNEL_RC_OK;
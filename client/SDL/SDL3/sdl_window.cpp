@@ -36,7 +36,8 @@ SdlWindow::SdlWindow(const std::string& title, Sint32 startupX, Sint32 startupY,
 }
 
 SdlWindow::SdlWindow(SdlWindow&& other)
-    : _window(other._window), _offset_x(other._offset_x), _offset_y(other._offset_y)
+    : _window(other._window), _offset_x(other._offset_x), _offset_y(other._offset_y),
+      _dirty(std::move(other._dirty)), _dirtyAll(other._dirtyAll)
 {
 	other._window = nullptr;
 }
@@ -172,6 +173,7 @@ bool SdlWindow::fill(Uint8 r, Uint8 g, Uint8 b, Uint8 a)
 	auto color = SDL_MapRGBA(surface->format, r, g, b, a);
 
 	SDL_FillSurfaceRect(surface, &rect, color);
+	_dirtyAll = true;
 	return true;
 }
 
@@ -184,6 +186,12 @@ bool SdlWindow::blit(SDL_Surface* surface, const SDL_Rect& srcRect, SDL_Rect& ds
 		return true;
 	if (!SDL_SetSurfaceClipRect(screen, &dstRect))
 		return true;
+
+	const SDL_Rect screenRect = { 0, 0, screen->w, screen->h };
+	SDL_Rect dirty = {};
+	if (SDL_GetRectIntersection(&screenRect, &dstRect, &dirty))
+		markDirty(dirty);
+
 	auto rc = SDL_BlitSurfaceScaled(surface, &srcRect, screen, &dstRect, SDL_SCALEMODE_BEST);
 	if (rc != 0)
 	{
@@ -192,7 +200,29 @@ bool SdlWindow::blit(SDL_Surface* surface, const SDL_Rect& srcRect, SDL_Rect& ds
 	return rc == 0;
 }
 
+void SdlWindow::markDirty(const SDL_Rect& rect)
+{
+	/* Past this many rects a single full update is cheaper than walking the list */
+	static const size_t maxDirtyRects = 64;
+
+	if (_dirtyAll)
+		return;
+	if (_dirty.size() >= maxDirtyRects)
+	{
+		_dirty.clear();
+		_dirtyAll = true;
+		return;
+	}
+	_dirty.push_back(rect);
+}
+
 void SdlWindow::updateSurface()
 {
-	SDL_UpdateWindowSurface(_window);
+	if (_dirtyAll)
+		SDL_UpdateWindowSurface(_window);
+	else if (!_dirty.empty())
+		SDL_UpdateWindowSurfaceRects(_window, _dirty.data(), static_cast<int>(_dirty.size()));
+
+	_dirty.clear();
+	_dirtyAll = false;
 }
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <SDL3/SDL.h>
 
 class SdlWindow
@@ -50,12 +51,18 @@ class SdlWindow
 
 	bool fill(Uint8 r = 0x00, Uint8 g = 0x00, Uint8 b = 0x00, Uint8 a = 0xff);
 	bool blit(SDL_Surface* surface, const SDL_Rect& src, SDL_Rect& dst);
+
+	/* Presents the areas changed by fill and blit since the last call */
 	void updateSurface();
 
   private:
+	void markDirty(const SDL_Rect& rect);
+
 	SDL_Window* _window = nullptr;
 	Sint32 _offset_x = 0;
 	Sint32 _offset_y = 0;
+	std::vector<SDL_Rect> _dirty;
+	bool _dirtyAll = false;
 
   private:
 	SdlWindow(const SdlWindow& other) = delete;
@@ -51,6 +51,10 @@
 #include <X11/extensions/Xinerama.h>
 #endif
 
+#ifdef WITH_XSHM
+#include <X11/extensions/XShm.h>
+#endif
+
 #include <X11/XKBlib.h>
 
 #include <errno.h>
@@ -101,6 +105,7 @@
 #include "xf_graphics.h"
 #include "xf_keyboard.h"
 #include "xf_channels.h"
+#include "xf_shm.h"
 #include "xfreerdp.h"
 #include "xf_utils.h"
 
@@ -406,6 +411,64 @@ static BOOL xf_paint(xfContext* xfc, const GDI_RGN* region)
 	return TRUE;
 }
 
+static BOOL xf_paint_shm(xfContext* xfc, const GDI_RGN* regions, INT32 count)
+{
+	UINT32 stride = 0;
+	RECTANGLE_16 stackRects[16] = { 0 };
+	RECTANGLE_16* rects = stackRects;
+	BOOL rc = FALSE;
+
+	WINPR_ASSERT(xfc);
+	WINPR_ASSERT(regions);
+
+	const rdpGdi* gdi = xfc->common.context.gdi;
+	WINPR_ASSERT(gdi);
+
+	BYTE* data = xf_shm_image_begin(xfc->shmImage, &stride);
+
+	if (!data)
+		return FALSE;
+
+	if ((size_t)count > ARRAYSIZE(stackRects))
+	{
+		rects = (RECTANGLE_16*)calloc((size_t)count, sizeof(RECTANGLE_16));
+
+		if (!rects)
+			return FALSE;
+	}
+
+	for (INT32 i = 0; i < count; i++)
+	{
+		const GDI_RGN* rgn = &regions[i];
+		RECTANGLE_16* rect = &rects[i];
+
+		if (!freerdp_image_copy_no_overlap(data, gdi->dstFormat, stride, rgn->x, rgn->y, rgn->w,
+		                                   rgn->h, gdi->primary_buffer, gdi->dstFormat,
+		                                   gdi->stride, rgn->x, rgn->y, NULL, FREERDP_FLIP_NONE))
+			goto fail;
+
+		rect->left = rgn->x;
+		rect->top = rgn->y;
+		rect->right = rgn->x + rgn->w;
+		rect->bottom = rgn->y + rgn->h;
+	}
+
+	if (!xf_shm_image_put(xfc->shmImage, xfc->primary, xfc->gc, rects, (UINT32)count, 0, 0))
+		goto fail;
+
+	for (INT32 i = 0; i < count; i++)
+	{
+		const GDI_RGN* rgn = &regions[i];
+		xf_draw_screen(xfc, rgn->x, rgn->y, rgn->w, rgn->h);
+	}
+
+	rc = TRUE;
+fail:
+	if (rects != stackRects)
+		free(rects);
+	return rc;
+}
+
 static BOOL xf_end_paint(rdpContext* context)
 {
 	xfContext* xfc = (xfContext*)context;
@@ -422,7 +485,12 @@ static BOOL xf_end_paint(rdpContext* context)
 		if (rgn->null)
 			return TRUE;
 		xf_lock_x11(xfc);
-		if (!xf_paint(xfc, rgn))
+		if (xfc->shmImage && !xfc->remote_app)
+		{
+			if (!xf_paint_shm(xfc, rgn, 1))
+				return FALSE;
+		}
+		else if (!xf_paint(xfc, rgn))
 			return FALSE;
 		xf_unlock_x11(xfc);
 	}
@@ -436,12 +504,20 @@ static BOOL xf_end_paint(rdpContext* context)
 
 		xf_lock_x11(xfc);
 
-		for (INT32 i = 0; i < ninvalid; i++)
+		if (xfc->shmImage && !xfc->remote_app)
 		{
-			const GDI_RGN* rgn = &cinvalid[i];
-			if (!xf_paint(xfc, rgn))
+			if (!xf_paint_shm(xfc, cinvalid, ninvalid))
 				return FALSE;
 		}
+		else
+		{
+			for (INT32 i = 0; i < ninvalid; i++)
+			{
+				const GDI_RGN* rgn = &cinvalid[i];
+				if (!xf_paint(xfc, rgn))
+					return FALSE;
+			}
+		}
 
 		XFlush(xfc->display);
 		xf_unlock_x11(xfc);
@@ -480,6 +556,8 @@ static BOOL xf_sw_desktop_resize(rdpContext* context)
 
 	xfc->image->byte_order = LSBFirst;
 	xfc->image->bitmap_bit_order = LSBFirst;
+	xf_shm_image_free(xfc->shmImage);
+	xfc->shmImage = xf_shm_image_new(xfc, gdi->width, gdi->height);
 	ret = xf_desktop_resize(context);
 out:
 	xf_unlock_x11(xfc);
@@ -702,6 +780,9 @@ BOOL xf_create_image(xfContext* xfc)
 		                          xfc->scanline_pad, cgdi->stride);
 		xfc->image->byte_order = LSBFirst;
 		xfc->image->bitmap_bit_order = LSBFirst;
+		xfc->shmImage =
+		    xf_shm_image_new(xfc, freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth),
+		                     freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight));
 	}
 	return TRUE;
 }
@@ -729,6 +810,9 @@ static void xf_window_free(xfContext* xfc)
 		xfc->image = NULL;
 	}
 
+	xf_shm_image_free(xfc->shmImage);
+	xfc->shmImage = NULL;
+
 	if (xfc->bitmap_mono)
 	{
 		XFreePixmap(xfc->display, xfc->bitmap_mono);
@@ -894,6 +978,14 @@ static void xf_check_extensions(xfContext* context)
 		context->xkbAvailable = TRUE;
 	}
 
+#ifdef WITH_XSHM
+	if (XShmQueryExtension(context->display) &&
+	    (ImageByteOrder(context->display) == LSBFirst))
+	{
+		context->xshmAvailable = TRUE;
+	}
+#endif
+
 #ifdef WITH_XRENDER
 	{
 		int xrender_event_base = 0;
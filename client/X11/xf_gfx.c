@@ -26,11 +26,78 @@
 #include <freerdp/log.h>
 #include "xf_gfx.h"
 #include "xf_rail.h"
+#include "xf_shm.h"
 
 #include <X11/Xutil.h>
 
 #define TAG CLIENT_TAG("x11")
 
+static UINT xf_OutputUpdateShm(xfContext* xfc, xfGfxSurface* surface, const RECTANGLE_16* rects,
+                               UINT32 nbRects)
+{
+	UINT rc = ERROR_INTERNAL_ERROR;
+	UINT32 stride = 0;
+	Drawable drawable = xfc->drawable;
+	BOOL drawScreen = FALSE;
+
+	const rdpGdi* gdi = xfc->common.context.gdi;
+	WINPR_ASSERT(gdi);
+
+	const rdpSettings* settings = xfc->common.context.settings;
+	WINPR_ASSERT(settings);
+
+	const INT32 surfaceX = (INT32)surface->gdi.outputOriginX;
+	const INT32 surfaceY = (INT32)surface->gdi.outputOriginY;
+
+#ifdef WITH_XRENDER
+	if (freerdp_settings_get_bool(settings, FreeRDP_SmartSizing) ||
+	    freerdp_settings_get_bool(settings, FreeRDP_MultiTouchGestures))
+	{
+		drawable = xfc->primary;
+		drawScreen = TRUE;
+	}
+#else
+	WINPR_UNUSED(settings);
+#endif
+
+	xf_lock_x11(xfc);
+	BYTE* data = xf_shm_image_begin(surface->shm, &stride);
+
+	if (!data)
+		goto fail;
+
+	/* Converts to the X11 format as well, no stage buffer is required */
+	for (UINT32 x = 0; x < nbRects; x++)
+	{
+		const RECTANGLE_16* rect = &rects[x];
+
+		if (!freerdp_image_copy_no_overlap(data, gdi->dstFormat, stride, rect->left, rect->top,
+		                                   rect->right - rect->left, rect->bottom - rect->top,
+		                                   surface->gdi.data, surface->gdi.format,
+		                                   surface->gdi.scanline, rect->left, rect->top, NULL,
+		                                   FREERDP_FLIP_NONE))
+			goto fail;
+	}
+
+	if (!xf_shm_image_put(surface->shm, drawable, xfc->gc, rects, nbRects, surfaceX, surfaceY))
+		goto fail;
+
+	if (drawScreen)
+	{
+		for (UINT32 x = 0; x < nbRects; x++)
+		{
+			const RECTANGLE_16* rect = &rects[x];
+			xf_draw_screen(xfc, surfaceX + rect->left, surfaceY + rect->top,
+			               rect->right - rect->left, rect->bottom - rect->top);
+		}
+	}
+
+	rc = CHANNEL_RC_OK;
+fail:
+	xf_unlock_x11(xfc);
+	return rc;
+}
+
 static UINT xf_OutputUpdate(xfContext* xfc, xfGfxSurface* surface)
 {
 	UINT rc = ERROR_INTERNAL_ERROR;
@@ -70,6 +137,16 @@ static UINT xf_OutputUpdate(xfContext* xfc, xfGfxSurface* surface)
 	if (!(rects = region16_rects(&surface->gdi.invalidRegion, &nbRects)))
 		return CHANNEL_RC_OK;
 
+	/* All rectangles of the frame are presented with a single shared memory request */
+	if (surface->shm && !xfc->remote_app &&
+	    (surface->gdi.outputTargetWidth == surface->gdi.mappedWidth) &&
+	    (surface->gdi.outputTargetHeight == surface->gdi.mappedHeight))
+	{
+		rc = xf_OutputUpdateShm(xfc, surface, rects, nbRects);
+		region16_clear(&surface->gdi.invalidRegion);
+		return rc;
+	}
+
 	for (UINT32 x = 0; x < nbRects; x++)
 	{
 		const RECTANGLE_16* rect = &rects[x];
@@ -362,17 +439,34 @@ static UINT xf_CreateSurface(RdpgfxClientContext* context,
 
 	surface->image->byte_order = LSBFirst;
 	surface->image->bitmap_bit_order = LSBFirst;
+	surface->shm = xf_shm_image_new(xfc, surface->gdi.mappedWidth, surface->gdi.mappedHeight);
 
 	region16_init(&surface->gdi.invalidRegion);
 
+	EnterCriticalSection(&context->mux);
+	const BOOL added = gdi_graphics_pipeline_add_surface(context, &surface->gdi);
+	LeaveCriticalSection(&context->mux);
+
+	if (!added)
+	{
+		WLog_ERR(TAG, "an error occurred when adding the surface to the decode pipeline");
+		goto error_set_surface_data;
+	}
+
 	if (context->SetSurfaceData(context, surface->gdi.surfaceId, (void*)surface) != CHANNEL_RC_OK)
 	{
 		WLog_ERR(TAG, "an error occurred during SetSurfaceData");
-		goto error_set_surface_data;
+		goto error_pipeline_add_surface;
 	}
 
 	return CHANNEL_RC_OK;
+error_pipeline_add_surface:
+	EnterCriticalSection(&context->mux);
+	gdi_graphics_pipeline_remove_surface(context, &surface->gdi);
+	LeaveCriticalSection(&context->mux);
 error_set_surface_data:
+	region16_uninit(&surface->gdi.invalidRegion);
+	xf_shm_image_free(surface->shm);
 	surface->image->data = NULL;
 	XDestroyImage(surface->image);
 error_surface_image:
@@ -403,9 +497,12 @@ static UINT xf_DeleteSurface(RdpgfxClientContext* context,
 		if (surface->gdi.windowMapped)
 			IFCALL(context->UnmapWindowForSurface, context, surface->gdi.windowId);
 
+		gdi_graphics_pipeline_remove_surface(context, &surface->gdi);
+
 #ifdef WITH_GFX_H264
 		h264_context_free(surface->gdi.h264);
 #endif
+		xf_shm_image_free(surface->shm);
 		surface->image->data = NULL;
 		XDestroyImage(surface->image);
 		winpr_aligned_free(surface->gdi.data);
@@ -0,0 +1,268 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 MIT-SHM presentation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <freerdp/log.h>
+
+#include <X11/Xutil.h>
+
+#ifdef WITH_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+#include "xf_shm.h"
+
+#define TAG CLIENT_TAG("x11shm")
+
+#ifdef WITH_XSHM
+typedef struct
+{
+	XShmSegmentInfo info;
+	XImage* image;
+	unsigned long serial;
+} xfShmBuffer;
+
+struct xf_shm_image
+{
+	xfContext* xfc;
+	size_t current;
+	xfShmBuffer buffers[2];
+	XRectangle* clip;
+	size_t clipSize;
+};
+
+static BOOL xf_shm_attach_failed = FALSE;
+
+static int xf_shm_error_handler(Display* display, XErrorEvent* event)
+{
+	WINPR_UNUSED(display);
+	WINPR_UNUSED(event);
+	xf_shm_attach_failed = TRUE;
+	return 0;
+}
+
+static void xf_shm_buffer_free(xfContext* xfc, xfShmBuffer* buffer)
+{
+	WINPR_ASSERT(xfc);
+	WINPR_ASSERT(buffer);
+
+	if (buffer->image)
+	{
+		if (buffer->info.shmseg)
+			XShmDetach(xfc->display, &buffer->info);
+
+		buffer->image->data = NULL;
+		XDestroyImage(buffer->image);
+	}
+
+	if (buffer->info.shmaddr && (buffer->info.shmaddr != (char*)-1))
+		shmdt(buffer->info.shmaddr);
+
+	ZeroMemory(buffer, sizeof(xfShmBuffer));
+}
+
+static BOOL xf_shm_buffer_init(xfContext* xfc, xfShmBuffer* buffer, UINT32 width, UINT32 height)
+{
+	WINPR_ASSERT(xfc);
+	WINPR_ASSERT(buffer);
+
+	buffer->image = XShmCreateImage(xfc->display, xfc->visual, xfc->depth, ZPixmap, NULL,
+	                                &buffer->info, width, height);
+
+	if (!buffer->image)
+		return FALSE;
+
+	const size_t size = 1ull * buffer->image->bytes_per_line * buffer->image->height;
+	buffer->info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+
+	if (buffer->info.shmid < 0)
+		return FALSE;
+
+	buffer->info.shmaddr = shmat(buffer->info.shmid, NULL, 0);
+	/* The segment is destroyed once both sides detached */
+	shmctl(buffer->info.shmid, IPC_RMID, NULL);
+
+	if (buffer->info.shmaddr == (char*)-1)
+		return FALSE;
+
+	buffer->image->data = buffer->info.shmaddr;
+	buffer->info.readOnly = True;
+
+	/* XShmAttach fails asynchronously for remote displays */
+	XSync(xfc->display, False);
+	xf_shm_attach_failed = FALSE;
+	int (*handler)(Display*, XErrorEvent*) = XSetErrorHandler(xf_shm_error_handler);
+	const Status status = XShmAttach(xfc->display, &buffer->info);
+	XSync(xfc->display, False);
+	XSetErrorHandler(handler);
+
+	if (!status || xf_shm_attach_failed)
+	{
+		buffer->info.shmseg = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif
+
+void xf_shm_image_free(xfShmImage* shm)
+{
+#ifdef WITH_XSHM
+	if (!shm)
+		return;
+
+	for (size_t x = 0; x < ARRAYSIZE(shm->buffers); x++)
+		xf_shm_buffer_free(shm->xfc, &shm->buffers[x]);
+
+	free(shm->clip);
+	free(shm);
+#else
+	WINPR_UNUSED(shm);
+#endif
+}
+
+xfShmImage* xf_shm_image_new(xfContext* xfc, UINT32 width, UINT32 height)
+{
+	WINPR_ASSERT(xfc);
+
+#ifdef WITH_XSHM
+	if (!xfc->xshmAvailable || (width == 0) || (height == 0))
+		return NULL;
+
+	xfShmImage* shm = (xfShmImage*)calloc(1, sizeof(xfShmImage));
+
+	if (!shm)
+		return NULL;
+
+	shm->xfc = xfc;
+	xf_lock_x11(xfc);
+
+	for (size_t x = 0; x < ARRAYSIZE(shm->buffers); x++)
+	{
+		if (!xf_shm_buffer_init(xfc, &shm->buffers[x], width, height))
+		{
+			WLog_WARN(TAG, "unable to attach shared memory image, falling back to XPutImage");
+			xfc->xshmAvailable = FALSE;
+			xf_shm_image_free(shm);
+			xf_unlock_x11(xfc);
+			return NULL;
+		}
+	}
+
+	xf_unlock_x11(xfc);
+	return shm;
+#else
+	WINPR_UNUSED(width);
+	WINPR_UNUSED(height);
+	return NULL;
+#endif
+}
+
+BYTE* xf_shm_image_begin(xfShmImage* shm, UINT32* pStride)
+{
+	WINPR_ASSERT(pStride);
+
+#ifdef WITH_XSHM
+	if (!shm)
+		return NULL;
+
+	xfShmBuffer* buffer = &shm->buffers[shm->current];
+	Display* display = shm->xfc->display;
+
+	/* The completion event of the last request reading this buffer updates the
+	 * processed serial, only synchronize if it did not arrive yet. */
+	if (buffer->serial && ((long)(LastKnownRequestProcessed(display) - buffer->serial) < 0))
+		XSync(display, False);
+
+	buffer->serial = 0;
+	*pStride = (UINT32)buffer->image->bytes_per_line;
+	return (BYTE*)buffer->image->data;
+#else
+	WINPR_UNUSED(shm);
+	*pStride = 0;
+	return NULL;
+#endif
+}
+
+BOOL xf_shm_image_put(xfShmImage* shm, Drawable drawable, GC gc, const RECTANGLE_16* rects,
+                      UINT32 count, INT32 nXDst, INT32 nYDst)
+{
+#ifdef WITH_XSHM
+	if (!shm || (!rects && (count > 0)))
+		return FALSE;
+
+	if (count == 0)
+		return TRUE;
+
+	if (shm->clipSize < count)
+	{
+		XRectangle* clip = (XRectangle*)realloc(shm->clip, sizeof(XRectangle) * count);
+
+		if (!clip)
+			return FALSE;
+
+		shm->clip = clip;
+		shm->clipSize = count;
+	}
+
+	RECTANGLE_16 bounds = rects[0];
+
+	for (UINT32 x = 0; x < count; x++)
+	{
+		const RECTANGLE_16* rect = &rects[x];
+		XRectangle* clip = &shm->clip[x];
+
+		clip->x = (short)rect->left;
+		clip->y = (short)rect->top;
+		clip->width = rect->right - rect->left;
+		clip->height = rect->bottom - rect->top;
+		bounds.left = MIN(bounds.left, rect->left);
+		bounds.top = MIN(bounds.top, rect->top);
+		bounds.right = MAX(bounds.right, rect->right);
+		bounds.bottom = MAX(bounds.bottom, rect->bottom);
+	}
+
+	xfShmBuffer* buffer = &shm->buffers[shm->current];
+	Display* display = shm->xfc->display;
+
+	/* One request for all dirty rectangles, the clip restricts it to the damage */
+	XSetClipRectangles(display, gc, nXDst, nYDst, shm->clip, (int)count, Unsorted);
+	buffer->serial = NextRequest(display);
+	XShmPutImage(display, drawable, gc, buffer->image, bounds.left, bounds.top,
+	             nXDst + bounds.left, nYDst + bounds.top, bounds.right - bounds.left,
+	             bounds.bottom - bounds.top, True);
+	XSetClipMask(display, gc, None);
+	XFlush(display);
+
+	shm->current = (shm->current + 1) % ARRAYSIZE(shm->buffers);
+	return TRUE;
+#else
+	WINPR_UNUSED(shm);
+	WINPR_UNUSED(drawable);
+	WINPR_UNUSED(gc);
+	WINPR_UNUSED(rects);
+	WINPR_UNUSED(count);
+	WINPR_UNUSED(nXDst);
+	WINPR_UNUSED(nYDst);
+	return FALSE;
+#endif
+}
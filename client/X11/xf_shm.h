@@ -0,0 +1,43 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 MIT-SHM presentation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FREERDP_CLIENT_X11_SHM_H
+#define FREERDP_CLIENT_X11_SHM_H
+
+#include <X11/Xlib.h>
+
+#include <freerdp/types.h>
+
+#include "xfreerdp.h"
+
+/*
+ * Double buffered shared memory image.
+ *
+ * Dirty rectangles are copied into the back buffer and presented with a single
+ * clipped XShmPutImage request. The buffer is only written again once the X server
+ * reported completion of the request that used it.
+ */
+
+void xf_shm_image_free(xfShmImage* shm);
+
+WINPR_ATTR_MALLOC(xf_shm_image_free, 1)
+xfShmImage* xf_shm_image_new(xfContext* xfc, UINT32 width, UINT32 height);
+
+BYTE* xf_shm_image_begin(xfShmImage* shm, UINT32* pStride);
+BOOL xf_shm_image_put(xfShmImage* shm, Drawable drawable, GC gc, const RECTANGLE_16* rects,
+                      UINT32 count, INT32 nXDst, INT32 nYDst);
+
+#endif /* FREERDP_CLIENT_X11_SHM_H */
@@ -112,6 +112,7 @@ typedef struct xf_clipboard xfClipboard;
 typedef struct s_xfDispContext xfDispContext;
 typedef struct s_xfVideoContext xfVideoContext;
 typedef struct xf_rail_icon_cache xfRailIconCache;
+typedef struct xf_shm_image xfShmImage;
 
 /* Number of buttons that are mapped from X11 to RDP button events. */
 #define NUM_BUTTONS_MAPPED 11
@@ -150,6 +151,7 @@ struct xf_context
 	BOOL invert;
 	Screen* screen;
 	XImage* image;
+	xfShmImage* shmImage;
 	Pixmap primary;
 	Pixmap drawing;
 	Visual* visual;
@@ -284,6 +286,7 @@ struct xf_context
 
 	BOOL xkbAvailable;
 	BOOL xrenderAvailable;
+	BOOL xshmAvailable;
 
 	/* value to be sent over wire for each logical client mouse button */
 	button_map button_map[NUM_BUTTONS_MAPPED];
@@ -58,6 +58,11 @@
 #define NO_CLIP_DATA_ID (UINT64_C(1) << 32)
 #define WIN32_FILETIME_TO_UNIX_EPOCH UINT64_C(11644473600)
 
+#define CLIPRDR_FUSE_MAX_READ_SIZE (8 * 1024 * 1024)
+#define CLIPRDR_FUSE_READ_AHEAD_CHUNK_SIZE (1024 * 1024)
+#define CLIPRDR_FUSE_READ_AHEAD_CHUNKS 8
+#define CLIPRDR_FUSE_SEQUENTIAL_READS 2
+
 #ifdef WITH_DEBUG_CLIPRDR
 #define DEBUG_CLIPRDR(log, ...) WLog_Print(log, WLOG_DEBUG, __VA_ARGS__)
 #else
@@ -76,8 +81,31 @@ typedef enum eFuseLowlevelOperationType
 	FUSE_LL_OPERATION_READ,
 } FuseLowlevelOperationType;
 
+typedef enum
+{
+	FUSE_READ_RANGE_MISSING,
+	FUSE_READ_RANGE_PENDING,
+	FUSE_READ_RANGE_AVAILABLE,
+} FuseReadRangeState;
+
 typedef struct sCliprdrFuseFile CliprdrFuseFile;
 
+typedef struct
+{
+	UINT64 offset;
+	UINT32 requested;
+	UINT32 size;
+	BOOL complete;
+	BYTE* data;
+} CliprdrFuseChunk;
+
+typedef struct
+{
+	fuse_req_t fuse_req;
+	UINT64 offset;
+	size_t size;
+} CliprdrFusePendingRead;
+
 struct sCliprdrFuseFile
 {
 	CliprdrFuseFile* parent;
@@ -99,6 +127,12 @@ struct sCliprdrFuseFile
 
 	BOOL has_clip_data_id;
 	UINT32 clip_data_id;
+
+	/* Sequential read detection and read-ahead cache */
+	UINT64 next_read_offset;
+	UINT32 sequential_reads;
+	wArrayList* chunks;
+	wArrayList* pending_reads;
 };
 
 typedef struct
@@ -128,6 +162,7 @@ typedef struct
 	CliprdrFuseFile* fuse_file;
 	fuse_req_t fuse_req;
 	UINT32 stream_id;
+	CliprdrFuseChunk* chunk;
 } CliprdrFuseRequest;
 
 typedef struct
@@ -204,6 +239,8 @@ static void fuse_file_free(void* data)
 		return;
 
 	ArrayList_Free(fuse_file->children);
+	ArrayList_Free(fuse_file->chunks);
+	ArrayList_Free(fuse_file->pending_reads);
 	free(fuse_file->filename_with_root);
 
 	free(fuse_file);
@@ -227,6 +264,160 @@ static CliprdrFuseFile* fuse_file_new(void)
 	return fuse_file;
 }
 
+static void fuse_chunk_free(void* data)
+{
+	CliprdrFuseChunk* chunk = data;
+
+	if (!chunk)
+		return;
+
+	free(chunk->data);
+	free(chunk);
+}
+
+static BOOL fuse_file_init_read_ahead(CliprdrFuseFile* fuse_file)
+{
+	WINPR_ASSERT(fuse_file);
+
+	if (fuse_file->chunks && fuse_file->pending_reads)
+		return TRUE;
+
+	if (!fuse_file->chunks)
+		fuse_file->chunks = ArrayList_New(FALSE);
+	if (!fuse_file->pending_reads)
+		fuse_file->pending_reads = ArrayList_New(FALSE);
+	if (!fuse_file->chunks || !fuse_file->pending_reads)
+		return FALSE;
+
+	wObject* cobj = ArrayList_Object(fuse_file->chunks);
+	WINPR_ASSERT(cobj);
+	cobj->fnObjectFree = fuse_chunk_free;
+
+	wObject* pobj = ArrayList_Object(fuse_file->pending_reads);
+	WINPR_ASSERT(pobj);
+	pobj->fnObjectFree = free;
+
+	return TRUE;
+}
+
+static CliprdrFuseChunk* fuse_file_find_chunk(CliprdrFuseFile* fuse_file, UINT64 offset)
+{
+	WINPR_ASSERT(fuse_file);
+
+	for (size_t x = 0; x < ArrayList_Count(fuse_file->chunks); x++)
+	{
+		CliprdrFuseChunk* chunk = ArrayList_GetItem(fuse_file->chunks, x);
+
+		if ((offset >= chunk->offset) && (offset < chunk->offset + chunk->requested))
+			return chunk;
+	}
+
+	return NULL;
+}
+
+static FuseReadRangeState fuse_file_get_range_state(CliprdrFuseFile* fuse_file, UINT64 offset,
+                                                    size_t size, size_t* available)
+{
+	UINT64 pos = offset;
+	const UINT64 end = offset + size;
+
+	WINPR_ASSERT(available);
+
+	while (pos < end)
+	{
+		const CliprdrFuseChunk* chunk = fuse_file_find_chunk(fuse_file, pos);
+
+		if (!chunk)
+			return FUSE_READ_RANGE_MISSING;
+		if (!chunk->complete)
+			return FUSE_READ_RANGE_PENDING;
+
+		/* The server returned less data than requested, the file ends here */
+		if (pos >= chunk->offset + chunk->size)
+			break;
+
+		pos = MIN(end, chunk->offset + chunk->size);
+	}
+
+	*available = pos - offset;
+	return FUSE_READ_RANGE_AVAILABLE;
+}
+
+static void fuse_file_reply_from_cache(CliprdrFuseFile* fuse_file, fuse_req_t fuse_req,
+                                       UINT64 offset, size_t size)
+{
+	struct iovec iov[CLIPRDR_FUSE_MAX_READ_SIZE / CLIPRDR_FUSE_READ_AHEAD_CHUNK_SIZE + 1] = { 0 };
+	UINT64 pos = offset;
+	size_t count = 0;
+
+	WINPR_ASSERT(size <= CLIPRDR_FUSE_MAX_READ_SIZE);
+
+	while (pos < offset + size)
+	{
+		CliprdrFuseChunk* chunk = fuse_file_find_chunk(fuse_file, pos);
+		WINPR_ASSERT(chunk && chunk->complete);
+		WINPR_ASSERT(count < ARRAYSIZE(iov));
+
+		const UINT64 end = MIN(offset + size, chunk->offset + chunk->size);
+
+		iov[count].iov_base = &chunk->data[pos - chunk->offset];
+		iov[count].iov_len = end - pos;
+		count++;
+		pos = end;
+	}
+
+	fuse_reply_iov(fuse_req, iov, (int)count);
+}
+
+/* Replies all pending reads whose range was either received or can no longer be received */
+static void fuse_file_serve_pending_reads(CliprdrFuseFile* fuse_file)
+{
+	size_t x = 0;
+
+	WINPR_ASSERT(fuse_file);
+
+	while (x < ArrayList_Count(fuse_file->pending_reads))
+	{
+		CliprdrFusePendingRead* pending_read = ArrayList_GetItem(fuse_file->pending_reads, x);
+		size_t available = 0;
+
+		switch (fuse_file_get_range_state(fuse_file, pending_read->offset, pending_read->size,
+		                                  &available))
+		{
+			case FUSE_READ_RANGE_PENDING:
+				x++;
+				continue;
+			case FUSE_READ_RANGE_MISSING:
+				fuse_reply_err(pending_read->fuse_req, EIO);
+				break;
+			case FUSE_READ_RANGE_AVAILABLE:
+				fuse_file_reply_from_cache(fuse_file, pending_read->fuse_req,
+				                           pending_read->offset, available);
+				break;
+		}
+
+		ArrayList_RemoveAt(fuse_file->pending_reads, x);
+	}
+}
+
+static void fuse_file_cancel_pending_reads(CliprdrFuseFile* fuse_file)
+{
+	WINPR_ASSERT(fuse_file);
+
+	/* Files never read have no read-ahead state */
+	if (!fuse_file->pending_reads)
+		return;
+
+	for (size_t x = 0; x < ArrayList_Count(fuse_file->pending_reads); x++)
+	{
+		CliprdrFusePendingRead* pending_read = ArrayList_GetItem(fuse_file->pending_reads, x);
+
+		fuse_reply_err(pending_read->fuse_req, EIO);
+	}
+
+	ArrayList_Clear(fuse_file->pending_reads);
+}
+
 static void clip_data_entry_free(void* data)
 {
 	CliprdrFuseClipDataEntry* clip_data_entry = data;
@@ -351,7 +542,8 @@ static BOOL maybe_clear_fuse_request(const void* key, void* value, void* arg)
 	DEBUG_CLIPRDR(file_context->log, "Clearing FileContentsRequest for file \"%s\"",
 	              fuse_file->filename_with_root);
 
-	fuse_reply_err(fuse_request->fuse_req, EIO);
+	if (fuse_request->fuse_req)
+		fuse_reply_err(fuse_request->fuse_req, EIO);
 	HashTable_Remove(file_context->request_table, key);
 
 	return TRUE;
@@ -368,6 +560,8 @@ static BOOL maybe_steal_inode(const void* key, void* value, void* arg)
 	if (should_remove_fuse_file(fuse_file, clear_context->all_files,
 	                            clear_context->has_clip_data_id, clear_context->clip_data_id))
 	{
+		fuse_file_cancel_pending_reads(fuse_file);
+
 		if (!ArrayList_Append(clear_context->fuse_files, fuse_file))
 			WLog_Print(file_context->log, WLOG_ERROR,
 			           "Failed to append FUSE file to list for deletion");
@@ -906,7 +1100,8 @@ static void cliprdr_file_fuse_open(fuse_req_t fuse_req, fuse_ino_t fuse_ino,
 }
 
 static BOOL request_file_range_async(CliprdrFileContext* file_context, CliprdrFuseFile* fuse_file,
-                                     fuse_req_t fuse_req, off_t offset, size_t requested_size)
+                                     fuse_req_t fuse_req, CliprdrFuseChunk* chunk, off_t offset,
+                                     size_t requested_size)
 {
 	CliprdrFuseRequest* fuse_request = NULL;
 	CLIPRDR_FILE_CONTENTS_REQUEST file_contents_request = { 0 };
@@ -919,6 +1114,8 @@ static BOOL request_file_range_async(CliprdrFileContext* file_context, CliprdrFu
 	if (!fuse_request)
 		return FALSE;
 
+	fuse_request->chunk = chunk;
+
 	file_contents_request.common.msgType = CB_FILECONTENTS_REQUEST;
 	file_contents_request.streamId = fuse_request->stream_id;
 	file_contents_request.listIndex = fuse_file->list_idx;
@@ -950,11 +1147,104 @@ static BOOL request_file_range_async(CliprdrFileContext* file_context, CliprdrFu
 	// NOLINTEND(clang-analyzer-unix.Malloc)
 }
 
+static BOOL fuse_file_chunk_in_use(CliprdrFuseFile* fuse_file, const CliprdrFuseChunk* chunk)
+{
+	for (size_t x = 0; x < ArrayList_Count(fuse_file->pending_reads); x++)
+	{
+		const CliprdrFusePendingRead* pending_read = ArrayList_GetItem(fuse_file->pending_reads, x);
+
+		if ((pending_read->offset < chunk->offset + chunk->requested) &&
+		    (chunk->offset < pending_read->offset + pending_read->size))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Keeps a window of CLIPRDR_FUSE_READ_AHEAD_CHUNKS chunks, starting at the chunk containing
+ * offset, requested from the server.
+ * Received chunks outside of the window are dropped unless a pending read still needs them,
+ * chunks in flight are kept until their response arrives.
+ */
+static void fuse_file_read_ahead(CliprdrFileContext* file_context, CliprdrFuseFile* fuse_file,
+                                 UINT64 offset, size_t size)
+{
+	const UINT64 first = offset - offset % CLIPRDR_FUSE_READ_AHEAD_CHUNK_SIZE;
+	const UINT64 window =
+	    1ull * CLIPRDR_FUSE_READ_AHEAD_CHUNKS * CLIPRDR_FUSE_READ_AHEAD_CHUNK_SIZE;
+	const UINT64 last = MIN(fuse_file->size, MAX(first + window, offset + size));
+
+	for (size_t x = ArrayList_Count(fuse_file->chunks); x > 0; x--)
+	{
+		const CliprdrFuseChunk* chunk = ArrayList_GetItem(fuse_file->chunks, x - 1);
+
+		if (!chunk->complete)
+			continue;
+		if ((chunk->offset + chunk->requested > first) && (chunk->offset < last))
+			continue;
+		if (fuse_file_chunk_in_use(fuse_file, chunk))
+			continue;
+
+		ArrayList_RemoveAt(fuse_file->chunks, x - 1);
+	}
+
+	for (UINT64 pos = first; pos < last; pos += CLIPRDR_FUSE_READ_AHEAD_CHUNK_SIZE)
+	{
+		CliprdrFuseChunk* chunk = NULL;
+
+		if (fuse_file_find_chunk(fuse_file, pos))
+			continue;
+
+		chunk = calloc(1, sizeof(CliprdrFuseChunk));
+		if (!chunk)
+			return;
+
+		chunk->offset = pos;
+		chunk->requested = (UINT32)MIN(CLIPRDR_FUSE_READ_AHEAD_CHUNK_SIZE, fuse_file->size - pos);
+
+		if (!ArrayList_Append(fuse_file->chunks, chunk))
+		{
+			fuse_chunk_free(chunk);
+			return;
+		}
+
+		if (!request_file_range_async(file_context, fuse_file, NULL, chunk, (off_t)chunk->offset,
+		                              chunk->requested))
+		{
+			ArrayList_Remove(fuse_file->chunks, chunk);
+			return;
+		}
+	}
+}
+
+static BOOL fuse_file_queue_read(CliprdrFuseFile* fuse_file, fuse_req_t fuse_req, UINT64 offset,
+                                 size_t size)
+{
+	CliprdrFusePendingRead* pending_read = calloc(1, sizeof(CliprdrFusePendingRead));
+
+	if (!pending_read)
+		return FALSE;
+
+	pending_read->fuse_req = fuse_req;
+	pending_read->offset = offset;
+	pending_read->size = size;
+
+	if (!ArrayList_Append(fuse_file->pending_reads, pending_read))
+	{
+		free(pending_read);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void cliprdr_file_fuse_read(fuse_req_t fuse_req, fuse_ino_t fuse_ino, size_t size,
                                    off_t offset, struct fuse_file_info* file_info)
 {
 	CliprdrFileContext* file_context = fuse_req_userdata(fuse_req);
 	CliprdrFuseFile* fuse_file = NULL;
+	size_t available = 0;
 	BOOL result = 0;
 
 	WINPR_ASSERT(file_context);
@@ -978,10 +1268,46 @@ static void cliprdr_file_fuse_read(fuse_req_t fuse_req, fuse_ino_t fuse_ino, siz
 		fuse_reply_err(fuse_req, EINVAL);
 		return;
 	}
+	if (!fuse_file_init_read_ahead(fuse_file))
+	{
+		HashTable_Unlock(file_context->inode_table);
+		fuse_reply_err(fuse_req, ENOMEM);
+		return;
+	}
+
+	size = MIN(size, CLIPRDR_FUSE_MAX_READ_SIZE);
+	size = MIN(size, fuse_file->size - (UINT64)offset);
+
+	if ((UINT64)offset == fuse_file->next_read_offset)
+		fuse_file->sequential_reads++;
+	else
+		fuse_file->sequential_reads = 0;
+	fuse_file->next_read_offset = offset + size;
 
-	size = MIN(size, 8 * 1024 * 1024);
+	/*
+	 * Sequential reads are served from chunks requested ahead of time, so several
+	 * FileContentsRequests are in flight instead of one round trip per FUSE read.
+	 */
+	if (fuse_file->sequential_reads >= CLIPRDR_FUSE_SEQUENTIAL_READS)
+		fuse_file_read_ahead(file_context, fuse_file, offset, size);
 
-	result = request_file_range_async(file_context, fuse_file, fuse_req, offset, size);
+	switch (fuse_file_get_range_state(fuse_file, offset, size, &available))
+	{
+		case FUSE_READ_RANGE_AVAILABLE:
+			DEBUG_CLIPRDR(file_context->log,
+			              "Serving file range (%zu Bytes at offset %lu) for file \"%s\" from cache",
+			              available, offset, fuse_file->filename);
+			fuse_file_reply_from_cache(fuse_file, fuse_req, offset, available);
+			result = TRUE;
+			break;
+		case FUSE_READ_RANGE_PENDING:
+			result = fuse_file_queue_read(fuse_file, fuse_req, offset, size);
+			break;
+		case FUSE_READ_RANGE_MISSING:
+			result = request_file_range_async(file_context, fuse_file, fuse_req, NULL, offset,
+			                                  size);
+			break;
+	}
 	HashTable_Unlock(file_context->inode_table);
 
 	if (!result)
@@ -1167,6 +1493,45 @@ static DWORD WINAPI cliprdr_file_fuse_thread(LPVOID arg)
 	return 0;
 }
 
+static void fuse_file_chunk_received(CliprdrFileContext* file_context,
+                                     CliprdrFuseRequest* fuse_request,
+                                     const CLIPRDR_FILE_CONTENTS_RESPONSE* file_contents_response)
+{
+	CliprdrFuseFile* fuse_file = fuse_request->fuse_file;
+	CliprdrFuseChunk* chunk = fuse_request->chunk;
+
+	WINPR_ASSERT(fuse_file);
+	WINPR_ASSERT(chunk);
+
+	if (file_contents_response->common.msgFlags & CB_RESPONSE_OK)
+	{
+		chunk->size = MIN(file_contents_response->cbRequested, chunk->requested);
+		chunk->data = malloc(chunk->size ? chunk->size : 1);
+	}
+
+	if (chunk->data)
+	{
+		if (chunk->size > 0)
+			memcpy(chunk->data, file_contents_response->requestedData, chunk->size);
+		chunk->complete = TRUE;
+
+		DEBUG_CLIPRDR(file_context->log,
+		              "Received read-ahead chunk (%" PRIu32 " Bytes at offset %" PRIu64
+		              ") for file \"%s\" with stream id %u",
+		              chunk->size, chunk->offset, fuse_file->filename, fuse_request->stream_id);
+	}
+	else
+	{
+		WLog_Print(file_context->log, WLOG_WARN,
+		           "Read-ahead FileContentsRequest for file \"%s\" was unsuccessful",
+		           fuse_file->filename);
+		ArrayList_Remove(fuse_file->chunks, chunk);
+	}
+
+	/* Reads waiting for a failed chunk are answered with EIO */
+	fuse_file_serve_pending_reads(fuse_file);
+}
+
 static UINT cliprdr_file_context_server_file_contents_response(
     CliprdrClientContext* cliprdr_context,
     const CLIPRDR_FILE_CONTENTS_RESPONSE* file_contents_response)
@@ -1190,6 +1555,15 @@ static UINT cliprdr_file_context_server_file_contents_response(
 		return CHANNEL_RC_OK;
 	}
 
+	if (fuse_request->chunk)
+	{
+		fuse_file_chunk_received(file_context, fuse_request, file_contents_response);
+		HashTable_Remove(file_context->request_table,
+		                 (void*)(UINT_PTR)file_contents_response->streamId);
+		HashTable_Unlock(file_context->inode_table);
+		return CHANNEL_RC_OK;
+	}
+
 	if (!(file_contents_response->common.msgFlags & CB_RESPONSE_OK))
 	{
 		WLog_Print(file_context->log, WLOG_WARN,
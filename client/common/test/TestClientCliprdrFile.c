@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/clipboard.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
+
+#include <freerdp/utils/cliprdr_utils.h>
+#include <freerdp/client/client_cliprdr_file.h>
+
+#define TEST_FILE_NAME "test.bin"
+#define TEST_FILE_SIZE (8 * 1024 * 1024 + 12345)
+#define TEST_READ_SIZE (64 * 1024)
+
+/* Answers FileContentsRequests of the client from a second thread, like a server would */
+typedef struct
+{
+	CliprdrClientContext cliprdr;
+	wMessageQueue* queue;
+	HANDLE thread;
+	LONG inFlight;
+	LONG maxInFlight;
+	LONG rangeRequests;
+} TestLoopbackServer;
+
+static BYTE test_file_byte(UINT64 offset)
+{
+	return (BYTE)((offset * 7) ^ (offset >> 13));
+}
+
+static UINT test_client_file_contents_request(CliprdrClientContext* context,
+                                              const CLIPRDR_FILE_CONTENTS_REQUEST* request)
+{
+	TestLoopbackServer* server = (TestLoopbackServer*)context;
+	CLIPRDR_FILE_CONTENTS_REQUEST* copy = malloc(sizeof(CLIPRDR_FILE_CONTENTS_REQUEST));
+
+	if (!copy)
+		return ERROR_OUTOFMEMORY;
+
+	*copy = *request;
+
+	const LONG inFlight = InterlockedIncrement(&server->inFlight);
+	if (inFlight > server->maxInFlight)
+		server->maxInFlight = inFlight;
+	if (request->dwFlags & FILECONTENTS_RANGE)
+		InterlockedIncrement(&server->rangeRequests);
+
+	if (!MessageQueue_Post(server->queue, NULL, 0, copy, NULL))
+	{
+		InterlockedDecrement(&server->inFlight);
+		free(copy);
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+static void test_server_respond(TestLoopbackServer* server,
+                                const CLIPRDR_FILE_CONTENTS_REQUEST* request)
+{
+	CLIPRDR_FILE_CONTENTS_RESPONSE response = { 0 };
+	const UINT64 size = TEST_FILE_SIZE;
+	BYTE* data = NULL;
+
+	response.common.msgType = CB_FILECONTENTS_RESPONSE;
+	response.common.msgFlags = CB_RESPONSE_OK;
+	response.streamId = request->streamId;
+
+	if (request->dwFlags & FILECONTENTS_SIZE)
+	{
+		response.cbRequested = sizeof(size);
+		response.requestedData = (const BYTE*)&size;
+	}
+	else
+	{
+		const UINT64 offset = ((UINT64)request->nPositionHigh << 32) | request->nPositionLow;
+		const UINT64 length = (offset < size) ? MIN(request->cbRequested, size - offset) : 0;
+
+		data = malloc(length ? length : 1);
+		if (data)
+		{
+			for (UINT64 x = 0; x < length; x++)
+				data[x] = test_file_byte(offset + x);
+
+			response.cbRequested = (UINT32)length;
+			response.requestedData = data;
+		}
+		else
+			response.common.msgFlags = CB_RESPONSE_FAIL;
+	}
+
+	server->cliprdr.ServerFileContentsResponse(&server->cliprdr, &response);
+	InterlockedDecrement(&server->inFlight);
+	free(data);
+}
+
+static DWORD WINAPI test_server_thread(LPVOID arg)
+{
+	TestLoopbackServer* server = arg;
+
+	while (MessageQueue_Wait(server->queue))
+	{
+		wMessage message = { 0 };
+
+		if (MessageQueue_Peek(server->queue, &message, TRUE) <= 0)
+			continue;
+		if (message.id == WMQ_QUIT)
+			break;
+
+		test_server_respond(server, message.wParam);
+		free(message.wParam);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static BOOL test_announce_file(CliprdrFileContext* file, wClipboard* clipboard)
+{
+	BOOL rc = FALSE;
+	BYTE* data = NULL;
+	UINT32 length = 0;
+	FILEDESCRIPTORW descriptor = { 0 };
+
+	descriptor.dwFlags = FD_ATTRIBUTES | FD_FILESIZE;
+	descriptor.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+	descriptor.nFileSizeLow = TEST_FILE_SIZE;
+	if (ConvertUtf8ToWChar(TEST_FILE_NAME, descriptor.cFileName,
+	                       ARRAYSIZE(descriptor.cFileName)) < 0)
+		return FALSE;
+
+	if (cliprdr_file_context_notify_new_server_format_list(file) != CHANNEL_RC_OK)
+		return FALSE;
+
+	if (cliprdr_serialize_file_list(&descriptor, 1, &data, &length) != CHANNEL_RC_OK)
+		return FALSE;
+
+	rc = cliprdr_file_context_update_server_data(file, clipboard, data, length);
+	free(data);
+	return rc;
+}
+
+/* The FUSE thread mounts asynchronously, the mount point changes its device once it did */
+static BOOL test_wait_for_mount(const char* basePath)
+{
+	BOOL rc = FALSE;
+	struct stat parent = { 0 };
+	struct stat mount = { 0 };
+	char* parentPath = NULL;
+	char* mountPath = _strdup(basePath);
+	char* sep = mountPath ? strrchr(mountPath, '/') : NULL;
+
+	/* basePath is the clip data directory inside of the mount point */
+	if (!sep)
+		goto fail;
+	*sep = '\0';
+
+	parentPath = _strdup(mountPath);
+	sep = parentPath ? strrchr(parentPath, '/') : NULL;
+	if (!sep)
+		goto fail;
+	sep[(sep == parentPath) ? 1 : 0] = '\0';
+
+	if (stat(parentPath, &parent) != 0)
+		goto fail;
+
+	for (size_t x = 0; x < 50; x++)
+	{
+		if ((stat(mountPath, &mount) == 0) && (mount.st_dev != parent.st_dev))
+		{
+			rc = TRUE;
+			break;
+		}
+		Sleep(100);
+	}
+
+fail:
+	free(parentPath);
+	free(mountPath);
+	return rc;
+}
+
+static BOOL test_check_data(const BYTE* data, UINT64 offset, size_t length)
+{
+	for (size_t x = 0; x < length; x++)
+	{
+		if (data[x] != test_file_byte(offset + x))
+		{
+			printf("data mismatch at offset %" PRIu64 "\n", offset + x);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_read_file(const char* path)
+{
+	BOOL rc = FALSE;
+	UINT64 offset = 0;
+	BYTE* buffer = malloc(TEST_READ_SIZE);
+	const int fd = open(path, O_RDONLY);
+
+	if (!buffer || (fd < 0))
+	{
+		printf("failed to open %s\n", path);
+		goto fail;
+	}
+
+	for (;;)
+	{
+		const ssize_t status = read(fd, buffer, TEST_READ_SIZE);
+
+		if (status < 0)
+		{
+			printf("read at offset %" PRIu64 " failed\n", offset);
+			goto fail;
+		}
+		if (status == 0)
+			break;
+		if (!test_check_data(buffer, offset, (size_t)status))
+			goto fail;
+
+		offset += (UINT64)status;
+	}
+
+	if (offset != TEST_FILE_SIZE)
+	{
+		printf("read %" PRIu64 " bytes, expected %d\n", offset, TEST_FILE_SIZE);
+		goto fail;
+	}
+
+	/* Random access after the sequential read */
+	offset = 3 * 1024 * 1024 + 7;
+	if ((pread(fd, buffer, 1000, (off_t)offset) != 1000) || !test_check_data(buffer, offset, 1000))
+	{
+		printf("random access read failed\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (fd >= 0)
+		close(fd);
+	free(buffer);
+	return rc;
+}
+
+int TestClientCliprdrFile(int argc, char* argv[])
+{
+	int rc = -1;
+	char* path = NULL;
+	TestLoopbackServer server = { 0 };
+	CliprdrFileContext* file = NULL;
+	wClipboard* clipboard = ClipboardCreate();
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	server.cliprdr.ClientFileContentsRequest = test_client_file_contents_request;
+	server.queue = MessageQueue_New(NULL);
+	if (!clipboard || !server.queue)
+		goto fail;
+
+	file = cliprdr_file_context_new(NULL);
+	if (!file || !cliprdr_file_context_init(file, &server.cliprdr))
+		goto fail;
+
+	server.thread = CreateThread(NULL, 0, test_server_thread, &server, 0, NULL);
+	if (!server.thread)
+		goto fail;
+
+	if (!test_announce_file(file, clipboard))
+		goto fail;
+
+	wClipboardDelegate* delegate = ClipboardGetDelegate(clipboard);
+	if (!delegate || !delegate->basePath)
+		goto fail;
+
+	if (!test_wait_for_mount(delegate->basePath))
+	{
+		printf("FUSE is not available, skipping\n");
+		rc = 0;
+		goto fail;
+	}
+
+	path = GetCombinedPath(delegate->basePath, TEST_FILE_NAME);
+	if (!path || !test_read_file(path))
+		goto fail;
+
+	/* Sequential reads are served from a few large chunks requested ahead of the reader */
+	printf("%" PRId32 " range requests, at most %" PRId32 " requests in flight\n",
+	       server.rangeRequests, server.maxInFlight);
+	if ((server.rangeRequests > 16) || (server.maxInFlight < 2))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (server.thread)
+	{
+		MessageQueue_PostQuit(server.queue, 0);
+		WaitForSingleObject(server.thread, INFINITE);
+		CloseHandle(server.thread);
+	}
+	if (server.queue)
+	{
+		wMessage message = { 0 };
+
+		while (MessageQueue_Peek(server.queue, &message, TRUE) > 0)
+		{
+			if (message.id != WMQ_QUIT)
+				free(message.wParam);
+		}
+	}
+	if (file)
+		cliprdr_file_context_uninit(file, &server.cliprdr);
+	cliprdr_file_context_free(file);
+	MessageQueue_Free(server.queue);
+	ClipboardDestroy(clipboard);
+	free(path);
+	return rc;
+}
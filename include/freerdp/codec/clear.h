@@ -35,6 +35,10 @@ extern "C"
 
 	FREERDP_API int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
 	                               BYTE** ppDstData, UINT32* pDstSize);
+	FREERDP_API BOOL clear_compose_message(CLEAR_CONTEXT* WINPR_RESTRICT clear,
+	                                       wStream* WINPR_RESTRICT s,
+	                                       const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat,
+	                                       UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight);
 
 	FREERDP_API INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
 	                                   UINT32 nWidth, UINT32 nHeight, BYTE* pDstData,
@@ -419,6 +419,30 @@ typedef struct gdi_palette gdiPalette;
 	                                     UINT32 nSrcStep, UINT32 nXSrc, UINT32 nYSrc,
 	                                     UINT32 nSrcWidth, UINT32 nSrcHeight);
 
+	/** @brief A reusable scaler that keeps its setup between calls with the same source size,
+	 *  destination size and formats.
+	 */
+	typedef struct S_FREERDP_IMAGE_SCALER FREERDP_IMAGE_SCALER;
+
+	FREERDP_API void freerdp_image_scaler_free(FREERDP_IMAGE_SCALER* scaler);
+
+	WINPR_ATTR_MALLOC(freerdp_image_scaler_free, 1)
+	FREERDP_API FREERDP_IMAGE_SCALER* freerdp_image_scaler_new(void);
+
+	/***
+	 *
+	 * Same as freerdp_image_scale but reuses the state of @param scaler
+	 *
+	 * @return          TRUE if success, FALSE otherwise
+	 */
+	FREERDP_API BOOL freerdp_image_scaler_scale(FREERDP_IMAGE_SCALER* scaler,
+	                                            BYTE* WINPR_RESTRICT pDstData, DWORD DstFormat,
+	                                            UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst,
+	                                            UINT32 nDstWidth, UINT32 nDstHeight,
+	                                            const BYTE* WINPR_RESTRICT pSrcData,
+	                                            DWORD SrcFormat, UINT32 nSrcStep, UINT32 nXSrc,
+	                                            UINT32 nYSrc, UINT32 nSrcWidth, UINT32 nSrcHeight);
+
 	/***
 	 *
 	 * @param pDstData  destionation buffer
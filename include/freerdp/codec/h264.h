@@ -70,6 +70,15 @@ extern "C"
 	                                  const RECTANGLE_16* regionRect, BYTE** ppDstData,
 	                                  UINT32* pDstSize, RDPGFX_H264_METABLOCK* meta);
 
+	/* Only converts the tiles of regionRect touched by damageRects, the rest of the previous
+	 * frame is kept. Returns 0 without calling the encoder if nothing changed. */
+	FREERDP_API INT32 avc420_compress_damage(H264_CONTEXT* h264, const BYTE* pSrcData,
+	                                         DWORD SrcFormat, UINT32 nSrcStep, UINT32 nSrcWidth,
+	                                         UINT32 nSrcHeight, const RECTANGLE_16* regionRect,
+	                                         const RECTANGLE_16* damageRects,
+	                                         UINT32 numDamageRects, BYTE** ppDstData,
+	                                         UINT32* pDstSize, RDPGFX_H264_METABLOCK* meta);
+
 	/* API for user to fill YUV I420 buffer before encoding */
 	FREERDP_API INT32 h264_get_yuv_buffer(H264_CONTEXT* h264, UINT32 nSrcStride, UINT32 nSrcWidth,
 	                                      UINT32 nSrcHeight, BYTE* YUVData[3], UINT32 stride[3]);
@@ -87,6 +96,13 @@ extern "C"
 	                                  UINT32* pAuxDstSize, RDPGFX_H264_METABLOCK* meta,
 	                                  RDPGFX_H264_METABLOCK* auxMeta);
 
+	FREERDP_API INT32 avc444_compress_damage(
+	    H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat, UINT32 nSrcStep,
+	    UINT32 nSrcWidth, UINT32 nSrcHeight, BYTE version, const RECTANGLE_16* regionRect,
+	    const RECTANGLE_16* damageRects, UINT32 numDamageRects, BYTE* op, BYTE** pDstData,
+	    UINT32* pDstSize, BYTE** pAuxDstData, UINT32* pAuxDstSize, RDPGFX_H264_METABLOCK* meta,
+	    RDPGFX_H264_METABLOCK* auxMeta);
+
 	FREERDP_API INT32 avc444_decompress(H264_CONTEXT* h264, BYTE op,
 	                                    const RECTANGLE_16* regionRects, UINT32 numRegionRect,
 	                                    const BYTE* pSrcData, UINT32 SrcSize,
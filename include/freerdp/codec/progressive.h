@@ -45,6 +45,17 @@ extern "C"
 	                                     BYTE** WINPR_RESTRICT ppDstData,
 	                                     UINT32* WINPR_RESTRICT pDstSize);
 
+	/* Stateful variant of progressive_compress: damaged tiles of the surface are sent as a
+	 * coarse first pass, later calls upgrade unchanged tiles until they reach full quality.
+	 * Returns 0 if there is nothing to send. */
+	FREERDP_API int progressive_compress_ex(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+	                                        UINT16 surfaceId, const BYTE* WINPR_RESTRICT pSrcData,
+	                                        UINT32 SrcSize, UINT32 SrcFormat, UINT32 Width,
+	                                        UINT32 Height, UINT32 ScanLine,
+	                                        const REGION16* WINPR_RESTRICT invalidRegion,
+	                                        BYTE** WINPR_RESTRICT ppDstData,
+	                                        UINT32* WINPR_RESTRICT pDstSize);
+
 	FREERDP_API INT32 progressive_decompress(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
 	                                         const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcSize,
 	                                         BYTE* WINPR_RESTRICT pDstData, UINT32 DstFormat,
@@ -32,6 +32,8 @@ extern "C"
 {
 #endif
 
+#define REGION16_TILE_SIZE 64
+
 	typedef struct S_REGION16_DATA REGION16_DATA;
 
 	typedef struct
@@ -120,6 +122,19 @@ extern "C"
 	FREERDP_API BOOL region16_union_rect(REGION16* dst, const REGION16* src,
 	                                     const RECTANGLE_16* rect);
 
+	/** adds a batch of rectangles to src and stores the resulting region in dst
+	 *
+	 * All rectangles are merged in a single sort and sweep pass, which is much cheaper
+	 * than calling region16_union_rect() for each of them. Empty rectangles are ignored.
+	 * @param dst destination region
+	 * @param src source region, may be dst
+	 * @param rects the rectangles to add
+	 * @param count the number of rectangles
+	 * @return if the operation was successful (false meaning out-of-memory)
+	 */
+	FREERDP_API BOOL region16_union_rects(REGION16* dst, const REGION16* src,
+	                                      const RECTANGLE_16* rects, UINT32 count);
+
 	/** returns if a rectangle intersects the region
 	 * @param src the region
 	 * @param arg2 the rectangle
@@ -141,6 +156,68 @@ extern "C"
 	 */
 	FREERDP_API void region16_uninit(REGION16* region);
 
+	/** A bitmap of dirty REGION16_TILE_SIZE x REGION16_TILE_SIZE tiles covering a surface,
+	 * as used by the tile based encoders.
+	 */
+	typedef struct S_REGION16_TILES REGION16_TILES;
+
+	/** releases a tile map
+	 * @param tiles the tile map to release
+	 */
+	FREERDP_API void region16_tiles_free(REGION16_TILES* tiles);
+
+	/** creates a tile map for a surface, all tiles are clean
+	 * @param width surface width in pixels
+	 * @param height surface height in pixels
+	 * @return the new tile map or NULL on failure
+	 */
+	WINPR_ATTR_MALLOC(region16_tiles_free, 1)
+	FREERDP_API REGION16_TILES* region16_tiles_new(UINT16 width, UINT16 height);
+
+	/** resizes the tile map if required and marks all tiles as clean
+	 * @param tiles the tile map
+	 * @param width surface width in pixels
+	 * @param height surface height in pixels
+	 * @return if the operation was successful (false meaning out-of-memory)
+	 */
+	FREERDP_API BOOL region16_tiles_reset(REGION16_TILES* tiles, UINT16 width, UINT16 height);
+
+	/** returns if a tile is marked dirty, tiles outside the surface are never dirty
+	 * @param tiles the tile map
+	 * @param xIdx horizontal tile index
+	 * @param yIdx vertical tile index
+	 * @return if the tile is dirty
+	 */
+	FREERDP_API BOOL region16_tiles_is_marked(const REGION16_TILES* tiles, UINT32 xIdx,
+	                                          UINT32 yIdx);
+
+	/** marks a tile dirty
+	 * @param tiles the tile map
+	 * @param xIdx horizontal tile index
+	 * @param yIdx vertical tile index
+	 * @return if the tile is inside the surface
+	 */
+	FREERDP_API BOOL region16_tiles_mark(REGION16_TILES* tiles, UINT32 xIdx, UINT32 yIdx);
+
+	/** marks all tiles touched by a rectangle dirty, the rectangle is clipped to the surface
+	 * @param tiles the tile map
+	 * @param rect the rectangle
+	 */
+	FREERDP_API void region16_tiles_mark_rect(REGION16_TILES* tiles, const RECTANGLE_16* rect);
+
+	/** marks all tiles touched by a region dirty, the region is clipped to the surface
+	 * @param tiles the tile map
+	 * @param region the region
+	 */
+	FREERDP_API void region16_tiles_mark_region(REGION16_TILES* tiles, const REGION16* region);
+
+	/** replaces dst with the area covered by the dirty tiles, clipped to the surface
+	 * @param tiles the tile map
+	 * @param dst destination region
+	 * @return if the operation was successful (false meaning out-of-memory)
+	 */
+	FREERDP_API BOOL region16_tiles_to_region(const REGION16_TILES* tiles, REGION16* dst);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,11 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE 65535
 
+#define ZGFX_COMPRESSION_LEVEL_NONE 0
+#define ZGFX_COMPRESSION_LEVEL_FAST 1
+#define ZGFX_COMPRESSION_LEVEL_DEFAULT 2
+#define ZGFX_COMPRESSION_LEVEL_BEST 3
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -52,6 +57,9 @@ extern "C"
 	                                        const BYTE* WINPR_RESTRICT pUncompressed,
 	                                        UINT32 uncompressedSize, UINT32* WINPR_RESTRICT pFlags);
 
+	/* Selects the match finder effort, one of ZGFX_COMPRESSION_LEVEL_* */
+	FREERDP_API BOOL zgfx_set_compression_level(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, UINT32 level);
+
 	FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, BOOL flush);
 
 	FREERDP_API void zgfx_context_free(ZGFX_CONTEXT* zgfx);
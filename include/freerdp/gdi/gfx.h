@@ -49,6 +49,7 @@ extern "C"
 		UINT32 outputTargetHeight;
 		BOOL windowMapped;
 		BOOL handleInUpdateSurfaceArea;
+		FREERDP_IMAGE_SCALER* scaler;
 	};
 	typedef struct gdi_gfx_surface gdiGfxSurface;
 
@@ -70,6 +71,29 @@ extern "C"
 	                                               pcRdpgfxUpdateSurfaceArea update);
 	FREERDP_API void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx);
 
+	/** @brief Registers a surface with the decode pipeline.
+	 *
+	 *  Implementations replacing the CreateSurface and DeleteSurface callbacks call this
+	 *  before publishing the surface with SetSurfaceData and call
+	 *  gdi_graphics_pipeline_remove_surface before releasing the surface data, both with the
+	 *  context mux held. Unregistered surfaces are decoded on the channel thread.
+	 *
+	 *  @param context The graphics pipeline context
+	 *  @param surface The surface to register
+	 *
+	 *  @return \b TRUE for success, \b FALSE otherwise
+	 */
+	FREERDP_API BOOL gdi_graphics_pipeline_add_surface(RdpgfxClientContext* context,
+	                                                   gdiGfxSurface* surface);
+
+	/** @brief Waits for the pending commands of a surface and unregisters it.
+	 *
+	 *  @param context The graphics pipeline context
+	 *  @param surface The surface to unregister
+	 */
+	FREERDP_API void gdi_graphics_pipeline_remove_surface(RdpgfxClientContext* context,
+	                                                      gdiGfxSurface* surface);
+
 #ifdef __cplusplus
 }
 #endif
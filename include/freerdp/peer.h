@@ -211,6 +211,62 @@ extern "C"
 	FREERDP_API BOOL freerdp_peer_set_local_and_hostname(freerdp_peer* client,
 	                                                     const struct sockaddr_storage* peer_addr);
 
+	/** @brief TLS handshakes completed by the peers of this process */
+	typedef struct
+	{
+		UINT64 FullHandshakes;    /** handshakes that negotiated a new session */
+		UINT64 ResumedHandshakes; /** handshakes that resumed a cached session or ticket */
+	} rdpPeerTlsStats;
+
+	/**
+	 * @brief Retrieve the TLS handshake counters of all peers
+	 *
+	 * Peers accepted with the same certificate and TLS settings share one TLS context,
+	 * so reconnecting clients can resume their previous session.
+	 *
+	 * @param stats A pointer to the counters to fill
+	 *
+	 * @return \b TRUE for success, \b FALSE otherwise
+	 */
+	FREERDP_API BOOL freerdp_peer_get_tls_stats(rdpPeerTlsStats* stats);
+
+	/**
+	 * @brief A reactor multiplexes the event handles of many peers over a small,
+	 * fixed set of threads instead of running one thread per peer.
+	 *
+	 * Each peer is bound to one reactor thread, all callbacks of a peer are called
+	 * from that thread. Once the handles of a peer are signaled the reactor calls
+	 * freerdp_peer::CheckFileDescriptor and then \b OnReady.
+	 */
+	typedef struct rdp_peer_reactor rdpPeerReactor;
+
+	typedef DWORD (*pPeerReactorGetEventHandles)(freerdp_peer* peer, void* arg, HANDLE* events,
+	                                             DWORD count);
+	typedef BOOL (*pPeerReactorCallback)(freerdp_peer* peer, void* arg);
+	typedef void (*pPeerReactorCloseCallback)(freerdp_peer* peer, void* arg);
+
+	typedef struct
+	{
+		/** additional handles to wait for, e.g. the virtual channel manager event */
+		pPeerReactorGetEventHandles GetEventHandles;
+		/** a handle was signaled, return FALSE to close the peer */
+		pPeerReactorCallback OnReady;
+		/** called every \b TimerInterval ms, return FALSE to close the peer */
+		pPeerReactorCallback OnTimer;
+		UINT32 TimerInterval;
+		/** the peer left the reactor, this is where it is released */
+		pPeerReactorCloseCallback OnClose;
+	} rdpPeerReactorCallbacks;
+
+	FREERDP_API void freerdp_peer_reactor_free(rdpPeerReactor* reactor);
+
+	WINPR_ATTR_MALLOC(freerdp_peer_reactor_free, 1)
+	FREERDP_API rdpPeerReactor* freerdp_peer_reactor_new(DWORD threads);
+
+	FREERDP_API BOOL freerdp_peer_reactor_add(rdpPeerReactor* reactor, freerdp_peer* peer,
+	                                          const rdpPeerReactorCallbacks* callbacks, void* arg);
+	FREERDP_API BOOL freerdp_peer_reactor_remove(rdpPeerReactor* reactor, freerdp_peer* peer);
+
 #ifdef __cplusplus
 }
 #endif
@@ -110,6 +110,10 @@ typedef pstatus_t (*__copy_no_overlap_t)(BYTE* WINPR_RESTRICT pDstData, DWORD Ds
 	                                     DWORD SrcFormat, UINT32 nSrcStep, UINT32 nXSrc,
 	                                     UINT32 nYSrc, const gdiPalette* WINPR_RESTRICT palette,
 	                                     UINT32 flags);
+typedef pstatus_t (*__scale_8u_AC4r_t)(const BYTE* WINPR_RESTRICT pSrc, UINT32 srcStep,
+	                                   UINT32 srcWidth, UINT32 srcHeight,
+	                                   BYTE* WINPR_RESTRICT pDst, UINT32 dstStep, UINT32 dstWidth,
+	                                   UINT32 dstHeight);
 typedef pstatus_t (*__lShiftC_16s_inplace_t)(INT16* WINPR_RESTRICT pSrcDst, UINT32 val, UINT32 len);
 typedef pstatus_t (*__lShiftC_16s_t)(const INT16* pSrc, UINT32 val, INT16* pSrcDst, UINT32 len);
 typedef pstatus_t (*__lShiftC_16u_t)(const UINT16* pSrc, UINT32 val, UINT16* pSrcDst, UINT32 len);
@@ -229,6 +233,10 @@ typedef struct
 	__add_16s_inplace_t add_16s_inplace;
 	__lShiftC_16s_inplace_t lShiftC_16s_inplace;
 	__copy_no_overlap_t copy_no_overlap;
+	/** \brief Bilinear scaling of 32bpp images, channel order is preserved
+	 *  pDst[dstWidth x dstHeight] = scale(pSrc[srcWidth x srcHeight])
+	 */
+	__scale_8u_AC4r_t scale_8u_AC4r;
 } primitives_t;
 
 typedef enum
@@ -56,6 +56,7 @@ extern "C"
 	typedef struct rdp_shadow_screen rdpShadowScreen;
 	typedef struct rdp_shadow_surface rdpShadowSurface;
 	typedef struct rdp_shadow_encoder rdpShadowEncoder;
+	typedef struct rdp_shadow_encode_cache rdpShadowEncodeCache;
 	typedef struct rdp_shadow_capture rdpShadowCapture;
 	typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 	typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
@@ -150,6 +151,7 @@ extern "C"
 		rdpShadowSurface* lobby;
 		rdpShadowCapture* capture;
 		rdpShadowSubsystem* subsystem;
+		rdpShadowEncodeCache* encodeCache;
 
 		DWORD port;
 		BOOL mayView;
@@ -346,8 +348,19 @@ extern "C"
 	                                                   UINT32 format2, UINT32 nStep2,
 	                                                   RECTANGLE_16* WINPR_RESTRICT rect);
 
+	/* Returns the changed 16x16 tiles in region, capture (optional) splits the work */
+	FREERDP_API int shadow_capture_compare_region(rdpShadowCapture* capture,
+	                                              const BYTE* WINPR_RESTRICT pData1,
+	                                              UINT32 format1, UINT32 nStep1, UINT32 nWidth,
+	                                              UINT32 nHeight, const BYTE* WINPR_RESTRICT pData2,
+	                                              UINT32 format2, UINT32 nStep2,
+	                                              REGION16* WINPR_RESTRICT region);
+
 	FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
+	/* Must be called with the surface lock held, in the same section that writes surface data */
+	FREERDP_API void shadow_subsystem_surface_changed(rdpShadowSubsystem* subsystem);
+
 	FREERDP_API BOOL shadow_client_post_msg(rdpShadowClient* client, void* context, UINT32 type,
 	                                        SHADOW_MSG_OUT* msg, void* lParam);
 	FREERDP_API int shadow_client_boardcast_msg(rdpShadowServer* server, void* context, UINT32 type,
@@ -37,6 +37,23 @@
 
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
+#define CLEARCODEC_GLYPH_CACHE_SIZE 4000
+
+/* Encoder limits */
+#define CLEARCODEC_GLYPH_MAX_PIXELS 1024
+#define CLEARCODEC_BAND_MAX_HEIGHT 52
+#define CLEARCODEC_RLEX_MAX_COLORS 127
+#define CLEARCODEC_BLOCK_WIDTH 64
+#define CLEARCODEC_BLOCK_HEIGHT CLEARCODEC_BAND_MAX_HEIGHT
+
+enum
+{
+	CLEAR_LAYER_RESIDUAL,
+	CLEAR_LAYER_BANDS,
+	CLEAR_LAYER_RLEX,
+	CLEAR_LAYER_NSCODEC,
+	CLEAR_LAYER_UNCOMPRESSED
+};
 
 typedef struct
 {
@@ -52,6 +69,20 @@ typedef struct
 	BYTE* pixels;
 } CLEAR_VBAR_ENTRY;
 
+typedef struct
+{
+	UINT32 layer;
+	UINT32 background;
+} CLEAR_BLOCK;
+
+typedef struct
+{
+	UINT32 count;
+	UINT32 colors[CLEARCODEC_RLEX_MAX_COLORS + 1];
+	UINT32 hits[CLEARCODEC_RLEX_MAX_COLORS + 1];
+	BYTE slots[256];
+} CLEAR_PALETTE;
+
 struct S_CLEAR_CONTEXT
 {
 	BOOL Compressor;
@@ -62,11 +93,26 @@ struct S_CLEAR_CONTEXT
 	UINT32 nTempStep;
 	UINT32 TempFormat;
 	UINT32 format;
-	CLEAR_GLYPH_ENTRY GlyphCache[4000];
+	CLEAR_GLYPH_ENTRY GlyphCache[CLEARCODEC_GLYPH_CACHE_SIZE];
 	UINT32 VBarStorageCursor;
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+
+	/* encoder state, the storage above mirrors the one of the decoder */
+	BOOL CacheResetPending;
+	UINT32 GlyphCursor;
+	UINT16 GlyphLookup[4096];
+	UINT16 VBarLookup[CLEARCODEC_VBAR_SIZE];
+	UINT16 ShortVBarLookup[CLEARCODEC_VBAR_SHORT_SIZE];
+	UINT32* EncodeBuffer;
+	UINT32 EncodeBufferSize;
+	CLEAR_BLOCK* Blocks;
+	UINT32 BlocksSize;
+	CLEAR_PALETTE Palette;
+	wStream* ResidualStream;
+	wStream* BandsStream;
+	wStream* SubcodecStream;
 };
 
 static const UINT32 CLEAR_LOG2_FLOOR[256] = {
@@ -928,7 +974,7 @@ static BOOL clear_decompress_glyph_data(CLEAR_CONTEXT* WINPR_RESTRICT clear,
 
 	Stream_Read_UINT16(s, glyphIndex);
 
-	if (glyphIndex >= 4000)
+	if (glyphIndex >= CLEARCODEC_GLYPH_CACHE_SIZE)
 	{
 		WLog_ERR(TAG, "Invalid glyphIndex %" PRIu16 "", glyphIndex);
 		return FALSE;
@@ -1144,11 +1190,851 @@ fail:
 	return rc;
 }
 
+static INLINE UINT32 clear_hash_keys(const UINT32* WINPR_RESTRICT keys, UINT32 count)
+{
+	UINT32 hash = 2166136261u;
+
+	for (UINT32 i = 0; i < count; i++)
+		hash = (hash ^ keys[i]) * 16777619u;
+
+	return hash ^ count;
+}
+
+static INLINE void clear_write_run_length(wStream* WINPR_RESTRICT s, UINT32 runLengthFactor)
+{
+	if (runLengthFactor < 0xFF)
+		Stream_Write_UINT8(s, (BYTE)runLengthFactor);
+	else if (runLengthFactor < 0xFFFF)
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, (UINT16)runLengthFactor);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, 0xFFFF);
+		Stream_Write_UINT32(s, runLengthFactor);
+	}
+}
+
+static INLINE void clear_write_key(wStream* WINPR_RESTRICT s, UINT32 key)
+{
+	Stream_Write_UINT8(s, key & 0xFF);         /* blue */
+	Stream_Write_UINT8(s, (key >> 8) & 0xFF);  /* green */
+	Stream_Write_UINT8(s, (key >> 16) & 0xFF); /* red */
+}
+
+static void clear_palette_reset(CLEAR_PALETTE* WINPR_RESTRICT palette)
+{
+	palette->count = 0;
+	ZeroMemory(palette->slots, sizeof(palette->slots));
+}
+
+/**
+ * Add a color to the palette, returning its index or -1 if the palette is full.
+ * Colors keep the order of their first appearance which makes gradients and
+ * anti-aliased glyph edges map to consecutive RLEX suites.
+ */
+static INLINE INT32 clear_palette_add(CLEAR_PALETTE* WINPR_RESTRICT palette, UINT32 key,
+                                      UINT32 hits)
+{
+	UINT32 slot = (key * 2654435761u) >> 24;
+
+	while (palette->slots[slot] != 0)
+	{
+		const UINT32 index = palette->slots[slot] - 1u;
+
+		if (palette->colors[index] == key)
+		{
+			palette->hits[index] += hits;
+			return (INT32)index;
+		}
+
+		slot = (slot + 1) % ARRAYSIZE(palette->slots);
+	}
+
+	if (palette->count >= ARRAYSIZE(palette->colors))
+		return -1;
+
+	palette->colors[palette->count] = key;
+	palette->hits[palette->count] = hits;
+	palette->slots[slot] = (BYTE)(++palette->count);
+	return (INT32)(palette->count - 1);
+}
+
+static BOOL clear_encode_load(CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                              const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat,
+                              UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight)
+{
+	const size_t count = 1ull * nWidth * nHeight;
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+
+	if ((bpp == 0) || (count > UINT32_MAX))
+		return FALSE;
+
+	if (count > clear->EncodeBufferSize)
+	{
+		UINT32* tmp = (UINT32*)winpr_aligned_recalloc(clear->EncodeBuffer, count, sizeof(UINT32), 32);
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "clear->EncodeBuffer winpr_aligned_recalloc failed for %" PRIuz " pixels",
+			         count);
+			return FALSE;
+		}
+
+		clear->EncodeBuffer = tmp;
+		clear->EncodeBufferSize = (UINT32)count;
+	}
+
+	for (UINT32 y = 0; y < nHeight; y++)
+	{
+		const BYTE* src = &pSrcData[1ull * y * nSrcStep];
+		UINT32* dst = &clear->EncodeBuffer[1ull * y * nWidth];
+
+		switch (SrcFormat)
+		{
+			case PIXEL_FORMAT_BGRA32:
+			case PIXEL_FORMAT_BGRX32:
+				for (UINT32 x = 0; x < nWidth; x++)
+				{
+					const BYTE* p = &src[4ull * x];
+					dst[x] = p[0] | ((UINT32)p[1] << 8) | ((UINT32)p[2] << 16);
+				}
+				break;
+
+			default:
+				for (UINT32 x = 0; x < nWidth; x++)
+				{
+					BYTE r = 0;
+					BYTE g = 0;
+					BYTE b = 0;
+					const UINT32 color = FreeRDPReadColor(&src[1ull * x * bpp], SrcFormat);
+					FreeRDPSplitColor(color, SrcFormat, &r, &g, &b, NULL, NULL);
+					dst[x] = b | ((UINT32)g << 8) | ((UINT32)r << 16);
+				}
+				break;
+		}
+	}
+
+	return TRUE;
+}
+
+static INLINE const UINT32* clear_encode_pixel(const CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                                               UINT32 nWidth, UINT32 x, UINT32 y)
+{
+	return &clear->EncodeBuffer[1ull * y * nWidth + x];
+}
+
+/* Limits [yOn, yOff) to the pixels of a column that differ from the background */
+static INLINE void clear_vbar_extent(const UINT32* WINPR_RESTRICT column, UINT32 stride,
+                                     UINT32 height, UINT32 colorBkg, UINT32* WINPR_RESTRICT pYOn,
+                                     UINT32* WINPR_RESTRICT pYOff)
+{
+	UINT32 yOn = 0;
+	UINT32 yOff = height;
+
+	while ((yOn < height) && (column[1ull * yOn * stride] == colorBkg))
+		yOn++;
+
+	while ((yOff > yOn) && (column[1ull * (yOff - 1) * stride] == colorBkg))
+		yOff--;
+
+	if (yOn == yOff)
+		yOn = yOff = 0;
+
+	*pYOn = yOn;
+	*pYOff = yOff;
+}
+
+static INLINE INT32 clear_vbar_lookup(const CLEAR_VBAR_ENTRY* WINPR_RESTRICT storage,
+                                      const UINT16* WINPR_RESTRICT lookup, UINT32 lookupSize,
+                                      const UINT32* WINPR_RESTRICT keys, UINT32 count)
+{
+	const UINT32 slot = clear_hash_keys(keys, count) % lookupSize;
+	const CLEAR_VBAR_ENTRY* entry = NULL;
+
+	if (lookup[slot] == 0)
+		return -1;
+
+	entry = &storage[lookup[slot] - 1];
+
+	if (entry->count != count)
+		return -1;
+
+	if ((count > 0) && (memcmp(entry->pixels, keys, 4ull * count) != 0))
+		return -1;
+
+	return lookup[slot] - 1;
+}
+
+/**
+ * Store a vBar at the storage cursor, exactly where the decoder will place it,
+ * and make it available for subsequent cache hits.
+ */
+static BOOL clear_vbar_store(CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                             CLEAR_VBAR_ENTRY* WINPR_RESTRICT storage,
+                             UINT16* WINPR_RESTRICT lookup, UINT32 size,
+                             UINT32* WINPR_RESTRICT pCursor, const UINT32* WINPR_RESTRICT keys,
+                             UINT32 count)
+{
+	const UINT32 cursor = *pCursor;
+	CLEAR_VBAR_ENTRY* entry = &storage[cursor];
+
+	const UINT32 old = clear_hash_keys((const UINT32*)entry->pixels, entry->count) % size;
+
+	if (lookup[old] == cursor + 1)
+		lookup[old] = 0;
+
+	entry->count = count;
+
+	if (!resize_vbar_entry(clear, entry))
+		return FALSE;
+
+	if (count > 0)
+		CopyMemory(entry->pixels, keys, 4ull * count);
+
+	lookup[clear_hash_keys(keys, count) % size] = (UINT16)(cursor + 1);
+	*pCursor = (cursor + 1) % size;
+	return TRUE;
+}
+
+static void clear_encode_analyze_block(CLEAR_CONTEXT* WINPR_RESTRICT clear, UINT32 nWidth,
+                                       UINT32 xStart, UINT32 yStart, UINT32 width, UINT32 height,
+                                       BOOL lossless, CLEAR_BLOCK* WINPR_RESTRICT block)
+{
+	CLEAR_PALETTE* palette = &clear->Palette;
+	const UINT32 pixels = width * height;
+	BOOL manyColors = FALSE;
+	UINT32 runs = 0;
+	UINT32 bandsCost = 11;
+
+	clear_palette_reset(palette);
+
+	for (UINT32 y = 0; y < height; y++)
+	{
+		const UINT32* row = clear_encode_pixel(clear, nWidth, xStart, yStart + y);
+		UINT32 x = 0;
+
+		while (x < width)
+		{
+			UINT32 length = 1;
+
+			while ((x + length < width) && (row[x + length] == row[x]))
+				length++;
+
+			runs++;
+
+			if (!manyColors && (clear_palette_add(palette, row[x], length) < 0))
+				manyColors = TRUE;
+
+			x += length;
+		}
+	}
+
+	if (palette->count > CLEARCODEC_RLEX_MAX_COLORS)
+		manyColors = TRUE;
+
+	UINT32 bestHits = palette->hits[0];
+	block->background = palette->colors[0];
+
+	for (UINT32 i = 1; i < palette->count; i++)
+	{
+		if (palette->hits[i] > bestHits)
+		{
+			bestHits = palette->hits[i];
+			block->background = palette->colors[i];
+		}
+	}
+
+	if (!manyColors && (palette->count == 1))
+	{
+		block->layer = CLEAR_LAYER_RESIDUAL;
+		return;
+	}
+
+	for (UINT32 x = 0; x < width; x++)
+	{
+		UINT32 yOn = 0;
+		UINT32 yOff = 0;
+		UINT32 vBar[CLEARCODEC_BAND_MAX_HEIGHT] = { 0 };
+		const UINT32* column = clear_encode_pixel(clear, nWidth, xStart + x, yStart);
+
+		for (UINT32 y = 0; y < height; y++)
+			vBar[y] = column[1ull * y * nWidth];
+
+		/* Columns already known to the decoder only cost a cache hit */
+		if (clear_vbar_lookup(clear->VBarStorage, clear->VBarLookup, CLEARCODEC_VBAR_SIZE, vBar,
+		                      height) >= 0)
+		{
+			bandsCost += 2;
+			continue;
+		}
+
+		clear_vbar_extent(vBar, 1, height, block->background, &yOn, &yOff);
+		bandsCost += 2 + 3 * (yOff - yOn);
+	}
+
+	const UINT32 residualCost = 4 * runs;
+	block->layer = CLEAR_LAYER_RESIDUAL;
+
+	if (bandsCost < residualCost)
+		block->layer = CLEAR_LAYER_BANDS;
+
+	if (!manyColors)
+	{
+		const UINT32 rlexCost = 13 + 1 + 3 * palette->count + 2 * runs;
+
+		if (rlexCost < MIN(residualCost, bandsCost))
+			block->layer = CLEAR_LAYER_RLEX;
+	}
+	else if (runs > pixels / 4)
+	{
+		/* Photographic content, NSCodec is lossy so it is only used outside the glyph cache */
+		if (!lossless)
+			block->layer = CLEAR_LAYER_NSCODEC;
+		else if (13 + 3 * pixels < MIN(residualCost, bandsCost))
+			block->layer = CLEAR_LAYER_UNCOMPRESSED;
+	}
+}
+
+static BOOL clear_encode_residual(CLEAR_CONTEXT* WINPR_RESTRICT clear, wStream* WINPR_RESTRICT s,
+                                  UINT32 nWidth, UINT32 nHeight, UINT32 nBlocksX)
+{
+	UINT32 runLength = 0;
+	UINT32 color = 0;
+	BOOL haveColor = FALSE;
+
+	for (UINT32 y = 0; y < nHeight; y++)
+	{
+		const CLEAR_BLOCK* blocks = &clear->Blocks[(y / CLEARCODEC_BLOCK_HEIGHT) * nBlocksX];
+		const UINT32* row = clear_encode_pixel(clear, nWidth, 0, y);
+
+		for (UINT32 x = 0; x < nWidth; x++)
+		{
+			/* Pixels covered by bands or subcodecs are overdrawn, extend the current run */
+			if (blocks[x / CLEARCODEC_BLOCK_WIDTH].layer != CLEAR_LAYER_RESIDUAL)
+			{
+				runLength++;
+				continue;
+			}
+
+			if (!haveColor)
+			{
+				color = row[x];
+				haveColor = TRUE;
+			}
+
+			if (row[x] == color)
+			{
+				runLength++;
+				continue;
+			}
+
+			if (!Stream_EnsureRemainingCapacity(s, 10))
+				return FALSE;
+
+			clear_write_key(s, color);
+			clear_write_run_length(s, runLength);
+			color = row[x];
+			runLength = 1;
+		}
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 10))
+		return FALSE;
+
+	clear_write_key(s, color);
+	clear_write_run_length(s, runLength);
+	return TRUE;
+}
+
+static BOOL clear_encode_vbar(CLEAR_CONTEXT* WINPR_RESTRICT clear, wStream* WINPR_RESTRICT s,
+                              const UINT32* WINPR_RESTRICT column, UINT32 stride, UINT32 height,
+                              UINT32 colorBkg)
+{
+	UINT32 yOn = 0;
+	UINT32 yOff = 0;
+	UINT32 vBar[CLEARCODEC_BAND_MAX_HEIGHT] = { 0 };
+	INT32 index = 0;
+
+	WINPR_ASSERT(height <= CLEARCODEC_BAND_MAX_HEIGHT);
+
+	if (!Stream_EnsureRemainingCapacity(s, 3 + 3ull * height))
+		return FALSE;
+
+	for (UINT32 y = 0; y < height; y++)
+		vBar[y] = column[1ull * y * stride];
+
+	index = clear_vbar_lookup(clear->VBarStorage, clear->VBarLookup, CLEARCODEC_VBAR_SIZE, vBar,
+	                          height);
+
+	if (index >= 0)
+	{
+		Stream_Write_UINT16(s, 0x8000 | (UINT16)index); /* VBAR_CACHE_HIT */
+		return TRUE;
+	}
+
+	clear_vbar_extent(vBar, 1, height, colorBkg, &yOn, &yOff);
+	index = clear_vbar_lookup(clear->ShortVBarStorage, clear->ShortVBarLookup,
+	                          CLEARCODEC_VBAR_SHORT_SIZE, &vBar[yOn], yOff - yOn);
+
+	if (index >= 0)
+	{
+		Stream_Write_UINT16(s, 0x4000 | (UINT16)index); /* SHORT_VBAR_CACHE_HIT */
+		Stream_Write_UINT8(s, (BYTE)yOn);
+	}
+	else
+	{
+		Stream_Write_UINT16(s, (UINT16)(yOn | (yOff << 8))); /* SHORT_VBAR_CACHE_MISS */
+
+		for (UINT32 y = yOn; y < yOff; y++)
+			clear_write_key(s, vBar[y]);
+
+		if (!clear_vbar_store(clear, clear->ShortVBarStorage, clear->ShortVBarLookup,
+		                      CLEARCODEC_VBAR_SHORT_SIZE, &clear->ShortVBarStorageCursor,
+		                      &vBar[yOn], yOff - yOn))
+			return FALSE;
+	}
+
+	return clear_vbar_store(clear, clear->VBarStorage, clear->VBarLookup, CLEARCODEC_VBAR_SIZE,
+	                        &clear->VBarStorageCursor, vBar, height);
+}
+
+static BOOL clear_encode_bands(CLEAR_CONTEXT* WINPR_RESTRICT clear, wStream* WINPR_RESTRICT s,
+                               UINT32 nWidth, UINT32 nHeight, UINT32 nBlocksX, UINT32 nBlocksY)
+{
+	for (UINT32 by = 0; by < nBlocksY; by++)
+	{
+		const UINT32 yStart = by * CLEARCODEC_BLOCK_HEIGHT;
+		const UINT32 height = MIN(CLEARCODEC_BLOCK_HEIGHT, nHeight - yStart);
+		const CLEAR_BLOCK* blocks = &clear->Blocks[by * nBlocksX];
+
+		for (UINT32 bx = 0; bx < nBlocksX; bx++)
+		{
+			UINT32 last = bx;
+
+			if (blocks[bx].layer != CLEAR_LAYER_BANDS)
+				continue;
+
+			/* Merge horizontally adjacent band blocks sharing the background color */
+			while ((last + 1 < nBlocksX) && (blocks[last + 1].layer == CLEAR_LAYER_BANDS) &&
+			       (blocks[last + 1].background == blocks[bx].background))
+				last++;
+
+			const UINT32 xStart = bx * CLEARCODEC_BLOCK_WIDTH;
+			const UINT32 xEnd = MIN((last + 1) * CLEARCODEC_BLOCK_WIDTH, nWidth) - 1;
+
+			if (!Stream_EnsureRemainingCapacity(s, 11))
+				return FALSE;
+
+			Stream_Write_UINT16(s, (UINT16)xStart);
+			Stream_Write_UINT16(s, (UINT16)xEnd);
+			Stream_Write_UINT16(s, (UINT16)yStart);
+			Stream_Write_UINT16(s, (UINT16)(yStart + height - 1));
+			clear_write_key(s, blocks[bx].background);
+
+			for (UINT32 x = xStart; x <= xEnd; x++)
+			{
+				const UINT32* column = clear_encode_pixel(clear, nWidth, x, yStart);
+
+				if (!clear_encode_vbar(clear, s, column, nWidth, height, blocks[bx].background))
+					return FALSE;
+			}
+
+			bx = last;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodec_rlex(CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                                       wStream* WINPR_RESTRICT s, UINT32 nWidth, UINT32 xStart,
+                                       UINT32 yStart, UINT32 width, UINT32 height)
+{
+	CLEAR_PALETTE* palette = &clear->Palette;
+	const UINT32 pixelCount = width * height;
+	BYTE* indices = NULL;
+	UINT32 numBits = 0;
+	UINT32 maxDepth = 0;
+	UINT32 pixelIndex = 0;
+
+	if (!clear_resize_buffer(clear, width, height))
+		return FALSE;
+
+	indices = clear->TempBuffer;
+	clear_palette_reset(palette);
+
+	for (UINT32 y = 0; y < height; y++)
+	{
+		const UINT32* row = clear_encode_pixel(clear, nWidth, xStart, yStart + y);
+
+		for (UINT32 x = 0; x < width; x++)
+		{
+			const INT32 index = clear_palette_add(palette, row[x], 1);
+
+			if ((index < 0) || (index >= CLEARCODEC_RLEX_MAX_COLORS))
+				return FALSE;
+
+			indices[y * width + x] = (BYTE)index;
+		}
+	}
+
+	numBits = CLEAR_LOG2_FLOOR[palette->count - 1] + 1;
+	maxDepth = CLEAR_8BIT_MASKS[8 - numBits];
+
+	if (!Stream_EnsureRemainingCapacity(s, 1 + 3ull * palette->count))
+		return FALSE;
+
+	Stream_Write_UINT8(s, (BYTE)palette->count);
+
+	for (UINT32 i = 0; i < palette->count; i++)
+		clear_write_key(s, palette->colors[i]);
+
+	while (pixelIndex < pixelCount)
+	{
+		const BYTE startIndex = indices[pixelIndex];
+		UINT32 runLength = 1;
+		UINT32 suiteDepth = 0;
+
+		while ((pixelIndex + runLength < pixelCount) &&
+		       (indices[pixelIndex + runLength] == startIndex))
+			runLength++;
+
+		/* The suite starts with the last pixel of the run and continues with increasing indices */
+		while ((suiteDepth < maxDepth) && (pixelIndex + runLength + suiteDepth < pixelCount) &&
+		       (indices[pixelIndex + runLength + suiteDepth] == startIndex + suiteDepth + 1))
+			suiteDepth++;
+
+		if (!Stream_EnsureRemainingCapacity(s, 8))
+			return FALSE;
+
+		Stream_Write_UINT8(s, (BYTE)((suiteDepth << numBits) | (startIndex + suiteDepth)));
+		clear_write_run_length(s, runLength - 1);
+		pixelIndex += runLength + suiteDepth;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodec_nscodec(CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                                          wStream* WINPR_RESTRICT s,
+                                          const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat,
+                                          UINT32 nSrcStep, UINT32 width, UINT32 height)
+{
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+	const UINT32 nTempStep = width * bpp;
+
+	if (!clear_resize_buffer(clear, width, height))
+		return FALSE;
+
+	/* The NSCodec encoder emits bottom-up scanlines, ClearCodec expects top-down */
+	if (!freerdp_image_copy_no_overlap(clear->TempBuffer, SrcFormat, nTempStep, 0, 0, width, height,
+	                                   pSrcData, SrcFormat, nSrcStep, 0, 0, NULL,
+	                                   FREERDP_FLIP_VERTICAL))
+		return FALSE;
+
+	if (!nsc_context_set_parameters(clear->nsc, NSC_COLOR_FORMAT, SrcFormat))
+		return FALSE;
+
+	return nsc_compose_message(clear->nsc, s, clear->TempBuffer, width, height, nTempStep);
+}
+
+static BOOL clear_encode_subcodec_uncompressed(CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                                               wStream* WINPR_RESTRICT s, UINT32 nWidth,
+                                               UINT32 xStart, UINT32 yStart, UINT32 width,
+                                               UINT32 height)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 3ull * width * height))
+		return FALSE;
+
+	for (UINT32 y = 0; y < height; y++)
+	{
+		const UINT32* row = clear_encode_pixel(clear, nWidth, xStart, yStart + y);
+
+		for (UINT32 x = 0; x < width; x++)
+			clear_write_key(s, row[x]);
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodec(CLEAR_CONTEXT* WINPR_RESTRICT clear, wStream* WINPR_RESTRICT s,
+                                  const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat,
+                                  UINT32 nSrcStep, UINT32 nWidth, UINT32 layer, UINT32 xStart,
+                                  UINT32 yStart, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	BYTE subcodecId = 0;
+	const size_t header = Stream_GetPosition(s);
+
+	if (!Stream_EnsureRemainingCapacity(s, 13))
+		return FALSE;
+
+	Stream_Seek(s, 13);
+
+	switch (layer)
+	{
+		case CLEAR_LAYER_NSCODEC:
+		{
+			const BYTE* pSrc = &pSrcData[1ull * yStart * nSrcStep +
+			                             1ull * xStart * FreeRDPGetBytesPerPixel(SrcFormat)];
+			subcodecId = 1;
+			rc = clear_encode_subcodec_nscodec(clear, s, pSrc, SrcFormat, nSrcStep, width, height);
+
+			/* Fall back to raw pixels if NSCodec did not pay off */
+			if (rc && (Stream_GetPosition(s) - header - 13 >= 3ull * width * height))
+			{
+				Stream_SetPosition(s, header + 13);
+				subcodecId = 0;
+				rc = clear_encode_subcodec_uncompressed(clear, s, nWidth, xStart, yStart, width,
+				                                        height);
+			}
+		}
+		break;
+
+		case CLEAR_LAYER_RLEX:
+			subcodecId = 2;
+			rc = clear_encode_subcodec_rlex(clear, s, nWidth, xStart, yStart, width, height);
+			break;
+
+		case CLEAR_LAYER_UNCOMPRESSED:
+		default:
+			subcodecId = 0;
+			rc = clear_encode_subcodec_uncompressed(clear, s, nWidth, xStart, yStart, width,
+			                                        height);
+			break;
+	}
+
+	if (!rc)
+		return FALSE;
+
+	const size_t end = Stream_GetPosition(s);
+	Stream_SetPosition(s, header);
+	Stream_Write_UINT16(s, (UINT16)xStart);
+	Stream_Write_UINT16(s, (UINT16)yStart);
+	Stream_Write_UINT16(s, (UINT16)width);
+	Stream_Write_UINT16(s, (UINT16)height);
+	Stream_Write_UINT32(s, (UINT32)(end - header - 13)); /* bitmapDataByteCount */
+	Stream_Write_UINT8(s, subcodecId);
+	Stream_SetPosition(s, end);
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodecs(CLEAR_CONTEXT* WINPR_RESTRICT clear, wStream* WINPR_RESTRICT s,
+                                   const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat,
+                                   UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight,
+                                   UINT32 nBlocksX, UINT32 nBlocksY)
+{
+	for (UINT32 by = 0; by < nBlocksY; by++)
+	{
+		const UINT32 yStart = by * CLEARCODEC_BLOCK_HEIGHT;
+		const UINT32 height = MIN(CLEARCODEC_BLOCK_HEIGHT, nHeight - yStart);
+		const CLEAR_BLOCK* blocks = &clear->Blocks[by * nBlocksX];
+
+		for (UINT32 bx = 0; bx < nBlocksX; bx++)
+		{
+			UINT32 last = bx;
+			const UINT32 layer = blocks[bx].layer;
+
+			if ((layer == CLEAR_LAYER_RESIDUAL) || (layer == CLEAR_LAYER_BANDS))
+				continue;
+
+			/* RLEX palettes are per block, the other subcodecs cover whole runs of blocks */
+			while ((layer != CLEAR_LAYER_RLEX) && (last + 1 < nBlocksX) &&
+			       (blocks[last + 1].layer == layer))
+				last++;
+
+			const UINT32 xStart = bx * CLEARCODEC_BLOCK_WIDTH;
+			const UINT32 width = MIN((last + 1) * CLEARCODEC_BLOCK_WIDTH, nWidth) - xStart;
+
+			if (!clear_encode_subcodec(clear, s, pSrcData, SrcFormat, nSrcStep, nWidth, layer,
+			                           xStart, yStart, width, height))
+				return FALSE;
+
+			bx = last;
+		}
+	}
+
+	return TRUE;
+}
+
+static INT32 clear_glyph_lookup(const CLEAR_CONTEXT* WINPR_RESTRICT clear,
+                                const UINT32* WINPR_RESTRICT keys, UINT32 count)
+{
+	const UINT32 slot = clear_hash_keys(keys, count) % ARRAYSIZE(clear->GlyphLookup);
+	const CLEAR_GLYPH_ENTRY* entry = NULL;
+
+	if (clear->GlyphLookup[slot] == 0)
+		return -1;
+
+	entry = &clear->GlyphCache[clear->GlyphLookup[slot] - 1];
+
+	if ((entry->count != count) || (memcmp(entry->pixels, keys, 4ull * count) != 0))
+		return -1;
+
+	return clear->GlyphLookup[slot] - 1;
+}
+
+static BOOL clear_glyph_store(CLEAR_CONTEXT* WINPR_RESTRICT clear, UINT32 index,
+                              const UINT32* WINPR_RESTRICT keys, UINT32 count)
+{
+	CLEAR_GLYPH_ENTRY* entry = &clear->GlyphCache[index];
+
+	const UINT32 old = clear_hash_keys(entry->pixels, entry->count) % ARRAYSIZE(clear->GlyphLookup);
+
+	if (clear->GlyphLookup[old] == index + 1)
+		clear->GlyphLookup[old] = 0;
+
+	if (count > entry->size)
+	{
+		UINT32* tmp = winpr_aligned_recalloc(entry->pixels, count, sizeof(UINT32), 32);
+
+		if (!tmp)
+			return FALSE;
+
+		entry->pixels = tmp;
+		entry->size = count;
+	}
+
+	entry->count = count;
+	CopyMemory(entry->pixels, keys, 4ull * count);
+	clear->GlyphLookup[clear_hash_keys(keys, count) % ARRAYSIZE(clear->GlyphLookup)] =
+	    (UINT16)(index + 1);
+	return TRUE;
+}
+
+BOOL clear_compose_message(CLEAR_CONTEXT* WINPR_RESTRICT clear, wStream* WINPR_RESTRICT s,
+                           const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
+                           UINT32 nWidth, UINT32 nHeight)
+{
+	BYTE glyphFlags = 0;
+	UINT16 glyphIndex = 0;
+	BOOL glyph = FALSE;
+
+	if (!clear || !s || !pSrcData || !clear->Compressor)
+		return FALSE;
+
+	if ((nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF))
+		return FALSE;
+
+	clear->format = PIXEL_FORMAT_BGRX32;
+
+	if (!clear_encode_load(clear, pSrcData, SrcFormat, nSrcStep, nWidth, nHeight))
+		return FALSE;
+
+	if (clear->CacheResetPending)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		clear->CacheResetPending = FALSE;
+	}
+
+	/* Small tiles are cached by the client, repeated ones are sent as a glyph hit */
+	if (nWidth * nHeight <= CLEARCODEC_GLYPH_MAX_PIXELS)
+	{
+		const INT32 index = clear_glyph_lookup(clear, clear->EncodeBuffer, nWidth * nHeight);
+		glyph = TRUE;
+		glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+
+		if (index >= 0)
+		{
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_HIT;
+			glyphIndex = (UINT16)index;
+		}
+		else
+		{
+			glyphIndex = (UINT16)clear->GlyphCursor;
+			clear->GlyphCursor = (clear->GlyphCursor + 1) % CLEARCODEC_GLYPH_CACHE_SIZE;
+
+			if (!clear_glyph_store(clear, glyphIndex, clear->EncodeBuffer, nWidth * nHeight))
+				return FALSE;
+		}
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 4))
+		return FALSE;
+
+	Stream_Write_UINT8(s, glyphFlags);
+	Stream_Write_UINT8(s, (BYTE)clear->seqNumber);
+	clear->seqNumber = (clear->seqNumber + 1) % 256;
+
+	if (glyph)
+		Stream_Write_UINT16(s, glyphIndex);
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT)
+		return TRUE;
+
+	const UINT32 nBlocksX = (nWidth + CLEARCODEC_BLOCK_WIDTH - 1) / CLEARCODEC_BLOCK_WIDTH;
+	const UINT32 nBlocksY = (nHeight + CLEARCODEC_BLOCK_HEIGHT - 1) / CLEARCODEC_BLOCK_HEIGHT;
+	BOOL residual = FALSE;
+
+	if (nBlocksX * nBlocksY > clear->BlocksSize)
+	{
+		CLEAR_BLOCK* tmp =
+		    winpr_aligned_recalloc(clear->Blocks, 1ull * nBlocksX * nBlocksY, sizeof(CLEAR_BLOCK), 32);
+
+		if (!tmp)
+			return FALSE;
+
+		clear->Blocks = tmp;
+		clear->BlocksSize = nBlocksX * nBlocksY;
+	}
+
+	for (UINT32 by = 0; by < nBlocksY; by++)
+	{
+		for (UINT32 bx = 0; bx < nBlocksX; bx++)
+		{
+			CLEAR_BLOCK* block = &clear->Blocks[by * nBlocksX + bx];
+			const UINT32 xStart = bx * CLEARCODEC_BLOCK_WIDTH;
+			const UINT32 yStart = by * CLEARCODEC_BLOCK_HEIGHT;
+			clear_encode_analyze_block(clear, nWidth, xStart, yStart,
+			                           MIN(CLEARCODEC_BLOCK_WIDTH, nWidth - xStart),
+			                           MIN(CLEARCODEC_BLOCK_HEIGHT, nHeight - yStart), glyph,
+			                           block);
+
+			if (block->layer == CLEAR_LAYER_RESIDUAL)
+				residual = TRUE;
+		}
+	}
+
+	Stream_SetPosition(clear->ResidualStream, 0);
+	Stream_SetPosition(clear->BandsStream, 0);
+	Stream_SetPosition(clear->SubcodecStream, 0);
+
+	if (residual &&
+	    !clear_encode_residual(clear, clear->ResidualStream, nWidth, nHeight, nBlocksX))
+		return FALSE;
+
+	if (!clear_encode_bands(clear, clear->BandsStream, nWidth, nHeight, nBlocksX, nBlocksY))
+		return FALSE;
+
+	if (!clear_encode_subcodecs(clear, clear->SubcodecStream, pSrcData, SrcFormat, nSrcStep,
+	                            nWidth, nHeight, nBlocksX, nBlocksY))
+		return FALSE;
+
+	const size_t residualByteCount = Stream_GetPosition(clear->ResidualStream);
+	const size_t bandsByteCount = Stream_GetPosition(clear->BandsStream);
+	const size_t subcodecByteCount = Stream_GetPosition(clear->SubcodecStream);
+
+	if (!Stream_EnsureRemainingCapacity(s, 12ull + residualByteCount + bandsByteCount +
+	                                           subcodecByteCount))
+		return FALSE;
+
+	Stream_Write_UINT32(s, (UINT32)residualByteCount);
+	Stream_Write_UINT32(s, (UINT32)bandsByteCount);
+	Stream_Write_UINT32(s, (UINT32)subcodecByteCount);
+	Stream_Write(s, Stream_Buffer(clear->ResidualStream), residualByteCount);
+	Stream_Write(s, Stream_Buffer(clear->BandsStream), bandsByteCount);
+	Stream_Write(s, Stream_Buffer(clear->SubcodecStream), subcodecByteCount);
+	return TRUE;
+}
+
 int clear_compress(CLEAR_CONTEXT* WINPR_RESTRICT clear, const BYTE* WINPR_RESTRICT pSrcData,
                    UINT32 SrcSize, BYTE** WINPR_RESTRICT ppDstData, UINT32* WINPR_RESTRICT pDstSize)
 {
-	WLog_ERR(TAG, "TODO: not implemented!");
-	return 1;
+	WLog_ERR(TAG, "missing bitmap dimensions, use clear_compose_message instead");
+	return -1;
 }
 
 BOOL clear_context_reset(CLEAR_CONTEXT* WINPR_RESTRICT clear)
@@ -1161,6 +2047,18 @@ BOOL clear_context_reset(CLEAR_CONTEXT* WINPR_RESTRICT clear)
 	 * and its internal caches must NOT be reset on the ResetGraphics PDU.
 	 */
 	clear->seqNumber = 0;
+
+	if (clear->Compressor)
+	{
+		clear->CacheResetPending = TRUE;
+		clear->VBarStorageCursor = 0;
+		clear->ShortVBarStorageCursor = 0;
+		clear->GlyphCursor = 0;
+		ZeroMemory(clear->GlyphLookup, sizeof(clear->GlyphLookup));
+		ZeroMemory(clear->VBarLookup, sizeof(clear->VBarLookup));
+		ZeroMemory(clear->ShortVBarLookup, sizeof(clear->ShortVBarLookup));
+	}
+
 	return TRUE;
 }
 
@@ -1186,6 +2084,16 @@ CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 	if (!clear->TempBuffer)
 		goto error_nsc;
 
+	if (Compressor)
+	{
+		clear->ResidualStream = Stream_New(NULL, 1024);
+		clear->BandsStream = Stream_New(NULL, 1024);
+		clear->SubcodecStream = Stream_New(NULL, 1024);
+
+		if (!clear->ResidualStream || !clear->BandsStream || !clear->SubcodecStream)
+			goto error_nsc;
+	}
+
 	if (!clear_context_reset(clear))
 		goto error_nsc;
 
@@ -1205,6 +2113,11 @@ void clear_context_free(CLEAR_CONTEXT* clear)
 
 	nsc_context_free(clear->nsc);
 	winpr_aligned_free(clear->TempBuffer);
+	winpr_aligned_free(clear->EncodeBuffer);
+	winpr_aligned_free(clear->Blocks);
+	Stream_Free(clear->ResidualStream, TRUE);
+	Stream_Free(clear->BandsStream, TRUE);
+	Stream_Free(clear->SubcodecStream, TRUE);
 
 	clear_reset_vbar_storage(clear, TRUE);
 	clear_reset_glyph_cache(clear);
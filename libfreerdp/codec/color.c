@@ -938,13 +938,150 @@ static int av_format_for_buffer(UINT32 format)
 }
 #endif
 
-BOOL freerdp_image_scale(BYTE* WINPR_RESTRICT pDstData, DWORD DstFormat, UINT32 nDstStep,
-                         UINT32 nXDst, UINT32 nYDst, UINT32 nDstWidth, UINT32 nDstHeight,
-                         const BYTE* WINPR_RESTRICT pSrcData, DWORD SrcFormat, UINT32 nSrcStep,
-                         UINT32 nXSrc, UINT32 nYSrc, UINT32 nSrcWidth, UINT32 nSrcHeight)
+struct S_FREERDP_IMAGE_SCALER
+{
+	UINT32 srcWidth;
+	UINT32 srcHeight;
+	UINT32 dstWidth;
+	UINT32 dstHeight;
+	DWORD srcFormat;
+	DWORD dstFormat;
+
+	/* intermediate image for 32bpp scaling with format conversion */
+	BYTE* tmp;
+	size_t tmpSize;
+#if defined(WITH_SWSCALE)
+	struct SwsContext* sws;
+#endif
+};
+
+static void freerdp_image_scaler_uninit(FREERDP_IMAGE_SCALER* scaler)
+{
+	WINPR_ASSERT(scaler);
+
+	winpr_aligned_free(scaler->tmp);
+	scaler->tmp = NULL;
+	scaler->tmpSize = 0;
+#if defined(WITH_SWSCALE)
+	sws_freeContext(scaler->sws);
+	scaler->sws = NULL;
+#endif
+}
+
+/* (re)build the cached state if sizes or formats differ from the last call */
+static BOOL freerdp_image_scaler_prepare(FREERDP_IMAGE_SCALER* scaler, DWORD DstFormat,
+                                         UINT32 nDstWidth, UINT32 nDstHeight, DWORD SrcFormat,
+                                         UINT32 nSrcWidth, UINT32 nSrcHeight)
+{
+	WINPR_ASSERT(scaler);
+
+	if ((scaler->srcWidth == nSrcWidth) && (scaler->srcHeight == nSrcHeight) &&
+	    (scaler->dstWidth == nDstWidth) && (scaler->dstHeight == nDstHeight) &&
+	    (scaler->srcFormat == SrcFormat) && (scaler->dstFormat == DstFormat))
+		return TRUE;
+
+	freerdp_image_scaler_uninit(scaler);
+	scaler->srcWidth = scaler->srcHeight = 0;
+	scaler->dstWidth = scaler->dstHeight = 0;
+
+	if ((FreeRDPGetBytesPerPixel(SrcFormat) == 4) && (FreeRDPGetBytesPerPixel(DstFormat) == 4))
+	{
+		if (!FreeRDPAreColorFormatsEqualNoAlpha(SrcFormat, DstFormat))
+		{
+			scaler->tmpSize = 4ULL * nDstWidth * nDstHeight;
+			scaler->tmp = winpr_aligned_malloc(scaler->tmpSize, 16);
+
+			if (!scaler->tmp)
+				return FALSE;
+		}
+	}
+#if defined(WITH_SWSCALE)
+	else
+	{
+		const int srcFormat = av_format_for_buffer(SrcFormat);
+		const int dstFormat = av_format_for_buffer(DstFormat);
+
+		if ((srcFormat == AV_PIX_FMT_NONE) || (dstFormat == AV_PIX_FMT_NONE))
+			return FALSE;
+
+		scaler->sws =
+		    sws_getContext((int)nSrcWidth, (int)nSrcHeight, srcFormat, (int)nDstWidth,
+		                   (int)nDstHeight, dstFormat, SWS_BILINEAR, NULL, NULL, NULL);
+
+		if (!scaler->sws)
+			return FALSE;
+	}
+#endif
+
+	scaler->srcWidth = nSrcWidth;
+	scaler->srcHeight = nSrcHeight;
+	scaler->dstWidth = nDstWidth;
+	scaler->dstHeight = nDstHeight;
+	scaler->srcFormat = SrcFormat;
+	scaler->dstFormat = DstFormat;
+	return TRUE;
+}
+
+static BOOL freerdp_image_scale_32bpp(FREERDP_IMAGE_SCALER* scaler, BYTE* WINPR_RESTRICT pDstData,
+                                      DWORD DstFormat, UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst,
+                                      UINT32 nDstWidth, UINT32 nDstHeight,
+                                      const BYTE* WINPR_RESTRICT pSrcData, DWORD SrcFormat,
+                                      UINT32 nSrcStep, UINT32 nXSrc, UINT32 nYSrc,
+                                      UINT32 nSrcWidth, UINT32 nSrcHeight)
+{
+	static primitives_t* prims = NULL;
+
+	if (!prims)
+		prims = primitives_get();
+
+	const BYTE* src = &pSrcData[4ULL * nXSrc + 1ULL * nYSrc * nSrcStep];
+
+	if (FreeRDPAreColorFormatsEqualNoAlpha(SrcFormat, DstFormat))
+	{
+		BYTE* dst = &pDstData[4ULL * nXDst + 1ULL * nYDst * nDstStep];
+		return prims->scale_8u_AC4r(src, nSrcStep, nSrcWidth, nSrcHeight, dst, nDstStep,
+		                            nDstWidth, nDstHeight) == PRIMITIVES_SUCCESS;
+	}
+
+	/* Scale in the source format, then convert to the destination format */
+	const UINT32 tmpStep = nDstWidth * 4;
+
+	WINPR_ASSERT(scaler->tmp);
+
+	if (prims->scale_8u_AC4r(src, nSrcStep, nSrcWidth, nSrcHeight, scaler->tmp, tmpStep,
+	                         nDstWidth, nDstHeight) != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	return freerdp_image_copy_no_overlap(pDstData, DstFormat, nDstStep, nXDst, nYDst, nDstWidth,
+	                                     nDstHeight, scaler->tmp, SrcFormat, tmpStep, 0, 0, NULL,
+	                                     FREERDP_FLIP_NONE);
+}
+
+FREERDP_IMAGE_SCALER* freerdp_image_scaler_new(void)
+{
+	return calloc(1, sizeof(FREERDP_IMAGE_SCALER));
+}
+
+void freerdp_image_scaler_free(FREERDP_IMAGE_SCALER* scaler)
+{
+	if (!scaler)
+		return;
+
+	freerdp_image_scaler_uninit(scaler);
+	free(scaler);
+}
+
+BOOL freerdp_image_scaler_scale(FREERDP_IMAGE_SCALER* scaler, BYTE* WINPR_RESTRICT pDstData,
+                                DWORD DstFormat, UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst,
+                                UINT32 nDstWidth, UINT32 nDstHeight,
+                                const BYTE* WINPR_RESTRICT pSrcData, DWORD SrcFormat,
+                                UINT32 nSrcStep, UINT32 nXSrc, UINT32 nYSrc, UINT32 nSrcWidth,
+                                UINT32 nSrcHeight)
 {
 	BOOL rc = FALSE;
 
+	WINPR_ASSERT(scaler);
+
 	if (nDstStep == 0)
 		nDstStep = nDstWidth * FreeRDPGetBytesPerPixel(DstFormat);
 
@@ -963,31 +1100,31 @@ BOOL freerdp_image_scale(BYTE* WINPR_RESTRICT pDstData, DWORD DstFormat, UINT32
 		                                     nDstHeight, pSrcData, SrcFormat, nSrcStep, nXSrc,
 		                                     nYSrc, NULL, FREERDP_FLIP_NONE);
 	}
+
+	/* 32bpp formats are handled by the built-in scaler */
+	if ((FreeRDPGetBytesPerPixel(SrcFormat) == 4) && (FreeRDPGetBytesPerPixel(DstFormat) == 4))
+	{
+		if (!freerdp_image_scaler_prepare(scaler, DstFormat, nDstWidth, nDstHeight, SrcFormat,
+		                                  nSrcWidth, nSrcHeight))
+			return FALSE;
+
+		return freerdp_image_scale_32bpp(scaler, pDstData, DstFormat, nDstStep, nXDst, nYDst,
+		                                 nDstWidth, nDstHeight, pSrcData, SrcFormat, nSrcStep,
+		                                 nXSrc, nYSrc, nSrcWidth, nSrcHeight);
+	}
 	else
 #if defined(WITH_SWSCALE)
 	{
-		int res = 0;
-		struct SwsContext* resize = NULL;
-		int srcFormat = av_format_for_buffer(SrcFormat);
-		int dstFormat = av_format_for_buffer(DstFormat);
 		const int srcStep[1] = { (int)nSrcStep };
 		const int dstStep[1] = { (int)nDstStep };
 
-		if ((srcFormat == AV_PIX_FMT_NONE) || (dstFormat == AV_PIX_FMT_NONE))
+		if (!freerdp_image_scaler_prepare(scaler, DstFormat, nDstWidth, nDstHeight, SrcFormat,
+		                                  nSrcWidth, nSrcHeight))
 			return FALSE;
 
-		resize = sws_getContext((int)nSrcWidth, (int)nSrcHeight, srcFormat, (int)nDstWidth,
-		                        (int)nDstHeight, dstFormat, SWS_BILINEAR, NULL, NULL, NULL);
-
-		if (!resize)
-			goto fail;
-
-		res = sws_scale(resize, &src, srcStep, 0, (int)nSrcHeight, &dst, dstStep);
+		const int res = sws_scale(scaler->sws, &src, srcStep, 0, (int)nSrcHeight, &dst, dstStep);
 		rc = (res == ((int)nDstHeight));
-	fail:
-		sws_freeContext(resize);
 	}
-
 #elif defined(WITH_CAIRO)
 	{
 		const double sx = (double)nDstWidth / (double)nSrcWidth;
@@ -1027,12 +1164,26 @@ BOOL freerdp_image_scale(BYTE* WINPR_RESTRICT pDstData, DWORD DstFormat, UINT32
 	}
 #else
 	{
-		WLog_WARN(TAG, "SmartScaling requested but compiled without libcairo support!");
+		WLog_WARN(TAG, "scaling %s to %s requires swscale or cairo support",
+		          FreeRDPGetColorFormatName(SrcFormat), FreeRDPGetColorFormatName(DstFormat));
 	}
 #endif
 	return rc;
 }
 
+BOOL freerdp_image_scale(BYTE* WINPR_RESTRICT pDstData, DWORD DstFormat, UINT32 nDstStep,
+                         UINT32 nXDst, UINT32 nYDst, UINT32 nDstWidth, UINT32 nDstHeight,
+                         const BYTE* WINPR_RESTRICT pSrcData, DWORD SrcFormat, UINT32 nSrcStep,
+                         UINT32 nXSrc, UINT32 nYSrc, UINT32 nSrcWidth, UINT32 nSrcHeight)
+{
+	FREERDP_IMAGE_SCALER scaler = { 0 };
+	const BOOL rc = freerdp_image_scaler_scale(&scaler, pDstData, DstFormat, nDstStep, nXDst, nYDst,
+	                                           nDstWidth, nDstHeight, pSrcData, SrcFormat,
+	                                           nSrcStep, nXSrc, nYSrc, nSrcWidth, nSrcHeight);
+	freerdp_image_scaler_uninit(&scaler);
+	return rc;
+}
+
 DWORD FreeRDPAreColorFormatsEqualNoAlpha(DWORD first, DWORD second)
 {
 	return FreeRDPAreColorFormatsEqualNoAlpha_int(first, second);
@@ -63,6 +63,8 @@
 #include <soxr.h>
 #endif
 
+#include "dsp_resample.h"
+
 #else
 #include "dsp_ffmpeg.h"
 #endif
@@ -118,6 +120,8 @@ struct S_FREERDP_DSP_CONTEXT
 
 #if defined(WITH_SOXR)
 	soxr_t sox;
+#else
+	FREERDP_DSP_RESAMPLER* resampler;
 #endif
 };
 
@@ -180,13 +184,22 @@ static BOOL freerdp_dsp_channel_mix(FREERDP_DSP_CONTEXT* WINPR_RESTRICT context,
 				if (!Stream_EnsureCapacity(context->common.channelmix, size * 2))
 					return FALSE;
 
-				for (size_t x = 0; x < samples; x++)
+				if (bpp == 2)
 				{
-					for (size_t y = 0; y < bpp; y++)
-						Stream_Write_UINT8(context->common.channelmix, src[x * bpp + y]);
-
-					for (size_t y = 0; y < bpp; y++)
-						Stream_Write_UINT8(context->common.channelmix, src[x * bpp + y]);
+					freerdp_dsp_get_kernels()->mono_to_stereo(
+					    src, Stream_Buffer(context->common.channelmix), samples);
+					Stream_SetPosition(context->common.channelmix, samples * 4);
+				}
+				else
+				{
+					for (size_t x = 0; x < samples; x++)
+					{
+						for (size_t y = 0; y < bpp; y++)
+							Stream_Write_UINT8(context->common.channelmix, src[x * bpp + y]);
+
+						for (size_t y = 0; y < bpp; y++)
+							Stream_Write_UINT8(context->common.channelmix, src[x * bpp + y]);
+					}
 				}
 
 				Stream_SealLength(context->common.channelmix);
@@ -207,12 +220,20 @@ static BOOL freerdp_dsp_channel_mix(FREERDP_DSP_CONTEXT* WINPR_RESTRICT context,
 			if (!Stream_EnsureCapacity(context->common.channelmix, size / 2))
 				return FALSE;
 
-			/* Simply drop second channel.
-			 * TODO: Calculate average */
-			for (size_t x = 0; x < samples; x++)
+			/* 16 bit samples are averaged, 8 bit samples simply drop the second channel. */
+			if (bpp == 2)
 			{
-				for (size_t y = 0; y < bpp; y++)
-					Stream_Write_UINT8(context->common.channelmix, src[2 * x * bpp + y]);
+				freerdp_dsp_get_kernels()->stereo_to_mono(
+				    src, Stream_Buffer(context->common.channelmix), samples);
+				Stream_SetPosition(context->common.channelmix, samples * 2);
+			}
+			else
+			{
+				for (size_t x = 0; x < samples; x++)
+				{
+					for (size_t y = 0; y < bpp; y++)
+						Stream_Write_UINT8(context->common.channelmix, src[2 * x * bpp + y]);
+				}
 			}
 
 			Stream_SealLength(context->common.channelmix);
@@ -295,8 +316,37 @@ static BOOL freerdp_dsp_resample(FREERDP_DSP_CONTEXT* WINPR_RESTRICT context,
 	*length = Stream_Length(context->common.resample);
 	return (error == 0) ? TRUE : FALSE;
 #else
-	WLog_ERR(TAG, "Missing resample support, recompile -DWITH_SOXR=ON or -DWITH_DSP_FFMPEG=ON");
-	return FALSE;
+	const UINT32 srcRate = srcFormat->nSamplesPerSec;
+	const UINT32 dstRate = context->common.format.nSamplesPerSec;
+	const UINT32 channels = srcFormat->nChannels;
+
+	if ((srcFormat->wBitsPerSample != 16) || (channels == 0))
+	{
+		WLog_ERR(TAG, "resampling requires 16 bit samples, got %" PRIu16 " bit",
+		         srcFormat->wBitsPerSample);
+		return FALSE;
+	}
+
+	/* Filter history and phase carry over between calls, only restart on a format change */
+	if (!freerdp_dsp_resampler_matches(context->resampler, srcRate, dstRate, channels))
+	{
+		freerdp_dsp_resampler_free(context->resampler);
+		context->resampler = freerdp_dsp_resampler_new(srcRate, dstRate, channels);
+
+		if (!context->resampler)
+			return FALSE;
+	}
+
+	Stream_SetPosition(context->common.resample, 0);
+
+	if (!freerdp_dsp_resampler_process(context->resampler, src, size / (2ull * channels),
+	                                   context->common.resample))
+		return FALSE;
+
+	Stream_SealLength(context->common.resample);
+	*data = Stream_Buffer(context->common.resample);
+	*length = Stream_Length(context->common.resample);
+	return TRUE;
 #endif
 }
 
@@ -1226,6 +1276,8 @@ void freerdp_dsp_context_free(FREERDP_DSP_CONTEXT* context)
 #endif
 #if defined(WITH_SOXR)
 		soxr_delete(context->sox);
+#else
+		freerdp_dsp_resampler_free(context->resampler);
 #endif
 		free(context);
 	}
@@ -1565,6 +1617,9 @@ BOOL freerdp_dsp_context_reset(FREERDP_DSP_CONTEXT* WINPR_RESTRICT context,
 		if (!context->sox || (error != 0))
 			return FALSE;
 	}
+#else
+	freerdp_dsp_resampler_free(context->resampler);
+	context->resampler = NULL;
 #endif
 	return TRUE;
 #endif
@@ -0,0 +1,400 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - PCM resampler and channel mixer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <math.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+
+#include <freerdp/log.h>
+
+#include "dsp_resample.h"
+#include "sse/dsp_sse2.h"
+#include "sse/dsp_avx2.h"
+#include "neon/dsp_neon.h"
+
+#define TAG FREERDP_TAG("codec.dsp.resample")
+
+/*
+ * Polyphase windowed sinc resampler.
+ *
+ * The rate ratio is reduced to dstRate / srcRate = L / M. Output sample n lies at input
+ * position n * M / L, its fractional part selects one of the filter phases. Rate pairs with
+ * a large L quantize the position to DSP_RESAMPLE_MAX_PHASES phases.
+ */
+#define DSP_RESAMPLE_TAPS 32
+#define DSP_RESAMPLE_MAX_TAPS 512
+#define DSP_RESAMPLE_MAX_PHASES 1024
+#define DSP_RESAMPLE_ROLLOFF 0.92
+#define DSP_RESAMPLE_KAISER_BETA 8.0
+
+struct S_FREERDP_DSP_RESAMPLER
+{
+	UINT32 srcRate;
+	UINT32 dstRate;
+	UINT32 channels;
+
+	UINT32 L;
+	UINT32 M;
+	UINT32 phases;
+	size_t taps;
+	INT16* coefficients;
+
+	/* Deinterleaved input history, channel c starts at history + c * capacity */
+	INT16* history;
+	size_t capacity;
+	size_t count;
+	size_t pos;
+	UINT32 acc;
+
+	const FREERDP_DSP_KERNELS* kernels;
+};
+
+static INT16 dsp_read_int16(const BYTE* WINPR_RESTRICT src)
+{
+	return (INT16)(src[0] | (src[1] << 8));
+}
+
+static void dsp_write_int16(BYTE* WINPR_RESTRICT dst, INT16 value)
+{
+	dst[0] = (BYTE)(value & 0xFF);
+	dst[1] = (BYTE)((value >> 8) & 0xFF);
+}
+
+static INT32 dsp_dot_generic(const INT16* WINPR_RESTRICT a, const INT16* WINPR_RESTRICT b,
+                             size_t count)
+{
+	INT32 sum = 0;
+
+	for (size_t x = 0; x < count; x++)
+		sum += a[x] * b[x];
+
+	return sum;
+}
+
+static void dsp_mono_to_stereo_generic(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+                                       size_t frames)
+{
+	for (size_t x = 0; x < frames; x++)
+	{
+		dst[4 * x + 0] = src[2 * x + 0];
+		dst[4 * x + 1] = src[2 * x + 1];
+		dst[4 * x + 2] = src[2 * x + 0];
+		dst[4 * x + 3] = src[2 * x + 1];
+	}
+}
+
+static void dsp_stereo_to_mono_generic(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+                                       size_t frames)
+{
+	for (size_t x = 0; x < frames; x++)
+	{
+		const INT32 left = dsp_read_int16(&src[4 * x]);
+		const INT32 right = dsp_read_int16(&src[4 * x + 2]);
+
+		dsp_write_int16(&dst[2 * x], (INT16)((left + right) >> 1));
+	}
+}
+
+static FREERDP_DSP_KERNELS dsp_kernels = { 0 };
+static INIT_ONCE dsp_kernels_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK dsp_kernels_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+	dsp_kernels.dot = dsp_dot_generic;
+	dsp_kernels.mono_to_stereo = dsp_mono_to_stereo_generic;
+	dsp_kernels.stereo_to_mono = dsp_stereo_to_mono_generic;
+
+	dsp_init_sse2(&dsp_kernels);
+	dsp_init_avx2(&dsp_kernels);
+	dsp_init_neon(&dsp_kernels);
+	return TRUE;
+}
+
+const FREERDP_DSP_KERNELS* freerdp_dsp_get_kernels(void)
+{
+	InitOnceExecuteOnce(&dsp_kernels_once, dsp_kernels_init, NULL, NULL);
+	return &dsp_kernels;
+}
+
+static UINT32 dsp_gcd(UINT32 a, UINT32 b)
+{
+	while (b != 0)
+	{
+		const UINT32 t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static double dsp_bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+
+	for (size_t k = 1; k < 64; k++)
+	{
+		const double f = x / (2.0 * (double)k);
+		term *= f * f;
+		sum += term;
+
+		if (term < sum * 1e-12)
+			break;
+	}
+
+	return sum;
+}
+
+static double dsp_kaiser_sinc(double x, double cutoff, double half)
+{
+	const double r = x / half;
+	double sinc = 1.0;
+
+	if ((r <= -1.0) || (r >= 1.0))
+		return 0.0;
+
+	if (fabs(x) > 1e-9)
+		sinc = sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+
+	return cutoff * sinc * dsp_bessel_i0(DSP_RESAMPLE_KAISER_BETA * sqrt(1.0 - r * r)) /
+	       dsp_bessel_i0(DSP_RESAMPLE_KAISER_BETA);
+}
+
+static BOOL dsp_resampler_init_filter(FREERDP_DSP_RESAMPLER* resampler)
+{
+	const double ratio = MIN(1.0, (double)resampler->L / (double)resampler->M);
+	const double cutoff = DSP_RESAMPLE_ROLLOFF * ratio;
+	double* phase = NULL;
+	size_t taps = (size_t)ceil(DSP_RESAMPLE_TAPS / ratio);
+
+	/* Multiple of 16 so the SIMD kernels never run a scalar tail */
+	taps = MIN(DSP_RESAMPLE_MAX_TAPS, (taps + 15) & ~(size_t)15);
+
+	resampler->taps = taps;
+	resampler->phases = MIN(resampler->L, DSP_RESAMPLE_MAX_PHASES);
+	resampler->coefficients =
+	    winpr_aligned_calloc(1ull * resampler->phases * taps, sizeof(INT16), 32);
+	phase = calloc(taps, sizeof(double));
+
+	if (!resampler->coefficients || !phase)
+	{
+		free(phase);
+		return FALSE;
+	}
+
+	for (UINT32 p = 0; p < resampler->phases; p++)
+	{
+		INT16* coefficients = &resampler->coefficients[1ull * p * taps];
+		const double frac = (double)p / (double)resampler->phases;
+		double sum = 0.0;
+		INT32 qsum = 0;
+		size_t center = 0;
+
+		for (size_t k = 0; k < taps; k++)
+		{
+			const double x = ((double)taps / 2.0 - 1.0 - (double)k) + frac;
+			phase[k] = dsp_kaiser_sinc(x, cutoff, (double)taps / 2.0);
+			sum += phase[k];
+		}
+
+		/* Unity gain at DC for every phase, rounding errors go to the largest tap */
+		for (size_t k = 0; k < taps; k++)
+		{
+			const double v = lround(phase[k] / sum * 32768.0);
+
+			coefficients[k] = (INT16)MAX(-32768.0, MIN(32767.0, v));
+			qsum += coefficients[k];
+
+			if (coefficients[k] > coefficients[center])
+				center = k;
+		}
+
+		coefficients[center] =
+		    (INT16)MAX(-32768, MIN(32767, coefficients[center] + (32768 - qsum)));
+	}
+
+	free(phase);
+	return TRUE;
+}
+
+static BOOL dsp_resampler_reserve(FREERDP_DSP_RESAMPLER* resampler, size_t frames)
+{
+	INT16* history = NULL;
+	size_t capacity = resampler->capacity;
+
+	if (resampler->count + frames <= capacity)
+		return TRUE;
+
+	while (capacity < resampler->count + frames)
+		capacity = MAX(capacity * 2, 1024);
+
+	history = winpr_aligned_calloc(1ull * capacity * resampler->channels, sizeof(INT16), 32);
+
+	if (!history)
+		return FALSE;
+
+	for (UINT32 c = 0; c < resampler->channels; c++)
+	{
+		if (resampler->count > 0)
+			memcpy(&history[c * capacity], &resampler->history[c * resampler->capacity],
+			       resampler->count * sizeof(INT16));
+	}
+
+	winpr_aligned_free(resampler->history);
+	resampler->history = history;
+	resampler->capacity = capacity;
+	return TRUE;
+}
+
+void freerdp_dsp_resampler_free(FREERDP_DSP_RESAMPLER* resampler)
+{
+	if (!resampler)
+		return;
+
+	winpr_aligned_free(resampler->coefficients);
+	winpr_aligned_free(resampler->history);
+	free(resampler);
+}
+
+FREERDP_DSP_RESAMPLER* freerdp_dsp_resampler_new(UINT32 srcRate, UINT32 dstRate, UINT32 channels)
+{
+	FREERDP_DSP_RESAMPLER* resampler = NULL;
+	UINT32 gcd = 0;
+
+	if ((srcRate == 0) || (dstRate == 0) || (channels == 0))
+		return NULL;
+
+	resampler = calloc(1, sizeof(FREERDP_DSP_RESAMPLER));
+
+	if (!resampler)
+		return NULL;
+
+	gcd = dsp_gcd(srcRate, dstRate);
+	resampler->srcRate = srcRate;
+	resampler->dstRate = dstRate;
+	resampler->channels = channels;
+	resampler->L = dstRate / gcd;
+	resampler->M = srcRate / gcd;
+	resampler->kernels = freerdp_dsp_get_kernels();
+
+	if (!dsp_resampler_init_filter(resampler))
+		goto fail;
+
+	/* Start with half a filter of silence so the first output is centered on the first input */
+	if (!dsp_resampler_reserve(resampler, resampler->taps / 2 - 1))
+		goto fail;
+
+	resampler->count = resampler->taps / 2 - 1;
+
+	WLog_DBG(TAG, "%" PRIu32 " -> %" PRIu32 " Hz, %" PRIu32 " phases, %" PRIuz " taps", srcRate,
+	         dstRate, resampler->phases, resampler->taps);
+	return resampler;
+
+fail:
+	freerdp_dsp_resampler_free(resampler);
+	return NULL;
+}
+
+BOOL freerdp_dsp_resampler_matches(const FREERDP_DSP_RESAMPLER* resampler, UINT32 srcRate,
+                                   UINT32 dstRate, UINT32 channels)
+{
+	if (!resampler)
+		return FALSE;
+
+	return (resampler->srcRate == srcRate) && (resampler->dstRate == dstRate) &&
+	       (resampler->channels == channels);
+}
+
+BOOL freerdp_dsp_resampler_process(FREERDP_DSP_RESAMPLER* WINPR_RESTRICT resampler,
+                                   const BYTE* WINPR_RESTRICT src, size_t frames,
+                                   wStream* WINPR_RESTRICT out)
+{
+	WINPR_ASSERT(resampler);
+	WINPR_ASSERT(src || (frames == 0));
+	WINPR_ASSERT(out);
+
+	const size_t channels = resampler->channels;
+
+	if (!dsp_resampler_reserve(resampler, frames))
+		return FALSE;
+
+	for (size_t c = 0; c < channels; c++)
+	{
+		INT16* history = &resampler->history[c * resampler->capacity + resampler->count];
+
+		for (size_t x = 0; x < frames; x++)
+			history[x] = dsp_read_int16(&src[(x * channels + c) * sizeof(INT16)]);
+	}
+
+	resampler->count += frames;
+
+	if (resampler->count > resampler->pos)
+	{
+		const UINT64 maxFrames =
+		    (1ull * (resampler->count - resampler->pos) * resampler->L) / resampler->M + 1;
+
+		if (!Stream_EnsureRemainingCapacity(out, maxFrames * channels * sizeof(INT16)))
+			return FALSE;
+	}
+
+	while (resampler->pos + resampler->taps <= resampler->count)
+	{
+		const size_t phase = (resampler->phases == resampler->L)
+		                         ? resampler->acc
+		                         : (1ull * resampler->acc * resampler->phases) / resampler->L;
+		const INT16* coefficients = &resampler->coefficients[phase * resampler->taps];
+
+		for (size_t c = 0; c < channels; c++)
+		{
+			const INT16* history = &resampler->history[c * resampler->capacity + resampler->pos];
+			const INT32 sum = resampler->kernels->dot(history, coefficients, resampler->taps);
+			const INT32 value = (sum + (1 << 14)) >> 15;
+
+			Stream_Write_INT16(out, (INT16)MAX(-32768, MIN(32767, value)));
+		}
+
+		resampler->acc += resampler->M;
+		resampler->pos += resampler->acc / resampler->L;
+		resampler->acc %= resampler->L;
+	}
+
+	/* Keep only the history the next output needs */
+	const size_t drop = MIN(resampler->pos, resampler->count);
+
+	if (drop > 0)
+	{
+		for (size_t c = 0; c < channels; c++)
+		{
+			INT16* history = &resampler->history[c * resampler->capacity];
+			memmove(history, &history[drop], (resampler->count - drop) * sizeof(INT16));
+		}
+
+		resampler->count -= drop;
+		resampler->pos -= drop;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,53 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - PCM resampler and channel mixer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_DSP_RESAMPLE_H
+#define FREERDP_LIB_CODEC_DSP_RESAMPLE_H
+
+#include <winpr/stream.h>
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+/* Kernels operating on 16 bit little endian PCM, replaced by SIMD versions where available */
+typedef struct
+{
+	INT32 (*dot)(const INT16* WINPR_RESTRICT a, const INT16* WINPR_RESTRICT b, size_t count);
+	void (*mono_to_stereo)(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+	                       size_t frames);
+	void (*stereo_to_mono)(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+	                       size_t frames);
+} FREERDP_DSP_KERNELS;
+
+typedef struct S_FREERDP_DSP_RESAMPLER FREERDP_DSP_RESAMPLER;
+
+FREERDP_LOCAL const FREERDP_DSP_KERNELS* freerdp_dsp_get_kernels(void);
+
+FREERDP_LOCAL void freerdp_dsp_resampler_free(FREERDP_DSP_RESAMPLER* resampler);
+
+WINPR_ATTR_MALLOC(freerdp_dsp_resampler_free, 1)
+FREERDP_LOCAL FREERDP_DSP_RESAMPLER* freerdp_dsp_resampler_new(UINT32 srcRate, UINT32 dstRate,
+                                                               UINT32 channels);
+
+FREERDP_LOCAL BOOL freerdp_dsp_resampler_matches(const FREERDP_DSP_RESAMPLER* resampler,
+                                                 UINT32 srcRate, UINT32 dstRate, UINT32 channels);
+
+FREERDP_LOCAL BOOL freerdp_dsp_resampler_process(FREERDP_DSP_RESAMPLER* WINPR_RESTRICT resampler,
+                                                 const BYTE* WINPR_RESTRICT src, size_t frames,
+                                                 wStream* WINPR_RESTRICT out);
+
+#endif /* FREERDP_LIB_CODEC_DSP_RESAMPLE_H */
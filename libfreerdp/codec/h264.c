@@ -29,6 +29,7 @@
 #include <freerdp/primitives.h>
 #include <freerdp/codec/h264.h>
 #include <freerdp/codec/yuv.h>
+#include <freerdp/codec/region.h>
 #include <freerdp/log.h>
 
 #include "h264.h"
@@ -74,6 +75,10 @@ BOOL avc420_ensure_buffer(H264_CONTEXT* h264, UINT32 stride, UINT32 width, UINT3
 		h264->width = width;
 		h264->height = height;
 
+		/* The encoder frames are updated incrementally, start over with a full frame */
+		h264->firstLumaFrameDone = FALSE;
+		h264->firstChromaFrameDone = FALSE;
+
 		for (size_t x = 0; x < 3; x++)
 		{
 			BYTE* tmp1 = winpr_aligned_recalloc(h264->pYUVData[x], h264->iStride[x], pheight, 16);
@@ -153,80 +158,168 @@ static BOOL allocate_h264_metablock(UINT32 QP, RECTANGLE_16* rectangles,
 	return TRUE;
 }
 
-static INLINE BOOL diff_tile(const RECTANGLE_16* regionRect, BYTE* pYUVData[3],
-                             BYTE* pOldYUVData[3], UINT32 const iStride[3])
+/* The AVC444v1 auxiliary view stores chroma in interleaved 16 line blocks, so a tile
+ * converted on its own may write up to the next 16 line boundary of the (padded) planes */
+static INLINE UINT32 tile_bottom(const RECTANGLE_16* tile, UINT32 height)
 {
-	size_t size = 0;
+	const UINT32 rows = tile->bottom - tile->top;
+	const UINT32 padHeight = (height + 15) & ~15u;
+	return MIN(padHeight, tile->top + ((rows + 15) & ~15u));
+}
 
-	if (!regionRect || !pYUVData || !pOldYUVData || !iStride)
-		return FALSE;
-	size = regionRect->right - regionRect->left;
-	if (regionRect->right > iStride[0])
-		return FALSE;
-	if (regionRect->right / 2u > iStride[1])
-		return FALSE;
-	if (regionRect->right / 2u > iStride[2])
-		return FALSE;
+static INLINE BOOL diff_tile(const RECTANGLE_16* tile, BYTE* pYUVData[3], BYTE* pOldYUVData[3],
+                             const UINT32 iStride[3], UINT32 height)
+{
+	const size_t size = tile->right - tile->left;
+	const size_t csize = (size + 1) / 2;
+	const UINT32 bottom = tile_bottom(tile, height);
 
-	for (UINT16 y = regionRect->top; y < regionRect->bottom; y++)
+	for (UINT32 y = tile->top; y < bottom; y++)
 	{
-		const BYTE* cur0 = &pYUVData[0][y * iStride[0]];
-		const BYTE* cur1 = &pYUVData[1][y * iStride[1]];
-		const BYTE* cur2 = &pYUVData[2][y * iStride[2]];
-		const BYTE* old0 = &pOldYUVData[0][y * iStride[0]];
-		const BYTE* old1 = &pOldYUVData[1][y * iStride[1]];
-		const BYTE* old2 = &pOldYUVData[2][y * iStride[2]];
+		const size_t offset = 1ull * y * iStride[0] + tile->left;
 
-		if (memcmp(&cur0[regionRect->left], &old0[regionRect->left], size) != 0)
-			return TRUE;
-		if (memcmp(&cur1[regionRect->left / 2], &old1[regionRect->left / 2], size / 2) != 0)
-			return TRUE;
-		if (memcmp(&cur2[regionRect->left / 2], &old2[regionRect->left / 2], size / 2) != 0)
+		if (memcmp(&pYUVData[0][offset], &pOldYUVData[0][offset], size) != 0)
 			return TRUE;
 	}
+
+	for (UINT32 y = tile->top / 2; y < bottom / 2; y++)
+	{
+		for (size_t x = 1; x < 3; x++)
+		{
+			const size_t offset = 1ull * y * iStride[x] + tile->left / 2;
+
+			if (memcmp(&pYUVData[x][offset], &pOldYUVData[x][offset], csize) != 0)
+				return TRUE;
+		}
+	}
+
 	return FALSE;
 }
 
-static BOOL detect_changes(BOOL firstFrameDone, const UINT32 QP, const RECTANGLE_16* regionRect,
-                           BYTE* pYUVData[3], BYTE* pOldYUVData[3], UINT32 const iStride[3],
-                           RDPGFX_H264_METABLOCK* meta)
+static INLINE void copy_tile(const RECTANGLE_16* tile, BYTE* pDstData[3], BYTE* pSrcData[3],
+                             const UINT32 iStride[3], UINT32 height)
+{
+	const size_t size = tile->right - tile->left;
+	const size_t csize = (size + 1) / 2;
+	const UINT32 bottom = tile_bottom(tile, height);
+
+	for (UINT32 y = tile->top; y < bottom; y++)
+	{
+		const size_t offset = 1ull * y * iStride[0] + tile->left;
+		memcpy(&pDstData[0][offset], &pSrcData[0][offset], size);
+	}
+
+	for (UINT32 y = tile->top / 2; y < bottom / 2; y++)
+	{
+		for (size_t x = 1; x < 3; x++)
+		{
+			const size_t offset = 1ull * y * iStride[x] + tile->left / 2;
+			memcpy(&pDstData[x][offset], &pSrcData[x][offset], csize);
+		}
+	}
+}
+
+/**
+ * Collect the 64x64 tiles of the frame grid within regionRect that are touched by the damage.
+ * Before the first frame is done every tile of regionRect is returned.
+ */
+static RECTANGLE_16* damaged_tiles(BOOL firstFrameDone, const RECTANGLE_16* regionRect,
+                                   const RECTANGLE_16* damageRects, UINT32 numDamageRects,
+                                   size_t* pCount)
 {
 	size_t count = 0;
-	size_t wc = 0;
-	size_t hc = 0;
-	RECTANGLE_16* rectangles = NULL;
+	RECTANGLE_16* tiles = NULL;
 
-	if (!regionRect || !pYUVData || !pOldYUVData || !iStride || !meta)
-		return FALSE;
+	WINPR_ASSERT(regionRect);
+	WINPR_ASSERT(damageRects || (numDamageRects == 0));
+	WINPR_ASSERT(pCount);
 
-	wc = (regionRect->right - regionRect->left) / 64 + 1;
-	hc = (regionRect->bottom - regionRect->top) / 64 + 1;
-	rectangles = calloc(wc * hc, sizeof(RECTANGLE_16));
-	if (!rectangles)
-		return FALSE;
-	if (!firstFrameDone)
+	*pCount = 0;
+	if ((regionRect->left >= regionRect->right) || (regionRect->top >= regionRect->bottom))
+		return calloc(1, sizeof(RECTANGLE_16));
+
+	const size_t left = regionRect->left / 64;
+	const size_t top = regionRect->top / 64;
+	const size_t wc = (regionRect->right + 63) / 64 - left;
+	const size_t hc = (regionRect->bottom + 63) / 64 - top;
+	BYTE* dirty = calloc(wc * hc, sizeof(BYTE));
+	tiles = calloc(wc * hc, sizeof(RECTANGLE_16));
+
+	if (!dirty || !tiles)
 	{
-		rectangles[0] = *regionRect;
-		count = 1;
+		free(dirty);
+		free(tiles);
+		return NULL;
 	}
+
+	if (!firstFrameDone)
+		memset(dirty, 1, wc * hc);
 	else
 	{
-		for (size_t y = regionRect->top; y < regionRect->bottom; y += 64)
+		for (UINT32 x = 0; x < numDamageRects; x++)
 		{
-			for (size_t x = regionRect->left; x < regionRect->right; x += 64)
+			RECTANGLE_16 rect = { 0 };
+
+			if (!rectangles_intersection(&damageRects[x], regionRect, &rect))
+				continue;
+
+			for (size_t ty = rect.top / 64; ty < (rect.bottom + 63ull) / 64; ty++)
 			{
-				RECTANGLE_16 rect;
-				rect.left = (UINT16)MIN(UINT16_MAX, regionRect->left + x);
-				rect.top = (UINT16)MIN(UINT16_MAX, regionRect->top + y);
-				rect.right =
-				    (UINT16)MIN(UINT16_MAX, MIN(regionRect->left + x + 64, regionRect->right));
-				rect.bottom =
-				    (UINT16)MIN(UINT16_MAX, MIN(regionRect->top + y + 64, regionRect->bottom));
-				if (diff_tile(&rect, pYUVData, pOldYUVData, iStride))
-					rectangles[count++] = rect;
+				for (size_t tx = rect.left / 64; tx < (rect.right + 63ull) / 64; tx++)
+					dirty[(ty - top) * wc + (tx - left)] = 1;
 			}
 		}
 	}
+
+	for (size_t ty = 0; ty < hc; ty++)
+	{
+		for (size_t tx = 0; tx < wc; tx++)
+		{
+			if (!dirty[ty * wc + tx])
+				continue;
+
+			RECTANGLE_16* tile = &tiles[count++];
+			tile->left = (UINT16)MAX(regionRect->left, (tx + left) * 64);
+			tile->top = (UINT16)MAX(regionRect->top, (ty + top) * 64);
+			tile->right = (UINT16)MIN(regionRect->right, (tx + left + 1) * 64);
+			tile->bottom = (UINT16)MIN(regionRect->bottom, (ty + top + 1) * 64);
+		}
+	}
+
+	free(dirty);
+	*pCount = count;
+	return tiles;
+}
+
+/**
+ * The tiles were converted into pNewYUVData. Tiles that differ from the frame in pYUVData
+ * (or all of them before the first frame is done) are copied over and added to the metablock.
+ */
+static BOOL detect_changes(BOOL firstFrameDone, const UINT32 QP, const RECTANGLE_16* tiles,
+                           size_t numTiles, BYTE* pYUVData[3], BYTE* pNewYUVData[3],
+                           UINT32 const iStride[3], UINT32 height, RDPGFX_H264_METABLOCK* meta)
+{
+	size_t count = 0;
+	RECTANGLE_16* rectangles = NULL;
+
+	if (!tiles || !pYUVData || !pNewYUVData || !iStride || !meta)
+		return FALSE;
+
+	rectangles = calloc(numTiles + 1, sizeof(RECTANGLE_16));
+	if (!rectangles)
+		return FALSE;
+
+	for (size_t x = 0; x < numTiles; x++)
+	{
+		const RECTANGLE_16* tile = &tiles[x];
+
+		if (firstFrameDone && !diff_tile(tile, pNewYUVData, pYUVData, iStride, height))
+			continue;
+
+		copy_tile(tile, pYUVData, pNewYUVData, iStride, height);
+		rectangles[count++] = *tile;
+	}
+
 	if (!allocate_h264_metablock(QP, rectangles, meta, count))
 		return FALSE;
 	return TRUE;
@@ -273,45 +366,53 @@ INT32 h264_compress(H264_CONTEXT* h264, BYTE** ppDstData, UINT32* pDstSize)
 INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat, UINT32 nSrcStep,
                       UINT32 nSrcWidth, UINT32 nSrcHeight, const RECTANGLE_16* regionRect,
                       BYTE** ppDstData, UINT32* pDstSize, RDPGFX_H264_METABLOCK* meta)
+{
+	return avc420_compress_damage(h264, pSrcData, SrcFormat, nSrcStep, nSrcWidth, nSrcHeight,
+	                              regionRect, regionRect, 1, ppDstData, pDstSize, meta);
+}
+
+INT32 avc420_compress_damage(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
+                             UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight,
+                             const RECTANGLE_16* regionRect, const RECTANGLE_16* damageRects,
+                             UINT32 numDamageRects, BYTE** ppDstData, UINT32* pDstSize,
+                             RDPGFX_H264_METABLOCK* meta)
 {
 	INT32 rc = -1;
-	BYTE* pYUVData[3] = { 0 };
-	const BYTE* pcYUVData[3] = { 0 };
-	BYTE* pOldYUVData[3] = { 0 };
+	size_t numTiles = 0;
+	RECTANGLE_16* tiles = NULL;
 
 	if (!h264 || !regionRect || !meta || !h264->Compressor)
 		return -1;
 
+	if (!damageRects && (numDamageRects > 0))
+		return -1;
+
 	if (!h264->subsystem->Compress)
 		return -1;
 
 	if (!avc420_ensure_buffer(h264, nSrcStep, nSrcWidth, nSrcHeight))
 		return -1;
 
-	if (h264->encodingBuffer)
-	{
-		for (size_t x = 0; x < 3; x++)
-		{
-			pYUVData[x] = h264->pYUVData[x];
-			pOldYUVData[x] = h264->pOldYUVData[x];
-		}
-	}
-	else
+	tiles = damaged_tiles(h264->firstLumaFrameDone, regionRect, damageRects, numDamageRects,
+	                      &numTiles);
+	if (!tiles)
+		goto fail;
+
+	/* No damage, neither color conversion nor encoding is required */
+	if (numTiles == 0)
 	{
-		for (size_t x = 0; x < 3; x++)
-		{
-			pYUVData[x] = h264->pOldYUVData[x];
-			pOldYUVData[x] = h264->pYUVData[x];
-		}
+		rc = 0;
+		goto fail;
 	}
-	h264->encodingBuffer = !h264->encodingBuffer;
 
-	if (!yuv420_context_encode(h264->yuv, pSrcData, nSrcStep, SrcFormat, h264->iStride, pYUVData,
-	                           regionRect, 1))
+	/* pYUVData holds the frame last sent to the encoder, the damaged tiles are converted
+	 * into pOldYUVData and only copied over if they actually changed. */
+	if (!yuv420_context_encode(h264->yuv, pSrcData, nSrcStep, SrcFormat, h264->iStride,
+	                           h264->pOldYUVData, tiles, (UINT32)numTiles))
 		goto fail;
 
-	if (!detect_changes(h264->firstLumaFrameDone, h264->QP, regionRect, pYUVData, pOldYUVData,
-	                    h264->iStride, meta))
+	if (!detect_changes(h264->firstLumaFrameDone, h264->QP, tiles, numTiles, h264->pYUVData,
+	                    h264->pOldYUVData, h264->iStride, h264->height, meta))
 		goto fail;
 
 	if (meta->numRegionRects == 0)
@@ -320,14 +421,14 @@ INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 		goto fail;
 	}
 
-	for (size_t x = 0; x < 3; x++)
-		pcYUVData[x] = pYUVData[x];
+	const BYTE* pcYUVData[3] = { h264->pYUVData[0], h264->pYUVData[1], h264->pYUVData[2] };
 
 	rc = h264->subsystem->Compress(h264, pcYUVData, h264->iStride, ppDstData, pDstSize);
 	if (rc >= 0)
 		h264->firstLumaFrameDone = TRUE;
 
 fail:
+	free(tiles);
 	if (rc < 0)
 		free_h264_metablock(meta);
 	return rc;
@@ -338,16 +439,29 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
                       BYTE* op, BYTE** ppDstData, UINT32* pDstSize, BYTE** ppAuxDstData,
                       UINT32* pAuxDstSize, RDPGFX_H264_METABLOCK* meta,
                       RDPGFX_H264_METABLOCK* auxMeta)
+{
+	return avc444_compress_damage(h264, pSrcData, SrcFormat, nSrcStep, nSrcWidth, nSrcHeight,
+	                              version, region, region, 1, op, ppDstData, pDstSize,
+	                              ppAuxDstData, pAuxDstSize, meta, auxMeta);
+}
+
+INT32 avc444_compress_damage(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
+                             UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight, BYTE version,
+                             const RECTANGLE_16* region, const RECTANGLE_16* damageRects,
+                             UINT32 numDamageRects, BYTE* op, BYTE** ppDstData, UINT32* pDstSize,
+                             BYTE** ppAuxDstData, UINT32* pAuxDstSize,
+                             RDPGFX_H264_METABLOCK* meta, RDPGFX_H264_METABLOCK* auxMeta)
 {
 	int rc = -1;
 	BYTE* coded = NULL;
 	UINT32 codedSize = 0;
-	BYTE** pYUV444Data = NULL;
-	BYTE** pOldYUV444Data = NULL;
-	BYTE** pYUVData = NULL;
-	BYTE** pOldYUVData = NULL;
+	size_t numTiles = 0;
+	RECTANGLE_16* tiles = NULL;
 
-	if (!h264 || !h264->Compressor)
+	if (!h264 || !h264->Compressor || !region || !op || !meta || !auxMeta)
+		return -1;
+
+	if (!damageRects && (numDamageRects > 0))
 		return -1;
 
 	if (!h264->subsystem->Compress)
@@ -359,31 +473,28 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	if (!avc444_ensure_buffer(h264, nSrcHeight))
 		return -1;
 
-	if (h264->encodingBuffer)
-	{
-		pYUV444Data = h264->pOldYUV444Data;
-		pOldYUV444Data = h264->pYUV444Data;
-		pYUVData = h264->pOldYUVData;
-		pOldYUVData = h264->pYUVData;
-	}
-	else
+	tiles = damaged_tiles(h264->firstLumaFrameDone && h264->firstChromaFrameDone, region,
+	                      damageRects, numDamageRects, &numTiles);
+	if (!tiles)
+		goto fail;
+
+	if (numTiles == 0)
 	{
-		pYUV444Data = h264->pYUV444Data;
-		pOldYUV444Data = h264->pOldYUV444Data;
-		pYUVData = h264->pYUVData;
-		pOldYUVData = h264->pOldYUVData;
+		rc = 0;
+		goto fail;
 	}
-	h264->encodingBuffer = !h264->encodingBuffer;
 
+	/* Same as for avc420, the damaged tiles of both views are converted into the old
+	 * buffers and only the changed ones are merged into the frames sent to the encoder. */
 	if (!yuv444_context_encode(h264->yuv, version, pSrcData, nSrcStep, SrcFormat, h264->iStride,
-	                           pYUV444Data, pYUVData, region, 1))
+	                           h264->pOldYUV444Data, h264->pOldYUVData, tiles, (UINT32)numTiles))
 		goto fail;
 
-	if (!detect_changes(h264->firstLumaFrameDone, h264->QP, region, pYUV444Data, pOldYUV444Data,
-	                    h264->iStride, meta))
+	if (!detect_changes(h264->firstLumaFrameDone, h264->QP, tiles, numTiles, h264->pYUV444Data,
+	                    h264->pOldYUV444Data, h264->iStride, h264->height, meta))
 		goto fail;
-	if (!detect_changes(h264->firstChromaFrameDone, h264->QP, region, pYUVData, pOldYUVData,
-	                    h264->iStride, auxMeta))
+	if (!detect_changes(h264->firstChromaFrameDone, h264->QP, tiles, numTiles, h264->pYUVData,
+	                    h264->pOldYUVData, h264->iStride, h264->height, auxMeta))
 		goto fail;
 
 	/* [MS-RDPEGFX] 2.2.4.5 RFX_AVC444_BITMAP_STREAM
@@ -407,7 +518,8 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 
 	if ((*op == 0) || (*op == 1))
 	{
-		const BYTE* pcYUV444Data[3] = { pYUV444Data[0], pYUV444Data[1], pYUV444Data[2] };
+		const BYTE* pcYUV444Data[3] = { h264->pYUV444Data[0], h264->pYUV444Data[1],
+			                               h264->pYUV444Data[2] };
 
 		if (h264->subsystem->Compress(h264, pcYUV444Data, h264->iStride, &coded, &codedSize) < 0)
 			goto fail;
@@ -419,7 +531,7 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 
 	if ((*op == 0) || (*op == 2))
 	{
-		const BYTE* pcYUVData[3] = { pYUVData[0], pYUVData[1], pYUVData[2] };
+		const BYTE* pcYUVData[3] = { h264->pYUVData[0], h264->pYUVData[1], h264->pYUVData[2] };
 
 		if (h264->subsystem->Compress(h264, pcYUVData, h264->iStride, &coded, &codedSize) < 0)
 			goto fail;
@@ -430,6 +542,7 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 
 	rc = 1;
 fail:
+	free(tiles);
 	if (rc < 0)
 	{
 		free_h264_metablock(meta);
@@ -78,7 +78,6 @@ extern "C"
 		const H264_CONTEXT_SUBSYSTEM* subsystem;
 		YUV_CONTEXT* yuv;
 
-		BOOL encodingBuffer;
 		BOOL firstLumaFrameDone;
 		BOOL firstChromaFrameDone;
 
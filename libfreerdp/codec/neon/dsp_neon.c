@@ -0,0 +1,118 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/platform.h>
+#include <winpr/sysinfo.h>
+#include <freerdp/config.h>
+#include <freerdp/log.h>
+
+#include "dsp_neon.h"
+
+#define TAG FREERDP_TAG("codec.dsp.neon")
+
+#if defined(WITH_NEON)
+#if defined(_M_ARM64) || defined(_M_ARM)
+#define NEON_ENABLED
+#endif
+#endif
+
+#if defined(NEON_ENABLED)
+#include <arm_neon.h>
+
+static INT32 dsp_dot_neon(const INT16* WINPR_RESTRICT a, const INT16* WINPR_RESTRICT b,
+                          size_t count)
+{
+	int32x4_t sum = vdupq_n_s32(0);
+	size_t x = 0;
+	INT32 result = 0;
+
+	for (; x + 8 <= count; x += 8)
+	{
+		const int16x8_t va = vld1q_s16(&a[x]);
+		const int16x8_t vb = vld1q_s16(&b[x]);
+		sum = vmlal_s16(sum, vget_low_s16(va), vget_low_s16(vb));
+		sum = vmlal_s16(sum, vget_high_s16(va), vget_high_s16(vb));
+	}
+
+	result = vgetq_lane_s32(sum, 0) + vgetq_lane_s32(sum, 1) + vgetq_lane_s32(sum, 2) +
+	         vgetq_lane_s32(sum, 3);
+
+	for (; x < count; x++)
+		result += a[x] * b[x];
+
+	return result;
+}
+
+static void dsp_mono_to_stereo_neon(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+                                    size_t frames)
+{
+	size_t x = 0;
+
+	for (; x + 8 <= frames; x += 8)
+	{
+		int16x8x2_t v;
+		v.val[0] = vld1q_s16((const int16_t*)&src[2 * x]);
+		v.val[1] = v.val[0];
+		vst2q_s16((int16_t*)&dst[4 * x], v);
+	}
+
+	for (; x < frames; x++)
+	{
+		dst[4 * x + 0] = src[2 * x + 0];
+		dst[4 * x + 1] = src[2 * x + 1];
+		dst[4 * x + 2] = src[2 * x + 0];
+		dst[4 * x + 3] = src[2 * x + 1];
+	}
+}
+
+static void dsp_stereo_to_mono_neon(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+                                    size_t frames)
+{
+	size_t x = 0;
+
+	for (; x + 8 <= frames; x += 8)
+	{
+		const int16x8x2_t v = vld2q_s16((const int16_t*)&src[4 * x]);
+		vst1q_s16((int16_t*)&dst[2 * x], vhaddq_s16(v.val[0], v.val[1]));
+	}
+
+	for (; x < frames; x++)
+	{
+		const INT32 left = (INT16)(src[4 * x] | (src[4 * x + 1] << 8));
+		const INT32 right = (INT16)(src[4 * x + 2] | (src[4 * x + 3] << 8));
+		const INT32 value = (left + right) >> 1;
+
+		dst[2 * x + 0] = (BYTE)(value & 0xFF);
+		dst[2 * x + 1] = (BYTE)((value >> 8) & 0xFF);
+	}
+}
+#endif
+
+void dsp_init_neon(FREERDP_DSP_KERNELS* kernels)
+{
+#if defined(NEON_ENABLED)
+	if (!IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	WLog_VRB(TAG, "NEON optimizations");
+	kernels->dot = dsp_dot_neon;
+	kernels->mono_to_stereo = dsp_mono_to_stereo_neon;
+	kernels->stereo_to_mono = dsp_stereo_to_mono_neon;
+#else
+	WINPR_UNUSED(kernels);
+#endif
+}
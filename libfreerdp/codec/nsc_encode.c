@@ -249,11 +249,15 @@ static BOOL nsc_encode_argb_to_aycocg(NSC_CONTEXT* WINPR_RESTRICT context,
 			*aplane++ = a_val;
 		}
 
-		if (context->ChromaSubsamplingLevel && (x % 2) == 1)
+		/* Pad up to the subsampled width so stale buffer content never reaches the RLE */
+		for (; context->ChromaSubsamplingLevel && (x > 0) && (x < rw); x++)
 		{
 			*yplane = *(yplane - 1);
 			*coplane = *(coplane - 1);
 			*cgplane = *(cgplane - 1);
+			yplane++;
+			coplane++;
+			cgplane++;
 		}
 	}
 
@@ -38,10 +38,15 @@
 #include "rfx_rlgr.h"
 #include "rfx_constants.h"
 #include "rfx_types.h"
+#include "rfx_encode.h"
 #include "progressive.h"
 
 #define TAG FREERDP_TAG("codec.progressive")
 
+/* Size of the sign and current coefficient buffers of a tile, also the buffer pool size */
+#define PROGRESSIVE_COEFFICIENTS_SIZE ((8192 + 32) * 3)
+#define PROGRESSIVE_TILE_SLAB_SIZE 64
+
 typedef struct
 {
 	BOOL nonLL;
@@ -345,15 +350,36 @@ progressive_get_surface_data(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive, UI
 	return HashTable_GetItemValue(progressive->SurfaceContexts, key);
 }
 
-static void progressive_tile_free(RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile)
+static void progressive_tile_release_coefficients(RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile)
 {
-	if (tile)
+	WINPR_ASSERT(tile);
+
+	winpr_aligned_free(tile->sign);
+	winpr_aligned_free(tile->current);
+	tile->sign = NULL;
+	tile->current = NULL;
+}
+
+static BOOL progressive_tile_alloc_coefficients(RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
+                                                BOOL sign)
+{
+	WINPR_ASSERT(tile);
+
+	if (!tile->current)
 	{
-		winpr_aligned_free(tile->sign);
-		winpr_aligned_free(tile->current);
-		winpr_aligned_free(tile->data);
-		winpr_aligned_free(tile);
+		tile->current = winpr_aligned_calloc(1, PROGRESSIVE_COEFFICIENTS_SIZE, 16);
+		if (!tile->current)
+			return FALSE;
+	}
+
+	if (sign && !tile->sign)
+	{
+		tile->sign = winpr_aligned_calloc(1, PROGRESSIVE_COEFFICIENTS_SIZE, 16);
+		if (!tile->sign)
+			return FALSE;
 	}
+
+	return TRUE;
 }
 
 static void progressive_surface_context_free(void* ptr)
@@ -368,84 +394,75 @@ static void progressive_surface_context_free(void* ptr)
 		for (size_t index = 0; index < surface->tilesSize; index++)
 		{
 			RFX_PROGRESSIVE_TILE* tile = surface->tiles[index];
-			progressive_tile_free(tile);
+			if (tile)
+				progressive_tile_release_coefficients(tile);
 		}
 	}
 
+	for (size_t index = 0; index < surface->numTileSlabs; index++)
+		winpr_aligned_free(surface->tileSlabs[index]);
+
+	free(surface->tileSlabs);
 	winpr_aligned_free(surface->tiles);
 	winpr_aligned_free(surface->updatedTileIndices);
 	winpr_aligned_free(surface);
 }
 
-static INLINE RFX_PROGRESSIVE_TILE* progressive_tile_new(void)
+/*
+ * Tiles are allocated on first use, in slabs of PROGRESSIVE_TILE_SLAB_SIZE.
+ * A tile stays assigned to its grid cell until the surface is freed.
+ */
+static RFX_PROGRESSIVE_TILE*
+progressive_surface_get_tile(PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT surface, size_t zIdx)
 {
-	RFX_PROGRESSIVE_TILE* tile = winpr_aligned_calloc(1, sizeof(RFX_PROGRESSIVE_TILE), 32);
-	if (!tile)
-		goto fail;
+	RFX_PROGRESSIVE_TILE* tile = NULL;
 
-	tile->width = 64;
-	tile->height = 64;
-	tile->stride = 4 * tile->width;
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(zIdx < surface->tilesSize);
 
-	size_t dataLen = 1ull * tile->stride * tile->height;
-	tile->data = (BYTE*)winpr_aligned_malloc(dataLen, 16);
-	if (!tile->data)
-		goto fail;
-	memset(tile->data, 0xFF, dataLen);
+	tile = surface->tiles[zIdx];
+	if (tile)
+		return tile;
 
-	size_t signLen = (8192 + 32) * 3;
-	tile->sign = (BYTE*)winpr_aligned_malloc(signLen, 16);
-	if (!tile->sign)
-		goto fail;
+	if ((surface->numTileSlabs == 0) || (surface->tileSlabUsed >= PROGRESSIVE_TILE_SLAB_SIZE))
+	{
+		RFX_PROGRESSIVE_TILE** slabs = realloc(
+		    surface->tileSlabs, (surface->numTileSlabs + 1) * sizeof(RFX_PROGRESSIVE_TILE*));
+		if (!slabs)
+			return NULL;
+		surface->tileSlabs = slabs;
 
-	size_t currentLen = (8192 + 32) * 3;
-	tile->current = (BYTE*)winpr_aligned_malloc(currentLen, 16);
-	if (!tile->current)
-		goto fail;
+		slabs[surface->numTileSlabs] =
+		    winpr_aligned_calloc(PROGRESSIVE_TILE_SLAB_SIZE, sizeof(RFX_PROGRESSIVE_TILE), 32);
+		if (!slabs[surface->numTileSlabs])
+			return NULL;
 
-	return tile;
+		surface->numTileSlabs++;
+		surface->tileSlabUsed = 0;
+	}
 
-fail:
-	progressive_tile_free(tile);
-	return NULL;
+	tile = &surface->tileSlabs[surface->numTileSlabs - 1][surface->tileSlabUsed++];
+	tile->width = 64;
+	tile->height = 64;
+	surface->tiles[zIdx] = tile;
+	return tile;
 }
 
 static INLINE BOOL
-progressive_allocate_tile_cache(PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT surface, size_t min)
+progressive_allocate_tile_cache(PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT surface)
 {
-	size_t oldIndex = 0;
-
 	WINPR_ASSERT(surface);
 	WINPR_ASSERT(surface->gridSize > 0);
 
-	if (surface->tiles)
-	{
-		oldIndex = surface->gridSize;
-		while (surface->gridSize < min)
-			surface->gridSize += 1024;
-	}
-
-	void* tmp = winpr_aligned_recalloc(surface->tiles, surface->gridSize,
-	                                   sizeof(RFX_PROGRESSIVE_TILE*), 32);
-	if (!tmp)
+	surface->tiles = winpr_aligned_calloc(surface->gridSize, sizeof(RFX_PROGRESSIVE_TILE*), 32);
+	if (!surface->tiles)
 		return FALSE;
 	surface->tilesSize = surface->gridSize;
-	surface->tiles = tmp;
-
-	for (size_t x = oldIndex; x < surface->tilesSize; x++)
-	{
-		surface->tiles[x] = progressive_tile_new();
-		if (!surface->tiles[x])
-			return FALSE;
-	}
 
-	tmp =
-	    winpr_aligned_recalloc(surface->updatedTileIndices, surface->gridSize, sizeof(UINT32), 32);
-	if (!tmp)
+	surface->updatedTileIndices = winpr_aligned_calloc(surface->gridSize, sizeof(UINT32), 32);
+	if (!surface->updatedTileIndices)
 		return FALSE;
 
-	surface->updatedTileIndices = tmp;
-
 	return TRUE;
 }
 
@@ -465,7 +482,7 @@ static PROGRESSIVE_SURFACE_CONTEXT* progressive_surface_context_new(UINT16 surfa
 	surface->gridHeight = (height + (64 - height % 64)) / 64;
 	surface->gridSize = surface->gridWidth * surface->gridHeight;
 
-	if (!progressive_allocate_tile_cache(surface, surface->gridSize))
+	if (!progressive_allocate_tile_cache(surface))
 	{
 		progressive_surface_context_free(surface);
 		return NULL;
@@ -493,7 +510,9 @@ progressive_surface_tile_replace(PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT sur
 		return FALSE;
 	}
 
-	t = surface->tiles[zIdx];
+	t = progressive_surface_get_tile(surface, zIdx);
+	if (!t)
+		return FALSE;
 
 	t->blockType = tile->blockType;
 	t->blockLen = tile->blockLen;
@@ -542,18 +561,6 @@ progressive_surface_tile_replace(PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT sur
 	}
 
 	region->tiles[region->usedTiles++] = t;
-	if (!t->dirty)
-	{
-		if (surface->numUpdatedTiles >= surface->gridSize)
-		{
-			if (!progressive_allocate_tile_cache(surface, surface->numUpdatedTiles + 1))
-				return FALSE;
-		}
-
-		surface->updatedTileIndices[surface->numUpdatedTiles++] = (UINT32)zIdx;
-	}
-
-	t->dirty = TRUE;
 	return TRUE;
 }
 
@@ -917,6 +924,97 @@ static INLINE int progressive_rfx_decode_component(
 	                                     FALSE);
 }
 
+static INLINE BOOL progressive_tile_clip(const PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                                         const RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
+                                         RECTANGLE_16* WINPR_RESTRICT tileRect,
+                                         REGION16* WINPR_RESTRICT updateRegion)
+{
+	tileRect->left = (UINT16)(progressive->nXDst + tile->x);
+	tileRect->top = (UINT16)(progressive->nYDst + tile->y);
+	tileRect->right = tileRect->left + 64;
+	tileRect->bottom = tileRect->top + 64;
+	return region16_intersect_rect(updateRegion, &progressive->clippingRects, tileRect);
+}
+
+/*
+ * Writes a decoded tile to the destination, clipped to the rectangles of its region.
+ * Tiles that are not clipped are converted in place, all others go through a scratch
+ * buffer that is copied rectangle by rectangle.
+ */
+static INLINE int progressive_tile_write(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                                         const RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
+                                         INT16* WINPR_RESTRICT pSrcDst[3])
+{
+	int rc = -1;
+	UINT32 nbUpdateRects = 0;
+	const RECTANGLE_16* updateRects = NULL;
+	RECTANGLE_16 tileRect = { 0 };
+	REGION16 updateRegion = { 0 };
+	BYTE* pScratch = NULL;
+	static const prim_size_t roi_64x64 = { 64, 64 };
+	const primitives_t* prims = primitives_get();
+
+	region16_init(&updateRegion);
+
+	if (!progressive_tile_clip(progressive, tile, &tileRect, &updateRegion))
+		goto fail;
+
+	updateRects = region16_rects(&updateRegion, &nbUpdateRects);
+
+	if ((nbUpdateRects == 1) && rectangles_equal(&updateRects[0], &tileRect) &&
+	    (progressive->format == progressive->DstFormat) &&
+	    !FreeRDPColorHasAlpha(progressive->DstFormat))
+	{
+		BYTE* pDst = &progressive->pDstData[1ull * tileRect.top * progressive->nDstStep +
+		                                    4ull * tileRect.left];
+
+		rc = prims->yCbCrToRGB_16s8u_P3AC4R((const INT16* const*)pSrcDst, 64 * 2, pDst,
+		                                    progressive->nDstStep, progressive->format,
+		                                    &roi_64x64);
+		goto fail;
+	}
+
+	rc = 1;
+	if (nbUpdateRects == 0)
+		goto fail;
+
+	pScratch = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!pScratch)
+	{
+		rc = -1;
+		goto fail;
+	}
+
+	rc = prims->yCbCrToRGB_16s8u_P3AC4R((const INT16* const*)pSrcDst, 64 * 2, pScratch, 64 * 4,
+	                                    progressive->format, &roi_64x64);
+	if (rc < 0)
+		goto fail;
+
+	for (UINT32 j = 0; j < nbUpdateRects; j++)
+	{
+		const RECTANGLE_16* rect = &updateRects[j];
+		const UINT32 nXSrc = rect->left - tileRect.left;
+		const UINT32 nYSrc = rect->top - tileRect.top;
+		const UINT32 width = rect->right - rect->left;
+		const UINT32 height = rect->bottom - rect->top;
+
+		if (!freerdp_image_copy_no_overlap(progressive->pDstData, progressive->DstFormat,
+		                                   progressive->nDstStep, rect->left, rect->top, width,
+		                                   height, pScratch, progressive->format, 64 * 4, nXSrc,
+		                                   nYSrc, NULL, FREERDP_KEEP_DST_ALPHA))
+		{
+			rc = -1;
+			break;
+		}
+	}
+
+fail:
+	if (pScratch)
+		BufferPool_Return(progressive->bufferPool, pScratch);
+	region16_uninit(&updateRegion);
+	return rc;
+}
+
 static INLINE int
 progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
                                   RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
@@ -928,6 +1026,9 @@ progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressiv
 	BOOL sub = 0;
 	BOOL extrapolate = 0;
 	BYTE* pBuffer = NULL;
+	BYTE* pScratchSign = NULL;
+	BYTE* sign = NULL;
+	BYTE* current = NULL;
 	INT16* pSign[3];
 	INT16* pSrcDst[3];
 	INT16* pCurrent[3];
@@ -941,8 +1042,6 @@ progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressiv
 	RFX_COMPONENT_CODEC_QUANT* quantProgCb = NULL;
 	RFX_COMPONENT_CODEC_QUANT* quantProgCr = NULL;
 	RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = NULL;
-	static const prim_size_t roi_64x64 = { 64, 64 };
-	const primitives_t* prims = primitives_get();
 
 	tile->pass = 1;
 	diff = tile->flags & RFX_TILE_DIFFERENCE;
@@ -1022,15 +1121,37 @@ progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressiv
 	progressive_rfx_quant_add(quantCr, quantProgCr, &shiftCr);
 	progressive_rfx_quant_lsub(&shiftCr, 1); /* -6 + 5 = -1 */
 
-	pSign[0] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * 0) + 16])); /* Y/R buffer */
-	pSign[1] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
-	pSign[2] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+	/*
+	 * Any later tile may be a difference to the current coefficients, so they are kept once a
+	 * tile was decoded. Only upgrade passes need the sign, a full quality tile decodes it into
+	 * a scratch buffer.
+	 */
+	if (!progressive_tile_alloc_coefficients(tile, tile->quality != 0xFF))
+		return -1;
 
-	pCurrent[0] = (INT16*)((BYTE*)(&tile->current[((8192 + 32) * 0) + 16])); /* Y/R buffer */
-	pCurrent[1] = (INT16*)((BYTE*)(&tile->current[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
-	pCurrent[2] = (INT16*)((BYTE*)(&tile->current[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+	current = tile->current;
+	sign = tile->sign;
+	if (!sign)
+	{
+		pScratchSign = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+		sign = pScratchSign;
+	}
 
 	pBuffer = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!sign || !current || !pBuffer)
+	{
+		rc = -1;
+		goto fail;
+	}
+
+	pSign[0] = (INT16*)((BYTE*)(&sign[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pSign[1] = (INT16*)((BYTE*)(&sign[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pSign[2] = (INT16*)((BYTE*)(&sign[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
+	pCurrent[0] = (INT16*)((BYTE*)(&current[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pCurrent[1] = (INT16*)((BYTE*)(&current[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pCurrent[2] = (INT16*)((BYTE*)(&current[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
 	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
 	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
 	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
@@ -1050,10 +1171,18 @@ progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressiv
 	if (rc < 0)
 		goto fail;
 
-	rc = prims->yCbCrToRGB_16s8u_P3AC4R((const INT16* const*)pSrcDst, 64 * 2, tile->data,
-	                                    tile->stride, progressive->format, &roi_64x64);
+	rc = progressive_tile_write(progressive, tile, pSrcDst);
 fail:
-	BufferPool_Return(progressive->bufferPool, pBuffer);
+	if (tile->quality == 0xFF)
+	{
+		winpr_aligned_free(tile->sign);
+		tile->sign = NULL;
+	}
+
+	if (pScratchSign)
+		BufferPool_Return(progressive->bufferPool, pScratchSign);
+	if (pBuffer)
+		BufferPool_Return(progressive->bufferPool, pBuffer);
 	return rc;
 }
 
@@ -1358,8 +1487,6 @@ progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progress
 	RFX_COMPONENT_CODEC_QUANT* quantProgCb = NULL;
 	RFX_COMPONENT_CODEC_QUANT* quantProgCr = NULL;
 	RFX_PROGRESSIVE_CODEC_QUANT* quantProg = NULL;
-	static const prim_size_t roi_64x64 = { 64, 64 };
-	const primitives_t* prims = primitives_get();
 
 	coeffDiff = tile->flags & RFX_TILE_DIFFERENCE;
 	sub = context->flags & RFX_SUBBAND_DIFFING;
@@ -1459,6 +1586,15 @@ progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progress
 	tile->cbProgQuant = *quantProgCb;
 	tile->crProgQuant = *quantProgCr;
 
+	if (!tile->sign || !tile->current)
+	{
+		WLog_Print(progressive->log, WLOG_WARN,
+		           "Upgrade for tile %" PRIu16 "x%" PRIu16 " without a previous pass", tile->xIdx,
+		           tile->yIdx);
+		if (!progressive_tile_alloc_coefficients(tile, TRUE))
+			return -1;
+	}
+
 	pSign[0] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * 0) + 16])); /* Y/R buffer */
 	pSign[1] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
 	pSign[2] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
@@ -1468,6 +1604,9 @@ progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progress
 	pCurrent[2] = (INT16*)((BYTE*)(&tile->current[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
 
 	pBuffer = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!pBuffer)
+		return -1;
+
 	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
 	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
 	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
@@ -1496,8 +1635,14 @@ progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progress
 	if (status < 0)
 		goto fail;
 
-	status = prims->yCbCrToRGB_16s8u_P3AC4R((const INT16* const*)pSrcDst, 64 * 2, tile->data,
-	                                        tile->stride, progressive->format, &roi_64x64);
+	status = progressive_tile_write(progressive, tile, pSrcDst);
+
+	/* The last pass reached full quality, no further upgrades can follow */
+	if ((status >= 0) && (tile->quality == 0xFF))
+	{
+		winpr_aligned_free(tile->sign);
+		tile->sign = NULL;
+	}
 fail:
 	BufferPool_Return(progressive->bufferPool, pBuffer);
 	return status;
@@ -1672,6 +1817,102 @@ static void CALLBACK progressive_process_tiles_tile_work_callback(PTP_CALLBACK_I
 	}
 }
 
+static INLINE BOOL
+progressive_update_clipping_rects(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                                  const PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT surface,
+                                  const PROGRESSIVE_BLOCK_REGION* WINPR_RESTRICT region)
+{
+	REGION16 clippingRects = { 0 };
+	const RECTANGLE_16 surfaceRect = { (UINT16)progressive->nXDst, (UINT16)progressive->nYDst,
+		                               (UINT16)(progressive->nXDst + surface->width),
+		                               (UINT16)(progressive->nYDst + surface->height) };
+	BOOL rc = TRUE;
+	RECTANGLE_16* rects = NULL;
+
+	region16_init(&clippingRects);
+
+	if (region->numRects > 0)
+	{
+		rects = (RECTANGLE_16*)calloc(region->numRects, sizeof(RECTANGLE_16));
+		if (!rects)
+			rc = FALSE;
+	}
+
+	for (UINT32 i = 0; rc && (i < region->numRects); i++)
+	{
+		RECTANGLE_16* clippingRect = &rects[i];
+		const RFX_RECT* rect = &(region->rects[i]);
+
+		clippingRect->left = (UINT16)progressive->nXDst + rect->x;
+		clippingRect->top = (UINT16)progressive->nYDst + rect->y;
+		clippingRect->right = clippingRect->left + rect->width;
+		clippingRect->bottom = clippingRect->top + rect->height;
+	}
+
+	if (rc)
+		rc = region16_union_rects(&clippingRects, &clippingRects, rects, region->numRects);
+	free(rects);
+
+	region16_clear(&progressive->clippingRects);
+	if (rc)
+		rc = region16_intersect_rect(&progressive->clippingRects, &clippingRects, &surfaceRect);
+	region16_uninit(&clippingRects);
+	return rc;
+}
+
+static INLINE BOOL
+progressive_invalidate_tiles(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                             const PROGRESSIVE_BLOCK_REGION* WINPR_RESTRICT region)
+{
+	BOOL rc = TRUE;
+	REGION16 updateRegion = { 0 };
+	RECTANGLE_16* rects = NULL;
+	UINT32 count = 0;
+	UINT32 capacity = 0;
+
+	if (!progressive->invalidRegion)
+		return TRUE;
+
+	region16_init(&updateRegion);
+
+	/* collect the visible part of all tiles and merge them in one go */
+	for (UINT32 idx = 0; rc && (idx < region->numTiles); idx++)
+	{
+		UINT32 nbUpdateRects = 0;
+		RECTANGLE_16 tileRect = { 0 };
+
+		if (!progressive_tile_clip(progressive, region->tiles[idx], &tileRect, &updateRegion))
+			rc = FALSE;
+
+		const RECTANGLE_16* updateRects = region16_rects(&updateRegion, &nbUpdateRects);
+
+		if (rc && (count + nbUpdateRects > capacity))
+		{
+			const UINT32 newCapacity = MAX(count + nbUpdateRects, capacity * 2);
+			RECTANGLE_16* tmp = (RECTANGLE_16*)realloc(rects, newCapacity * sizeof(RECTANGLE_16));
+
+			if (!tmp)
+				rc = FALSE;
+			else
+			{
+				rects = tmp;
+				capacity = newCapacity;
+			}
+		}
+
+		for (UINT32 j = 0; rc && (j < nbUpdateRects); j++)
+			rects[count++] = updateRects[j];
+	}
+
+	if (rc)
+		rc = region16_union_rects(progressive->invalidRegion, progressive->invalidRegion, rects,
+		                          count);
+
+	free(rects);
+	region16_uninit(&updateRegion);
+	return rc;
+}
+
 static INLINE SSIZE_T progressive_process_tiles(
     PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive, wStream* WINPR_RESTRICT s,
     PROGRESSIVE_BLOCK_REGION* WINPR_RESTRICT region,
@@ -1766,6 +2007,9 @@ static INLINE SSIZE_T progressive_process_tiles(
 		return -1044;
 	}
 
+	if (!progressive_update_clipping_rects(progressive, surface, region))
+		return -1;
+
 	for (UINT32 idx = 0; idx < region->numTiles; idx++)
 	{
 		RFX_PROGRESSIVE_TILE* tile = region->tiles[idx];
@@ -1813,6 +2057,9 @@ static INLINE SSIZE_T progressive_process_tiles(
 		}
 	}
 
+	if ((status >= 0) && !progressive_invalidate_tiles(progressive, region))
+		status = -1;
+
 fail:
 
 	if (status < 0)
@@ -2306,85 +2553,6 @@ static INLINE SSIZE_T progressive_parse_block(PROGRESSIVE_CONTEXT* WINPR_RESTRIC
 	return rc;
 }
 
-static INLINE BOOL update_tiles(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
-                                PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT surface,
-                                BYTE* WINPR_RESTRICT pDstData, UINT32 DstFormat, UINT32 nDstStep,
-                                UINT32 nXDst, UINT32 nYDst,
-                                PROGRESSIVE_BLOCK_REGION* WINPR_RESTRICT region,
-                                REGION16* WINPR_RESTRICT invalidRegion)
-{
-	BOOL rc = TRUE;
-	REGION16 clippingRects = { 0 };
-	region16_init(&clippingRects);
-
-	for (UINT32 i = 0; i < region->numRects; i++)
-	{
-		RECTANGLE_16 clippingRect = { 0 };
-		const RFX_RECT* rect = &(region->rects[i]);
-
-		clippingRect.left = (UINT16)nXDst + rect->x;
-		clippingRect.top = (UINT16)nYDst + rect->y;
-		clippingRect.right = clippingRect.left + rect->width;
-		clippingRect.bottom = clippingRect.top + rect->height;
-		region16_union_rect(&clippingRects, &clippingRects, &clippingRect);
-	}
-
-	for (UINT32 i = 0; i < surface->numUpdatedTiles; i++)
-	{
-		UINT32 nbUpdateRects = 0;
-		const RECTANGLE_16* updateRects = NULL;
-		RECTANGLE_16 updateRect = { 0 };
-
-		WINPR_ASSERT(surface->updatedTileIndices);
-		const UINT32 index = surface->updatedTileIndices[i];
-
-		WINPR_ASSERT(index < surface->tilesSize);
-		RFX_PROGRESSIVE_TILE* tile = surface->tiles[index];
-		WINPR_ASSERT(tile);
-
-		updateRect.left = nXDst + tile->x;
-		updateRect.top = nYDst + tile->y;
-		updateRect.right = updateRect.left + 64;
-		updateRect.bottom = updateRect.top + 64;
-
-		REGION16 updateRegion = { 0 };
-		region16_init(&updateRegion);
-		region16_intersect_rect(&updateRegion, &clippingRects, &updateRect);
-		updateRects = region16_rects(&updateRegion, &nbUpdateRects);
-
-		for (UINT32 j = 0; j < nbUpdateRects; j++)
-		{
-			const RECTANGLE_16* rect = &updateRects[j];
-			if (rect->left < updateRect.left)
-				goto fail;
-			const UINT32 nXSrc = rect->left - updateRect.left;
-			const UINT32 nYSrc = rect->top - updateRect.top;
-			const UINT32 width = rect->right - rect->left;
-			const UINT32 height = rect->bottom - rect->top;
-
-			if (rect->left + width > surface->width)
-				goto fail;
-			if (rect->top + height > surface->height)
-				goto fail;
-			rc = freerdp_image_copy_no_overlap(
-			    pDstData, DstFormat, nDstStep, rect->left, rect->top, width, height, tile->data,
-			    progressive->format, tile->stride, nXSrc, nYSrc, NULL, FREERDP_KEEP_DST_ALPHA);
-			if (!rc)
-				break;
-
-			if (invalidRegion)
-				region16_union_rect(invalidRegion, invalidRegion, rect);
-		}
-
-		region16_uninit(&updateRegion);
-		tile->dirty = FALSE;
-	}
-
-fail:
-	region16_uninit(&clippingRects);
-	return rc;
-}
-
 INT32 progressive_decompress(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
                              const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcSize,
                              BYTE* WINPR_RESTRICT pDstData, UINT32 DstFormat, UINT32 nDstStep,
@@ -2406,11 +2574,13 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
 	PROGRESSIVE_BLOCK_REGION* WINPR_RESTRICT region = &progressive->region;
 	WINPR_ASSERT(region);
 
-	if (surface->frameId != frameId)
-	{
-		surface->frameId = frameId;
-		surface->numUpdatedTiles = 0;
-	}
+	surface->frameId = frameId;
+	progressive->pDstData = pDstData;
+	progressive->DstFormat = DstFormat;
+	progressive->nDstStep = nDstStep;
+	progressive->nXDst = nXDst;
+	progressive->nYDst = nYDst;
+	progressive->invalidRegion = invalidRegion;
 
 	wStream ss = { 0 };
 	wStream* s = Stream_StaticConstInit(&ss, pSrcData, SrcSize);
@@ -2447,10 +2617,9 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
 		goto fail;
 	}
 
-	if (!update_tiles(progressive, surface, pDstData, DstFormat, nDstStep, nXDst, nYDst, region,
-	                  invalidRegion))
-		return -2002;
 fail:
+	progressive->pDstData = NULL;
+	progressive->invalidRegion = NULL;
 	return rc;
 }
 
@@ -2466,6 +2635,28 @@ BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT* progr
 	return rfx_write_message_progressive_simple(context, s, msg);
 }
 
+static INLINE BOOL progressive_compress_scanline(UINT32 SrcFormat, UINT32 Width, UINT32* ScanLine)
+{
+	if (*ScanLine != 0)
+		return TRUE;
+
+	switch (SrcFormat)
+	{
+		case PIXEL_FORMAT_ABGR32:
+		case PIXEL_FORMAT_ARGB32:
+		case PIXEL_FORMAT_XBGR32:
+		case PIXEL_FORMAT_XRGB32:
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			*ScanLine = Width * 4;
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
 int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData, UINT32 SrcSize,
                          UINT32 SrcFormat, UINT32 Width, UINT32 Height, UINT32 ScanLine,
                          const REGION16* invalidRegion, BYTE** ppDstData, UINT32* pDstSize)
@@ -2484,24 +2675,8 @@ int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 		return -1;
 	}
 
-	if (ScanLine == 0)
-	{
-		switch (SrcFormat)
-		{
-			case PIXEL_FORMAT_ABGR32:
-			case PIXEL_FORMAT_ARGB32:
-			case PIXEL_FORMAT_XBGR32:
-			case PIXEL_FORMAT_XRGB32:
-			case PIXEL_FORMAT_BGRA32:
-			case PIXEL_FORMAT_BGRX32:
-			case PIXEL_FORMAT_RGBA32:
-			case PIXEL_FORMAT_RGBX32:
-				ScanLine = Width * 4;
-				break;
-			default:
-				return -2;
-		}
-	}
+	if (!progressive_compress_scanline(SrcFormat, Width, &ScanLine))
+		return -2;
 
 	if (SrcSize < Height * ScanLine)
 		return -4;
@@ -2589,6 +2764,774 @@ fail:
 	return res;
 }
 
+/* Quantization used for all tiles sent by progressive_compress_ex */
+static const RFX_COMPONENT_CODEC_QUANT progressive_encode_quant = { 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 };
+
+/**
+ * Quality levels of progressive_compress_ex, a damaged tile is sent with the first one
+ * and upgraded one level per frame until it reaches full quality (0xFF).
+ */
+static const RFX_PROGRESSIVE_CODEC_QUANT progressive_encode_quality[] = {
+	{ 25,
+	  { 2, 3, 3, 3, 4, 4, 4, 5, 5, 5 },
+	  { 2, 3, 3, 3, 4, 4, 4, 5, 5, 5 },
+	  { 2, 3, 3, 3, 4, 4, 4, 5, 5, 5 } },
+	{ 50,
+	  { 0, 1, 1, 1, 2, 2, 2, 2, 2, 2 },
+	  { 0, 1, 1, 1, 2, 2, 2, 2, 2, 2 },
+	  { 0, 1, 1, 1, 2, 2, 2, 2, 2, 2 } }
+};
+
+/* Band offsets of the reduce-extrapolate layout, in bitstream order (HL1 ... HH3, LL3) */
+static const size_t progressive_rfx_band_offset[11] = { 0,    1023, 2046, 3007, 3279, 3551,
+	                                                    3807, 3879, 3951, 4015, 4096 };
+
+#define PROGRESSIVE_BAND_LL3 9
+
+static INLINE BYTE progressive_rfx_quant_band(const RFX_COMPONENT_CODEC_QUANT* WINPR_RESTRICT q,
+                                              size_t band)
+{
+	switch (band)
+	{
+		case 0:
+			return q->HL1;
+		case 1:
+			return q->LH1;
+		case 2:
+			return q->HH1;
+		case 3:
+			return q->HL2;
+		case 4:
+			return q->LH2;
+		case 5:
+			return q->HH2;
+		case 6:
+			return q->HL3;
+		case 7:
+			return q->LH3;
+		case 8:
+			return q->HH3;
+		default:
+			return q->LL3;
+	}
+}
+
+static INLINE void
+progressive_component_codec_quant_write(wStream* WINPR_RESTRICT s,
+                                        const RFX_COMPONENT_CODEC_QUANT* WINPR_RESTRICT quantVal)
+{
+	Stream_Write_UINT8(s, (BYTE)(quantVal->LL3 | (quantVal->HL3 << 4)));
+	Stream_Write_UINT8(s, (BYTE)(quantVal->LH3 | (quantVal->HH3 << 4)));
+	Stream_Write_UINT8(s, (BYTE)(quantVal->HL2 | (quantVal->LH2 << 4)));
+	Stream_Write_UINT8(s, (BYTE)(quantVal->HH2 | (quantVal->HL1 << 4)));
+	Stream_Write_UINT8(s, (BYTE)(quantVal->LH1 | (quantVal->HH1 << 4)));
+}
+
+/* Forward lifting step, the exact counterpart of progressive_rfx_idwt_x/progressive_rfx_idwt_y */
+static INLINE void progressive_rfx_dwt_1d(const INT16* WINPR_RESTRICT pX, size_t nXStep,
+                                          INT16* WINPR_RESTRICT pL, size_t nLStep,
+                                          INT16* WINPR_RESTRICT pH, size_t nHStep,
+                                          size_t nLowCount, size_t nHighCount)
+{
+#define DWT_X(_i) ((INT32)pX[(_i)*nXStep])
+#define DWT_H(_i) ((INT32)pH[(_i)*nHStep])
+
+	for (size_t n = 0; n < nHighCount; n++)
+		pH[n * nHStep] = (INT16)((DWT_X(2 * n + 1) - ((DWT_X(2 * n) + DWT_X(2 * n + 2)) / 2)) / 2);
+
+	pL[0] = (INT16)(DWT_X(0) + DWT_H(0));
+
+	for (size_t n = 1; n < nHighCount; n++)
+		pL[n * nLStep] = (INT16)(DWT_X(2 * n) + ((DWT_H(n - 1) + DWT_H(n)) / 2));
+
+	if (nLowCount > (nHighCount + 1))
+	{
+		const INT32 X0 = DWT_X(2 * nHighCount);
+		pL[nHighCount * nLStep] = (INT16)(X0 + (DWT_H(nHighCount - 1) / 2));
+		pL[(nHighCount + 1) * nLStep] = (INT16)((2 * DWT_X(2 * nHighCount + 1)) - X0);
+	}
+	else
+		pL[nHighCount * nLStep] = (INT16)(DWT_X(2 * nHighCount) + DWT_H(nHighCount - 1));
+
+#undef DWT_X
+#undef DWT_H
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode_block(INT16* WINPR_RESTRICT buffer,
+                                                       INT16* WINPR_RESTRICT temp, size_t level)
+{
+	const size_t nBandL = progressive_rfx_get_band_l_count(level);
+	const size_t nBandH = progressive_rfx_get_band_h_count(level);
+	const size_t nDstStep = nBandL + nBandH;
+	INT16* HL = &buffer[0];
+	INT16* LH = &HL[nBandH * nBandL];
+	INT16* HH = &LH[nBandL * nBandH];
+	INT16* LL = &HH[nBandH * nBandH];
+	INT16* L = &temp[0];
+	INT16* H = &temp[nBandL * nDstStep];
+
+	/* vertical (LL -> L + H) */
+	for (size_t x = 0; x < nDstStep; x++)
+		progressive_rfx_dwt_1d(&buffer[x], nDstStep, &L[x], nDstStep, &H[x], nDstStep, nBandL,
+		                       nBandH);
+
+	/* horizontal (L -> LL + HL) */
+	for (size_t y = 0; y < nBandL; y++)
+		progressive_rfx_dwt_1d(&L[y * nDstStep], 1, &LL[y * nBandL], 1, &HL[y * nBandH], 1, nBandL,
+		                       nBandH);
+
+	/* horizontal (H -> LH + HH) */
+	for (size_t y = 0; y < nBandH; y++)
+		progressive_rfx_dwt_1d(&H[y * nDstStep], 1, &LH[y * nBandL], 1, &HH[y * nBandH], 1, nBandL,
+		                       nBandH);
+}
+
+static INLINE void progressive_rfx_dwt_2d_extrapolate_encode(INT16* WINPR_RESTRICT buffer,
+                                                             INT16* WINPR_RESTRICT temp)
+{
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+}
+
+static INLINE INT16 progressive_rfx_truncate(INT16 value, UINT32 bits)
+{
+	if (value < 0)
+		return (INT16)(-((-value) >> bits));
+	return (INT16)(value >> bits);
+}
+
+/* Quantize the coefficients of a component, the result is the tile at full quality */
+static INLINE void
+progressive_rfx_quantize_component(INT16* WINPR_RESTRICT buffer,
+                                   const RFX_COMPONENT_CODEC_QUANT* WINPR_RESTRICT quant)
+{
+	for (size_t band = 0; band < 10; band++)
+	{
+		/* -6 + 5 = -1, the coefficients are scaled by << 5 at RGB->YCbCr phase */
+		const UINT32 shift = progressive_rfx_quant_band(quant, band) - 1U;
+		const INT32 half = 1 << (shift - 1);
+
+		for (size_t i = progressive_rfx_band_offset[band]; i < progressive_rfx_band_offset[band + 1];
+		     i++)
+			buffer[i] = (INT16)((buffer[i] + half) >> shift);
+	}
+}
+
+/**
+ * The decoder keeps the sign of non-LL coefficients and only adds magnitude bits to them,
+ * so these are truncated towards zero. LL3 bits are added unsigned, it is rounded down.
+ */
+static INLINE INT16 progressive_rfx_coeff_at(const INT16* WINPR_RESTRICT coeffs, size_t band,
+                                             size_t index, UINT32 bits)
+{
+	if (band == PROGRESSIVE_BAND_LL3)
+		return (INT16)(coeffs[index] >> bits);
+	return progressive_rfx_truncate(coeffs[index], bits);
+}
+
+static INLINE int progressive_rfx_encode_first_component(
+    PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive, const INT16* WINPR_RESTRICT coeffs,
+    const RFX_COMPONENT_CODEC_QUANT* WINPR_RESTRICT progQuant, INT16* WINPR_RESTRICT temp,
+    BYTE* WINPR_RESTRICT dst, UINT32 dstSize)
+{
+	for (size_t band = 0; band < 10; band++)
+	{
+		const UINT32 bits = progressive_rfx_quant_band(progQuant, band);
+
+		for (size_t i = progressive_rfx_band_offset[band]; i < progressive_rfx_band_offset[band + 1];
+		     i++)
+			temp[i] = progressive_rfx_coeff_at(coeffs, band, i, bits);
+	}
+
+	rfx_differential_encode(&temp[4015], 81);
+
+	/* The RLGR encoder expects a zeroed buffer */
+	ZeroMemory(dst, dstSize);
+	return progressive->rfx_context->rlgr_encode(RLGR1, temp, 4096, dst, dstSize);
+}
+
+static INLINE void progressive_rfx_write_zeros(wBitStream* WINPR_RESTRICT bs, UINT32 count)
+{
+	while (count > 0)
+	{
+		const UINT32 n = MIN(16, count);
+		BitStream_Write_Bits(bs, 0, n);
+		count -= n;
+	}
+}
+
+/* Encoder side of progressive_rfx_srl_read */
+static INLINE void progressive_rfx_srl_write(wBitStream* WINPR_RESTRICT bs,
+                                             const INT16* WINPR_RESTRICT values,
+                                             const BYTE* WINPR_RESTRICT numBits, size_t count)
+{
+	UINT32 kp = 8;
+	size_t index = 0;
+
+	while (index < count)
+	{
+		const UINT32 k = kp / 8;
+		size_t run = 0;
+
+		while ((index + run < count) && (values[index + run] == 0) && (run < (1u << k)))
+			run++;
+
+		/* '0' bit, a run of (1 << k) zeros. Also used for trailing zeros, the decoder stops
+		 * before the run is exhausted */
+		if ((run == (1u << k)) || (index + run == count))
+		{
+			BitStream_Write_Bits(bs, 0, 1);
+			index += run;
+			kp = MIN(kp + 4, 80);
+			continue;
+		}
+
+		/* '1' bit, run < (1 << k) zeros followed by a nonzero value */
+		BitStream_Write_Bits(bs, 1, 1);
+
+		if (k)
+			BitStream_Write_Bits(bs, (UINT32)run, k);
+
+		index += run;
+
+		const INT16 value = values[index];
+		const UINT32 bits = numBits[index];
+		index++;
+
+		BitStream_Write_Bits(bs, (value < 0) ? 1 : 0, 1);
+		kp = (kp < 6) ? 0 : kp - 6;
+
+		if (bits > 1)
+		{
+			/* unary magnitude, the terminating '1' is omitted for the maximum */
+			const UINT32 mag = (UINT32)abs(value);
+			const UINT32 max = (1u << bits) - 1;
+
+			progressive_rfx_write_zeros(bs, mag - 1);
+
+			if (mag < max)
+				BitStream_Write_Bits(bs, 1, 1);
+		}
+	}
+}
+
+static INLINE size_t progressive_rfx_bitstream_finish(wBitStream* WINPR_RESTRICT bs)
+{
+	BitStream_Flush(bs);
+	return (bs->position + 7) / 8;
+}
+
+/**
+ * Encoder side of progressive_rfx_upgrade_component: sends the bits between the old and the
+ * new quality. Coefficients the decoder already knows to be nonzero get RAW magnitude bits,
+ * all others are run length coded in the SRL stream.
+ */
+static INLINE BOOL progressive_rfx_upgrade_encode_component(
+    const INT16* WINPR_RESTRICT coeffs, const RFX_COMPONENT_CODEC_QUANT* WINPR_RESTRICT oldQuant,
+    const RFX_COMPONENT_CODEC_QUANT* WINPR_RESTRICT newQuant, BYTE* WINPR_RESTRICT scratch,
+    wStream* WINPR_RESTRICT s, UINT16* WINPR_RESTRICT srlLen, UINT16* WINPR_RESTRICT rawLen)
+{
+	size_t count = 0;
+	UINT32 maxBits = 0;
+	wBitStream srl = { 0 };
+	wBitStream raw = { 0 };
+	INT16* values = (INT16*)scratch;
+	BYTE* numBits = &scratch[4096 * sizeof(INT16)];
+	BYTE* rawData = &numBits[4096];
+	const size_t rawSize = 4096 * 2;
+
+	ZeroMemory(rawData, rawSize);
+	BitStream_Attach(&raw, rawData, rawSize);
+
+	for (size_t band = 0; band < 10; band++)
+	{
+		const UINT32 oldBits = progressive_rfx_quant_band(oldQuant, band);
+		const UINT32 newBits = progressive_rfx_quant_band(newQuant, band);
+
+		if (newBits >= oldBits)
+			continue;
+
+		const UINT32 bits = oldBits - newBits;
+		const UINT32 mask = (1u << bits) - 1;
+
+		maxBits = MAX(maxBits, bits);
+
+		for (size_t i = progressive_rfx_band_offset[band]; i < progressive_rfx_band_offset[band + 1];
+		     i++)
+		{
+			const INT16 value = progressive_rfx_coeff_at(coeffs, band, i, newBits);
+
+			if (band == PROGRESSIVE_BAND_LL3)
+				BitStream_Write_Bits(&raw, (UINT32)value & mask, bits);
+			else if (progressive_rfx_truncate(coeffs[i], oldBits) != 0)
+				BitStream_Write_Bits(&raw, (UINT32)abs(value) & mask, bits);
+			else
+			{
+				values[count] = value;
+				numBits[count] = (BYTE)bits;
+				count++;
+			}
+		}
+	}
+
+	const size_t rawBytes = progressive_rfx_bitstream_finish(&raw);
+
+	/* '1' bit, k bits of run length, sign and unary magnitude */
+	const size_t srlSize = (count * (12 + (1ull << maxBits)) + 7) / 8;
+	if ((srlSize + rawBytes > UINT16_MAX) || (rawBytes > rawSize))
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(s, srlSize + rawBytes))
+		return FALSE;
+
+	BYTE* srlData = Stream_Pointer(s);
+	ZeroMemory(srlData, srlSize);
+	BitStream_Attach(&srl, srlData, (UINT32)srlSize);
+	progressive_rfx_srl_write(&srl, values, numBits, count);
+
+	const size_t srlBytes = progressive_rfx_bitstream_finish(&srl);
+	if (srlBytes > srlSize)
+		return FALSE;
+
+	Stream_Seek(s, srlBytes);
+	Stream_Write(s, rawData, rawBytes);
+	*srlLen = (UINT16)srlBytes;
+	*rawLen = (UINT16)rawBytes;
+	return TRUE;
+}
+
+static INLINE void progressive_tile_set_quality(RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
+                                                BYTE quality,
+                                                const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal)
+{
+	tile->quality = quality;
+	tile->yQuant = progressive_encode_quant;
+	tile->cbQuant = progressive_encode_quant;
+	tile->crQuant = progressive_encode_quant;
+	tile->yProgQuant = quantProgVal->yQuantValues;
+	tile->cbProgQuant = quantProgVal->cbQuantValues;
+	tile->crProgQuant = quantProgVal->crQuantValues;
+	progressive_rfx_quant_add(&tile->yQuant, &tile->yProgQuant, &tile->yBitPos);
+	progressive_rfx_quant_add(&tile->cbQuant, &tile->cbProgQuant, &tile->cbBitPos);
+	progressive_rfx_quant_add(&tile->crQuant, &tile->crProgQuant, &tile->crBitPos);
+}
+
+static INLINE BOOL progressive_compress_tile_first(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                                                   RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
+                                                   const BYTE* WINPR_RESTRICT pSrcData,
+                                                   UINT32 width, UINT32 height, UINT32 ScanLine,
+                                                   wStream* WINPR_RESTRICT s)
+{
+	BOOL rc = FALSE;
+	INT16* pSrcDst[3] = { 0 };
+	UINT16 len[3] = { 0 };
+	const size_t start = Stream_GetPosition(s);
+	const UINT32 dstSize = 4096 * 4;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = &progressive_encode_quality[0];
+	BYTE* temp = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!temp)
+		return FALSE;
+
+	if (!progressive_tile_alloc_coefficients(tile, FALSE))
+		goto fail;
+
+	progressive_tile_set_quality(tile, 0, quantProgVal);
+
+	/* The full quality coefficients are kept in current, upgrades are computed from them */
+	for (size_t i = 0; i < 3; i++)
+		pSrcDst[i] = (INT16*)((BYTE*)(&tile->current[((8192 + 32) * i) + 16]));
+
+	rfx_encode_rgb_to_ycbcr(progressive->rfx_context, pSrcData, width, height, ScanLine, pSrcDst);
+
+	if (!Stream_EnsureRemainingCapacity(s, 23 + 3ull * dstSize))
+		goto fail;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_FIRST); /* blockType (2 bytes) */
+	Stream_Seek(s, 4);                                  /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx);                 /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx);                 /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* flags (1 byte) */
+	Stream_Write_UINT8(s, tile->quality);               /* quality (1 byte) */
+	Stream_Seek(s, 8); /* yLen, cbLen, crLen, tailLen (8 bytes) */
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		const RFX_COMPONENT_CODEC_QUANT* quant = (i == 0)   ? &tile->yQuant
+		                                         : (i == 1) ? &tile->cbQuant
+		                                                    : &tile->crQuant;
+		const RFX_COMPONENT_CODEC_QUANT* progQuant = (i == 0)   ? &tile->yProgQuant
+		                                             : (i == 1) ? &tile->cbProgQuant
+		                                                        : &tile->crProgQuant;
+
+		progressive_rfx_dwt_2d_extrapolate_encode(pSrcDst[i], (INT16*)temp);
+		progressive_rfx_quantize_component(pSrcDst[i], quant);
+
+		const int status = progressive_rfx_encode_first_component(
+		    progressive, pSrcDst[i], progQuant, (INT16*)temp, Stream_Pointer(s), dstSize);
+		if ((status <= 0) || ((UINT32)status > dstSize))
+			goto fail;
+
+		len[i] = (UINT16)status;
+		Stream_Seek(s, len[i]);
+	}
+
+	const size_t end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start + 2);
+	Stream_Write_UINT32(s, (UINT32)(end - start)); /* blockLen (4 bytes) */
+	Stream_Seek(s, 9);
+	Stream_Write_UINT16(s, len[0]); /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, len[1]); /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, len[2]); /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0);      /* tailLen (2 bytes) */
+	Stream_SetPosition(s, end);
+
+	tile->pass = 1;
+	tile->dirty = FALSE;
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, temp);
+	return rc;
+}
+
+static INLINE BOOL progressive_compress_tile_upgrade(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                                                     RFX_PROGRESSIVE_TILE* WINPR_RESTRICT tile,
+                                                     wStream* WINPR_RESTRICT s)
+{
+	BOOL rc = FALSE;
+	UINT16 srlLen[3] = { 0 };
+	UINT16 rawLen[3] = { 0 };
+	const size_t start = Stream_GetPosition(s);
+	const RFX_COMPONENT_CODEC_QUANT oldProgQuant[3] = { tile->yProgQuant, tile->cbProgQuant,
+		                                                tile->crProgQuant };
+	const BYTE quality =
+	    (tile->quality + 1U < ARRAYSIZE(progressive_encode_quality)) ? tile->quality + 1 : 0xFF;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = (quality == 0xFF)
+	                                                      ? &progressive->quantProgValFull
+	                                                      : &progressive_encode_quality[quality];
+	BYTE* scratch = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!scratch)
+		return FALSE;
+
+	progressive_tile_set_quality(tile, quality, quantProgVal);
+
+	if (!Stream_EnsureRemainingCapacity(s, 26))
+		goto fail;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_UPGRADE); /* blockType (2 bytes) */
+	Stream_Seek(s, 4);                                    /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx);                   /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx);                   /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, tile->quality);                 /* quality (1 byte) */
+	Stream_Seek(s, 12); /* ySrlLen, yRawLen, cbSrlLen, cbRawLen, crSrlLen, crRawLen (12 bytes) */
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		const INT16* coeffs = (const INT16*)((BYTE*)(&tile->current[((8192 + 32) * i) + 16]));
+		const RFX_COMPONENT_CODEC_QUANT* progQuant = (i == 0)   ? &tile->yProgQuant
+		                                             : (i == 1) ? &tile->cbProgQuant
+		                                                        : &tile->crProgQuant;
+
+		if (!progressive_rfx_upgrade_encode_component(coeffs, &oldProgQuant[i], progQuant, scratch,
+		                                              s, &srlLen[i], &rawLen[i]))
+			goto fail;
+	}
+
+	const size_t end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start + 2);
+	Stream_Write_UINT32(s, (UINT32)(end - start)); /* blockLen (4 bytes) */
+	Stream_Seek(s, 8);
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		Stream_Write_UINT16(s, srlLen[i]); /* srlLen (2 bytes) */
+		Stream_Write_UINT16(s, rawLen[i]); /* rawLen (2 bytes) */
+	}
+
+	Stream_SetPosition(s, end);
+	tile->pass++;
+
+	/* Nothing is left to send for this tile until it is damaged again */
+	if (tile->quality == 0xFF)
+		progressive_tile_release_coefficients(tile);
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, scratch);
+	return rc;
+}
+
+static INLINE BOOL progressive_write_wb_sync(wStream* WINPR_RESTRICT s)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 12))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_SYNC); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 12);                   /* blockLen (4 bytes) */
+	Stream_Write_UINT32(s, 0xCACCACCA);           /* magic (4 bytes) */
+	Stream_Write_UINT16(s, 0x0100);               /* version (2 bytes) */
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_wb_context(wStream* WINPR_RESTRICT s)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 10))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_CONTEXT); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 10);                      /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                        /* ctxId (1 byte) */
+	Stream_Write_UINT16(s, 64);                      /* tileSize (2 bytes) */
+	Stream_Write_UINT8(s, RFX_SUBBAND_DIFFING);      /* flags (1 byte) */
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_frame_begin(wStream* WINPR_RESTRICT s, UINT32 frameIdx)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 12))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 12);                          /* blockLen (4 bytes) */
+	Stream_Write_UINT32(s, frameIdx);                    /* frameIndex (4 bytes) */
+	Stream_Write_UINT16(s, 1);                           /* regionCount (2 bytes) */
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_frame_end(wStream* WINPR_RESTRICT s)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 6))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_END); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 6);                         /* blockLen (4 bytes) */
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_region(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive,
+                                            PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT surface,
+                                            const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcFormat,
+                                            UINT32 Width, UINT32 Height, UINT32 ScanLine,
+                                            wStream* WINPR_RESTRICT s)
+{
+	const size_t numTiles = surface->numUpdatedTiles;
+	const size_t start = Stream_GetPosition(s);
+	const size_t numProgQuant = ARRAYSIZE(progressive_encode_quality);
+	const size_t headerLen = 18 + numTiles * 8 + 5 + numProgQuant * 16;
+
+	if (numTiles > UINT16_MAX)
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(s, headerLen))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION);    /* blockType (2 bytes) */
+	Stream_Seek(s, 4);                                 /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 64);                         /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, (UINT16)numTiles);          /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1);                          /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, (BYTE)numProgQuant);         /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE); /* flags (1 byte) */
+	Stream_Write_UINT16(s, (UINT16)numTiles);          /* numTiles (2 bytes) */
+	Stream_Seek(s, 4);                                 /* tileDataSize (4 bytes) */
+
+	for (size_t index = 0; index < numTiles; index++)
+	{
+		const RFX_PROGRESSIVE_TILE* tile = surface->tiles[surface->updatedTileIndices[index]];
+		const UINT32 width = MIN(tile->width, Width - tile->x);
+		const UINT32 height = MIN(tile->height, Height - tile->y);
+
+		/* TS_RFX_RECT */
+		Stream_Write_UINT16(s, (UINT16)tile->x); /* x (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)tile->y); /* y (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)width);   /* width (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)height);  /* height (2 bytes) */
+	}
+
+	progressive_component_codec_quant_write(s, &progressive_encode_quant);
+
+	for (size_t index = 0; index < numProgQuant; index++)
+	{
+		const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = &progressive_encode_quality[index];
+
+		Stream_Write_UINT8(s, quantProgVal->quality);
+		progressive_component_codec_quant_write(s, &quantProgVal->yQuantValues);
+		progressive_component_codec_quant_write(s, &quantProgVal->cbQuantValues);
+		progressive_component_codec_quant_write(s, &quantProgVal->crQuantValues);
+	}
+
+	const size_t tilesStart = Stream_GetPosition(s);
+	const size_t bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+
+	for (size_t index = 0; index < numTiles; index++)
+	{
+		RFX_PROGRESSIVE_TILE* tile = surface->tiles[surface->updatedTileIndices[index]];
+		BOOL rc = 0;
+
+		if (tile->dirty)
+		{
+			const BYTE* src = &pSrcData[1ull * tile->y * ScanLine + 1ull * tile->x * bpp];
+			rc = progressive_compress_tile_first(progressive, tile, src,
+			                                     MIN(tile->width, Width - tile->x),
+			                                     MIN(tile->height, Height - tile->y), ScanLine, s);
+		}
+		else
+			rc = progressive_compress_tile_upgrade(progressive, tile, s);
+
+		if (!rc)
+			return FALSE;
+	}
+
+	const size_t end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start + 2);
+	Stream_Write_UINT32(s, (UINT32)(end - start)); /* blockLen (4 bytes) */
+	Stream_SetPosition(s, start + 14);
+	Stream_Write_UINT32(s, (UINT32)(end - tilesStart)); /* tileDataSize (4 bytes) */
+	Stream_SetPosition(s, end);
+	return TRUE;
+}
+
+/**
+ * Mirrors the decoder's surface state: damaged tiles are flagged dirty and get a new first
+ * pass, tiles that were sent before and are not at full quality yet get the next upgrade.
+ */
+static INLINE BOOL progressive_compress_select_tiles(PROGRESSIVE_SURFACE_CONTEXT* WINPR_RESTRICT
+                                                         surface,
+                                                     UINT32 Width, UINT32 Height,
+                                                     const REGION16* WINPR_RESTRICT invalidRegion)
+{
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects = NULL;
+	const RECTANGLE_16 full = { 0, 0, (UINT16)Width, (UINT16)Height };
+	const UINT32 gridWidth = (Width + 63) / 64;
+	const UINT32 gridHeight = (Height + 63) / 64;
+
+	if (invalidRegion)
+		rects = region16_rects(invalidRegion, &numRects);
+	else
+	{
+		rects = &full;
+		numRects = 1;
+	}
+
+	for (UINT32 index = 0; index < numRects; index++)
+	{
+		const RECTANGLE_16* r = &rects[index];
+		const UINT32 right = MIN((r->right + 63U) / 64U, gridWidth);
+		const UINT32 bottom = MIN((r->bottom + 63U) / 64U, gridHeight);
+
+		for (UINT32 yIdx = r->top / 64U; yIdx < bottom; yIdx++)
+		{
+			for (UINT32 xIdx = r->left / 64U; xIdx < right; xIdx++)
+			{
+				RFX_PROGRESSIVE_TILE* tile =
+				    progressive_surface_get_tile(surface, yIdx * surface->gridWidth + xIdx);
+
+				if (!tile)
+					return FALSE;
+				tile->dirty = TRUE;
+			}
+		}
+	}
+
+	surface->numUpdatedTiles = 0;
+
+	for (UINT32 yIdx = 0; yIdx < gridHeight; yIdx++)
+	{
+		for (UINT32 xIdx = 0; xIdx < gridWidth; xIdx++)
+		{
+			const UINT32 zIdx = yIdx * surface->gridWidth + xIdx;
+			RFX_PROGRESSIVE_TILE* tile = surface->tiles[zIdx];
+
+			if (!tile || (!tile->dirty && ((tile->pass == 0) || (tile->quality == 0xFF))))
+				continue;
+
+			tile->xIdx = (UINT16)xIdx;
+			tile->yIdx = (UINT16)yIdx;
+			tile->x = xIdx * tile->width;
+			tile->y = yIdx * tile->height;
+			surface->updatedTileIndices[surface->numUpdatedTiles++] = zIdx;
+		}
+	}
+
+	return TRUE;
+}
+
+int progressive_compress_ex(PROGRESSIVE_CONTEXT* WINPR_RESTRICT progressive, UINT16 surfaceId,
+                            const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcSize, UINT32 SrcFormat,
+                            UINT32 Width, UINT32 Height, UINT32 ScanLine,
+                            const REGION16* WINPR_RESTRICT invalidRegion,
+                            BYTE** WINPR_RESTRICT ppDstData, UINT32* WINPR_RESTRICT pDstSize)
+{
+	wStream* s = NULL;
+	PROGRESSIVE_SURFACE_CONTEXT* surface = NULL;
+
+	if (!progressive || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if ((Width > UINT16_MAX) || (Height > UINT16_MAX))
+		return -1;
+
+	if (!progressive_compress_scanline(SrcFormat, Width, &ScanLine))
+		return -2;
+
+	if (SrcSize < Height * ScanLine)
+		return -4;
+
+	surface = progressive_get_surface_data(progressive, surfaceId);
+
+	if (surface && ((surface->width != Width) || (surface->height != Height)))
+	{
+		progressive_delete_surface_context(progressive, surfaceId);
+		surface = NULL;
+	}
+
+	if (!surface)
+	{
+		if (progressive_create_surface_context(progressive, surfaceId, Width, Height) < 0)
+			return -5;
+
+		surface = progressive_get_surface_data(progressive, surfaceId);
+		if (!surface)
+			return -5;
+	}
+
+	if (!progressive_compress_select_tiles(surface, Width, Height, invalidRegion))
+		return -1;
+
+	*pDstSize = 0;
+
+	if (surface->numUpdatedTiles == 0)
+		return 0;
+
+	s = progressive->buffer;
+	Stream_SetPosition(s, 0);
+	rfx_context_set_pixel_format(progressive->rfx_context, SrcFormat);
+
+	if (!progressive_write_wb_sync(s) || !progressive_write_wb_context(s) ||
+	    !progressive_write_frame_begin(s, progressive->rfx_context->frameIdx++) ||
+	    !progressive_write_region(progressive, surface, pSrcData, SrcFormat, Width, Height,
+	                              ScanLine, s) ||
+	    !progressive_write_frame_end(s))
+	{
+		WLog_Print(progressive->log, WLOG_ERROR, "failed to encode progressive message");
+		return -6;
+	}
+
+	const size_t pos = Stream_GetPosition(s);
+	WINPR_ASSERT(pos <= UINT32_MAX);
+	*pDstSize = (UINT32)pos;
+	*ppDstData = Stream_Buffer(s);
+	return 1;
+}
+
 BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
 {
 	if (!progressive)
@@ -2610,6 +3553,7 @@ PROGRESSIVE_CONTEXT* progressive_context_new_ex(BOOL Compressor, UINT32 Threadin
 	if (!progressive)
 		return NULL;
 
+	region16_init(&progressive->clippingRects);
 	progressive->Compressor = Compressor;
 	progressive->quantProgValFull.quality = 100;
 	progressive->log = WLog_Get(TAG);
@@ -2624,7 +3568,7 @@ PROGRESSIVE_CONTEXT* progressive_context_new_ex(BOOL Compressor, UINT32 Threadin
 	progressive->rects = Stream_New(NULL, 1024);
 	if (!progressive->rects)
 		goto fail;
-	progressive->bufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
+	progressive->bufferPool = BufferPool_New(TRUE, PROGRESSIVE_COEFFICIENTS_SIZE, 16);
 	if (!progressive->bufferPool)
 		goto fail;
 	progressive->SurfaceContexts = HashTable_New(TRUE);
@@ -2656,6 +3600,7 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 
 	BufferPool_Free(progressive->bufferPool);
 	HashTable_Free(progressive->SurfaceContexts);
+	region16_uninit(&progressive->clippingRects);
 
 	winpr_aligned_free(progressive);
 }
@@ -26,6 +26,7 @@
 #include <winpr/collections.h>
 
 #include <freerdp/codec/rfx.h>
+#include <freerdp/codec/region.h>
 
 #define RFX_SUBBAND_DIFFING 0x01
 
@@ -121,9 +122,8 @@ typedef struct
 	UINT32 y;
 	UINT32 width;
 	UINT32 height;
-	UINT32 stride;
 
-	BYTE* data;
+	/* Coefficients, only allocated while further upgrade passes can follow */
 	BYTE* current;
 
 	UINT16 pass;
@@ -194,8 +194,11 @@ typedef struct
 	UINT32 gridWidth;
 	UINT32 gridHeight;
 	UINT32 gridSize;
-	RFX_PROGRESSIVE_TILE** tiles;
+	RFX_PROGRESSIVE_TILE** tiles; /* NULL until the tile is first used */
 	size_t tilesSize;
+	RFX_PROGRESSIVE_TILE** tileSlabs;
+	size_t numTileSlabs;
+	size_t tileSlabUsed;
 	UINT32 frameId;
 	UINT32 numUpdatedTiles;
 	UINT32* updatedTileIndices;
@@ -228,6 +231,16 @@ struct S_PROGRESSIVE_CONTEXT
 	wStream* buffer;
 	wStream* rects;
 	RFX_CONTEXT* rfx_context;
+
+	/* Destination of the running progressive_decompress, tiles are written there directly */
+	BYTE* pDstData;
+	UINT32 DstFormat;
+	UINT32 nDstStep;
+	UINT32 nXDst;
+	UINT32 nYDst;
+	REGION16 clippingRects;
+	REGION16* invalidRegion;
+
 	PROGRESSIVE_TILE_PROCESS_WORK_PARAM params[0x10000];
 	PTP_WORK work_objects[0x10000];
 };
@@ -19,6 +19,8 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <winpr/assert.h>
 #include <winpr/memory.h>
 #include <freerdp/log.h>
@@ -70,10 +72,33 @@
 
 struct S_REGION16_DATA
 {
-	long size;
+	long size; /* allocated bytes, the rectangles in use are given by nbRects */
 	long nbRects;
 };
 
+struct S_REGION16_TILES
+{
+	UINT16 width;
+	UINT16 height;
+	UINT32 gridWidth;
+	UINT32 gridHeight;
+	size_t wordsPerRow;
+	size_t capacity;
+	UINT64* bits;
+};
+
+/* Collects a banded region band by band, merging each band with the previous one when
+ * they touch and have the same items. The storage grows geometrically and is handed over
+ * to the destination region as is.
+ */
+typedef struct
+{
+	REGION16_DATA* data;
+	RECTANGLE_16 extents;
+	long prevBand;
+	long prevCount;
+} REGION16_BUILDER;
+
 static REGION16_DATA empty_region = { 0, 0 };
 
 void region16_init(REGION16* region)
@@ -201,6 +226,45 @@ static INLINE REGION16_DATA* allocateRegion(long nbItems)
 	return ret;
 }
 
+static INLINE BOOL region16_owns_data(const REGION16_DATA* data)
+{
+	return data && (data != &empty_region) && (data->size > 0);
+}
+
+static INLINE size_t region16_capacity(const REGION16_DATA* data)
+{
+	if (!region16_owns_data(data))
+		return 0;
+
+	return ((size_t)data->size - sizeof(REGION16_DATA)) / sizeof(RECTANGLE_16);
+}
+
+/* Makes room for nbItems rectangles, the rectangles already stored are kept */
+static REGION16_DATA* region16_data_reserve(REGION16_DATA* data, size_t nbItems)
+{
+	const size_t capacity = data ? region16_capacity(data) : 0;
+
+	if (data && (capacity >= nbItems))
+		return data;
+
+	const size_t newCapacity = MAX(nbItems, capacity * 2);
+	const size_t allocSize = sizeof(REGION16_DATA) + (newCapacity * sizeof(RECTANGLE_16));
+
+	if ((newCapacity > INT32_MAX) || (allocSize > INT32_MAX))
+		return NULL;
+
+	REGION16_DATA* newData = (REGION16_DATA*)realloc(data, allocSize);
+
+	if (!newData)
+		return NULL;
+
+	if (!data)
+		newData->nbRects = 0;
+
+	newData->size = (long)allocSize;
+	return newData;
+}
+
 BOOL region16_copy(REGION16* dst, const REGION16* src)
 {
 	WINPR_ASSERT(dst);
@@ -213,24 +277,143 @@ BOOL region16_copy(REGION16* dst, const REGION16* src)
 
 	dst->extents = src->extents;
 
-	if ((dst->data->size > 0) && (dst->data != &empty_region))
-		free(dst->data);
+	if (src->data->nbRects == 0)
+	{
+		if ((dst->data->size > 0) && (dst->data != &empty_region))
+			free(dst->data);
 
-	if (src->data->size == 0)
 		dst->data = &empty_region;
+	}
 	else
 	{
-		dst->data = allocateRegion(src->data->nbRects);
+		/* reuse the destination storage when it is large enough */
+		REGION16_DATA* data = region16_owns_data(dst->data) ? dst->data : NULL;
+
+		dst->data = region16_data_reserve(data, (size_t)src->data->nbRects);
 
 		if (!dst->data)
+		{
+			free(data);
+			dst->data = &empty_region;
+			ZeroMemory(&dst->extents, sizeof(dst->extents));
 			return FALSE;
+		}
 
-		CopyMemory(dst->data, src->data, src->data->size);
+		dst->data->nbRects = src->data->nbRects;
+		CopyMemory(&dst->data[1], &src->data[1],
+		           (size_t)src->data->nbRects * sizeof(RECTANGLE_16));
 	}
 
 	return TRUE;
 }
 
+static void region16_builder_init(REGION16_BUILDER* builder)
+{
+	WINPR_ASSERT(builder);
+	ZeroMemory(builder, sizeof(REGION16_BUILDER));
+	builder->prevBand = -1;
+}
+
+/** appends a band, the items must be sorted from left to right and must not touch
+ * @param builder the builder
+ * @param top top of the band
+ * @param bottom bottom of the band
+ * @param items the band items, only left and right are used
+ * @param count the number of items
+ * @return if the operation was successful (false meaning out-of-memory)
+ */
+static BOOL region16_builder_add_band(REGION16_BUILDER* builder, UINT16 top, UINT16 bottom,
+                                      const RECTANGLE_16* items, long count)
+{
+	WINPR_ASSERT(builder);
+	WINPR_ASSERT(items || (count == 0));
+
+	if ((count == 0) || (top >= bottom))
+		return TRUE;
+
+	if ((builder->prevBand >= 0) && (builder->prevCount == count))
+	{
+		RECTANGLE_16* prev = (RECTANGLE_16*)(&builder->data[1]) + builder->prevBand;
+		BOOL match = (prev->bottom == top);
+
+		for (long x = 0; match && (x < count); x++)
+			match = (prev[x].left == items[x].left) && (prev[x].right == items[x].right);
+
+		if (match)
+		{
+			for (long x = 0; x < count; x++)
+				prev[x].bottom = bottom;
+
+			builder->extents.bottom = bottom;
+			return TRUE;
+		}
+	}
+
+	const long nbRects = builder->data ? builder->data->nbRects : 0;
+	REGION16_DATA* data = region16_data_reserve(builder->data, (size_t)(nbRects + count));
+
+	if (!data)
+		return FALSE;
+
+	builder->data = data;
+
+	RECTANGLE_16* dst = (RECTANGLE_16*)(&data[1]) + nbRects;
+
+	for (long x = 0; x < count; x++)
+	{
+		dst[x].left = items[x].left;
+		dst[x].right = items[x].right;
+		dst[x].top = top;
+		dst[x].bottom = bottom;
+	}
+
+	if (nbRects == 0)
+	{
+		builder->extents.left = items[0].left;
+		builder->extents.top = top;
+		builder->extents.right = items[count - 1].right;
+	}
+	else
+	{
+		builder->extents.left = MIN(builder->extents.left, items[0].left);
+		builder->extents.right = MAX(builder->extents.right, items[count - 1].right);
+	}
+
+	builder->extents.bottom = bottom;
+	builder->prevBand = nbRects;
+	builder->prevCount = count;
+	data->nbRects = nbRects + count;
+	return TRUE;
+}
+
+/* Replaces the content of dst with the built region, or drops it on failure */
+static BOOL region16_builder_finish(REGION16_BUILDER* builder, REGION16* dst, BOOL success)
+{
+	WINPR_ASSERT(builder);
+	WINPR_ASSERT(dst);
+
+	if (!success)
+	{
+		free(builder->data);
+		return FALSE;
+	}
+
+	if (region16_owns_data(dst->data))
+		free(dst->data);
+
+	if (!builder->data || (builder->data->nbRects == 0))
+	{
+		free(builder->data);
+		dst->data = &empty_region;
+		ZeroMemory(&dst->extents, sizeof(dst->extents));
+		return TRUE;
+	}
+
+	dst->data = builder->data;
+	dst->extents = builder->extents;
+	return TRUE;
+}
+
 void region16_print(const REGION16* region)
 {
 	const RECTANGLE_16* rects = NULL;
@@ -509,12 +692,16 @@ BOOL region16_union_rect(REGION16* dst, const REGION16* src, const RECTANGLE_16*
 	if (!region16_n_rects(src))
 	{
 		/* source is empty, so the union is rect */
-		dst->extents = *rect;
-		dst->data = allocateRegion(1);
+		REGION16_DATA* data =
+		    region16_data_reserve(region16_owns_data(dst->data) ? dst->data : NULL, 1);
 
-		if (!dst->data)
+		if (!data)
 			return FALSE;
 
+		dst->extents = *rect;
+		dst->data = data;
+		dst->data->nbRects = 1;
+
 		dstRect = region16_rects_noconst(dst);
 		dstRect->top = rect->top;
 		dstRect->left = rect->left;
@@ -663,7 +850,7 @@ BOOL region16_union_rect(REGION16* dst, const REGION16* src, const RECTANGLE_16*
 		dstRect++;
 	}
 
-	if ((src == dst) && (dst->data != &empty_region))
+	if (region16_owns_data(dst->data))
 		free(dst->data);
 
 	dstExtents->top = MIN(rect->top, srcExtents->top);
@@ -684,6 +871,140 @@ BOOL region16_union_rect(REGION16* dst, const REGION16* src, const RECTANGLE_16*
 	return region16_simplify_bands(dst);
 }
 
+static int region16_compare_top(const void* pa, const void* pb)
+{
+	const RECTANGLE_16* a = pa;
+	const RECTANGLE_16* b = pb;
+
+	if (a->top != b->top)
+		return (a->top < b->top) ? -1 : 1;
+	if (a->left != b->left)
+		return (a->left < b->left) ? -1 : 1;
+	return 0;
+}
+
+static int region16_compare_y(const void* pa, const void* pb)
+{
+	const UINT16* a = pa;
+	const UINT16* b = pb;
+
+	if (*a == *b)
+		return 0;
+	return (*a < *b) ? -1 : 1;
+}
+
+BOOL region16_union_rects(REGION16* dst, const REGION16* src, const RECTANGLE_16* rects,
+                          UINT32 count)
+{
+	UINT32 srcNbRects = 0;
+	size_t nbItems = 0;
+	size_t nbEdges = 0;
+	size_t nbActive = 0;
+	size_t next = 0;
+	BOOL rc = TRUE;
+	REGION16_BUILDER builder = { 0 };
+
+	WINPR_ASSERT(dst);
+	WINPR_ASSERT(dst->data);
+	WINPR_ASSERT(src);
+	WINPR_ASSERT(src->data);
+	WINPR_ASSERT(rects || (count == 0));
+
+	const RECTANGLE_16* srcRects = region16_rects(src, &srcNbRects);
+
+	if (count == 0)
+		return region16_copy(dst, src);
+
+	if ((count == 1) && !rectangle_is_empty(rects))
+		return region16_union_rect(dst, src, rects);
+
+	/* One scratch block holds the input items, the sweep's active list and the band edges */
+	const size_t total = (size_t)srcNbRects + count;
+	BYTE* arena = malloc(total * (2 * sizeof(RECTANGLE_16) + 2 * sizeof(UINT16)));
+
+	if (!arena)
+		return FALSE;
+
+	RECTANGLE_16* items = (RECTANGLE_16*)arena;
+	RECTANGLE_16* active = &items[total];
+	UINT16* edges = (UINT16*)&active[total];
+
+	for (UINT32 x = 0; x < srcNbRects; x++)
+		items[nbItems++] = srcRects[x];
+
+	for (UINT32 x = 0; x < count; x++)
+	{
+		if (!rectangle_is_empty(&rects[x]))
+			items[nbItems++] = rects[x];
+	}
+
+	qsort(items, nbItems, sizeof(RECTANGLE_16), region16_compare_top);
+
+	for (size_t x = 0; x < nbItems; x++)
+	{
+		edges[nbEdges++] = items[x].top;
+		edges[nbEdges++] = items[x].bottom;
+	}
+
+	qsort(edges, nbEdges, sizeof(UINT16), region16_compare_y);
+
+	region16_builder_init(&builder);
+
+	/* Sweep the bands between consecutive edges, keeping the items crossing the current
+	 * band sorted by their left side. Overlapping or touching items are merged. */
+	for (size_t e = 0; rc && (e + 1 < nbEdges); e++)
+	{
+		const UINT16 top = edges[e];
+		const UINT16 bottom = edges[e + 1];
+		size_t kept = 0;
+		long bandItems = 0;
+
+		if (top == bottom)
+			continue;
+
+		for (size_t x = 0; x < nbActive; x++)
+		{
+			if (active[x].bottom > top)
+				active[kept++] = active[x];
+		}
+
+		nbActive = kept;
+
+		while ((next < nbItems) && (items[next].top <= top))
+		{
+			size_t pos = nbActive++;
+
+			while ((pos > 0) && (active[pos - 1].left > items[next].left))
+			{
+				active[pos] = active[pos - 1];
+				pos--;
+			}
+
+			active[pos] = items[next++];
+		}
+
+		if (nbActive == 0)
+			continue;
+
+		/* the items already moved to the active list leave enough room for the band */
+		RECTANGLE_16* band = items;
+		band[0] = active[0];
+
+		for (size_t x = 1; x < nbActive; x++)
+		{
+			if (active[x].left <= band[bandItems].right)
+				band[bandItems].right = MAX(band[bandItems].right, active[x].right);
+			else
+				band[++bandItems] = active[x];
+		}
+
+		rc = region16_builder_add_band(&builder, top, bottom, band, bandItems + 1);
+	}
+
+	free(arena);
+	return region16_builder_finish(&builder, dst, rc);
+}
+
 BOOL region16_intersects_rect(const REGION16* src, const RECTANGLE_16* arg2)
 {
 	const RECTANGLE_16* rect = NULL;
@@ -750,10 +1071,23 @@ BOOL region16_intersect_rect(REGION16* dst, const REGION16* src, const RECTANGLE
 		return TRUE;
 	}
 
-	newItems = allocateRegion(nbRects);
+	/* the storage of a distinct destination is reused when it is large enough */
+	if ((dst != src) && region16_owns_data(dst->data))
+	{
+		newItems = region16_data_reserve(dst->data, nbRects);
 
-	if (!newItems)
-		return FALSE;
+		if (!newItems)
+			return FALSE;
+
+		dst->data = newItems;
+	}
+	else
+	{
+		newItems = region16_data_reserve(NULL, nbRects);
+
+		if (!newItems)
+			return FALSE;
+	}
 
 	dstPtr = (RECTANGLE_16*)(&newItems[1]);
 	usedRects = 0;
@@ -789,17 +1123,13 @@ BOOL region16_intersect_rect(REGION16* dst, const REGION16* src, const RECTANGLE
 	}
 
 	newItems->nbRects = usedRects;
-	newItems->size = sizeof(REGION16_DATA) + (usedRects * sizeof(RECTANGLE_16));
-
-	if ((dst->data->size > 0) && (dst->data != &empty_region))
-		free(dst->data);
-
-	dst->data = realloc(newItems, newItems->size);
 
-	if (!dst->data)
+	if (dst->data != newItems)
 	{
-		free(newItems);
-		return FALSE;
+		if (region16_owns_data(dst->data))
+			free(dst->data);
+
+		dst->data = newItems;
 	}
 
 	dst->extents = newExtents;
@@ -818,3 +1148,182 @@ void region16_uninit(REGION16* region)
 		region->data = NULL;
 	}
 }
+
+void region16_tiles_free(REGION16_TILES* tiles)
+{
+	if (!tiles)
+		return;
+
+	free(tiles->bits);
+	free(tiles);
+}
+
+REGION16_TILES* region16_tiles_new(UINT16 width, UINT16 height)
+{
+	REGION16_TILES* tiles = (REGION16_TILES*)calloc(1, sizeof(REGION16_TILES));
+
+	if (!tiles)
+		return NULL;
+
+	if (!region16_tiles_reset(tiles, width, height))
+	{
+		region16_tiles_free(tiles);
+		return NULL;
+	}
+
+	return tiles;
+}
+
+BOOL region16_tiles_reset(REGION16_TILES* tiles, UINT16 width, UINT16 height)
+{
+	WINPR_ASSERT(tiles);
+
+	const UINT32 gridWidth = (width + REGION16_TILE_SIZE - 1) / REGION16_TILE_SIZE;
+	const UINT32 gridHeight = (height + REGION16_TILE_SIZE - 1) / REGION16_TILE_SIZE;
+	const size_t wordsPerRow = (gridWidth + 63) / 64;
+	const size_t words = MAX(wordsPerRow * gridHeight, 1);
+
+	if (words > tiles->capacity)
+	{
+		UINT64* bits = (UINT64*)realloc(tiles->bits, words * sizeof(UINT64));
+
+		if (!bits)
+			return FALSE;
+
+		tiles->bits = bits;
+		tiles->capacity = words;
+	}
+
+	tiles->width = width;
+	tiles->height = height;
+	tiles->gridWidth = gridWidth;
+	tiles->gridHeight = gridHeight;
+	tiles->wordsPerRow = wordsPerRow;
+	ZeroMemory(tiles->bits, words * sizeof(UINT64));
+	return TRUE;
+}
+
+BOOL region16_tiles_is_marked(const REGION16_TILES* tiles, UINT32 xIdx, UINT32 yIdx)
+{
+	WINPR_ASSERT(tiles);
+
+	if ((xIdx >= tiles->gridWidth) || (yIdx >= tiles->gridHeight))
+		return FALSE;
+
+	const UINT64* row = &tiles->bits[yIdx * tiles->wordsPerRow];
+	return (row[xIdx / 64] & (1ull << (xIdx % 64))) ? TRUE : FALSE;
+}
+
+BOOL region16_tiles_mark(REGION16_TILES* tiles, UINT32 xIdx, UINT32 yIdx)
+{
+	WINPR_ASSERT(tiles);
+
+	if ((xIdx >= tiles->gridWidth) || (yIdx >= tiles->gridHeight))
+		return FALSE;
+
+	UINT64* row = &tiles->bits[yIdx * tiles->wordsPerRow];
+	row[xIdx / 64] |= (1ull << (xIdx % 64));
+	return TRUE;
+}
+
+void region16_tiles_mark_rect(REGION16_TILES* tiles, const RECTANGLE_16* rect)
+{
+	WINPR_ASSERT(tiles);
+	WINPR_ASSERT(rect);
+
+	const UINT32 right = MIN(rect->right, tiles->width);
+	const UINT32 bottom = MIN(rect->bottom, tiles->height);
+
+	if ((rect->left >= right) || (rect->top >= bottom))
+		return;
+
+	const UINT32 x1 = rect->left / REGION16_TILE_SIZE;
+	const UINT32 x2 = (right - 1) / REGION16_TILE_SIZE;
+
+	for (UINT32 yIdx = rect->top / REGION16_TILE_SIZE; yIdx <= (bottom - 1) / REGION16_TILE_SIZE;
+	     yIdx++)
+	{
+		UINT64* row = &tiles->bits[yIdx * tiles->wordsPerRow];
+
+		/* set whole words at once, only the first and last word are partial */
+		for (UINT32 word = x1 / 64; word <= x2 / 64; word++)
+		{
+			const UINT32 first = (word == x1 / 64) ? x1 % 64 : 0;
+			const UINT32 last = (word == x2 / 64) ? x2 % 64 : 63;
+			const UINT64 high = (last == 63) ? UINT64_MAX : ((1ull << (last + 1)) - 1);
+
+			row[word] |= high & ~((1ull << first) - 1);
+		}
+	}
+}
+
+void region16_tiles_mark_region(REGION16_TILES* tiles, const REGION16* region)
+{
+	UINT32 nbRects = 0;
+	const RECTANGLE_16* rects = region16_rects(region, &nbRects);
+
+	for (UINT32 x = 0; x < nbRects; x++)
+		region16_tiles_mark_rect(tiles, &rects[x]);
+}
+
+BOOL region16_tiles_to_region(const REGION16_TILES* tiles, REGION16* dst)
+{
+	BOOL rc = TRUE;
+	RECTANGLE_16* band = NULL;
+	REGION16_BUILDER builder = { 0 };
+
+	WINPR_ASSERT(tiles);
+	WINPR_ASSERT(dst);
+
+	region16_builder_init(&builder);
+
+	if (tiles->gridWidth > 0)
+	{
+		/* a row has at most one run for every other tile */
+		band = (RECTANGLE_16*)calloc((tiles->gridWidth + 1) / 2, sizeof(RECTANGLE_16));
+
+		if (!band)
+			return FALSE;
+	}
+
+	/* each tile row is a band made of the runs of dirty tiles, equal rows are merged */
+	for (UINT32 yIdx = 0; rc && (yIdx < tiles->gridHeight); yIdx++)
+	{
+		const UINT64* row = &tiles->bits[yIdx * tiles->wordsPerRow];
+		const UINT32 top = yIdx * REGION16_TILE_SIZE;
+		const UINT32 bottom = MIN(top + REGION16_TILE_SIZE, tiles->height);
+		long count = 0;
+		UINT32 xIdx = 0;
+
+		while (xIdx < tiles->gridWidth)
+		{
+			const UINT64 word = row[xIdx / 64] >> (xIdx % 64);
+
+			if (word == 0)
+			{
+				xIdx = (xIdx / 64 + 1) * 64;
+				continue;
+			}
+
+			if ((word & 1) == 0)
+			{
+				xIdx++;
+				continue;
+			}
+
+			const UINT32 start = xIdx;
+
+			while ((xIdx < tiles->gridWidth) && region16_tiles_is_marked(tiles, xIdx, yIdx))
+				xIdx++;
+
+			band[count].left = (UINT16)(start * REGION16_TILE_SIZE);
+			band[count].right = (UINT16)MIN(xIdx * REGION16_TILE_SIZE, tiles->width);
+			count++;
+		}
+
+		rc = region16_builder_add_band(&builder, (UINT16)top, (UINT16)bottom, band, count);
+	}
+
+	free(band);
+	return region16_builder_finish(&builder, dst, rc);
+}
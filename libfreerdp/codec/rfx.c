@@ -382,6 +382,7 @@ void rfx_context_free(RFX_CONTEXT* context)
 		}
 
 		BufferPool_Free(priv->BufferPool);
+		region16_tiles_free(priv->EncodedTiles);
 		winpr_aligned_free(priv);
 	}
 	winpr_aligned_free(context);
@@ -1296,6 +1297,15 @@ BOOL rfx_process_message(RFX_CONTEXT* WINPR_RESTRICT context, const BYTE* WINPR_
 
 		WINPR_ASSERT(dstWidth <= UINT16_MAX);
 		WINPR_ASSERT(dstHeight <= UINT16_MAX);
+
+		RECTANGLE_16* clippingRectArray = NULL;
+		if (message->numRects > 0)
+		{
+			clippingRectArray = (RECTANGLE_16*)calloc(message->numRects, sizeof(RECTANGLE_16));
+			if (!clippingRectArray)
+				return FALSE;
+		}
+
 		for (UINT32 i = 0; i < message->numRects; i++)
 		{
 			RECTANGLE_16 clippingRect = { 0 };
@@ -1310,9 +1320,12 @@ BOOL rfx_process_message(RFX_CONTEXT* WINPR_RESTRICT context, const BYTE* WINPR_
 			clippingRect.top = (UINT16)MIN(top + rect->y, dstHeight);
 			clippingRect.right = (UINT16)MIN(clippingRect.left + rect->width, dstWidth);
 			clippingRect.bottom = (UINT16)MIN(clippingRect.top + rect->height, dstHeight);
-			region16_union_rect(&clippingRects, &clippingRects, &clippingRect);
+			clippingRectArray[i] = clippingRect;
 		}
 
+		region16_union_rects(&clippingRects, &clippingRects, clippingRectArray, message->numRects);
+		free(clippingRectArray);
+
 		for (UINT32 i = 0; i < message->numTiles; i++)
 		{
 			RECTANGLE_16 updateRect = { 0 };
@@ -1577,23 +1590,31 @@ static INLINE void CALLBACK rfx_compose_message_tile_work_callback(PTP_CALLBACK_
 static INLINE BOOL computeRegion(const RFX_RECT* WINPR_RESTRICT rects, size_t numRects,
                                  REGION16* WINPR_RESTRICT region, size_t width, size_t height)
 {
+	BOOL rc = FALSE;
 	const RECTANGLE_16 mainRect = { 0, 0, width, height };
 
 	WINPR_ASSERT(rects);
+	WINPR_ASSERT(numRects <= UINT32_MAX);
+
+	RECTANGLE_16* rects16 = (RECTANGLE_16*)calloc(numRects, sizeof(RECTANGLE_16));
+	if (!rects16)
+		return FALSE;
+
 	for (size_t i = 0; i < numRects; i++)
 	{
 		const RFX_RECT* rect = &rects[i];
-		RECTANGLE_16 rect16 = { 0 };
-		rect16.left = rect->x;
-		rect16.top = rect->y;
-		rect16.right = rect->x + rect->width;
-		rect16.bottom = rect->y + rect->height;
-
-		if (!region16_union_rect(region, region, &rect16))
-			return FALSE;
+		RECTANGLE_16* rect16 = &rects16[i];
+		rect16->left = rect->x;
+		rect16->top = rect->y;
+		rect16->right = rect->x + rect->width;
+		rect16->bottom = rect->y + rect->height;
 	}
 
-	return region16_intersect_rect(region, region, &mainRect);
+	if (region16_union_rects(region, region, rects16, (UINT32)numRects))
+		rc = region16_intersect_rect(region, region, &mainRect);
+
+	free(rects16);
+	return rc;
 }
 
 #define TILE_NO(v) ((v) / 64)
@@ -1646,8 +1667,6 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* WINPR_RESTRICT context,
 	RFX_TILE_COMPOSE_WORK_PARAM* workParam = NULL;
 	BOOL success = FALSE;
 	REGION16 rectsRegion = { 0 };
-	REGION16 tilesRegion = { 0 };
-	RECTANGLE_16 currentTileRect = { 0 };
 	const RECTANGLE_16* regionRect = NULL;
 
 	WINPR_ASSERT(data);
@@ -1660,7 +1679,6 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* WINPR_RESTRICT context,
 	if (!(message = (RFX_MESSAGE*)winpr_aligned_calloc(1, sizeof(RFX_MESSAGE), 32)))
 		return NULL;
 
-	region16_init(&tilesRegion);
 	region16_init(&rectsRegion);
 
 	if (context->state == RFX_STATE_SEND_HEADERS)
@@ -1690,6 +1708,17 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* WINPR_RESTRICT context,
 	if (!computeRegion(rects, numRects, &rectsRegion, width, height))
 		goto skip_encoding_loop;
 
+	/* tiles shared by several rectangles are only encoded once */
+	WINPR_ASSERT(width <= UINT16_MAX);
+	WINPR_ASSERT(height <= UINT16_MAX);
+	if (!context->priv->EncodedTiles)
+		context->priv->EncodedTiles = region16_tiles_new((UINT16)width, (UINT16)height);
+	else if (!region16_tiles_reset(context->priv->EncodedTiles, (UINT16)width, (UINT16)height))
+		goto skip_encoding_loop;
+
+	if (!context->priv->EncodedTiles)
+		goto skip_encoding_loop;
+
 	const RECTANGLE_16* extents = region16_extents(&rectsRegion);
 	WINPR_ASSERT((INT32)extents->right - extents->left > 0);
 	WINPR_ASSERT((INT32)extents->bottom - extents->top > 0);
@@ -1737,9 +1766,6 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* WINPR_RESTRICT context,
 			if ((yIdx == endTileY) && (gridRelY + 64 > height))
 				tileHeight = height - gridRelY;
 
-			currentTileRect.top = gridRelY;
-			currentTileRect.bottom = gridRelY + tileHeight;
-
 			for (UINT32 xIdx = startTileX, gridRelX = startTileX * 64; xIdx <= endTileX;
 			     xIdx++, gridRelX += 64)
 			{
@@ -1753,11 +1779,8 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* WINPR_RESTRICT context,
 				if ((xIdx == endTileX) && (gridRelX + 64 > width))
 					tileWidth = width - gridRelX;
 
-				currentTileRect.left = gridRelX;
-				currentTileRect.right = gridRelX + tileWidth;
-
 				/* checks if this tile is already treated */
-				if (region16_intersects_rect(&tilesRegion, &currentTileRect))
+				if (region16_tiles_is_marked(context->priv->EncodedTiles, xIdx, yIdx))
 					continue;
 
 				RFX_TILE* tile = (RFX_TILE*)ObjectPool_Take(context->priv->TilePool);
@@ -1820,7 +1843,7 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* WINPR_RESTRICT context,
 					rfx_encode_rgb(context, tile);
 				}
 
-				if (!region16_union_rect(&tilesRegion, &tilesRegion, &currentTileRect))
+				if (!region16_tiles_mark(context->priv->EncodedTiles, xIdx, yIdx))
 					goto skip_encoding_loop;
 			} /* xIdx */
 		}     /* yIdx */
@@ -1852,7 +1875,6 @@ skip_encoding_loop:
 			message->tilesDataSize += rfx_tile_length(tile);
 		}
 
-		region16_uninit(&tilesRegion);
 		region16_uninit(&rectsRegion);
 
 		return message;
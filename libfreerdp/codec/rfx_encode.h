@@ -23,6 +23,10 @@
 #include <freerdp/codec/rfx.h>
 #include <freerdp/api.h>
 
+FREERDP_LOCAL void rfx_encode_rgb_to_ycbcr(RFX_CONTEXT* WINPR_RESTRICT context,
+                                           const BYTE* WINPR_RESTRICT data, UINT32 width,
+                                           UINT32 height, UINT32 scanline,
+                                           INT16* pSrcDst[3]);
 FREERDP_LOCAL void rfx_encode_rgb(RFX_CONTEXT* WINPR_RESTRICT context,
                                   RFX_TILE* WINPR_RESTRICT tile);
 
@@ -77,6 +77,9 @@ struct S_RFX_CONTEXT_PRIV
 
 	wBufferPool* BufferPool;
 
+	/* tiles already part of the message being encoded */
+	REGION16_TILES* EncodedTiles;
+
 	/* profilers */
 	PROFILER_DEFINE(prof_rfx_decode_rgb)
 	PROFILER_DEFINE(prof_rfx_decode_component)
@@ -0,0 +1,75 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/platform.h>
+#include <winpr/sysinfo.h>
+#include <freerdp/config.h>
+#include <freerdp/log.h>
+
+#include "dsp_avx2.h"
+
+#define TAG FREERDP_TAG("codec.dsp.avx2")
+
+#if defined(WITH_SSE2)
+#if defined(_M_IX86) || defined(_M_AMD64) || defined(_M_IA64) || defined(_M_IX86_AMD64)
+#define SSE2_ENABLED
+#endif
+#endif
+
+#if defined(SSE2_ENABLED)
+#include <immintrin.h>
+
+static INT32 dsp_dot_avx2(const INT16* WINPR_RESTRICT a, const INT16* WINPR_RESTRICT b,
+                          size_t count)
+{
+	__m256i sum = _mm256_setzero_si256();
+	__m128i sum128 = { 0 };
+	size_t x = 0;
+	INT32 result = 0;
+
+	for (; x + 16 <= count; x += 16)
+	{
+		const __m256i va = _mm256_loadu_si256((const __m256i*)&a[x]);
+		const __m256i vb = _mm256_loadu_si256((const __m256i*)&b[x]);
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+	}
+
+	sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+	result = _mm_cvtsi128_si32(sum128);
+
+	for (; x < count; x++)
+		result += a[x] * b[x];
+
+	return result;
+}
+#endif
+
+/* Only the FIR dot product gains from 256 bit registers, the channel mixers stay on SSE2 */
+void dsp_init_avx2(FREERDP_DSP_KERNELS* kernels)
+{
+#if defined(SSE2_ENABLED)
+	if (!IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	WLog_VRB(TAG, "AVX2 optimizations");
+	kernels->dot = dsp_dot_avx2;
+#else
+	WINPR_UNUSED(kernels);
+#endif
+}
@@ -0,0 +1,122 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/platform.h>
+#include <winpr/sysinfo.h>
+#include <freerdp/config.h>
+#include <freerdp/log.h>
+
+#include "dsp_sse2.h"
+
+#define TAG FREERDP_TAG("codec.dsp.sse2")
+
+#if defined(WITH_SSE2)
+#if defined(_M_IX86) || defined(_M_AMD64) || defined(_M_IA64) || defined(_M_IX86_AMD64)
+#define SSE2_ENABLED
+#endif
+#endif
+
+#if defined(SSE2_ENABLED)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+static INT32 dsp_dot_sse2(const INT16* WINPR_RESTRICT a, const INT16* WINPR_RESTRICT b,
+                          size_t count)
+{
+	__m128i sum = _mm_setzero_si128();
+	size_t x = 0;
+	INT32 result = 0;
+
+	for (; x + 8 <= count; x += 8)
+	{
+		const __m128i va = _mm_loadu_si128((const __m128i*)&a[x]);
+		const __m128i vb = _mm_loadu_si128((const __m128i*)&b[x]);
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(va, vb));
+	}
+
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	result = _mm_cvtsi128_si32(sum);
+
+	for (; x < count; x++)
+		result += a[x] * b[x];
+
+	return result;
+}
+
+static void dsp_mono_to_stereo_sse2(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+                                    size_t frames)
+{
+	size_t x = 0;
+
+	for (; x + 8 <= frames; x += 8)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)&src[2 * x]);
+		_mm_storeu_si128((__m128i*)&dst[4 * x], _mm_unpacklo_epi16(v, v));
+		_mm_storeu_si128((__m128i*)&dst[4 * x + 16], _mm_unpackhi_epi16(v, v));
+	}
+
+	for (; x < frames; x++)
+	{
+		dst[4 * x + 0] = src[2 * x + 0];
+		dst[4 * x + 1] = src[2 * x + 1];
+		dst[4 * x + 2] = src[2 * x + 0];
+		dst[4 * x + 3] = src[2 * x + 1];
+	}
+}
+
+static void dsp_stereo_to_mono_sse2(const BYTE* WINPR_RESTRICT src, BYTE* WINPR_RESTRICT dst,
+                                    size_t frames)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	size_t x = 0;
+
+	for (; x + 8 <= frames; x += 8)
+	{
+		const __m128i lo = _mm_loadu_si128((const __m128i*)&src[4 * x]);
+		const __m128i hi = _mm_loadu_si128((const __m128i*)&src[4 * x + 16]);
+		const __m128i slo = _mm_srai_epi32(_mm_madd_epi16(lo, ones), 1);
+		const __m128i shi = _mm_srai_epi32(_mm_madd_epi16(hi, ones), 1);
+		_mm_storeu_si128((__m128i*)&dst[2 * x], _mm_packs_epi32(slo, shi));
+	}
+
+	for (; x < frames; x++)
+	{
+		const INT32 left = (INT16)(src[4 * x] | (src[4 * x + 1] << 8));
+		const INT32 right = (INT16)(src[4 * x + 2] | (src[4 * x + 3] << 8));
+		const INT32 value = (left + right) >> 1;
+
+		dst[2 * x + 0] = (BYTE)(value & 0xFF);
+		dst[2 * x + 1] = (BYTE)((value >> 8) & 0xFF);
+	}
+}
+#endif
+
+void dsp_init_sse2(FREERDP_DSP_KERNELS* kernels)
+{
+#if defined(SSE2_ENABLED)
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	WLog_VRB(TAG, "SSE2 optimizations");
+	kernels->dot = dsp_dot_sse2;
+	kernels->mono_to_stereo = dsp_mono_to_stereo_sse2;
+	kernels->stereo_to_mono = dsp_stereo_to_mono_sse2;
+#else
+	WINPR_UNUSED(kernels);
+#endif
+}
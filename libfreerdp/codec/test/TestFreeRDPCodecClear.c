@@ -68,6 +68,280 @@ fail:
 	return rc;
 }
 
+static void test_ClearFillImage(BYTE* data, UINT32 width, UINT32 height, UINT32 step)
+{
+	/* light background with a colored frame */
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			BYTE* p = &data[y * step + x * 4];
+			const BOOL frame = (x < 2) || (y < 2) || (x >= width - 2) || (y >= height - 2);
+			p[0] = frame ? 0x80 : 0xF0;
+			p[1] = frame ? 0x40 : 0xF0;
+			p[2] = frame ? 0x20 : 0xF0;
+			p[3] = 0xFF;
+		}
+	}
+
+	/* repeated text-like glyphs in a few colors */
+	for (UINT32 y = 10; y < 60; y += 16)
+	{
+		for (UINT32 x = 8; x + 8 < width; x += 9)
+		{
+			const UINT32 glyph = (x / 9) % 5;
+
+			for (UINT32 gy = 0; gy < 11; gy++)
+			{
+				for (UINT32 gx = 0; gx < 7; gx++)
+				{
+					BYTE* p = &data[(y + gy) * step + (x + gx) * 4];
+
+					if (((gx * 3 + gy * (glyph + 1)) % 7) < 3)
+					{
+						p[0] = (BYTE)(glyph * 40);
+						p[1] = 0;
+						p[2] = 0;
+					}
+				}
+			}
+		}
+	}
+
+	/* horizontal gradient, few colors */
+	for (UINT32 y = 64; y < 100; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			BYTE* p = &data[y * step + x * 4];
+			p[0] = (BYTE)(x / 4);
+			p[1] = 0x80;
+			p[2] = (BYTE)(255 - x / 4);
+		}
+	}
+
+	/* photo-like area, many colors */
+	for (UINT32 y = 104; y < height; y++)
+	{
+		for (UINT32 x = 64; x < width; x++)
+		{
+			BYTE* p = &data[y * step + x * 4];
+			p[0] = (BYTE)(x / 2 + y / 4);
+			p[1] = (BYTE)y;
+			p[2] = (BYTE)((x + y) / 3);
+		}
+	}
+}
+
+static BOOL test_ClearCompare(const BYTE* src, const BYTE* dst, UINT32 width, UINT32 height,
+                              UINT32 step, UINT32 lossyY)
+{
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			const BYTE* a = &src[y * step + x * 4];
+			const BYTE* b = &dst[y * step + x * 4];
+			const BOOL lossy = (y >= lossyY) && (x >= 64);
+
+			for (UINT32 c = 0; c < 3; c++)
+			{
+				const int diff = abs((int)a[c] - (int)b[c]);
+
+				if ((diff > 0) && (!lossy || (diff > 24)))
+				{
+					printf("pixel mismatch at %" PRIu32 "x%" PRIu32 "\n", x, y);
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_ClearRoundTrip(CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder, wStream* s,
+                                const BYTE* src, BYTE* dst, UINT32 width, UINT32 height,
+                                UINT32 lossyY, size_t* pSize)
+{
+	const UINT32 step = width * 4;
+
+	Stream_SetPosition(s, 0);
+
+	if (!clear_compose_message(encoder, s, src, PIXEL_FORMAT_BGRX32, step, width, height))
+		return FALSE;
+
+	*pSize = Stream_GetPosition(s);
+	memset(dst, 0, 1ull * step * height);
+
+	if (clear_decompress(decoder, Stream_Buffer(s), (UINT32)*pSize, width, height, dst,
+	                     PIXEL_FORMAT_BGRX32, step, 0, 0, width, height, NULL) != 0)
+		return FALSE;
+
+	return test_ClearCompare(src, dst, width, height, step, lossyY);
+}
+
+static BOOL test_ClearCompress(void)
+{
+	BOOL rc = FALSE;
+	size_t first = 0;
+	size_t second = 0;
+	size_t size = 0;
+	const UINT32 width = 300;
+	const UINT32 height = 180;
+	BYTE* src = calloc(width * height, 4);
+	BYTE* dst = calloc(width * height, 4);
+	wStream* s = Stream_New(NULL, 1024);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!src || !dst || !s || !encoder || !decoder)
+		goto fail;
+
+	test_ClearFillImage(src, width, height, width * 4);
+
+	if (!test_ClearRoundTrip(encoder, decoder, s, src, dst, width, height, 104, &first))
+		goto fail;
+
+	/* the second frame must decode against the caches filled by the first one */
+	if (!test_ClearRoundTrip(encoder, decoder, s, src, dst, width, height, 104, &second))
+		goto fail;
+
+	printf("clear_compose_message %" PRIu32 "x%" PRIu32 ": %" PRIuz " and %" PRIuz " bytes\n",
+	       width, height, first, second);
+
+	if ((first >= 3ull * width * height) || (second > first))
+		goto fail;
+
+	/* small tiles use the glyph cache */
+	if (!test_ClearRoundTrip(encoder, decoder, s, src, dst, 16, 16, UINT32_MAX, &size))
+		goto fail;
+
+	if (!test_ClearRoundTrip(encoder, decoder, s, src, dst, 16, 16, UINT32_MAX, &size))
+		goto fail;
+
+	if (size != 4)
+		goto fail;
+
+	/* a reset encoder must not refer to glyphs a new decoder never received */
+	clear_context_free(decoder);
+	decoder = clear_context_new(FALSE);
+
+	if (!decoder || !clear_context_reset(encoder))
+		goto fail;
+
+	if (!test_ClearRoundTrip(encoder, decoder, s, src, dst, 16, 16, UINT32_MAX, &size))
+		goto fail;
+
+	if (size <= 4)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("test_ClearCompress failed\n");
+
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	Stream_Free(s, TRUE);
+	free(src);
+	free(dst);
+	return rc;
+}
+
+static void test_ClearSetPixel(BYTE* data, UINT32 width, UINT32 x, UINT32 y, UINT32 color)
+{
+	BYTE* pixel = &data[4ull * (1ull * y * width + x)];
+
+	pixel[0] = color & 0xFF;
+	pixel[1] = (color >> 8) & 0xFF;
+	pixel[2] = (color >> 16) & 0xFF;
+	pixel[3] = 0xFF;
+}
+
+/* The band background must be the most frequent color, not the last one beating the first */
+static BOOL test_ClearBandBackground(void)
+{
+	BOOL rc = FALSE;
+	size_t size = 0;
+	const UINT32 width = 64;
+	const UINT32 height = 50;
+	const UINT32 colorA = 0x0000FF;
+	const UINT32 colorB = 0x00FF00;
+	const UINT32 colorC = 0xFF0000;
+	BYTE* src = calloc(width * height, 4);
+	BYTE* dst = calloc(width * height, 4);
+	wStream* s = Stream_New(NULL, 1024);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!src || !dst || !s || !encoder || !decoder)
+		goto fail;
+
+	/* Palette order A (1 pixel), B (most pixels), C, then many single pixel colors */
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			UINT32 color = colorB;
+
+			if ((x == 0) && (y == 0))
+				color = colorA;
+			else if ((y == 38) || (y == 39))
+				color = colorC;
+			else if (y >= 40)
+				color = 0x808000 + (y - 40) * width + x;
+
+			test_ClearSetPixel(src, width, x, y, color);
+		}
+	}
+
+	if (!test_ClearRoundTrip(encoder, decoder, s, src, dst, width, height, UINT32_MAX, &size))
+		goto fail;
+
+	/* glyphFlags, seqNumber and the composition header, then residual and band data */
+	UINT32 residualByteCount = 0;
+	UINT32 bandsByteCount = 0;
+
+	Stream_SealLength(s);
+	Stream_SetPosition(s, 2);
+	if (Stream_GetRemainingLength(s) < 12)
+		goto fail;
+
+	Stream_Read_UINT32(s, residualByteCount);
+	Stream_Read_UINT32(s, bandsByteCount);
+	Stream_Seek_UINT32(s);
+
+	/* The first band starts with its rectangle followed by the background color */
+	if ((bandsByteCount < 11) || !Stream_SafeSeek(s, residualByteCount + 8ull) ||
+	    (Stream_GetRemainingLength(s) < 3))
+	{
+		printf("test_ClearBandBackground: no band was encoded\n");
+		goto fail;
+	}
+
+	const BYTE* key = Stream_ConstPointer(s);
+	const UINT32 background = key[0] | (key[1] << 8) | ((UINT32)key[2] << 16);
+	if (background != colorB)
+	{
+		printf("test_ClearBandBackground: background 0x%06" PRIx32 ", expected 0x%06" PRIx32 "\n",
+		       background, colorB);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("test_ClearBandBackground failed\n");
+
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	Stream_Free(s, TRUE);
+	free(src);
+	free(dst);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -87,5 +361,11 @@ int TestFreeRDPCodecClear(int argc, char* argv[])
 	if (!test_ClearDecompressExample(4, 7, 15, TEST_CLEAR_EXAMPLE_4, sizeof(TEST_CLEAR_EXAMPLE_4)))
 		return -1;
 
+	if (!test_ClearCompress())
+		return -1;
+
+	if (!test_ClearBandBackground())
+		return -1;
+
 	return 0;
 }
@@ -84,6 +84,58 @@ fail:
 	free(dst);
 	return rc;
 }
+
+/* a reused scaler must give the same result as the one shot API, also when the
+ * sizes and formats change between calls */
+static BOOL TestFreeRDPImageScaler(FREERDP_IMAGE_SCALER* scaler, UINT32 srcFormat,
+                                   UINT32 dstFormat)
+{
+	BOOL rc = FALSE;
+	const UINT32 sizes[][4] = { { 64, 48, 32, 24 }, { 64, 48, 100, 77 }, { 64, 48, 32, 24 } };
+	const size_t maxSize = 4ULL * 100 * 77;
+	BYTE* src = calloc(64 * 48, 4);
+	BYTE* d1 = calloc(1, maxSize);
+	BYTE* d2 = calloc(1, maxSize);
+
+	if (!src || !d1 || !d2)
+		goto fail;
+
+	for (size_t x = 0; x < ARRAYSIZE(sizes); x++)
+	{
+		const UINT32 sw = sizes[x][0];
+		const UINT32 sh = sizes[x][1];
+		const UINT32 dw = sizes[x][2];
+		const UINT32 dh = sizes[x][3];
+
+		winpr_RAND_pseudo(src, 4ULL * sw * sh);
+		memset(d1, 0, maxSize);
+		memset(d2, 0, maxSize);
+
+		if (!freerdp_image_scale(d1, dstFormat, 0, 0, 0, dw, dh, src, srcFormat, 0, 0, 0, sw, sh))
+			goto fail;
+
+		if (!freerdp_image_scaler_scale(scaler, d2, dstFormat, 0, 0, 0, dw, dh, src, srcFormat, 0,
+		                                0, 0, sw, sh))
+			goto fail;
+
+		if (memcmp(d1, d2, maxSize) != 0)
+		{
+			fprintf(stderr, "[%s] %" PRIu32 "x%" PRIu32 " [%-20s] -> %" PRIu32 "x%" PRIu32
+			                " [%-20s] differs\n",
+			        __func__, sw, sh, FreeRDPGetColorFormatName(srcFormat), dw, dh,
+			        FreeRDPGetColorFormatName(dstFormat));
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(d1);
+	free(d2);
+	return rc;
+}
+
 int TestFreeRDPCodecCopy(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -124,5 +176,30 @@ int TestFreeRDPCodecCopy(int argc, char* argv[])
 		}
 	}
 
+	FREERDP_IMAGE_SCALER* scaler = freerdp_image_scaler_new();
+	if (!scaler)
+		return -1;
+
+	for (size_t x = 0; x < ARRAYSIZE(formats); x++)
+	{
+		const UINT32 SrcFormat = formats[x];
+		if (FreeRDPGetBytesPerPixel(SrcFormat) != 4)
+			continue;
+
+		for (size_t y = 0; y < ARRAYSIZE(formats); y++)
+		{
+			const UINT32 DstFormat = formats[y];
+			if (FreeRDPGetBytesPerPixel(DstFormat) != 4)
+				continue;
+
+			if (!TestFreeRDPImageScaler(scaler, SrcFormat, DstFormat))
+			{
+				freerdp_image_scaler_free(scaler);
+				return -1;
+			}
+		}
+	}
+
+	freerdp_image_scaler_free(scaler);
 	return 0;
 }
@@ -0,0 +1,180 @@
+#include <math.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/config.h>
+#include <freerdp/codec/dsp.h>
+#include <freerdp/codec/audio.h>
+
+#define TEST_TONE_FREQUENCY 1000.0
+#define TEST_TONE_AMPLITUDE 16000.0
+
+static AUDIO_FORMAT test_pcm_format(UINT16 channels, UINT32 rate)
+{
+	AUDIO_FORMAT format = { 0 };
+
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = channels;
+	format.nSamplesPerSec = rate;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = channels * 2;
+	format.nAvgBytesPerSec = rate * format.nBlockAlign;
+	return format;
+}
+
+static INT16 test_sample(const BYTE* data, size_t index)
+{
+	return (INT16)(data[2 * index] | (data[2 * index + 1] << 8));
+}
+
+static BOOL test_stereo_to_mono(void)
+{
+	BOOL rc = FALSE;
+	const AUDIO_FORMAT src = test_pcm_format(2, 22050);
+	const AUDIO_FORMAT dst = test_pcm_format(1, 22050);
+	FREERDP_DSP_CONTEXT* context = freerdp_dsp_context_new(TRUE);
+	wStream* out = Stream_New(NULL, 1024);
+	BYTE input[4 * 37] = { 0 };
+
+	if (!context || !out || !freerdp_dsp_context_reset(context, &dst, 0))
+		goto fail;
+
+	for (size_t x = 0; x < 37; x++)
+	{
+		const INT16 left = (INT16)(x * 1000 - 18000);
+		const INT16 right = (INT16)(-3 * (INT16)x);
+
+		input[4 * x + 0] = (BYTE)(left & 0xFF);
+		input[4 * x + 1] = (BYTE)((left >> 8) & 0xFF);
+		input[4 * x + 2] = (BYTE)(right & 0xFF);
+		input[4 * x + 3] = (BYTE)((right >> 8) & 0xFF);
+	}
+
+	if (!freerdp_dsp_encode(context, &src, input, sizeof(input), out))
+		goto fail;
+
+	if (Stream_GetPosition(out) != 37 * 2)
+		goto fail;
+
+	/* Channels are averaged, not dropped */
+	for (size_t x = 0; x < 37; x++)
+	{
+		const INT32 left = test_sample(input, 2 * x);
+		const INT32 right = test_sample(input, 2 * x + 1);
+
+		if (test_sample(Stream_Buffer(out), x) != (INT16)((left + right) >> 1))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		fprintf(stderr, "%s failed\n", __func__);
+	Stream_Free(out, TRUE);
+	freerdp_dsp_context_free(context);
+	return rc;
+}
+
+static BOOL test_resample(UINT32 srcRate, UINT32 dstRate, size_t block)
+{
+	BOOL rc = FALSE;
+	const AUDIO_FORMAT src = test_pcm_format(1, srcRate);
+	const AUDIO_FORMAT dst = test_pcm_format(2, dstRate);
+	FREERDP_DSP_CONTEXT* context = freerdp_dsp_context_new(TRUE);
+	wStream* out = Stream_New(NULL, 1024);
+	BYTE* input = calloc(srcRate, 2);
+	size_t frames = 0;
+	size_t crossings = 0;
+	double power = 0.0;
+
+	if (!context || !out || !input || !freerdp_dsp_context_reset(context, &dst, 0))
+		goto fail;
+
+	for (size_t x = 0; x < srcRate; x++)
+	{
+		const INT16 value = (INT16)lround(
+		    TEST_TONE_AMPLITUDE * sin(2.0 * M_PI * TEST_TONE_FREQUENCY * x / srcRate));
+
+		input[2 * x + 0] = (BYTE)(value & 0xFF);
+		input[2 * x + 1] = (BYTE)((value >> 8) & 0xFF);
+	}
+
+	/* One second of audio in small blocks, the filter state must carry over */
+	for (size_t x = 0; x < srcRate; x += block)
+	{
+		const size_t count = MIN(block, srcRate - x);
+
+		if (!freerdp_dsp_encode(context, &src, &input[2 * x], count * 2, out))
+			goto fail;
+	}
+
+	frames = Stream_GetPosition(out) / 4;
+
+	if ((frames > dstRate) || (frames + dstRate / 100 < dstRate))
+		goto fail;
+
+	/* Skip the filter delay, then check tone frequency and level */
+	for (size_t x = dstRate / 100; x < frames; x++)
+	{
+		const INT16 left = test_sample(Stream_Buffer(out), 2 * x);
+		const INT16 prev = test_sample(Stream_Buffer(out), 2 * x - 2);
+
+		if (left != test_sample(Stream_Buffer(out), 2 * x + 1))
+			goto fail;
+
+		if ((prev < 0) != (left < 0))
+			crossings++;
+
+		power += (double)left * left;
+	}
+
+	{
+		const size_t measured = frames - dstRate / 100;
+		const double expectedCrossings = 2.0 * TEST_TONE_FREQUENCY * measured / dstRate;
+		const double rms = sqrt(power / measured);
+
+		if (fabs(crossings - expectedCrossings) > 4.0)
+			goto fail;
+
+		if (fabs(rms - TEST_TONE_AMPLITUDE / sqrt(2.0)) > TEST_TONE_AMPLITUDE * 0.02)
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		fprintf(stderr, "%s [%" PRIu32 " -> %" PRIu32 "] failed\n", __func__, srcRate, dstRate);
+	free(input);
+	Stream_Free(out, TRUE);
+	freerdp_dsp_context_free(context);
+	return rc;
+}
+
+int TestFreeRDPCodecDsp(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+#if defined(WITH_DSP_FFMPEG)
+	/* PCM conversion is handled by libswresample */
+	return 0;
+#else
+	if (!test_stereo_to_mono())
+		return -1;
+
+	if (!test_resample(44100, 48000, 441))
+		return -1;
+
+	if (!test_resample(48000, 44100, 480))
+		return -1;
+
+	if (!test_resample(8000, 48000, 160))
+		return -1;
+
+	if (!test_resample(22050, 16000, 1000))
+		return -1;
+
+	return 0;
+#endif
+}
@@ -20,6 +20,7 @@
 #include <freerdp/crypto/crypto.h>
 
 #include "../progressive.h"
+#include "../rfx_constants.h"
 
 /**
  * Microsoft Progressive Codec Sample Data
@@ -820,76 +821,15 @@ static size_t test_memcmp_count(const BYTE* mem1, const BYTE* mem2, size_t size,
 }
 
 static int test_progressive_decode(PROGRESSIVE_CONTEXT* progressive, EGFX_SAMPLE_FILE files[4],
-                                   EGFX_SAMPLE_FILE bitmaps[4], int quarter, int count)
+                                   EGFX_SAMPLE_FILE bitmaps[4], int count)
 {
-	int nXSrc = 0;
-	int nYSrc = 0;
-
-	RECTANGLE_16 clippingRect = { 0 };
-	clippingRect.right = g_Width;
-	clippingRect.bottom = g_Height;
-
 	for (int pass = 0; pass < count; pass++)
 	{
+		/* Tiles are clipped to their region and written straight to the destination */
 		const int status =
 		    progressive_decompress(progressive, files[pass].buffer, files[pass].size, g_DstData,
 		                           PIXEL_FORMAT_XRGB32, g_DstStep, 0, 0, NULL, 0, 0);
 		printf("ProgressiveDecompress: status: %d pass: %d\n", status, pass + 1);
-		PROGRESSIVE_BLOCK_REGION* region = &(progressive->region);
-
-		switch (quarter)
-		{
-			case 0:
-				clippingRect.left = 0;
-				clippingRect.top = 0;
-				clippingRect.right = g_Width / 2;
-				clippingRect.bottom = g_Height / 2;
-				break;
-
-			case 1:
-				clippingRect.left = g_Width / 2;
-				clippingRect.top = g_Height / 2;
-				clippingRect.right = g_Width;
-				clippingRect.bottom = g_Height;
-				break;
-
-			case 2:
-				clippingRect.left = 0;
-				clippingRect.top = g_Height / 2;
-				clippingRect.right = g_Width / 2;
-				clippingRect.bottom = g_Height;
-				break;
-
-			case 3:
-				clippingRect.left = g_Width / 2;
-				clippingRect.top = 0;
-				clippingRect.right = g_Width;
-				clippingRect.bottom = g_Height / 2;
-				break;
-		}
-
-		for (UINT16 index = 0; index < region->numTiles; index++)
-		{
-			RFX_PROGRESSIVE_TILE* tile = region->tiles[index];
-
-			const RECTANGLE_16 tileRect = { tile->x, tile->y, tile->x + tile->width,
-				                            tile->y + tile->height };
-			RECTANGLE_16 updateRect = { 0 };
-			rectangles_intersection(&tileRect, &clippingRect, &updateRect);
-			const UINT16 nXDst = updateRect.left;
-			const UINT16 nYDst = updateRect.top;
-			const UINT16 nWidth = updateRect.right - updateRect.left;
-			const UINT16 nHeight = updateRect.bottom - updateRect.top;
-
-			if ((nWidth <= 0) || (nHeight <= 0))
-				continue;
-
-			nXSrc = nXDst - tile->x;
-			nYSrc = nYDst - tile->y;
-			freerdp_image_copy(g_DstData, PIXEL_FORMAT_XRGB32, g_DstStep, nXDst, nYDst, nWidth,
-			                   nHeight, tile->data, PIXEL_FORMAT_XRGB32, 64 * 4, nXSrc, nYSrc, NULL,
-			                   FREERDP_FLIP_NONE);
-		}
 
 		const size_t size = bitmaps[pass].size;
 		const size_t cnt = test_memcmp_count(g_DstData, bitmaps[pass].buffer, size, 1);
@@ -960,10 +900,10 @@ static int test_progressive_ms_sample(char* ms_sample_path)
 	{
 		printf("\nSample Image 1\n");
 		test_image_fill(g_DstData, g_DstStep, 0, 0, g_Width, g_Height, 0xFF000000);
-		test_progressive_decode(progressive, files[0][0], bitmaps[0][0], 0, count);
-		test_progressive_decode(progressive, files[0][1], bitmaps[0][1], 1, count);
-		test_progressive_decode(progressive, files[0][2], bitmaps[0][2], 2, count);
-		test_progressive_decode(progressive, files[0][3], bitmaps[0][3], 3, count);
+		test_progressive_decode(progressive, files[0][0], bitmaps[0][0], count);
+		test_progressive_decode(progressive, files[0][1], bitmaps[0][1], count);
+		test_progressive_decode(progressive, files[0][2], bitmaps[0][2], count);
+		test_progressive_decode(progressive, files[0][3], bitmaps[0][3], count);
 	}
 
 	/* image 2 */
@@ -972,10 +912,10 @@ static int test_progressive_ms_sample(char* ms_sample_path)
 	{
 		printf("\nSample Image 2\n"); /* sample data is in incorrect order */
 		test_image_fill(g_DstData, g_DstStep, 0, 0, g_Width, g_Height, 0xFF000000);
-		test_progressive_decode(progressive, files[1][0], bitmaps[1][0], 0, count);
-		test_progressive_decode(progressive, files[1][1], bitmaps[1][1], 1, count);
-		test_progressive_decode(progressive, files[1][2], bitmaps[1][2], 2, count);
-		test_progressive_decode(progressive, files[1][3], bitmaps[1][3], 3, count);
+		test_progressive_decode(progressive, files[1][0], bitmaps[1][0], count);
+		test_progressive_decode(progressive, files[1][1], bitmaps[1][1], count);
+		test_progressive_decode(progressive, files[1][2], bitmaps[1][2], count);
+		test_progressive_decode(progressive, files[1][3], bitmaps[1][3], count);
 	}
 
 	/* image 3 */
@@ -984,10 +924,10 @@ static int test_progressive_ms_sample(char* ms_sample_path)
 	{
 		printf("\nSample Image 3\n"); /* sample data is in incorrect order */
 		test_image_fill(g_DstData, g_DstStep, 0, 0, g_Width, g_Height, 0xFF000000);
-		test_progressive_decode(progressive, files[2][0], bitmaps[2][0], 0, count);
-		test_progressive_decode(progressive, files[2][1], bitmaps[2][1], 1, count);
-		test_progressive_decode(progressive, files[2][2], bitmaps[2][2], 2, count);
-		test_progressive_decode(progressive, files[2][3], bitmaps[2][3], 3, count);
+		test_progressive_decode(progressive, files[2][0], bitmaps[2][0], count);
+		test_progressive_decode(progressive, files[2][1], bitmaps[2][1], count);
+		test_progressive_decode(progressive, files[2][2], bitmaps[2][2], count);
+		test_progressive_decode(progressive, files[2][3], bitmaps[2][3], count);
 	}
 
 	progressive_context_free(progressive);
@@ -1114,6 +1054,383 @@ fail:
 	return res;
 }
 
+static UINT64 test_image_error(UINT32 format, const BYTE* orig, const BYTE* dec, UINT32 width,
+                               UINT32 height, UINT32 scanline)
+{
+	UINT64 error = 0;
+
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			BYTE a[3] = { 0 };
+			BYTE b[3] = { 0 };
+			const size_t offset = 1ull * y * scanline + 4ull * x;
+			FreeRDPSplitColor(FreeRDPReadColor(&orig[offset], format), format, &a[0], &a[1], &a[2],
+			                  NULL, NULL);
+			FreeRDPSplitColor(FreeRDPReadColor(&dec[offset], format), format, &b[0], &b[1], &b[2],
+			                  NULL, NULL);
+
+			for (size_t c = 0; c < 3; c++)
+				error += (UINT64)((a[c] - b[c]) * (a[c] - b[c]));
+		}
+	}
+
+	return error;
+}
+
+static BOOL test_encode_decode_passes(const char* path)
+{
+	BOOL res = FALSE;
+	int rc = 0;
+	UINT32 passes = 0;
+	UINT64 error = UINT64_MAX;
+	BYTE* resultData = NULL;
+	BYTE* dstData = NULL;
+	UINT32 dstSize = 0;
+	UINT32 ColorFormat = PIXEL_FORMAT_BGRX32;
+	REGION16 region = { 0 };
+	REGION16 invalidRegion = { 0 };
+	const RECTANGLE_16 damage = { 70, 10, 100, 40 };
+	wImage* image = winpr_image_new();
+	char* name = GetCombinedPath(path, "progressive.bmp");
+	PROGRESSIVE_CONTEXT* progressiveEnc = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* progressiveDec = progressive_context_new(FALSE);
+
+	region16_init(&region);
+	region16_init(&invalidRegion);
+	if (!image || !name || !progressiveEnc || !progressiveDec)
+		goto fail;
+
+	rc = winpr_image_read(image, name);
+	if (rc <= 0)
+		goto fail;
+
+	resultData = calloc(image->scanline, image->height);
+	if (!resultData)
+		goto fail;
+
+	rc = progressive_create_surface_context(progressiveDec, 0, image->width, image->height);
+	if (rc <= 0)
+		goto fail;
+
+	/* A coarse first pass, then upgrades for the unchanged image until it is at full quality */
+	do
+	{
+		rc = progressive_compress_ex(progressiveEnc, 0, image->data,
+		                             image->scanline * image->height, ColorFormat, image->width,
+		                             image->height, image->scanline, (passes == 0) ? NULL : &region,
+		                             &dstData, &dstSize);
+		if (rc < 0)
+			goto fail;
+
+		if (rc > 0)
+		{
+			rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, ColorFormat,
+			                            image->scanline, 0, 0, &invalidRegion, 0, 0);
+			if (rc < 0)
+				goto fail;
+
+			const UINT64 current = test_image_error(ColorFormat, image->data, resultData,
+			                                        image->width, image->height, image->scanline);
+			printf("pass %" PRIu32 ": %" PRIu32 " bytes, error %" PRIu64 "\n", passes, dstSize,
+			       current);
+
+			if (current >= error)
+				goto fail;
+
+			error = current;
+			passes++;
+		}
+	} while ((rc > 0) && (passes < 8));
+
+	if (passes != 3)
+		goto fail;
+
+	for (UINT32 y = 0; y < image->height; y++)
+	{
+		for (UINT32 x = 0; x < image->width; x++)
+		{
+			const size_t offset = 1ull * y * image->scanline + 4ull * x;
+			const DWORD a = FreeRDPReadColor(&image->data[offset], ColorFormat);
+			const DWORD b = FreeRDPReadColor(&resultData[offset], ColorFormat);
+			if (!colordiff(ColorFormat, a, b))
+				goto fail;
+		}
+	}
+
+	/* Damage restarts the touched tiles with a first pass */
+	if (!region16_union_rect(&region, &region, &damage))
+		goto fail;
+
+	rc = progressive_compress_ex(progressiveEnc, 0, image->data, image->scanline * image->height,
+	                             ColorFormat, image->width, image->height, image->scanline, &region,
+	                             &dstData, &dstSize);
+	if (rc <= 0)
+		goto fail;
+
+	region16_clear(&invalidRegion);
+	rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, ColorFormat,
+	                            image->scanline, 0, 0, &invalidRegion, 0, 0);
+	if (rc < 0)
+		goto fail;
+
+	{
+		const RECTANGLE_16* extents = region16_extents(&invalidRegion);
+		if ((extents->left != 64) || (extents->top != 0) || (extents->right != 128) ||
+		    (extents->bottom != 64))
+			goto fail;
+	}
+
+	res = TRUE;
+fail:
+	region16_uninit(&region);
+	region16_uninit(&invalidRegion);
+	progressive_context_free(progressiveEnc);
+	progressive_context_free(progressiveDec);
+	winpr_image_free(image, TRUE);
+	free(resultData);
+	free(name);
+	return res;
+}
+
+/* Turn every tile of a simple progressive message into a difference to the previous one */
+static BOOL test_progressive_mark_difference(BYTE* data, UINT32 size)
+{
+	size_t tiles = 0;
+	wStream sbuffer = { 0 };
+	wStream* s = Stream_StaticInit(&sbuffer, data, size);
+
+	while (Stream_GetRemainingLength(s) >= 6)
+	{
+		UINT16 blockType = 0;
+		UINT32 blockLen = 0;
+		const size_t start = Stream_GetPosition(s);
+
+		Stream_Read_UINT16(s, blockType);
+		Stream_Read_UINT32(s, blockLen);
+		if ((blockLen < 6) || (blockLen > size - start))
+			return FALSE;
+
+		if (blockType == PROGRESSIVE_WBT_REGION)
+		{
+			UINT16 numRects = 0;
+			BYTE numQuant = 0;
+			BYTE numProgQuant = 0;
+
+			Stream_Seek_UINT8(s); /* tileSize */
+			Stream_Read_UINT16(s, numRects);
+			Stream_Read_UINT8(s, numQuant);
+			Stream_Read_UINT8(s, numProgQuant);
+			Stream_Seek(s, 7); /* flags, numTiles, tileDataSize */
+			Stream_Seek(s, 8ull * numRects + 5ull * numQuant + 16ull * numProgQuant);
+
+			while (Stream_GetPosition(s) + 14 <= start + blockLen)
+			{
+				UINT32 tileLen = 0;
+				BYTE* tile = Stream_Pointer(s);
+
+				Stream_Seek_UINT16(s); /* blockType */
+				Stream_Read_UINT32(s, tileLen);
+				if (tileLen < 14)
+					return FALSE;
+
+				tile[13] |= RFX_TILE_DIFFERENCE; /* flags */
+				Stream_Seek(s, tileLen - 6);
+				tiles++;
+			}
+		}
+
+		Stream_SetPosition(s, start + blockLen);
+	}
+
+	return tiles > 0;
+}
+
+static BOOL test_progressive_compare(const BYTE* expected, const BYTE* actual, UINT32 width,
+                                     UINT32 height, UINT32 scanline, BYTE margin)
+{
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			BYTE a[3] = { 0 };
+			BYTE b[3] = { 0 };
+			const size_t offset = 1ull * y * scanline + 4ull * x;
+			FreeRDPSplitColor(FreeRDPReadColor(&expected[offset], PIXEL_FORMAT_BGRX32),
+			                  PIXEL_FORMAT_BGRX32, &a[0], &a[1], &a[2], NULL, NULL);
+			FreeRDPSplitColor(FreeRDPReadColor(&actual[offset], PIXEL_FORMAT_BGRX32),
+			                  PIXEL_FORMAT_BGRX32, &b[0], &b[1], &b[2], NULL, NULL);
+
+			for (size_t c = 0; c < 3; c++)
+			{
+				if (MAX(a[c], b[c]) - MIN(a[c], b[c]) > margin)
+				{
+					printf("[%s] [%" PRIu32 ":%" PRIu32 "] differs\n", __func__, x, y);
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * Decode a damaged area, the full surface and then a difference to it. The surface is not tile
+ * aligned, tiles are only allocated once used and full quality tiles keep their coefficients
+ * as base for later differences.
+ */
+static BOOL test_decode_difference(void)
+{
+	BOOL res = FALSE;
+	int rc = 0;
+	const UINT32 width = 160;
+	const UINT32 height = 100;
+	const UINT32 scanline = width * 4;
+	const UINT32 sentinel = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x11, 0x22, 0x33, 0xFF);
+	const RECTANGLE_16 damage = { 70, 10, 100, 40 };
+	BYTE* image = calloc(height, scanline);
+	BYTE* gray = calloc(height, scanline);
+	BYTE* resultData = calloc(height, scanline);
+	BYTE* previous = calloc(height, scanline);
+	BYTE* dstData = NULL;
+	UINT32 dstSize = 0;
+	REGION16 region = { 0 };
+	REGION16 invalidRegion = { 0 };
+	PROGRESSIVE_CONTEXT* progressiveEnc = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* progressiveDec = progressive_context_new(FALSE);
+	PROGRESSIVE_SURFACE_CONTEXT* surface = NULL;
+
+	region16_init(&region);
+	region16_init(&invalidRegion);
+	if (!image || !gray || !resultData || !previous || !progressiveEnc || !progressiveDec)
+		goto fail;
+
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			const size_t offset = 1ull * y * scanline + 4ull * x;
+			FreeRDPWriteColor(&image[offset], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, (BYTE)(x + 40), (BYTE)(2 * y),
+			                                  0xC0, 0xFF));
+			FreeRDPWriteColor(&gray[offset], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x80, 0x80, 0x80, 0xFF));
+			FreeRDPWriteColor(&resultData[offset], PIXEL_FORMAT_BGRX32, sentinel);
+		}
+	}
+
+	rc = progressive_create_surface_context(progressiveDec, 0, width, height);
+	if (rc <= 0)
+		goto fail;
+
+	surface = HashTable_GetItemValue(progressiveDec->SurfaceContexts, (void*)(ULONG_PTR)1);
+	if (!surface || (surface->gridWidth != 3) || (surface->gridHeight != 2))
+		goto fail;
+
+	/* Only the damaged area is written and only the tile it touches exists */
+	if (!region16_union_rect(&region, &region, &damage))
+		goto fail;
+
+	rc = progressive_compress(progressiveEnc, image, scanline * height, PIXEL_FORMAT_BGRX32, width,
+	                          height, scanline, &region, &dstData, &dstSize);
+	if (rc < 0)
+		goto fail;
+
+	rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, PIXEL_FORMAT_BGRX32,
+	                            scanline, 0, 0, &invalidRegion, 0, 0);
+	if (rc < 0)
+		goto fail;
+
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			const size_t offset = 1ull * y * scanline + 4ull * x;
+			const BOOL inside = (x >= damage.left) && (x < damage.right) && (y >= damage.top) &&
+			                    (y < damage.bottom);
+			const UINT32 color = FreeRDPReadColor(&resultData[offset], PIXEL_FORMAT_BGRX32);
+
+			if (inside ? !colordiff(PIXEL_FORMAT_BGRX32, color,
+			                        FreeRDPReadColor(&image[offset], PIXEL_FORMAT_BGRX32))
+			           : (color != sentinel))
+			{
+				printf("[%s] damage [%" PRIu32 ":%" PRIu32 "] %08" PRIX32 "\n", __func__, x, y,
+				       color);
+				goto fail;
+			}
+		}
+	}
+
+	for (size_t zIdx = 0; zIdx < surface->gridSize; zIdx++)
+	{
+		const RFX_PROGRESSIVE_TILE* tile = surface->tiles[zIdx];
+
+		if ((zIdx == 1) != (tile != NULL))
+			goto fail;
+
+		/* No upgrades follow a full quality tile, a difference may */
+		if (tile && (!tile->current || tile->sign))
+			goto fail;
+	}
+
+	/* The whole surface, the last column and row of tiles are clipped to it */
+	region16_clear(&invalidRegion);
+	rc = progressive_compress(progressiveEnc, image, scanline * height, PIXEL_FORMAT_BGRX32, width,
+	                          height, scanline, NULL, &dstData, &dstSize);
+	if (rc < 0)
+		goto fail;
+
+	rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, PIXEL_FORMAT_BGRX32,
+	                            scanline, 0, 0, &invalidRegion, 0, 0);
+	if (rc < 0)
+		goto fail;
+
+	{
+		const RECTANGLE_16* extents = region16_extents(&invalidRegion);
+		if ((extents->left != 0) || (extents->top != 0) || (extents->right != width) ||
+		    (extents->bottom != height))
+			goto fail;
+	}
+
+	if (!test_progressive_compare(image, resultData, width, height, scanline, 0x25))
+		goto fail;
+
+	CopyMemory(previous, resultData, 1ull * height * scanline);
+
+	/* Mid gray has (almost) no coefficients, as a difference it leaves the image as is */
+	progressive_context_free(progressiveEnc);
+	progressiveEnc = progressive_context_new(TRUE);
+	if (!progressiveEnc)
+		goto fail;
+
+	rc = progressive_compress(progressiveEnc, gray, scanline * height, PIXEL_FORMAT_BGRX32, width,
+	                          height, scanline, NULL, &dstData, &dstSize);
+	if ((rc < 0) || !test_progressive_mark_difference(dstData, dstSize))
+		goto fail;
+
+	rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, PIXEL_FORMAT_BGRX32,
+	                            scanline, 0, 0, &invalidRegion, 0, 0);
+	if (rc < 0)
+		goto fail;
+
+	if (!test_progressive_compare(previous, resultData, width, height, scanline, 8))
+		goto fail;
+
+	res = TRUE;
+fail:
+	region16_uninit(&region);
+	region16_uninit(&invalidRegion);
+	progressive_context_free(progressiveEnc);
+	progressive_context_free(progressiveDec);
+	free(image);
+	free(gray);
+	free(resultData);
+	free(previous);
+	return res;
+}
+
 static BOOL read_cmd(FILE* fp, RDPGFX_SURFACE_COMMAND* cmd, UINT32* frameId)
 {
 	WINPR_ASSERT(fp);
@@ -1485,6 +1802,10 @@ int TestFreeRDPCodecProgressive(int argc, char* argv[])
 		    */
 		if (!test_encode_decode(ms_sample_path))
 			goto fail;
+		if (!test_encode_decode_passes(ms_sample_path))
+			goto fail;
+		if (!test_decode_difference())
+			goto fail;
 		rc = 0;
 	}
 
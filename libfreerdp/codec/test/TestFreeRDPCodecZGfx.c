@@ -253,6 +253,89 @@ fail:
 	return rc;
 }
 
+static BOOL test_ZGfxRoundTripBuffer(ZGFX_CONTEXT* compressor, ZGFX_CONTEXT* decompressor,
+                                      const BYTE* pSrcData, UINT32 SrcSize, UINT32* pTotal)
+{
+	BOOL rc = FALSE;
+	UINT32 Flags = 0;
+	UINT32 DstSize = 0;
+	BYTE* pDstData = NULL;
+	UINT32 CompressedSize = 0;
+	BYTE* pCompressedData = NULL;
+
+	if (zgfx_compress(compressor, pSrcData, SrcSize, &pCompressedData, &CompressedSize, &Flags) <
+	    0)
+		goto fail;
+
+	if (zgfx_decompress(decompressor, pCompressedData, CompressedSize, &pDstData, &DstSize, 0) < 0)
+		goto fail;
+
+	if ((DstSize != SrcSize) || (memcmp(pDstData, pSrcData, SrcSize) != 0))
+	{
+		printf("test_ZGfxRoundTrip: output mismatch (%" PRIu32 " bytes, expected %" PRIu32 ")\n",
+		       DstSize, SrcSize);
+		goto fail;
+	}
+
+	*pTotal += CompressedSize;
+	rc = TRUE;
+fail:
+	free(pDstData);
+	free(pCompressedData);
+	return rc;
+}
+
+static int test_ZGfxRoundTrip(UINT32 level)
+{
+	int rc = -1;
+	UINT32 total = 0;
+	UINT32 uncompressed = 0;
+	const UINT32 size = 200000;
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+	BYTE* buffer = calloc(size, 1);
+
+	if (!compressor || !decompressor || !buffer)
+		goto fail;
+
+	if (!zgfx_set_compression_level(compressor, level))
+		goto fail;
+
+	/* Pseudo random data interleaved with repetitive patterns */
+	for (UINT32 x = 0; x < size; x++)
+	{
+		if ((x / 4096) % 3 == 0)
+			buffer[x] = (BYTE)((x * 7919u) ^ (x >> 5) ^ (x >> 13));
+		else
+			buffer[x] = (BYTE)(x % 61);
+	}
+
+	/* Multipart, matches reaching into previous PDUs and tiny PDUs */
+	const UINT32 sizes[] = { size, 1, 2, 3, 100, 65535, 65536, size };
+
+	for (size_t x = 0; x < ARRAYSIZE(sizes); x++)
+	{
+		const UINT32 offset = (UINT32)((x * 12345u) % (size - sizes[x] + 1));
+
+		if (!test_ZGfxRoundTripBuffer(compressor, decompressor, &buffer[offset], sizes[x], &total))
+			goto fail;
+
+		uncompressed += sizes[x];
+	}
+
+	printf("level %" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes\n", level, uncompressed, total);
+
+	if ((level != ZGFX_COMPRESSION_LEVEL_NONE) && (total >= uncompressed / 2))
+		goto fail;
+
+	rc = 0;
+fail:
+	free(buffer);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -270,5 +353,11 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	for (UINT32 level = ZGFX_COMPRESSION_LEVEL_NONE; level <= ZGFX_COMPRESSION_LEVEL_BEST; level++)
+	{
+		if (test_ZGfxRoundTrip(level) < 0)
+			return -1;
+	}
+
 	return 0;
 }
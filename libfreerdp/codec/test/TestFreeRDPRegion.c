@@ -815,6 +815,178 @@ out:
 	return retCode;
 }
 
+#define COVERAGE_SIZE 400
+
+static BOOL coverage(const REGION16* region, BYTE* map, BOOL strict)
+{
+	UINT32 nbRects = 0;
+	const RECTANGLE_16* rects = region16_rects(region, &nbRects);
+
+	ZeroMemory(map, COVERAGE_SIZE * COVERAGE_SIZE);
+
+	for (UINT32 i = 0; i < nbRects; i++)
+	{
+		const RECTANGLE_16* r = &rects[i];
+
+		/* bands are sorted, items of a band are sorted and must not touch */
+		if ((i > 0) && (r->top == rects[i - 1].top) &&
+		    (strict ? (r->left <= rects[i - 1].right) : (r->left < rects[i - 1].right)))
+			return FALSE;
+
+		if ((i > 0) && (r->top != rects[i - 1].top) && (r->top < rects[i - 1].bottom))
+			return FALSE;
+
+		for (UINT16 y = r->top; y < r->bottom; y++)
+		{
+			for (UINT16 x = r->left; x < r->right; x++)
+			{
+				if (map[y * COVERAGE_SIZE + x]++)
+					return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static int test_union_rects(void)
+{
+	REGION16 batch;
+	REGION16 single;
+	int retCode = -1;
+	RECTANGLE_16 rects[200] = { 0 };
+	BYTE* batchMap = calloc(COVERAGE_SIZE, COVERAGE_SIZE);
+	BYTE* singleMap = calloc(COVERAGE_SIZE, COVERAGE_SIZE);
+	region16_init(&batch);
+	region16_init(&single);
+
+	if (!batchMap || !singleMap)
+		goto out;
+
+	/* rectangles on a coarse grid so that they often touch and share edges */
+	srand(42);
+
+	for (int i = 0; i < 200; i++)
+	{
+		rects[i].left = (UINT16)((rand() % 40) * 8);
+		rects[i].top = (UINT16)((rand() % 40) * 8);
+		rects[i].right = (UINT16)(rects[i].left + (rand() % 10) * 8);
+		rects[i].bottom = (UINT16)(rects[i].top + (rand() % 10) * 8);
+	}
+
+	for (int round = 0; round < 4; round++)
+	{
+		RECTANGLE_16* cur = &rects[round * 50];
+
+		for (int i = 0; i < 50; i++)
+		{
+			if (rectangle_is_empty(&cur[i]))
+				continue;
+
+			if (!region16_union_rect(&single, &single, &cur[i]))
+				goto out;
+		}
+
+		if (!region16_union_rects(&batch, &batch, cur, 50))
+			goto out;
+
+		/* region16_union_rect may keep touching items, so compare the covered area */
+		if (!coverage(&batch, batchMap, TRUE) || !coverage(&single, singleMap, FALSE))
+			goto out;
+
+		if (memcmp(batchMap, singleMap, COVERAGE_SIZE * COVERAGE_SIZE) != 0)
+			goto out;
+
+		if (region16_n_rects(&batch) > region16_n_rects(&single))
+			goto out;
+
+		if (!compareRectangles(region16_extents(&batch), region16_extents(&single), 1))
+			goto out;
+	}
+
+	retCode = 0;
+out:
+	free(batchMap);
+	free(singleMap);
+	region16_uninit(&batch);
+	region16_uninit(&single);
+	return retCode;
+}
+
+static int test_tiles(void)
+{
+	REGION16 region;
+	int retCode = -1;
+	const RECTANGLE_16* rects = NULL;
+	UINT32 nbRects = 0;
+	REGION16_TILES* tiles = region16_tiles_new(200, 150);
+	RECTANGLE_16 r1 = { 10, 10, 20, 20 };
+	RECTANGLE_16 r2 = { 70, 60, 190, 140 };
+	RECTANGLE_16 expected[] = { { 0, 0, 192, 64 }, { 64, 64, 192, 150 } };
+	region16_init(&region);
+
+	if (!tiles)
+		goto out;
+
+	region16_tiles_mark_rect(tiles, &r1);
+	region16_tiles_mark_rect(tiles, &r2);
+
+	if (!region16_tiles_is_marked(tiles, 0, 0) || region16_tiles_is_marked(tiles, 0, 1) ||
+	    !region16_tiles_is_marked(tiles, 2, 2) || region16_tiles_is_marked(tiles, 3, 0) ||
+	    region16_tiles_is_marked(tiles, 4, 0))
+		goto out;
+
+	if (!region16_tiles_to_region(tiles, &region))
+		goto out;
+
+	rects = region16_rects(&region, &nbRects);
+
+	if ((nbRects != ARRAYSIZE(expected)) || !compareRectangles(rects, expected, nbRects))
+		goto out;
+
+	/* back to tiles, the same tiles must be marked */
+	if (!region16_tiles_reset(tiles, 200, 150))
+		goto out;
+
+	region16_tiles_mark_region(tiles, &region);
+
+	for (UINT32 y = 0; y < 3; y++)
+	{
+		for (UINT32 x = 0; x < 4; x++)
+		{
+			const BOOL expect = (x < 3) && ((y == 0) || (x > 0));
+
+			if (region16_tiles_is_marked(tiles, x, y) != expect)
+				goto out;
+		}
+	}
+
+	/* a wide surface spans several bitmap words per row */
+	if (!region16_tiles_reset(tiles, 65535, 128))
+		goto out;
+
+	if (!region16_tiles_mark(tiles, 63, 1) || !region16_tiles_mark(tiles, 64, 1) ||
+	    !region16_tiles_mark(tiles, 1023, 1) || region16_tiles_mark(tiles, 1024, 1))
+		goto out;
+
+	if (!region16_tiles_to_region(tiles, &region))
+		goto out;
+
+	{
+		RECTANGLE_16 wide[] = { { 63 * 64, 64, 65 * 64, 128 }, { 1023 * 64, 64, 65535, 128 } };
+		rects = region16_rects(&region, &nbRects);
+
+		if ((nbRects != ARRAYSIZE(wide)) || !compareRectangles(rects, wide, nbRects))
+			goto out;
+	}
+
+	retCode = 0;
+out:
+	region16_tiles_free(tiles);
+	region16_uninit(&region);
+	return retCode;
+}
+
 typedef int (*TestFunction)(void);
 struct UnitaryTest
 {
@@ -836,6 +1008,8 @@ static struct UnitaryTest tests[] = { { "Basic trivial tests", test_basic },
 	                                  { "norbert's case", test_norbert_case },
 	                                  { "norbert's case 2", test_norbert2_case },
 	                                  { "empty rectangle case", test_empty_rectangle },
+	                                  { "batched union", test_union_rects },
+	                                  { "dirty tiles", test_tiles },
 
 	                                  { NULL, NULL } };
 
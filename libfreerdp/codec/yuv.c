@@ -823,21 +823,17 @@ static BOOL pool_encode(YUV_CONTEXT* WINPR_RESTRICT context, PTP_WORK_CALLBACK c
 		return TRUE;
 	}
 
-	/* case where we use threads */
-	for (UINT32 x = 0; x < numRegionRects; x++)
-	{
-		const RECTANGLE_16* rect = &regionRects[x];
-		const UINT32 height = rect->bottom - rect->top;
-		const UINT32 steps = (height + context->heightStep / 2) / context->heightStep;
-
-		waitCount += steps;
-	}
+	/* case where we use threads
+	 * Rectangles are split in stripes of whole 16 line blocks, the AVC444v1 auxiliary
+	 * view is laid out in 16 line blocks relative to the top of the converted area and
+	 * small (tile sized) rectangles must result in at least one stripe. */
+	const UINT32 heightStep = MAX(16, context->heightStep & ~15u);
 
 	for (UINT32 x = 0; x < numRegionRects; x++)
 	{
 		const RECTANGLE_16* rect = &regionRects[x];
 		const UINT32 height = rect->bottom - rect->top;
-		const UINT32 steps = (height + context->heightStep / 2) / context->heightStep;
+		const UINT32 steps = (height + heightStep - 1) / heightStep;
 
 		for (UINT32 y = 0; y < steps; y++)
 		{
@@ -854,7 +850,8 @@ static BOOL pool_encode(YUV_CONTEXT* WINPR_RESTRICT context, PTP_WORK_CALLBACK c
 			}
 
 			current = &context->work_enc_params[waitCount];
-			r.top += y * context->heightStep;
+			r.top += y * heightStep;
+			r.bottom = (UINT16)MIN(rect->bottom, r.top + heightStep);
 			*current = pool_encode_fill(&r, context, pSrcData, nSrcStep, SrcFormat, iStride,
 			                            pYUVLumaData, pYUVChromaData);
 			if (!submit_object(&context->work_objects[waitCount], cb, current, context))
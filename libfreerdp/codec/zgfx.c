@@ -40,6 +40,24 @@
  * Minimum match length: 3 bytes
  */
 
+#define ZGFX_HASH_BITS 16
+#define ZGFX_HASH_SIZE (1u << ZGFX_HASH_BITS)
+#define ZGFX_MIN_MATCH 3
+
+typedef struct
+{
+	UINT32 maxChain;
+	UINT32 niceLength;
+	BOOL lazy;
+} ZGFX_EFFORT;
+
+static const ZGFX_EFFORT ZGFX_EFFORT_TABLE[] = {
+	{ 0, 0, FALSE },      /* ZGFX_COMPRESSION_LEVEL_NONE */
+	{ 8, 32, FALSE },     /* ZGFX_COMPRESSION_LEVEL_FAST */
+	{ 64, 258, TRUE },    /* ZGFX_COMPRESSION_LEVEL_DEFAULT */
+	{ 1024, 65535, TRUE } /* ZGFX_COMPRESSION_LEVEL_BEST */
+};
+
 typedef struct
 {
 	UINT32 prefixLength;
@@ -67,6 +85,14 @@ struct S_ZGFX_CONTEXT
 	BYTE HistoryBuffer[2500000];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	/* compressor state */
+	UINT32 CompressionLevel;
+	UINT32 HistoryFill;
+	UINT32* HashHead;
+	UINT32* HashChain;
+	UINT16 LiteralCode[256];
+	BYTE LiteralBits[256];
 };
 
 static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] = {
@@ -493,20 +519,316 @@ fail:
 	return status;
 }
 
+static INLINE UINT32 zgfx_hash(const BYTE* WINPR_RESTRICT data)
+{
+	const UINT32 value = ((UINT32)data[0] << 16) | ((UINT32)data[1] << 8) | data[2];
+	return (value * 2654435761u) >> (32 - ZGFX_HASH_BITS);
+}
+
+static INLINE void zgfx_write_bits(wBitStream* WINPR_RESTRICT bs, UINT32 bits, UINT32 nbits)
+{
+	if (nbits > 0)
+		BitStream_Write_Bits(bs, bits, nbits);
+}
+
+static INLINE const ZGFX_TOKEN* zgfx_distance_token(UINT32 distance)
+{
+	for (size_t x = 0; ZGFX_TOKEN_TABLE[x].prefixLength != 0; x++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[x];
+
+		if (token->tokenType != 1)
+			continue;
+
+		if ((distance >= token->valueBase) &&
+		    ((distance - token->valueBase) < (1ull << token->valueBits)))
+			return token;
+	}
+
+	return NULL;
+}
+
+static INLINE UINT32 zgfx_length_cost(UINT32 length)
+{
+	UINT32 extra = 2;
+	UINT32 base = 4;
+
+	if (length == 3)
+		return 1;
+
+	while (length >= base * 2)
+	{
+		base *= 2;
+		extra++;
+	}
+
+	/* prefix of (extra - 1) one bits terminated by a zero bit, followed by the value */
+	return extra + extra;
+}
+
+static INLINE UINT32 zgfx_match_cost(UINT32 distance, UINT32 length)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+
+	if (!token)
+		return UINT32_MAX;
+
+	return token->prefixLength + token->valueBits + zgfx_length_cost(length);
+}
+
+static INLINE void zgfx_write_literal(ZGFX_CONTEXT* WINPR_RESTRICT zgfx,
+                                      wBitStream* WINPR_RESTRICT bs, BYTE c)
+{
+	zgfx_write_bits(bs, zgfx->LiteralCode[c], zgfx->LiteralBits[c]);
+}
+
+static INLINE void zgfx_write_match(wBitStream* WINPR_RESTRICT bs, UINT32 distance, UINT32 length)
+{
+	UINT32 extra = 2;
+	UINT32 base = 4;
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+
+	WINPR_ASSERT(token);
+	WINPR_ASSERT(length >= ZGFX_MIN_MATCH);
+
+	zgfx_write_bits(bs, token->prefixCode, token->prefixLength);
+	zgfx_write_bits(bs, distance - token->valueBase, token->valueBits);
+
+	if (length == 3)
+	{
+		zgfx_write_bits(bs, 0, 1);
+		return;
+	}
+
+	while (length >= base * 2)
+	{
+		base *= 2;
+		extra++;
+	}
+
+	zgfx_write_bits(bs, ((1u << (extra - 1)) - 1) << 1, extra);
+	zgfx_write_bits(bs, length - base, extra);
+}
+
+static INLINE UINT32 zgfx_match_length(const ZGFX_CONTEXT* WINPR_RESTRICT zgfx, UINT32 index,
+                                       const BYTE* WINPR_RESTRICT src, UINT32 maxLength)
+{
+	UINT32 length = 0;
+
+	while (length < maxLength)
+	{
+		const UINT32 run = MIN(maxLength - length, zgfx->HistoryBufferSize - index);
+		const BYTE* hist = &zgfx->HistoryBuffer[index];
+		const BYTE* cur = &src[length];
+		UINT32 n = 0;
+
+		while ((n + 8 <= run) && (memcmp(&hist[n], &cur[n], 8) == 0))
+			n += 8;
+
+		while ((n < run) && (hist[n] == cur[n]))
+			n++;
+
+		length += n;
+
+		if (n < run)
+			break;
+
+		index = 0;
+	}
+
+	return length;
+}
+
+/**
+ * Walk the hash chain of the history position @index looking for the longest
+ * match of the data at @src. Only distances up to @maxDistance are considered,
+ * which guarantees the decoder has the referenced bytes in its history.
+ */
+static INLINE UINT32 zgfx_find_match(const ZGFX_CONTEXT* WINPR_RESTRICT zgfx, UINT32 index,
+                                     const BYTE* WINPR_RESTRICT src, UINT32 maxLength,
+                                     UINT32 maxDistance, UINT32* WINPR_RESTRICT pDistance)
+{
+	const ZGFX_EFFORT* effort = &ZGFX_EFFORT_TABLE[zgfx->CompressionLevel];
+	const UINT32 size = zgfx->HistoryBufferSize;
+	UINT32 bestLength = 0;
+	UINT32 lastDistance = 0;
+	UINT32 candidate = zgfx->HashHead[zgfx_hash(src)];
+
+	for (UINT32 chain = 0; chain < effort->maxChain; chain++)
+	{
+		const UINT32 distance = (index + size - candidate) % size;
+
+		/* Chains are not cleared, stale entries end the walk once distances stop growing. */
+		if ((distance <= lastDistance) || (distance > maxDistance))
+			break;
+
+		lastDistance = distance;
+
+		if (zgfx->HistoryBuffer[(candidate + bestLength) % size] == src[bestLength])
+		{
+			const UINT32 length = zgfx_match_length(zgfx, candidate, src, maxLength);
+
+			if (length > bestLength)
+			{
+				bestLength = length;
+				*pDistance = distance;
+
+				if ((length >= effort->niceLength) || (length == maxLength))
+					break;
+			}
+		}
+
+		candidate = zgfx->HashChain[candidate];
+	}
+
+	return bestLength;
+}
+
+static INLINE BOOL zgfx_match_worthwhile(const ZGFX_CONTEXT* WINPR_RESTRICT zgfx,
+                                         const BYTE* WINPR_RESTRICT src, UINT32 distance,
+                                         UINT32 length)
+{
+	UINT32 literalCost = 0;
+
+	if (length < ZGFX_MIN_MATCH)
+		return FALSE;
+
+	if (length > 8)
+		return TRUE;
+
+	for (UINT32 x = 0; x < length; x++)
+		literalCost += zgfx->LiteralBits[src[x]];
+
+	return zgfx_match_cost(distance, length) < literalCost;
+}
+
+static INLINE void zgfx_hash_insert(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, UINT32 index,
+                                    const BYTE* WINPR_RESTRICT src)
+{
+	const UINT32 hash = zgfx_hash(src);
+	zgfx->HashChain[index] = zgfx->HashHead[hash];
+	zgfx->HashHead[hash] = index;
+}
+
+/**
+ * Encode a segment with the RDP8 LZ77 + Huffman scheme into zgfx->OutputBuffer.
+ * The segment must already be present in the history buffer at @startIndex.
+ *
+ * @return the number of bytes written (including the trailing padding byte) or 0
+ * if the compressed form would not be smaller than the raw segment.
+ */
+static UINT32 zgfx_compress_segment_rdp8(ZGFX_CONTEXT* WINPR_RESTRICT zgfx,
+                                         const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcSize,
+                                         UINT32 startIndex, UINT32 historyFill)
+{
+	wBitStream bs = { 0 };
+	const ZGFX_EFFORT* effort = &ZGFX_EFFORT_TABLE[zgfx->CompressionLevel];
+	const UINT32 size = zgfx->HistoryBufferSize;
+	const UINT32 limit = MIN(SrcSize, sizeof(zgfx->OutputBuffer) - 8);
+	UINT32 pos = 0;
+
+	BitStream_Attach(&bs, zgfx->OutputBuffer, sizeof(zgfx->OutputBuffer));
+
+	while (pos < SrcSize)
+	{
+		UINT32 length = 0;
+		UINT32 distance = 0;
+		const UINT32 index = (startIndex + pos) % size;
+		const UINT32 remaining = SrcSize - pos;
+
+		if (remaining >= ZGFX_MIN_MATCH)
+		{
+			const UINT32 maxDistance = MIN(historyFill + pos, size - SrcSize);
+			length = zgfx_find_match(zgfx, index, &pSrcData[pos], remaining, maxDistance,
+			                         &distance);
+
+			if (length && !zgfx_match_worthwhile(zgfx, &pSrcData[pos], distance, length))
+				length = 0;
+
+			zgfx_hash_insert(zgfx, index, &pSrcData[pos]);
+
+			if (effort->lazy && (length > 0) && (length < effort->niceLength) &&
+			    (remaining > ZGFX_MIN_MATCH))
+			{
+				UINT32 nextDistance = 0;
+				const UINT32 nextIndex = (index + 1) % size;
+				const UINT32 nextMaxDistance = MIN(historyFill + pos + 1, size - SrcSize);
+				const UINT32 nextLength =
+				    zgfx_find_match(zgfx, nextIndex, &pSrcData[pos + 1], remaining - 1,
+				                    nextMaxDistance, &nextDistance);
+
+				/* Defer to the next position if it yields a strictly longer match */
+				if ((nextLength > length + 1) &&
+				    zgfx_match_worthwhile(zgfx, &pSrcData[pos + 1], nextDistance, nextLength))
+					length = 0;
+			}
+		}
+
+		if (length == 0)
+		{
+			zgfx_write_literal(zgfx, &bs, pSrcData[pos]);
+			pos++;
+		}
+		else
+		{
+			zgfx_write_match(&bs, distance, length);
+
+			for (UINT32 x = 1; x < length; x++)
+			{
+				if (pos + x + ZGFX_MIN_MATCH > SrcSize)
+					break;
+
+				zgfx_hash_insert(zgfx, (index + x) % size, &pSrcData[pos + x]);
+			}
+
+			pos += length;
+		}
+
+		if (((bs.position + 7) / 8) + 1 >= limit)
+			return 0;
+	}
+
+	BitStream_Flush(&bs);
+
+	const UINT32 DstSize = (bs.position + 7) / 8;
+	zgfx->OutputBuffer[DstSize] = (BYTE)((DstSize * 8) - bs.position);
+	return DstSize + 1;
+}
+
 static BOOL zgfx_compress_segment(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, wStream* WINPR_RESTRICT s,
                                   const BYTE* WINPR_RESTRICT pSrcData, UINT32 SrcSize,
                                   UINT32* WINPR_RESTRICT pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	UINT32 DstSize = 0;
+	BYTE header = ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
+	const UINT32 startIndex = zgfx->HistoryIndex;
+	const UINT32 historyFill = zgfx->HistoryFill;
+
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return FALSE;
 	}
 
-	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags));         /* header (1 byte) */
-	Stream_Write(s, pSrcData, SrcSize);
+	/* The decoder adds every segment to its history, compressed or not. */
+	zgfx_history_buffer_ring_write(zgfx, pSrcData, SrcSize);
+	zgfx->HistoryFill = MIN(zgfx->HistoryBufferSize, historyFill + SrcSize);
+
+	if ((zgfx->CompressionLevel != ZGFX_COMPRESSION_LEVEL_NONE) && zgfx->HashHead &&
+	    (SrcSize <= sizeof(zgfx->OutputBuffer)))
+		DstSize = zgfx_compress_segment_rdp8(zgfx, pSrcData, SrcSize, startIndex, historyFill);
+
+	if (DstSize > 0)
+		header |= PACKET_COMPRESSED;
+
+	(*pFlags) |= header;
+	Stream_Write_UINT8(s, header); /* header (1 byte) */
+
+	if (DstSize > 0)
+		Stream_Write(s, zgfx->OutputBuffer, DstSize);
+	else
+		Stream_Write(s, pSrcData, SrcSize);
+
 	return TRUE;
 }
 
@@ -606,9 +928,48 @@ int zgfx_compress(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, const BYTE* WINPR_RESTRICT
 	return status;
 }
 
+BOOL zgfx_set_compression_level(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, UINT32 level)
+{
+	WINPR_ASSERT(zgfx);
+
+	if (level > ZGFX_COMPRESSION_LEVEL_BEST)
+		return FALSE;
+
+	zgfx->CompressionLevel = level;
+	return TRUE;
+}
+
 void zgfx_context_reset(ZGFX_CONTEXT* WINPR_RESTRICT zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+	zgfx->HistoryFill = 0;
+}
+
+static void zgfx_init_literals(ZGFX_CONTEXT* WINPR_RESTRICT zgfx)
+{
+	for (size_t c = 0; c < ARRAYSIZE(zgfx->LiteralCode); c++)
+	{
+		zgfx->LiteralBits[c] = 0;
+
+		for (size_t x = 0; ZGFX_TOKEN_TABLE[x].prefixLength != 0; x++)
+		{
+			const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[x];
+			const UINT32 bits = token->prefixLength + token->valueBits;
+
+			if (token->tokenType != 0)
+				continue;
+
+			if ((c < token->valueBase) || ((c - token->valueBase) >= (1ull << token->valueBits)))
+				continue;
+
+			if ((zgfx->LiteralBits[c] != 0) && (zgfx->LiteralBits[c] <= bits))
+				continue;
+
+			zgfx->LiteralCode[c] =
+			    (UINT16)((token->prefixCode << token->valueBits) | (c - token->valueBase));
+			zgfx->LiteralBits[c] = (BYTE)bits;
+		}
+	}
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -620,6 +981,22 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 	{
 		zgfx->Compressor = Compressor;
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+		zgfx->CompressionLevel = ZGFX_COMPRESSION_LEVEL_DEFAULT;
+
+		if (Compressor)
+		{
+			zgfx->HashHead = (UINT32*)calloc(ZGFX_HASH_SIZE, sizeof(UINT32));
+			zgfx->HashChain = (UINT32*)calloc(zgfx->HistoryBufferSize, sizeof(UINT32));
+
+			if (!zgfx->HashHead || !zgfx->HashChain)
+			{
+				zgfx_context_free(zgfx);
+				return NULL;
+			}
+
+			zgfx_init_literals(zgfx);
+		}
+
 		zgfx_context_reset(zgfx, FALSE);
 	}
 
@@ -628,5 +1005,10 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->HashHead);
+	free(zgfx->HashChain);
 	free(zgfx);
 }
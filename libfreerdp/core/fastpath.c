@@ -1223,8 +1223,13 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			rdp->sec_flags |= SEC_SECURE_CHECKSUM;
 	}
 
+	/* All fragments are assembled back to back in fs and handed to the transport with a
+	 * single write, so the TLS layer can fill its records and the socket is flushed once. */
+	Stream_SetPosition(fs, 0);
+
 	for (int fragment = 0; (totalLength > 0) || (fragment == 0); fragment++)
 	{
+		const size_t start = Stream_GetPosition(fs);
 		const BYTE* pSrcData = NULL;
 		UINT32 SrcSize = 0;
 		UINT32 DstSize = 0;
@@ -1280,9 +1285,13 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		fpUpdatePduHeaderSize = fastpath_get_update_pdu_header_size(&fpUpdatePduHeader, rdp);
 		fpHeaderSize = fpUpdateHeaderSize + fpUpdatePduHeaderSize;
 
+		/* header, data and up to 7 bytes of FIPS padding */
+		if (!Stream_EnsureRemainingCapacity(fs, (size_t)fpHeaderSize + DstSize + 8))
+			return FALSE;
+
 		if (rdp->sec_flags & SEC_ENCRYPT)
 		{
-			pSignature = Stream_Buffer(fs) + 3;
+			pSignature = Stream_Buffer(fs) + start + 3;
 
 			if (rdp->settings->EncryptionMethods == ENCRYPTION_METHOD_FIPS)
 			{
@@ -1299,7 +1308,6 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		}
 
 		fpUpdatePduHeader.length = fpUpdateHeader.size + fpHeaderSize + pad;
-		Stream_SetPosition(fs, 0);
 		if (!fastpath_write_update_pdu_header(fs, &fpUpdatePduHeader, rdp))
 			return FALSE;
 		if (!fastpath_write_update_header(fs, &fpUpdateHeader))
@@ -1350,17 +1358,14 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 				return FALSE;
 		}
 
-		Stream_SealLength(fs);
-
-		if (transport_write(rdp->transport, fs) < 0)
-		{
-			status = FALSE;
-			break;
-		}
-
 		Stream_Seek(s, SrcSize);
 	}
 
+	Stream_SealLength(fs);
+
+	if (transport_write(rdp->transport, fs) < 0)
+		status = FALSE;
+
 	rdp->sec_flags = 0;
 	return status;
 }
@@ -39,6 +39,7 @@
 #include "rdp.h"
 #include "peer.h"
 #include "multitransport.h"
+#include "../crypto/tls.h"
 
 #define TAG FREERDP_TAG("core.peer")
 
@@ -1507,6 +1508,15 @@ void freerdp_peer_free(freerdp_peer* client)
 	free(client);
 }
 
+BOOL freerdp_peer_get_tls_stats(rdpPeerTlsStats* stats)
+{
+	if (!stats)
+		return FALSE;
+
+	freerdp_tls_get_server_stats(&stats->FullHandshakes, &stats->ResumedHandshakes);
+	return TRUE;
+}
+
 static BOOL freerdp_peer_transport_setup(freerdp_peer* client)
 {
 	rdpRdp* rdp = NULL;
@@ -0,0 +1,592 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Multi session server reactor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/collections.h>
+
+#include <freerdp/peer.h>
+#include <freerdp/log.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <unistd.h>
+#define WITH_PEER_REACTOR
+#endif
+
+#define TAG FREERDP_TAG("core.reactor")
+
+/* Retry interval for peers with a blocked output buffer */
+#define REACTOR_WRITE_RETRY_MS 10
+#define REACTOR_MAX_EVENTS 64
+
+#if defined(WITH_PEER_REACTOR)
+typedef struct s_rdp_peer_reactor_worker rdpPeerReactorWorker;
+
+typedef struct
+{
+	freerdp_peer* peer;
+	rdpPeerReactorCallbacks callbacks;
+	void* arg;
+	rdpPeerReactorWorker* worker;
+
+	int fds[MAXIMUM_WAIT_OBJECTS];
+	DWORD count;
+	UINT64 nextTimer;
+	BOOL writeBlocked;
+	BOOL registered;
+	BOOL ready;
+	volatile LONG closing;
+} rdpPeerReactorEntry;
+
+struct s_rdp_peer_reactor_worker
+{
+	rdpPeerReactor* reactor;
+	HANDLE thread;
+	HANDLE wakeEvent;
+	int epfd;
+	CRITICAL_SECTION lock;
+	wArrayList* entries;
+	UINT64 deadline;
+	rdpPeerReactorEntry** scan;
+	size_t scanSize;
+};
+
+struct rdp_peer_reactor
+{
+	rdpPeerReactorWorker* workers;
+	size_t count;
+	volatile LONG stop;
+};
+
+static DWORD reactor_entry_get_fds(rdpPeerReactorEntry* entry, int* fds, DWORD size)
+{
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	freerdp_peer* peer = entry->peer;
+	DWORD count = 0;
+
+	WINPR_ASSERT(peer);
+	WINPR_ASSERT(peer->GetEventHandles);
+
+	count = peer->GetEventHandles(peer, handles, ARRAYSIZE(handles));
+
+	if (count == 0)
+		return 0;
+
+	if (entry->callbacks.GetEventHandles)
+	{
+		const DWORD tmp = entry->callbacks.GetEventHandles(peer, entry->arg, &handles[count],
+		                                                   ARRAYSIZE(handles) - count);
+		count += tmp;
+	}
+
+	if (count > size)
+		return 0;
+
+	for (DWORD x = 0; x < count; x++)
+	{
+		fds[x] = GetEventFileDescriptor(handles[x]);
+
+		if (fds[x] < 0)
+		{
+			WLog_ERR(TAG, "peer event handle %" PRIu32 " has no file descriptor", x);
+			return 0;
+		}
+	}
+
+	return count;
+}
+
+static BOOL reactor_fd_in(int fd, const int* fds, DWORD count)
+{
+	for (DWORD x = 0; x < count; x++)
+	{
+		if (fds[x] == fd)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Brings the epoll registration in line with the current handles of the peer.
+ * The transport handles change when the connection is upgraded (TLS, redirection). */
+static BOOL reactor_entry_update(rdpPeerReactorEntry* entry)
+{
+	int fds[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	const int epfd = entry->worker->epfd;
+	const DWORD count = reactor_entry_get_fds(entry, fds, ARRAYSIZE(fds));
+
+	if (count == 0)
+		return FALSE;
+
+	for (DWORD x = 0; x < entry->count; x++)
+	{
+		if (!reactor_fd_in(entry->fds[x], fds, count))
+			epoll_ctl(epfd, EPOLL_CTL_DEL, entry->fds[x], NULL);
+	}
+
+	for (DWORD x = 0; x < count; x++)
+	{
+		struct epoll_event event = { 0 };
+
+		if (reactor_fd_in(fds[x], entry->fds, entry->count) || reactor_fd_in(fds[x], fds, x))
+			continue;
+
+		event.events = EPOLLIN;
+		event.data.ptr = entry;
+
+		if ((epoll_ctl(epfd, EPOLL_CTL_ADD, fds[x], &event) < 0) && (errno != EEXIST))
+		{
+			char ebuffer[256] = { 0 };
+			WLog_ERR(TAG, "epoll_ctl failed: %s [%d]",
+			         winpr_strerror(errno, ebuffer, sizeof(ebuffer)), errno);
+			return FALSE;
+		}
+	}
+
+	memcpy(entry->fds, fds, sizeof(int) * count);
+	entry->count = count;
+	return TRUE;
+}
+
+static void reactor_entry_close(rdpPeerReactorEntry* entry)
+{
+	rdpPeerReactorWorker* worker = entry->worker;
+
+	for (DWORD x = 0; x < entry->count; x++)
+		epoll_ctl(worker->epfd, EPOLL_CTL_DEL, entry->fds[x], NULL);
+
+	EnterCriticalSection(&worker->lock);
+	ArrayList_Remove(worker->entries, entry);
+	LeaveCriticalSection(&worker->lock);
+
+	if (entry->callbacks.OnClose)
+		entry->callbacks.OnClose(entry->peer, entry->arg);
+
+	free(entry);
+}
+
+static BOOL reactor_entry_dispatch(rdpPeerReactorEntry* entry)
+{
+	freerdp_peer* peer = entry->peer;
+
+	WINPR_ASSERT(peer);
+	WINPR_ASSERT(peer->CheckFileDescriptor);
+
+	if (!peer->CheckFileDescriptor(peer))
+		return FALSE;
+
+	if (entry->callbacks.OnReady && !entry->callbacks.OnReady(peer, entry->arg))
+		return FALSE;
+
+	return reactor_entry_update(entry);
+}
+
+static BOOL reactor_entry_drain(rdpPeerReactorEntry* entry)
+{
+	freerdp_peer* peer = entry->peer;
+
+	entry->writeBlocked = FALSE;
+
+	if (!peer->IsWriteBlocked || !peer->IsWriteBlocked(peer))
+		return TRUE;
+
+	if (peer->DrainOutputBuffer(peer) < 0)
+		return FALSE;
+
+	entry->writeBlocked = peer->IsWriteBlocked(peer);
+	return TRUE;
+}
+
+static void reactor_entry_process(rdpPeerReactorWorker* worker, rdpPeerReactorEntry* entry,
+                                  UINT64 now)
+{
+	BOOL rc = !InterlockedCompareExchange(&entry->closing, 0, 0);
+
+	/* New peers are registered from their own thread, so epoll never reports an
+	 * entry the thread does not know yet */
+	if (rc && !entry->registered)
+	{
+		rc = reactor_entry_update(entry);
+		entry->registered = TRUE;
+
+		/* Data may already be buffered, check the peer once */
+		entry->ready = TRUE;
+	}
+
+	if (rc && entry->ready)
+		rc = reactor_entry_dispatch(entry);
+
+	if (rc && entry->callbacks.OnTimer && (entry->callbacks.TimerInterval > 0) &&
+	    (entry->nextTimer <= now))
+	{
+		entry->nextTimer = now + entry->callbacks.TimerInterval;
+		rc = entry->callbacks.OnTimer(entry->peer, entry->arg);
+	}
+
+	if (rc && (entry->ready || entry->writeBlocked))
+		rc = reactor_entry_drain(entry);
+
+	entry->ready = FALSE;
+
+	if (!rc || InterlockedCompareExchange(&entry->closing, 0, 0))
+	{
+		reactor_entry_close(entry);
+		return;
+	}
+
+	if (entry->callbacks.OnTimer && (entry->callbacks.TimerInterval > 0))
+		worker->deadline = MIN(worker->deadline, entry->nextTimer);
+
+	if (entry->writeBlocked)
+		worker->deadline = MIN(worker->deadline, now + REACTOR_WRITE_RETRY_MS);
+}
+
+/* Visits every peer of the thread: new peers, peers to close, timers and blocked writes */
+static BOOL reactor_worker_scan(rdpPeerReactorWorker* worker, UINT64 now)
+{
+	EnterCriticalSection(&worker->lock);
+	const size_t count = ArrayList_Count(worker->entries);
+
+	if (worker->scanSize < count)
+	{
+		rdpPeerReactorEntry** tmp =
+		    (rdpPeerReactorEntry**)realloc(worker->scan, sizeof(rdpPeerReactorEntry*) * count);
+
+		if (!tmp)
+		{
+			LeaveCriticalSection(&worker->lock);
+			return FALSE;
+		}
+
+		worker->scan = tmp;
+		worker->scanSize = count;
+	}
+
+	/* Callbacks may add or remove peers, work on a snapshot */
+	for (size_t x = 0; x < count; x++)
+		worker->scan[x] = ArrayList_GetItem(worker->entries, x);
+
+	LeaveCriticalSection(&worker->lock);
+
+	worker->deadline = UINT64_MAX;
+
+	for (size_t x = 0; x < count; x++)
+		reactor_entry_process(worker, worker->scan[x], now);
+
+	return TRUE;
+}
+
+static DWORD WINAPI reactor_worker_thread(LPVOID arg)
+{
+	rdpPeerReactorWorker* worker = (rdpPeerReactorWorker*)arg;
+	rdpPeerReactor* reactor = worker->reactor;
+
+	while (!InterlockedCompareExchange(&reactor->stop, 0, 0))
+	{
+		struct epoll_event events[REACTOR_MAX_EVENTS] = { 0 };
+		rdpPeerReactorEntry* ready[REACTOR_MAX_EVENTS] = { 0 };
+		size_t nready = 0;
+		BOOL scan = FALSE;
+		int timeout = -1;
+		UINT64 now = GetTickCount64();
+
+		if (worker->deadline != UINT64_MAX)
+			timeout = (worker->deadline <= now) ? 0 : (int)MIN(worker->deadline - now, INT32_MAX);
+
+		const int status = epoll_wait(worker->epfd, events, ARRAYSIZE(events), timeout);
+
+		if (status < 0)
+		{
+			char ebuffer[256] = { 0 };
+
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed: %s [%d]",
+			         winpr_strerror(errno, ebuffer, sizeof(ebuffer)), errno);
+			break;
+		}
+
+		for (int x = 0; x < status; x++)
+		{
+			rdpPeerReactorEntry* entry = events[x].data.ptr;
+
+			if (!entry)
+			{
+				ResetEvent(worker->wakeEvent);
+				scan = TRUE;
+			}
+			else if (!entry->ready)
+			{
+				entry->ready = TRUE;
+				ready[nready++] = entry;
+			}
+		}
+
+		now = GetTickCount64();
+
+		if (scan || (worker->deadline <= now))
+		{
+			if (!reactor_worker_scan(worker, now))
+			{
+				WLog_ERR(TAG, "failed to allocate scan list");
+				break;
+			}
+		}
+		else
+		{
+			for (size_t x = 0; x < nready; x++)
+				reactor_entry_process(worker, ready[x], now);
+		}
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static void reactor_worker_uninit(rdpPeerReactorWorker* worker)
+{
+	if (worker->thread)
+	{
+		SetEvent(worker->wakeEvent);
+		WaitForSingleObject(worker->thread, INFINITE);
+		CloseHandle(worker->thread);
+	}
+
+	/* Peers still attached are released on the calling thread */
+	while (worker->entries && (ArrayList_Count(worker->entries) > 0))
+		reactor_entry_close(ArrayList_GetItem(worker->entries, 0));
+
+	ArrayList_Free(worker->entries);
+	free(worker->scan);
+
+	if (worker->epfd >= 0)
+		close(worker->epfd);
+
+	if (worker->wakeEvent)
+		CloseHandle(worker->wakeEvent);
+
+	if (worker->reactor)
+		DeleteCriticalSection(&worker->lock);
+}
+
+static BOOL reactor_worker_init(rdpPeerReactor* reactor, rdpPeerReactorWorker* worker)
+{
+	struct epoll_event event = { 0 };
+
+	worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (worker->epfd < 0)
+		return FALSE;
+
+	if (!InitializeCriticalSectionAndSpinCount(&worker->lock, 4000))
+		return FALSE;
+
+	worker->reactor = reactor;
+	worker->deadline = UINT64_MAX;
+	worker->entries = ArrayList_New(FALSE);
+	worker->wakeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!worker->entries || !worker->wakeEvent)
+		return FALSE;
+
+	/* The wake event is the only registration without an entry */
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, GetEventFileDescriptor(worker->wakeEvent),
+	              &event) < 0)
+		return FALSE;
+
+	worker->thread = CreateThread(NULL, 0, reactor_worker_thread, worker, 0, NULL);
+	return worker->thread != NULL;
+}
+#endif
+
+void freerdp_peer_reactor_free(rdpPeerReactor* reactor)
+{
+#if defined(WITH_PEER_REACTOR)
+	if (!reactor)
+		return;
+
+	InterlockedExchange(&reactor->stop, 1);
+
+	for (size_t x = 0; x < reactor->count; x++)
+		reactor_worker_uninit(&reactor->workers[x]);
+
+	free(reactor->workers);
+	free(reactor);
+#else
+	WINPR_UNUSED(reactor);
+#endif
+}
+
+rdpPeerReactor* freerdp_peer_reactor_new(DWORD threads)
+{
+#if defined(WITH_PEER_REACTOR)
+	rdpPeerReactor* reactor = (rdpPeerReactor*)calloc(1, sizeof(rdpPeerReactor));
+
+	if (!reactor)
+		return NULL;
+
+	if (threads == 0)
+	{
+		SYSTEM_INFO sysinfo = { 0 };
+		GetNativeSystemInfo(&sysinfo);
+		threads = MAX(1, sysinfo.dwNumberOfProcessors);
+	}
+
+	reactor->workers = (rdpPeerReactorWorker*)calloc(threads, sizeof(rdpPeerReactorWorker));
+
+	if (!reactor->workers)
+		goto fail;
+
+	for (DWORD x = 0; x < threads; x++)
+	{
+		rdpPeerReactorWorker* worker = &reactor->workers[x];
+		worker->epfd = -1;
+		reactor->count++;
+
+		if (!reactor_worker_init(reactor, worker))
+		{
+			WLog_ERR(TAG, "failed to start reactor thread %" PRIu32, x);
+			goto fail;
+		}
+	}
+
+	return reactor;
+fail:
+	freerdp_peer_reactor_free(reactor);
+	return NULL;
+#else
+	WINPR_UNUSED(threads);
+	WLog_ERR(TAG, "peer reactor is not supported on this platform");
+	return NULL;
+#endif
+}
+
+BOOL freerdp_peer_reactor_add(rdpPeerReactor* reactor, freerdp_peer* peer,
+                              const rdpPeerReactorCallbacks* callbacks, void* arg)
+{
+#if defined(WITH_PEER_REACTOR)
+	rdpPeerReactorWorker* worker = NULL;
+	size_t load = SIZE_MAX;
+
+	if (!reactor || !peer || !callbacks)
+		return FALSE;
+
+	rdpPeerReactorEntry* entry = (rdpPeerReactorEntry*)calloc(1, sizeof(rdpPeerReactorEntry));
+
+	if (!entry)
+		return FALSE;
+
+	/* Bind the peer to the least loaded thread */
+	for (size_t x = 0; x < reactor->count; x++)
+	{
+		rdpPeerReactorWorker* cur = &reactor->workers[x];
+		EnterCriticalSection(&cur->lock);
+		const size_t count = ArrayList_Count(cur->entries);
+		LeaveCriticalSection(&cur->lock);
+
+		if (count < load)
+		{
+			worker = cur;
+			load = count;
+		}
+	}
+
+	WINPR_ASSERT(worker);
+	entry->peer = peer;
+	entry->callbacks = *callbacks;
+	entry->arg = arg;
+	entry->worker = worker;
+	entry->nextTimer = GetTickCount64() + callbacks->TimerInterval;
+
+	/* The entry is only published here, its handles are registered by the worker
+	 * thread on the next scan */
+	EnterCriticalSection(&worker->lock);
+	const BOOL rc = ArrayList_Append(worker->entries, entry);
+	LeaveCriticalSection(&worker->lock);
+
+	if (!rc)
+	{
+		free(entry);
+		return FALSE;
+	}
+
+	SetEvent(worker->wakeEvent);
+	return TRUE;
+#else
+	WINPR_UNUSED(reactor);
+	WINPR_UNUSED(peer);
+	WINPR_UNUSED(callbacks);
+	WINPR_UNUSED(arg);
+	return FALSE;
+#endif
+}
+
+BOOL freerdp_peer_reactor_remove(rdpPeerReactor* reactor, freerdp_peer* peer)
+{
+#if defined(WITH_PEER_REACTOR)
+	if (!reactor || !peer)
+		return FALSE;
+
+	for (size_t x = 0; x < reactor->count; x++)
+	{
+		rdpPeerReactorWorker* worker = &reactor->workers[x];
+		BOOL found = FALSE;
+
+		EnterCriticalSection(&worker->lock);
+
+		for (size_t y = 0; y < ArrayList_Count(worker->entries); y++)
+		{
+			rdpPeerReactorEntry* entry = ArrayList_GetItem(worker->entries, y);
+
+			if (entry->peer == peer)
+			{
+				/* The owning thread closes the peer, OnClose is called from there */
+				InterlockedExchange(&entry->closing, 1);
+				found = TRUE;
+				break;
+			}
+		}
+
+		LeaveCriticalSection(&worker->lock);
+
+		if (found)
+		{
+			SetEvent(worker->wakeEvent);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+#else
+	WINPR_UNUSED(reactor);
+	WINPR_UNUSED(peer);
+	return FALSE;
+#endif
+}
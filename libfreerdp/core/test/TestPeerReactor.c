@@ -0,0 +1,254 @@
+#include <stdio.h>
+
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/peer.h>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+	freerdp_peer* peer;
+	int remote;
+	volatile LONG timers;
+	HANDLE timer;
+	HANDLE ready;
+	HANDLE closed;
+} test_reactor_peer;
+
+static BOOL test_reactor_on_timer(freerdp_peer* peer, void* arg)
+{
+	test_reactor_peer* ctx = arg;
+	WINPR_UNUSED(peer);
+
+	/* Signal once the timer repeated */
+	if (InterlockedIncrement(&ctx->timers) >= 2)
+		SetEvent(ctx->timer);
+
+	return TRUE;
+}
+
+static BOOL test_reactor_on_ready(freerdp_peer* peer, void* arg)
+{
+	test_reactor_peer* ctx = arg;
+	WINPR_UNUSED(peer);
+	SetEvent(ctx->ready);
+	return TRUE;
+}
+
+static void test_reactor_on_close(freerdp_peer* peer, void* arg)
+{
+	test_reactor_peer* ctx = arg;
+	freerdp_peer_context_free(peer);
+	freerdp_peer_free(peer);
+	ctx->peer = NULL;
+	SetEvent(ctx->closed);
+}
+
+static void test_reactor_peer_free(test_reactor_peer* ctx)
+{
+	if (ctx->peer)
+	{
+		freerdp_peer_context_free(ctx->peer);
+		freerdp_peer_free(ctx->peer);
+	}
+
+	if (ctx->remote >= 0)
+		close(ctx->remote);
+
+	if (ctx->timer)
+		CloseHandle(ctx->timer);
+
+	if (ctx->ready)
+		CloseHandle(ctx->ready);
+
+	if (ctx->closed)
+		CloseHandle(ctx->closed);
+}
+
+/* freerdp_peer_new requires a TCP socket, connect one over loopback */
+static BOOL test_reactor_socketpair(int sv[2])
+{
+	struct sockaddr_in addr = { 0 };
+	socklen_t len = sizeof(addr);
+	BOOL rc = FALSE;
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listener < 0)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(listener, 1) != 0))
+		goto fail;
+
+	if (getsockname(listener, (struct sockaddr*)&addr, &len) != 0)
+		goto fail;
+
+	sv[1] = socket(AF_INET, SOCK_STREAM, 0);
+
+	if ((sv[1] < 0) || (connect(sv[1], (struct sockaddr*)&addr, sizeof(addr)) != 0))
+		goto fail;
+
+	sv[0] = accept(listener, NULL, NULL);
+	rc = sv[0] >= 0;
+fail:
+	close(listener);
+	return rc;
+}
+
+static BOOL test_reactor_peer_init(test_reactor_peer* ctx)
+{
+	int sv[2] = { -1, -1 };
+
+	ctx->remote = -1;
+	ctx->timer = CreateEvent(NULL, TRUE, FALSE, NULL);
+	ctx->ready = CreateEvent(NULL, TRUE, FALSE, NULL);
+	ctx->closed = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!ctx->timer || !ctx->ready || !ctx->closed)
+		return FALSE;
+
+	if (!test_reactor_socketpair(sv))
+	{
+		if (sv[1] >= 0)
+			close(sv[1]);
+		return FALSE;
+	}
+
+	ctx->remote = sv[1];
+	ctx->peer = freerdp_peer_new(sv[0]);
+
+	if (!ctx->peer)
+	{
+		close(sv[0]);
+		return FALSE;
+	}
+
+	return freerdp_peer_context_new(ctx->peer);
+}
+
+static BOOL test_reactor(void)
+{
+	BOOL rc = FALSE;
+	test_reactor_peer peers[3] = { 0 };
+	const rdpPeerReactorCallbacks cb = { .OnReady = test_reactor_on_ready,
+		                                 .OnTimer = test_reactor_on_timer,
+		                                 .TimerInterval = 10,
+		                                 .OnClose = test_reactor_on_close };
+	rdpPeerReactor* reactor = freerdp_peer_reactor_new(2);
+
+	if (!reactor)
+	{
+		fprintf(stderr, "[%s] freerdp_peer_reactor_new failed\n", __func__);
+		return FALSE;
+	}
+
+	for (size_t x = 0; x < ARRAYSIZE(peers); x++)
+	{
+		if (!test_reactor_peer_init(&peers[x]))
+		{
+			fprintf(stderr, "[%s] failed to create peer %" PRIuz "\n", __func__, x);
+			goto fail;
+		}
+
+		if (!freerdp_peer_reactor_add(reactor, peers[x].peer, &cb, &peers[x]))
+		{
+			fprintf(stderr, "[%s] freerdp_peer_reactor_add failed\n", __func__);
+			goto fail;
+		}
+	}
+
+	/* An idle peer only sees its timer */
+	for (size_t x = 0; x < ARRAYSIZE(peers); x++)
+	{
+		if (WaitForSingleObject(peers[x].timer, 5000) != WAIT_OBJECT_0)
+		{
+			fprintf(stderr, "[%s] timer of peer %" PRIuz " did not fire\n", __func__, x);
+			goto fail;
+		}
+
+		if (WaitForSingleObject(peers[x].closed, 0) == WAIT_OBJECT_0)
+		{
+			fprintf(stderr, "[%s] idle peer %" PRIuz " was closed\n", __func__, x);
+			goto fail;
+		}
+	}
+
+	/* Peer 0 is removed explicitly */
+	if (!freerdp_peer_reactor_remove(reactor, peers[0].peer))
+		goto fail;
+
+	if (WaitForSingleObject(peers[0].closed, 5000) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "[%s] removed peer was not closed\n", __func__);
+		goto fail;
+	}
+
+	/* Peer 1 sends an incomplete PDU, it is dispatched but stays connected */
+	/* The initial check of a new peer runs before its first timer tick */
+	ResetEvent(peers[1].ready);
+
+	if (write(peers[1].remote, "\x03\x00\x00\x20", 4) != 4)
+		goto fail;
+
+	if (WaitForSingleObject(peers[1].ready, 5000) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "[%s] peer 1 was not dispatched\n", __func__);
+		goto fail;
+	}
+
+	if (WaitForSingleObject(peers[1].closed, 0) == WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "[%s] peer 1 was closed\n", __func__);
+		goto fail;
+	}
+
+	/* Peer 2 hangs up */
+	close(peers[2].remote);
+	peers[2].remote = -1;
+
+	if (WaitForSingleObject(peers[2].closed, 5000) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "[%s] peer 2 was not closed\n", __func__);
+		goto fail;
+	}
+
+	/* Peers still attached are closed when the reactor is freed */
+	freerdp_peer_reactor_free(reactor);
+	reactor = NULL;
+
+	if (WaitForSingleObject(peers[1].closed, 0) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "[%s] peer 1 was not closed by the reactor\n", __func__);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	freerdp_peer_reactor_free(reactor);
+
+	for (size_t x = 0; x < ARRAYSIZE(peers); x++)
+		test_reactor_peer_free(&peers[x]);
+
+	return rc;
+}
+
+int TestPeerReactor(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_reactor())
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,353 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/client.h>
+#include <freerdp/gdi/gdi.h>
+
+#include "../rdp.h"
+#include "../fastpath.h"
+#include "../surface.h"
+#include "../transport.h"
+
+#define TEST_UPDATE_SIZE 40000
+
+static pTransportRWFkt test_default_write = NULL;
+static size_t test_write_count = 0;
+static BYTE* test_update_data = NULL;
+static size_t test_surface_bits_count = 0;
+
+/* a connected loopback TCP pair, the transport only accepts socket file descriptors */
+static BOOL test_socket_pair(int fds[2])
+{
+	BOOL rc = FALSE;
+	struct sockaddr_in addr = { 0 };
+	socklen_t len = sizeof(addr);
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	fds[0] = fds[1] = -1;
+
+	if (listener < 0)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(listener, 1) != 0) ||
+	    (getsockname(listener, (struct sockaddr*)&addr, &len) != 0))
+		goto fail;
+
+	fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+
+	if ((fds[1] < 0) || (connect(fds[1], (struct sockaddr*)&addr, sizeof(addr)) != 0))
+		goto fail;
+
+	fds[0] = accept(listener, NULL, NULL);
+	rc = fds[0] >= 0;
+fail:
+	close(listener);
+	return rc;
+}
+
+static BOOL test_send(int fd, const BYTE* data, size_t length)
+{
+	while (length > 0)
+	{
+		const ssize_t rc = send(fd, data, length, 0);
+
+		if (rc <= 0)
+			return FALSE;
+
+		data += rc;
+		length -= (size_t)rc;
+	}
+
+	return TRUE;
+}
+
+static size_t test_tpkt(BYTE* data, size_t length, BYTE fill)
+{
+	WINPR_ASSERT(length >= 7);
+	WINPR_ASSERT(length <= UINT16_MAX);
+
+	data[0] = 0x03;
+	data[1] = 0x00;
+	data[2] = (BYTE)(length >> 8);
+	data[3] = (BYTE)length;
+	memset(&data[4], fill, length - 4);
+	return length;
+}
+
+/* Reads until a PDU completes, the transport is non blocking so 0 means wait for more data */
+static int test_read(rdpTransport* transport, wStream* s, const BYTE* expected, size_t length)
+{
+	int rc = 0;
+
+	for (size_t x = 0; (x < 1000) && (rc == 0); x++)
+	{
+		rc = transport_read_pdu(transport, s);
+
+		if (rc == 0)
+			Sleep(1);
+	}
+
+	if (rc < 0)
+		return rc;
+
+	if (((size_t)rc != length) || (Stream_Length(s) != length) ||
+	    (memcmp(Stream_Buffer(s), expected, length) != 0))
+		return -1;
+
+	Stream_SetPosition(s, 0);
+	Stream_SetLength(s, 0);
+	return rc;
+}
+
+static BOOL test_read_ahead(rdpContext* context, int fd)
+{
+	BOOL rc = FALSE;
+	rdpTransport* transport = context->rdp->transport;
+	wStream* s = Stream_New(NULL, 1024);
+	BYTE* data = calloc(1, 0x20000);
+	size_t offset = 0;
+	size_t sizes[5] = { 0 };
+
+	if (!s || !data)
+		goto fail;
+
+	/* small, larger than the read ahead buffer, small, maximum size, minimum size */
+	sizes[0] = test_tpkt(&data[offset], 300, 0x11);
+	offset += sizes[0];
+	sizes[1] = test_tpkt(&data[offset], 40000, 0x22);
+	offset += sizes[1];
+	sizes[2] = test_tpkt(&data[offset], 17, 0x33);
+	offset += sizes[2];
+	sizes[3] = test_tpkt(&data[offset], UINT16_MAX, 0x44);
+	offset += sizes[3];
+	sizes[4] = test_tpkt(&data[offset], 7, 0x55);
+	offset += sizes[4];
+
+	/* partial header, the transport has to keep what it got */
+	if (!test_send(fd, data, 2) || (transport_read_pdu(transport, s) != 0))
+		goto fail;
+
+	/* rest of the first PDU and the start of the second one */
+	if (!test_send(fd, &data[2], sizes[0] + 100))
+		goto fail;
+
+	if (test_read(transport, s, data, sizes[0]) < 0)
+		goto fail;
+
+	/* the event loop must come back for the bytes already buffered */
+	if (!transport_have_more_bytes_to_read(transport))
+		goto fail;
+
+	/* everything else in one go, several PDUs end up in the read ahead buffer */
+	if (!test_send(fd, &data[2 + sizes[0] + 100], offset - sizes[0] - 102))
+		goto fail;
+
+	offset = 0;
+
+	for (size_t x = 1; x < ARRAYSIZE(sizes); x++)
+	{
+		offset += sizes[x - 1];
+
+		if (test_read(transport, s, &data[offset], sizes[x]) < 0)
+			goto fail;
+	}
+
+	/* the whole stream was consumed, nothing left to report */
+	if (transport_read_pdu(transport, s) != 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("%s failed\n", __func__);
+	free(data);
+	Stream_Free(s, TRUE);
+	return rc;
+}
+
+static int test_count_write(rdpTransport* transport, wStream* s)
+{
+	test_write_count++;
+	return test_default_write(transport, s);
+}
+
+static BOOL test_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	WINPR_UNUSED(context);
+
+	if ((cmd->bmp.bitmapDataLength != TEST_UPDATE_SIZE) ||
+	    (memcmp(cmd->bmp.bitmapData, test_update_data, TEST_UPDATE_SIZE) != 0))
+		return FALSE;
+
+	test_surface_bits_count++;
+	return TRUE;
+}
+
+/* An update larger than a fast-path PDU is split in fragments, these must leave the sender with
+ * a single transport write and come together again on the receiving side. */
+static BOOL test_fastpath_fragments(rdpContext* context, rdpContext* peer)
+{
+	BOOL rc = FALSE;
+	size_t pdus = 0;
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	rdpTransportIo io = *freerdp_get_io_callbacks(peer);
+	wStream* update = Stream_New(NULL, TEST_UPDATE_SIZE + 64);
+	wStream* s = Stream_New(NULL, 1024);
+
+	test_update_data = malloc(TEST_UPDATE_SIZE);
+
+	if (!update || !s || !test_update_data)
+		goto fail;
+
+	for (size_t x = 0; x < TEST_UPDATE_SIZE; x++)
+		test_update_data[x] = (BYTE)(x * 13 + (x >> 8));
+
+	test_default_write = io.WritePdu;
+	io.WritePdu = test_count_write;
+
+	if (!freerdp_set_io_callbacks(peer, &io))
+		goto fail;
+
+	if (!freerdp_settings_set_bool(peer->settings, FreeRDP_FastPathOutput, TRUE) ||
+	    !freerdp_settings_set_bool(peer->settings, FreeRDP_CompressionEnabled, FALSE) ||
+	    !freerdp_settings_set_uint32(peer->settings, FreeRDP_MultifragMaxRequestSize,
+	                                 2 * TEST_UPDATE_SIZE) ||
+	    !freerdp_settings_set_uint32(context->settings, FreeRDP_MultifragMaxRequestSize,
+	                                 2 * TEST_UPDATE_SIZE))
+		goto fail;
+
+	/* the receiving side paints through the GDI, only the surface bits are checked */
+	if (!gdi_init(context->instance, PIXEL_FORMAT_BGRX32))
+		goto fail;
+
+	context->update->SurfaceBits = test_surface_bits;
+
+	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd.destRight = 64;
+	cmd.destBottom = 64;
+	cmd.bmp.bpp = 32;
+	cmd.bmp.codecID = RDP_CODEC_ID_NONE;
+	cmd.bmp.width = 64;
+	cmd.bmp.height = 64;
+	cmd.bmp.bitmapDataLength = TEST_UPDATE_SIZE;
+	cmd.bmp.bitmapData = test_update_data;
+
+	if (!update_write_surfcmd_surface_bits(update, &cmd))
+		goto fail;
+
+	if (!fastpath_send_update_pdu(peer->rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, update,
+	                              TRUE))
+		goto fail;
+
+	if (test_write_count != 1)
+	{
+		printf("%s: update sent with %" PRIuz " writes\n", __func__, test_write_count);
+		goto fail;
+	}
+
+	/* every fragment is a fast-path PDU of its own */
+	while (test_surface_bits_count == 0)
+	{
+		int status = 0;
+		UINT16 length = 0;
+
+		for (size_t x = 0; (x < 1000) && (status == 0); x++)
+		{
+			status = transport_read_pdu(context->rdp->transport, s);
+
+			if (status == 0)
+				Sleep(1);
+		}
+
+		if (status <= 0)
+			goto fail;
+
+		pdus++;
+		Stream_SetPosition(s, 0);
+
+		if (!fastpath_read_header_rdp(context->rdp->fastpath, s, &length) ||
+		    (fastpath_recv_updates(context->rdp->fastpath, s) != STATE_RUN_SUCCESS))
+			goto fail;
+
+		Stream_SetPosition(s, 0);
+		Stream_SetLength(s, 0);
+	}
+
+	if (pdus < 3)
+	{
+		printf("%s: update arrived in %" PRIuz " fragments\n", __func__, pdus);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("%s failed\n", __func__);
+	gdi_free(context->instance);
+	free(test_update_data);
+	test_update_data = NULL;
+	Stream_Free(update, TRUE);
+	Stream_Free(s, TRUE);
+	return rc;
+}
+
+int TestTransport(int argc, char* argv[])
+{
+	int rc = -1;
+	int fds[2] = { -1, -1 };
+	RDP_CLIENT_ENTRY_POINTS entry = { 0 };
+	rdpContext* context = NULL;
+	rdpContext* peer = NULL;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	entry.Version = RDP_CLIENT_INTERFACE_VERSION;
+	entry.Size = sizeof(RDP_CLIENT_ENTRY_POINTS_V1);
+	entry.ContextSize = sizeof(rdpContext);
+
+	context = freerdp_client_context_new(&entry);
+	peer = freerdp_client_context_new(&entry);
+
+	if (!context || !peer || !test_socket_pair(fds))
+		goto fail;
+
+	/* the transport owns the socket once attached */
+	if (!transport_attach(context->rdp->transport, fds[0]))
+		goto fail;
+
+	fds[0] = -1;
+
+	if (!transport_set_blocking_mode(context->rdp->transport, FALSE))
+		goto fail;
+
+	if (!test_read_ahead(context, fds[1]))
+		goto fail;
+
+	if (!transport_attach(peer->rdp->transport, fds[1]))
+		goto fail;
+
+	fds[1] = -1;
+
+	if (!test_fastpath_fragments(context, peer))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	freerdp_client_context_free(peer);
+	freerdp_client_context_free(context);
+	return rc;
+}
@@ -79,6 +79,7 @@ struct rdp_transport
 	wStream* ReceiveBuffer;
 	TransportRecv ReceiveCallback;
 	wStreamPool* ReceivePool;
+	wStream* ReadAhead;
 	HANDLE connectedEvent;
 	BOOL NlaMode;
 	BOOL RdstlsMode;
@@ -165,6 +166,34 @@ wStream* transport_send_stream_init(rdpTransport* transport, size_t size)
 	return s;
 }
 
+static void transport_read_ahead_reset(rdpTransport* transport)
+{
+	WINPR_ASSERT(transport);
+
+	if (!transport->ReadAhead)
+		return;
+
+	Stream_SetPosition(transport->ReadAhead, 0);
+	Stream_SetLength(transport->ReadAhead, 0);
+}
+
+/* Data read ahead belongs to the current front BIO and can not be handed to a new layer */
+static BOOL transport_read_ahead_check_empty(rdpTransport* transport, const char* what)
+{
+	WINPR_ASSERT(transport);
+
+	if (!transport->ReadAhead)
+		return TRUE;
+
+	const size_t pending = Stream_GetRemainingLength(transport->ReadAhead);
+	if (pending == 0)
+		return TRUE;
+
+	WLog_Print(transport->log, WLOG_ERROR,
+	           "%s: %" PRIuz " bytes received before the layer change, aborting", what, pending);
+	return FALSE;
+}
+
 BOOL transport_attach(rdpTransport* transport, int sockfd)
 {
 	if (!transport)
@@ -309,6 +338,9 @@ static BOOL transport_default_connect_tls(rdpTransport* transport)
 		tls->port = 3389;
 
 	tls->isGatewayTransport = FALSE;
+	if (!transport_read_ahead_check_empty(transport, "TLS connect"))
+		return FALSE;
+
 	tlsStatus = freerdp_tls_connect(tls, transport->frontBio);
 
 	if (tlsStatus < 1)
@@ -633,6 +665,9 @@ static BOOL transport_default_accept_tls(rdpTransport* transport)
 
 	transport->layer = TRANSPORT_LAYER_TLS;
 
+	if (!transport_read_ahead_check_empty(transport, "TLS accept"))
+		return FALSE;
+
 	if (!freerdp_tls_accept(transport->tls, transport->frontBio, settings))
 		return FALSE;
 
@@ -780,10 +815,36 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 
 	while (read < (SSIZE_T)bytes)
 	{
-		const SSIZE_T tr = (SSIZE_T)bytes - read;
-		int r = (int)((tr > INT_MAX) ? INT_MAX : tr);
+		wStream* ra = transport->ReadAhead;
+		const size_t tr = bytes - (size_t)read;
+		const size_t buffered = Stream_GetRemainingLength(ra);
+
+		/* Serve from data received by an earlier read first */
+		if (buffered > 0)
+		{
+			const size_t len = MIN(buffered, tr);
+			Stream_Read(ra, data + read, len);
+			read += (SSIZE_T)len;
+			continue;
+		}
+
+		/* Requests that do not fit the read ahead buffer go straight to the destination,
+		 * everything else (PDU headers, small PDUs) pulls as much as is available so the
+		 * following reads do not need to hit the BIO */
+		const BOOL direct = tr >= Stream_Capacity(ra);
+		BYTE* dst = data + read;
+		size_t dstSize = tr;
+
+		if (!direct)
+		{
+			transport_read_ahead_reset(transport);
+			dst = Stream_Buffer(ra);
+			dstSize = Stream_Capacity(ra);
+		}
+
+		int r = (int)((dstSize > INT_MAX) ? INT_MAX : dstSize);
 		ERR_clear_error();
-		int status = BIO_read(transport->frontBio, data + read, r);
+		int status = BIO_read(transport->frontBio, dst, r);
 
 		if (freerdp_shall_disconnect_context(context))
 			return -1;
@@ -821,10 +882,21 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 		}
 
 #ifdef FREERDP_HAVE_VALGRIND_MEMCHECK_H
-		VALGRIND_MAKE_MEM_DEFINED(data + read, bytes - read);
+		VALGRIND_MAKE_MEM_DEFINED(dst, (size_t)status);
 #endif
-		read += status;
 		rdp->inBytes += status;
+
+		if (direct)
+			read += status;
+		else
+			Stream_SetLength(ra, (size_t)status);
+	}
+
+	/* Make sure the event loop comes back for PDUs that are already buffered */
+	if ((Stream_GetRemainingLength(transport->ReadAhead) > 0) && !transport->haveMoreBytesToRead)
+	{
+		transport->haveMoreBytesToRead = TRUE;
+		SetEvent(transport->rereadEvent);
 	}
 
 	return read;
@@ -1541,6 +1613,7 @@ static BOOL transport_default_disconnect(rdpTransport* transport)
 		transport->wst = NULL;
 	}
 
+	transport_read_ahead_reset(transport);
 	transport->frontBio = NULL;
 	transport->layer = TRANSPORT_LAYER_TCP;
 	transport->earlyUserAuth = FALSE;
@@ -1584,6 +1657,13 @@ rdpTransport* transport_new(rdpContext* context)
 	if (!transport->ReceiveBuffer)
 		goto fail;
 
+	/* read ahead buffer, reduces the number of BIO reads per PDU */
+	transport->ReadAhead = Stream_New(NULL, BUFFER_SIZE);
+
+	if (!transport->ReadAhead)
+		goto fail;
+
+	transport_read_ahead_reset(transport);
 	transport->connectedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	if (!transport->connectedEvent || transport->connectedEvent == INVALID_HANDLE_VALUE)
@@ -1630,6 +1710,7 @@ void transport_free(rdpTransport* transport)
 		Stream_Release(transport->ReceiveBuffer);
 
 	nla_free(transport->nla);
+	Stream_Free(transport->ReadAhead, TRUE);
 	StreamPool_Free(transport->ReceivePool);
 	CloseHandle(transport->connectedEvent);
 	CloseHandle(transport->rereadEvent);
@@ -0,0 +1,272 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/ssl.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/settings.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "../tls.h"
+#include "../certificate.h"
+#include "../privatekey.h"
+
+/* A self signed certificate for a freshly generated key */
+static BOOL test_tls_server_credentials(rdpSettings* settings)
+{
+	BOOL rc = FALSE;
+	EVP_PKEY* pkey = NULL;
+	X509* x509 = NULL;
+	rdpCertificate* cert = NULL;
+	rdpPrivateKey* key = freerdp_key_new();
+
+	if (!key || !freerdp_key_generate(key, 2048))
+		goto fail;
+
+	pkey = freerdp_key_get_evp_pkey(key);
+	x509 = X509_new();
+	if (!pkey || !x509)
+		goto fail;
+
+	X509_NAME* name = X509_get_subject_name(x509);
+	if (!X509_set_version(x509, 2) || !ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) ||
+	    !X509_gmtime_adj(X509_getm_notBefore(x509), 0) ||
+	    !X509_gmtime_adj(X509_getm_notAfter(x509), 3600) || !X509_set_pubkey(x509, pkey) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost",
+	                                -1, -1, 0) ||
+	    !X509_set_issuer_name(x509, name) || !X509_sign(x509, pkey, EVP_sha256()))
+		goto fail;
+
+	cert = freerdp_certificate_new_from_x509(x509, NULL);
+	if (!cert)
+		goto fail;
+
+	if (!freerdp_settings_set_pointer_len(settings, FreeRDP_RdpServerRsaKey, key, 1))
+		goto fail;
+	key = NULL;
+
+	if (!freerdp_settings_set_pointer_len(settings, FreeRDP_RdpServerCertificate, cert, 1))
+		goto fail;
+	cert = NULL;
+
+	rc = TRUE;
+fail:
+	freerdp_certificate_free(cert);
+	freerdp_key_free(key);
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+	return rc;
+}
+
+static BOOL test_tls_client_step(SSL* client, BOOL* done)
+{
+	const int status = SSL_do_handshake(client);
+
+	if (status == 1)
+	{
+		*done = TRUE;
+		return TRUE;
+	}
+
+	switch (SSL_get_error(client, status))
+	{
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+static BOOL test_tls_server_step(TlsHandshakeResult result, BOOL* done)
+{
+	switch (result)
+	{
+		case TLS_HANDSHAKE_SUCCESS:
+			*done = TRUE;
+			return TRUE;
+		case TLS_HANDSHAKE_CONTINUE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Connects an OpenSSL client to a server side rdpTls over a BIO pair, offering session if set.
+ * On success session holds the session to resume next and resumed tells if this one was.
+ */
+static BOOL test_tls_connect(rdpContext* context, SSL_CTX* clientCtx, SSL_SESSION** session,
+                             BOOL* resumed)
+{
+	BOOL rc = FALSE;
+	BOOL clientDone = FALSE;
+	BOOL serverDone = FALSE;
+	BIO* serverBio = NULL;
+	BIO* clientBio = NULL;
+	SSL* client = NULL;
+	UINT64 fullBefore = 0;
+	UINT64 resumedBefore = 0;
+	UINT64 fullAfter = 0;
+	UINT64 resumedAfter = 0;
+	rdpTls* tls = freerdp_tls_new(context);
+
+	if (!tls || !BIO_new_bio_pair(&serverBio, 0, &clientBio, 0))
+		goto fail;
+
+	client = SSL_new(clientCtx);
+	if (!client)
+		goto fail;
+
+	SSL_set_bio(client, clientBio, clientBio);
+	clientBio = NULL;
+	SSL_set_connect_state(client);
+
+	if (*session && !SSL_set_session(client, *session))
+		goto fail;
+
+	freerdp_tls_get_server_stats(&fullBefore, &resumedBefore);
+
+	/* The client speaks first, the server keeps waiting until it did */
+	if (!test_tls_client_step(client, &clientDone))
+		goto fail;
+
+	const TlsHandshakeResult result = freerdp_tls_accept_ex(
+	    tls, serverBio, context->settings, freerdp_tls_get_ssl_method(FALSE, FALSE));
+	serverBio = NULL;
+	if (!test_tls_server_step(result, &serverDone))
+		goto fail;
+
+	for (size_t x = 0; (x < 16) && (!clientDone || !serverDone); x++)
+	{
+		if (!clientDone && !test_tls_client_step(client, &clientDone))
+			goto fail;
+
+		if (!serverDone && !test_tls_server_step(freerdp_tls_handshake(tls), &serverDone))
+			goto fail;
+	}
+
+	if (!clientDone || !serverDone)
+		goto fail;
+
+	/* TLS 1.3 sends the session ticket after the handshake, let the client process it */
+	char buffer = 0;
+	const int status = SSL_read(client, &buffer, sizeof(buffer));
+	if ((status > 0) || (SSL_get_error(client, status) != SSL_ERROR_WANT_READ))
+		goto fail;
+
+	freerdp_tls_get_server_stats(&fullAfter, &resumedAfter);
+	*resumed = SSL_session_reused(client) ? TRUE : FALSE;
+
+	/* Every accepted handshake is counted once, as the kind the client saw */
+	if (*resumed)
+	{
+		if ((fullAfter != fullBefore) || (resumedAfter != resumedBefore + 1))
+			goto fail;
+	}
+	else
+	{
+		if ((fullAfter != fullBefore + 1) || (resumedAfter != resumedBefore))
+			goto fail;
+	}
+
+	SSL_SESSION_free(*session);
+	*session = SSL_get1_session(client);
+	if (!*session)
+		goto fail;
+
+	/* OpenSSL does not resume sessions of connections closed without close notify */
+	if (SSL_shutdown(client) < 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	SSL_free(client);
+	BIO_free(clientBio);
+	BIO_free(serverBio);
+	freerdp_tls_free(tls);
+	return rc;
+}
+
+static BOOL test_tls_resume(rdpContext* context, int version)
+{
+	BOOL rc = FALSE;
+	BOOL resumed = FALSE;
+	SSL_SESSION* session = NULL;
+	SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method());
+
+	if (!clientCtx)
+		goto fail;
+
+	SSL_CTX_set_verify(clientCtx, SSL_VERIFY_NONE, NULL);
+	if (!SSL_CTX_set_max_proto_version(clientCtx, version))
+		goto fail;
+
+	/* Start from an empty cache, like a fresh server process would */
+	freerdp_tls_free_server_contexts();
+
+	if (!test_tls_connect(context, clientCtx, &session, &resumed) || resumed)
+	{
+		printf("[%x] first connection was not a full handshake\n", version);
+		goto fail;
+	}
+
+	if (!test_tls_connect(context, clientCtx, &session, &resumed) || !resumed)
+	{
+		printf("[%x] reconnect did not resume the session\n", version);
+		goto fail;
+	}
+
+	/* Shutdown releases the shared contexts and with them sessions and ticket keys */
+	freerdp_tls_free_server_contexts();
+
+	if (!test_tls_connect(context, clientCtx, &session, &resumed) || resumed)
+	{
+		printf("[%x] session was resumed after the contexts were freed\n", version);
+		goto fail;
+	}
+
+	if (!test_tls_connect(context, clientCtx, &session, &resumed) || !resumed)
+	{
+		printf("[%x] reconnect to the new context did not resume the session\n", version);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	SSL_SESSION_free(session);
+	SSL_CTX_free(clientCtx);
+	return rc;
+}
+
+int TestTlsResume(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpContext context = { 0 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!winpr_InitializeSSL(WINPR_SSL_INIT_DEFAULT))
+		return -1;
+
+	context.settings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
+	if (!context.settings || !test_tls_server_credentials(context.settings))
+		goto fail;
+
+	if (!test_tls_resume(&context, TLS1_2_VERSION))
+		goto fail;
+
+#if defined(TLS1_3_VERSION)
+	if (!test_tls_resume(&context, TLS1_3_VERSION))
+		goto fail;
+#endif
+
+	rc = 0;
+fail:
+	freerdp_tls_free_server_contexts();
+	freerdp_settings_free(context.settings);
+	return rc;
+}
@@ -741,59 +741,85 @@ static void tls_reset(rdpTls* tls)
 }
 
 #if OPENSSL_VERSION_NUMBER >= 0x010000000L
-static BOOL tls_prepare(rdpTls* tls, BIO* underlying, const SSL_METHOD* method, int options,
-                        BOOL clientMode)
+static SSL_CTX* tls_ctx_new(const rdpSettings* settings, const SSL_METHOD* method, int options)
 #else
-static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method, int options,
-                        BOOL clientMode)
+static SSL_CTX* tls_ctx_new(const rdpSettings* settings, SSL_METHOD* method, int options)
 #endif
 {
-	WINPR_ASSERT(tls);
-
-	rdpSettings* settings = tls->context->settings;
 	WINPR_ASSERT(settings);
 
-	tls_reset(tls);
-	tls->ctx = SSL_CTX_new(method);
+	SSL_CTX* ctx = SSL_CTX_new(method);
 
-	tls->underlying = underlying;
-
-	if (!tls->ctx)
+	if (!ctx)
 	{
 		WLog_ERR(TAG, "SSL_CTX_new failed");
-		return FALSE;
+		return NULL;
 	}
 
-	SSL_CTX_set_mode(tls->ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
-	SSL_CTX_set_options(tls->ctx, options);
-	SSL_CTX_set_read_ahead(tls->ctx, 1);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+	SSL_CTX_set_options(ctx, options);
+	SSL_CTX_set_read_ahead(ctx, 1);
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	UINT16 version = freerdp_settings_get_uint16(settings, FreeRDP_TLSMinVersion);
-	if (!SSL_CTX_set_min_proto_version(tls->ctx, version))
+	if (!SSL_CTX_set_min_proto_version(ctx, version))
 	{
-		WLog_ERR(TAG, "SSL_CTX_set_min_proto_version %s failed", version);
-		return FALSE;
+		WLog_ERR(TAG, "SSL_CTX_set_min_proto_version %" PRIu16 " failed", version);
+		goto fail;
 	}
 	version = freerdp_settings_get_uint16(settings, FreeRDP_TLSMaxVersion);
-	if (!SSL_CTX_set_max_proto_version(tls->ctx, version))
+	if (!SSL_CTX_set_max_proto_version(ctx, version))
 	{
-		WLog_ERR(TAG, "SSL_CTX_set_max_proto_version %s failed", version);
-		return FALSE;
+		WLog_ERR(TAG, "SSL_CTX_set_max_proto_version %" PRIu16 " failed", version);
+		goto fail;
 	}
 #endif
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER)
-	SSL_CTX_set_security_level(tls->ctx, settings->TlsSecLevel);
+	SSL_CTX_set_security_level(ctx, settings->TlsSecLevel);
 #endif
 
 	if (settings->AllowedTlsCiphers)
 	{
-		if (!SSL_CTX_set_cipher_list(tls->ctx, settings->AllowedTlsCiphers))
+		if (!SSL_CTX_set_cipher_list(ctx, settings->AllowedTlsCiphers))
 		{
 			WLog_ERR(TAG, "SSL_CTX_set_cipher_list %s failed", settings->AllowedTlsCiphers);
-			return FALSE;
+			goto fail;
 		}
 	}
 
+	if (settings->TlsSecretsFile)
+	{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+		InitOnceExecuteOnce(&secrets_file_idx_once, secrets_file_init_cb, NULL, NULL);
+
+		if (secrets_file_idx != -1)
+			SSL_CTX_set_keylog_callback(ctx, SSLCTX_keylog_cb);
+#else
+		WLog_WARN(TAG, "Key-Logging not available - requires OpenSSL 1.1.1 or higher");
+#endif
+	}
+
+	return ctx;
+
+fail:
+	SSL_CTX_free(ctx);
+	return NULL;
+}
+
+/* Takes ownership of ctx and underlying, both are released by tls_reset */
+static BOOL tls_prepare_ssl(rdpTls* tls, BIO* underlying, SSL_CTX* ctx, BOOL clientMode)
+{
+	WINPR_ASSERT(tls);
+
+	rdpSettings* settings = tls->context->settings;
+	WINPR_ASSERT(settings);
+
+	tls_reset(tls);
+	tls->ctx = ctx;
+	tls->underlying = underlying;
+
+	if (!tls->ctx)
+		return FALSE;
+
 	tls->bio = BIO_new_rdp_tls(tls->ctx, clientMode);
 
 	if (BIO_get_ssl(tls->bio, &tls->ssl) < 0)
@@ -802,25 +828,296 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method, int op
 		return FALSE;
 	}
 
-	if (settings->TlsSecretsFile)
-	{
 #if OPENSSL_VERSION_NUMBER >= 0x10101000L
-		InitOnceExecuteOnce(&secrets_file_idx_once, secrets_file_init_cb, NULL, NULL);
+	if (settings->TlsSecretsFile && (secrets_file_idx != -1))
+		SSL_set_ex_data(tls->ssl, secrets_file_idx, settings->TlsSecretsFile);
+#endif
 
-		if (secrets_file_idx != -1)
-		{
-			SSL_set_ex_data(tls->ssl, secrets_file_idx, settings->TlsSecretsFile);
-			SSL_CTX_set_keylog_callback(tls->ctx, SSLCTX_keylog_cb);
-		}
+	BIO_push(tls->bio, underlying);
+	return TRUE;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x010000000L
+static BOOL tls_prepare(rdpTls* tls, BIO* underlying, const SSL_METHOD* method, int options,
+                        BOOL clientMode)
 #else
-		WLog_WARN(TAG, "Key-Logging not available - requires OpenSSL 1.1.1 or higher");
+static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method, int options,
+                        BOOL clientMode)
 #endif
-	}
+{
+	WINPR_ASSERT(tls);
+	WINPR_ASSERT(tls->context);
 
-	BIO_push(tls->bio, underlying);
+	SSL_CTX* ctx = tls_ctx_new(tls->context->settings, method, options);
+	return tls_prepare_ssl(tls, underlying, ctx, clientMode);
+}
+
+/**
+ * Accepted peers share one SSL_CTX per server configuration. Besides saving the context setup
+ * this lets reconnecting clients resume their session, either from the session cache of the
+ * context or with a TLS 1.3 session ticket encrypted with the ticket keys of the context.
+ * The cache holds the contexts of the most recently used configurations.
+ */
+#define TLS_SERVER_CONTEXTS_MAX 8
+#define TLS_SERVER_SESSION_CACHE_SIZE 4096
+
+typedef struct
+{
+	char* key;
+	SSL_CTX* ctx;
+} TLS_SERVER_CONTEXT;
+
+static INIT_ONCE server_contexts_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION server_contexts_lock;
+static TLS_SERVER_CONTEXT server_contexts[TLS_SERVER_CONTEXTS_MAX] = { 0 };
+static size_t server_contexts_count = 0;
+static UINT64 server_full_handshakes = 0;
+static UINT64 server_resumed_handshakes = 0;
+
+static void server_contexts_cleanup(void)
+{
+	freerdp_tls_free_server_contexts();
+}
+
+static BOOL CALLBACK server_contexts_init_cb(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+	if (!InitializeCriticalSectionAndSpinCount(&server_contexts_lock, 4000))
+		return FALSE;
+
+	/* Registered after OpenSSL was initialized, so this runs before OpenSSL cleans up */
+	(void)atexit(server_contexts_cleanup);
 	return TRUE;
 }
 
+static char* tls_server_ctx_key(const rdpSettings* settings, const rdpCertificate* cert,
+                                const SSL_METHOD* method, int options)
+{
+	char* key = NULL;
+	size_t keylen = 0;
+	char* fingerprint = freerdp_certificate_get_fingerprint_by_hash(cert, "sha256");
+
+	if (!fingerprint)
+		return NULL;
+
+	/* Everything tls_ctx_new and tls_server_ctx_new configure the context with */
+	winpr_asprintf(&key, &keylen, "%p|%d|%" PRIu16 "|%" PRIu16 "|%" PRIu32 "|%s|%d|%s",
+	               (const void*)method, options,
+	               freerdp_settings_get_uint16(settings, FreeRDP_TLSMinVersion),
+	               freerdp_settings_get_uint16(settings, FreeRDP_TLSMaxVersion),
+	               settings->TlsSecLevel,
+	               settings->AllowedTlsCiphers ? settings->AllowedTlsCiphers : "",
+	               settings->TlsSecretsFile ? 1 : 0, fingerprint);
+	free(fingerprint);
+	return key;
+}
+
+static SSL_CTX* tls_server_ctx_new(const rdpSettings* settings, const rdpPrivateKey* key,
+                                   rdpCertificate* cert, const SSL_METHOD* method, int options)
+{
+	static const char sid_ctx[] = "FreeRDP";
+	int status = 0;
+	SSL_CTX* ctx = tls_ctx_new(settings, method, options);
+
+	if (!ctx)
+		return NULL;
+
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx, TLS_SERVER_SESSION_CACHE_SIZE);
+	if (!SSL_CTX_set_session_id_context(ctx, (const unsigned char*)sid_ctx, sizeof(sid_ctx) - 1))
+	{
+		WLog_ERR(TAG, "SSL_CTX_set_session_id_context failed");
+		goto fail;
+	}
+#if (OPENSSL_VERSION_NUMBER >= 0x10101000L) && !defined(LIBRESSL_VERSION_NUMBER)
+	/* A reconnect needs one ticket, do not spend time on more */
+	SSL_CTX_set_num_tickets(ctx, 1);
+#endif
+
+	EVP_PKEY* privkey = freerdp_key_get_evp_pkey(key);
+	if (!privkey)
+	{
+		WLog_ERR(TAG, "invalid private key");
+		goto fail;
+	}
+
+	status = SSL_CTX_use_PrivateKey(ctx, privkey);
+	/* The local reference to the private key will anyway go out of
+	 * scope; so the reference count should be decremented weither
+	 * SSL_CTX_use_PrivateKey succeeds or fails.
+	 */
+	EVP_PKEY_free(privkey);
+
+	if (status <= 0)
+	{
+		WLog_ERR(TAG, "SSL_CTX_use_PrivateKey failed");
+		goto fail;
+	}
+
+	status = SSL_CTX_use_certificate(ctx, freerdp_certificate_get_x509(cert));
+
+	if (status <= 0)
+	{
+		WLog_ERR(TAG, "SSL_CTX_use_certificate failed");
+		goto fail;
+	}
+
+	return ctx;
+
+fail:
+	SSL_CTX_free(ctx);
+	return NULL;
+}
+
+/* Moves entry index to the front, the cache is kept in most recently used order */
+static SSL_CTX* tls_server_ctx_use(size_t index)
+{
+	const TLS_SERVER_CONTEXT entry = server_contexts[index];
+
+	WINPR_ASSERT(index < server_contexts_count);
+
+	memmove(&server_contexts[1], &server_contexts[0], index * sizeof(TLS_SERVER_CONTEXT));
+	server_contexts[0] = entry;
+
+	SSL_CTX_up_ref(entry.ctx);
+	return entry.ctx;
+}
+
+static SSL_CTX* tls_server_ctx_find(const char* key)
+{
+	for (size_t x = 0; x < server_contexts_count; x++)
+	{
+		if (strcmp(server_contexts[x].key, key) == 0)
+			return tls_server_ctx_use(x);
+	}
+
+	return NULL;
+}
+
+/* Returns a reference to the shared server context for settings, created on first use */
+static SSL_CTX* tls_get_server_ctx(const rdpSettings* tlsSettings, rdpSettings* settings,
+                                   const SSL_METHOD* method, int options)
+{
+	SSL_CTX* ctx = NULL;
+
+	const rdpPrivateKey* key = freerdp_settings_get_pointer(settings, FreeRDP_RdpServerRsaKey);
+	if (!key)
+	{
+		WLog_ERR(TAG, "invalid private key");
+		return NULL;
+	}
+
+	rdpCertificate* cert =
+	    freerdp_settings_get_pointer_writable(settings, FreeRDP_RdpServerCertificate);
+	if (!cert)
+	{
+		WLog_ERR(TAG, "invalid certificate");
+		return NULL;
+	}
+
+	if (!InitOnceExecuteOnce(&server_contexts_once, server_contexts_init_cb, NULL, NULL))
+		return NULL;
+
+	char* ctxKey = tls_server_ctx_key(tlsSettings, cert, method, options);
+	if (!ctxKey)
+		return NULL;
+
+	EnterCriticalSection(&server_contexts_lock);
+	ctx = tls_server_ctx_find(ctxKey);
+	LeaveCriticalSection(&server_contexts_lock);
+
+	if (ctx)
+	{
+		free(ctxKey);
+		return ctx;
+	}
+
+	/* Loading certificate and key is the expensive part, do not block other peers meanwhile */
+	SSL_CTX* created = tls_server_ctx_new(tlsSettings, key, cert, method, options);
+	if (!created)
+	{
+		free(ctxKey);
+		return NULL;
+	}
+
+	EnterCriticalSection(&server_contexts_lock);
+	ctx = tls_server_ctx_find(ctxKey);
+	if (!ctx)
+	{
+		if (server_contexts_count == TLS_SERVER_CONTEXTS_MAX)
+		{
+			TLS_SERVER_CONTEXT* last = &server_contexts[--server_contexts_count];
+			free(last->key);
+			SSL_CTX_free(last->ctx);
+		}
+
+		server_contexts[server_contexts_count].key = ctxKey;
+		server_contexts[server_contexts_count].ctx = created;
+		server_contexts_count++;
+
+		ctxKey = NULL;
+		created = NULL;
+		ctx = tls_server_ctx_use(server_contexts_count - 1);
+	}
+	LeaveCriticalSection(&server_contexts_lock);
+
+	free(ctxKey);
+	SSL_CTX_free(created);
+	return ctx;
+}
+
+static void tls_count_server_handshake(BOOL resumed)
+{
+	if (!InitOnceExecuteOnce(&server_contexts_once, server_contexts_init_cb, NULL, NULL))
+		return;
+
+	EnterCriticalSection(&server_contexts_lock);
+	if (resumed)
+		server_resumed_handshakes++;
+	else
+		server_full_handshakes++;
+	LeaveCriticalSection(&server_contexts_lock);
+}
+
+void freerdp_tls_get_server_stats(UINT64* fullHandshakes, UINT64* resumedHandshakes)
+{
+	WINPR_ASSERT(fullHandshakes);
+	WINPR_ASSERT(resumedHandshakes);
+
+	*fullHandshakes = 0;
+	*resumedHandshakes = 0;
+
+	if (!InitOnceExecuteOnce(&server_contexts_once, server_contexts_init_cb, NULL, NULL))
+		return;
+
+	EnterCriticalSection(&server_contexts_lock);
+	*fullHandshakes = server_full_handshakes;
+	*resumedHandshakes = server_resumed_handshakes;
+	LeaveCriticalSection(&server_contexts_lock);
+}
+
+void freerdp_tls_free_server_contexts(void)
+{
+	if (!InitOnceExecuteOnce(&server_contexts_once, server_contexts_init_cb, NULL, NULL))
+		return;
+
+	EnterCriticalSection(&server_contexts_lock);
+	for (size_t x = 0; x < server_contexts_count; x++)
+	{
+		TLS_SERVER_CONTEXT* cur = &server_contexts[x];
+		free(cur->key);
+		/* Peers still connected hold their own reference to the context */
+		SSL_CTX_free(cur->ctx);
+		cur->key = NULL;
+		cur->ctx = NULL;
+	}
+	server_contexts_count = 0;
+	LeaveCriticalSection(&server_contexts_lock);
+}
+
 static void adjustSslOptions(int* options)
 {
 	WINPR_ASSERT(options);
@@ -967,6 +1264,9 @@ TlsHandshakeResult freerdp_tls_handshake(rdpTls* tls)
 		}
 	} while (0);
 
+	if ((ret == TLS_HANDSHAKE_SUCCESS) && !tls->isClientMode)
+		tls_count_server_handshake(SSL_session_reused(tls->ssl) ? TRUE : FALSE);
+
 	freerdp_certificate_free(cert);
 	return ret;
 }
@@ -1078,7 +1378,6 @@ TlsHandshakeResult freerdp_tls_accept_ex(rdpTls* tls, BIO* underlying, rdpSettin
 	WINPR_ASSERT(tls);
 
 	long options = 0;
-	int status = 0;
 
 	/**
 	 * SSL_OP_NO_SSLv2:
@@ -1125,51 +1424,11 @@ TlsHandshakeResult freerdp_tls_accept_ex(rdpTls* tls, BIO* underlying, rdpSettin
 	options |= SSL_OP_NO_RENEGOTIATION;
 #endif
 
-	if (!tls_prepare(tls, underlying, methods, options, FALSE))
-		return TLS_HANDSHAKE_ERROR;
-
-	const rdpPrivateKey* key = freerdp_settings_get_pointer(settings, FreeRDP_RdpServerRsaKey);
-	if (!key)
-	{
-		WLog_ERR(TAG, "invalid private key");
-		return TLS_HANDSHAKE_ERROR;
-	}
-
-	EVP_PKEY* privkey = freerdp_key_get_evp_pkey(key);
-	if (!privkey)
-	{
-		WLog_ERR(TAG, "invalid private key");
-		return TLS_HANDSHAKE_ERROR;
-	}
-
-	status = SSL_use_PrivateKey(tls->ssl, privkey);
-	/* The local reference to the private key will anyway go out of
-	 * scope; so the reference count should be decremented weither
-	 * SSL_use_PrivateKey succeeds or fails.
-	 */
-	EVP_PKEY_free(privkey);
-
-	if (status <= 0)
-	{
-		WLog_ERR(TAG, "SSL_CTX_use_PrivateKey_file failed");
-		return TLS_HANDSHAKE_ERROR;
-	}
-
-	rdpCertificate* cert =
-	    freerdp_settings_get_pointer_writable(settings, FreeRDP_RdpServerCertificate);
-	if (!cert)
-	{
-		WLog_ERR(TAG, "invalid certificate");
-		return TLS_HANDSHAKE_ERROR;
-	}
-
-	status = SSL_use_certificate(tls->ssl, freerdp_certificate_get_x509(cert));
+	WINPR_ASSERT(tls->context);
 
-	if (status <= 0)
-	{
-		WLog_ERR(TAG, "SSL_use_certificate_file failed");
+	SSL_CTX* ctx = tls_get_server_ctx(tls->context->settings, settings, methods, (int)options);
+	if (!tls_prepare_ssl(tls, underlying, ctx, FALSE))
 		return TLS_HANDSHAKE_ERROR;
-	}
 
 #if defined(MICROSOFT_IOS_SNI_BUG) && !defined(OPENSSL_NO_TLSEXT) && \
     !defined(LIBRESSL_VERSION_NUMBER)
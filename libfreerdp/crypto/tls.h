@@ -113,6 +113,11 @@ extern "C"
 
 	FREERDP_LOCAL TlsHandshakeResult freerdp_tls_handshake(rdpTls* tls);
 
+	FREERDP_LOCAL void freerdp_tls_get_server_stats(UINT64* fullHandshakes,
+	                                                UINT64* resumedHandshakes);
+
+	FREERDP_LOCAL void freerdp_tls_free_server_contexts(void);
+
 	FREERDP_LOCAL BOOL freerdp_tls_send_alert(rdpTls* tls);
 
 	FREERDP_LOCAL int freerdp_tls_write_all(rdpTls* tls, const BYTE* data, int length);
@@ -25,6 +25,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <winpr/assert.h>
+
 #include <freerdp/api.h>
 #include <freerdp/freerdp.h>
 #include <freerdp/gdi/gdi.h>
@@ -277,71 +279,266 @@ static UINT32 process_rop(UINT32 src, UINT32 dst, UINT32 pat, const char* rop, U
 	return stack[0];
 }
 
-static INLINE BOOL BitBlt_write(HGDI_DC hdcDest, HGDI_DC hdcSrc, INT32 nXDest, INT32 nYDest,
-                                INT32 nXSrc, INT32 nYSrc, INT32 x, INT32 y, BOOL useSrc,
-                                BOOL usePat, UINT32 style, const char* rop,
-                                const gdiPalette* palette)
+/* Number of pixels converted to the destination format and combined at once */
+#define GDI_ROP3_CHUNK 64
+
+typedef struct gdi_rop3 GDI_ROP3;
+typedef void (*gdi_rop3_row_fn)(const GDI_ROP3* WINPR_RESTRICT rop3, UINT32* WINPR_RESTRICT dst,
+                                const UINT32* WINPR_RESTRICT src, const UINT32* WINPR_RESTRICT pat,
+                                size_t count);
+
+/* A raster operation compiled for one BitBlt */
+struct gdi_rop3
+{
+	const char* rpn;
+	UINT32 format;
+	BYTE table; /* ROP3 truth table, bit ((P << 2) | (S << 1) | D) is the result */
+	UINT32 color;
+	BOOL useSrc;
+	BOOL usePat;
+	BOOL useDst;
+	gdi_rop3_row_fn row;
+};
+
+#define GDI_ROP3_ROW(name, expr)                                                                \
+	static void gdi_rop3_row_##name(const GDI_ROP3* WINPR_RESTRICT rop3,                       \
+	                                UINT32* WINPR_RESTRICT dst, const UINT32* WINPR_RESTRICT src, \
+	                                const UINT32* WINPR_RESTRICT pat, size_t count)             \
+	{                                                                                           \
+		WINPR_UNUSED(rop3);                                                                     \
+		WINPR_UNUSED(src);                                                                      \
+		WINPR_UNUSED(pat);                                                                      \
+		for (size_t x = 0; x < count; x++)                                                      \
+			dst[x] = (expr);                                                                    \
+	}
+
+GDI_ROP3_ROW(PATCOPY, pat[x])
+GDI_ROP3_ROW(PATINVERT, pat[x] ^ dst[x])
+GDI_ROP3_ROW(SRCCOPY, src[x])
+GDI_ROP3_ROW(SRCINVERT, src[x] ^ dst[x])
+GDI_ROP3_ROW(SRCAND, src[x] & dst[x])
+GDI_ROP3_ROW(SRCPAINT, src[x] | dst[x])
+GDI_ROP3_ROW(SRCERASE, src[x] & ~dst[x])
+GDI_ROP3_ROW(NOTSRCCOPY, ~src[x])
+GDI_ROP3_ROW(NOTSRCERASE, ~(src[x] | dst[x]))
+GDI_ROP3_ROW(DSTINVERT, ~dst[x])
+GDI_ROP3_ROW(MERGECOPY, pat[x] & src[x])
+GDI_ROP3_ROW(MERGEPAINT, ~src[x] | dst[x])
+GDI_ROP3_ROW(PATPAINT, pat[x] | ~src[x] | dst[x])
+GDI_ROP3_ROW(DSna, dst[x] & ~src[x])
+GDI_ROP3_ROW(DPa, dst[x] & pat[x])
+GDI_ROP3_ROW(PDna, pat[x] & ~dst[x])
+GDI_ROP3_ROW(DSPDxax, ((pat[x] ^ dst[x]) & src[x]) ^ dst[x])
+GDI_ROP3_ROW(PSDPxax, ((dst[x] ^ pat[x]) & src[x]) ^ pat[x])
+
+/* Any of the 256 operations, evaluates the truth table with bitwise selects */
+static void gdi_rop3_row_table(const GDI_ROP3* WINPR_RESTRICT rop3, UINT32* WINPR_RESTRICT dst,
+                               const UINT32* WINPR_RESTRICT src, const UINT32* WINPR_RESTRICT pat,
+                               size_t count)
+{
+	UINT32 m[8] = { 0 };
+
+	for (size_t x = 0; x < ARRAYSIZE(m); x++)
+		m[x] = ((rop3->table >> x) & 1) ? UINT32_MAX : 0;
+
+	for (size_t x = 0; x < count; x++)
+	{
+		const UINT32 D = dst[x];
+		const UINT32 S = src[x];
+		const UINT32 P = pat[x];
+		const UINT32 p0s0 = (D & m[1]) | (~D & m[0]);
+		const UINT32 p0s1 = (D & m[3]) | (~D & m[2]);
+		const UINT32 p1s0 = (D & m[5]) | (~D & m[4]);
+		const UINT32 p1s1 = (D & m[7]) | (~D & m[6]);
+		const UINT32 p0 = (S & p0s1) | (~S & p0s0);
+		const UINT32 p1 = (S & p1s1) | (~S & p1s0);
+		dst[x] = (P & p1) | (~P & p0);
+	}
+}
+
+static void gdi_rop3_row_fill(const GDI_ROP3* WINPR_RESTRICT rop3, UINT32* WINPR_RESTRICT dst,
+                              const UINT32* WINPR_RESTRICT src, const UINT32* WINPR_RESTRICT pat,
+                              size_t count)
+{
+	WINPR_UNUSED(src);
+	WINPR_UNUSED(pat);
+
+	for (size_t x = 0; x < count; x++)
+		dst[x] = rop3->color;
+}
+
+/* Scalar reference, interprets the RPN string for every pixel */
+static void gdi_rop3_row_rpn(const GDI_ROP3* WINPR_RESTRICT rop3, UINT32* WINPR_RESTRICT dst,
+                             const UINT32* WINPR_RESTRICT src, const UINT32* WINPR_RESTRICT pat,
+                             size_t count)
+{
+	for (size_t x = 0; x < count; x++)
+		dst[x] = process_rop(src[x], dst[x], pat[x], rop3->rpn, rop3->format);
+}
+
+static const struct
+{
+	BYTE table;
+	gdi_rop3_row_fn row;
+} gdi_rop3_rows[] = { { 0xF0, gdi_rop3_row_PATCOPY },    { 0x5A, gdi_rop3_row_PATINVERT },
+	                  { 0xCC, gdi_rop3_row_SRCCOPY },    { 0x66, gdi_rop3_row_SRCINVERT },
+	                  { 0x88, gdi_rop3_row_SRCAND },     { 0xEE, gdi_rop3_row_SRCPAINT },
+	                  { 0x44, gdi_rop3_row_SRCERASE },   { 0x33, gdi_rop3_row_NOTSRCCOPY },
+	                  { 0x11, gdi_rop3_row_NOTSRCERASE }, { 0x55, gdi_rop3_row_DSTINVERT },
+	                  { 0xC0, gdi_rop3_row_MERGECOPY },  { 0xBB, gdi_rop3_row_MERGEPAINT },
+	                  { 0xFB, gdi_rop3_row_PATPAINT },   { 0x22, gdi_rop3_row_DSna },
+	                  { 0xA0, gdi_rop3_row_DPa },        { 0x50, gdi_rop3_row_PDna },
+	                  { 0xE2, gdi_rop3_row_DSPDxax },    { 0xB8, gdi_rop3_row_PSDPxax } };
+
+static BOOL gdi_rop3_compile(GDI_ROP3* rop3, const char* rop, UINT32 format)
 {
-	UINT32 dstColor = 0;
-	UINT32 colorA = 0;
-	UINT32 colorB = 0;
-	UINT32 colorC = 0;
-	const INT32 dstX = nXDest + x;
-	const INT32 dstY = nYDest + y;
-	BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, dstX, dstY);
-
-	if (!dstp)
+	BOOL useConst = FALSE;
+
+	WINPR_ASSERT(rop3);
+
+	if (!rop)
+		return FALSE;
+
+	rop3->rpn = rop;
+	rop3->format = format;
+
+	for (const char* iter = rop; *iter != '\0'; iter++)
+	{
+		switch (*iter)
+		{
+			case 'P':
+				rop3->usePat = TRUE;
+				break;
+
+			case 'S':
+				rop3->useSrc = TRUE;
+				break;
+
+			case 'D':
+				rop3->useDst = TRUE;
+				break;
+
+			case '0':
+			case '1':
+				useConst = TRUE;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	if (!rop3->usePat && !rop3->useSrc && !rop3->useDst)
+	{
+		rop3->color = process_rop(0, 0, 0, rop, format);
+		rop3->row = gdi_rop3_row_fill;
+		return TRUE;
+	}
+
+	/* The constants are format dependent colors, not all zero or all one bits */
+	if (useConst)
+	{
+		rop3->row = gdi_rop3_row_rpn;
+		return TRUE;
+	}
+
+	/* Every operator works bitwise, so evaluating the program on the canonical operand
+	 * bit patterns yields its truth table */
+	rop3->table = (BYTE)(process_rop(0xCCCCCCCC, 0xAAAAAAAA, 0xF0F0F0F0, rop, format) & 0xFF);
+	rop3->row = gdi_rop3_row_table;
+
+	for (size_t x = 0; x < ARRAYSIZE(gdi_rop3_rows); x++)
+	{
+		if (gdi_rop3_rows[x].table == rop3->table)
+			rop3->row = gdi_rop3_rows[x].row;
+	}
+
+	return TRUE;
+}
+
+static BOOL BitBlt_write_row(HGDI_DC hdcDest, HGDI_DC hdcSrc, INT32 nXDest, INT32 nYDest,
+                             INT32 nXSrc, INT32 nYSrc, INT32 x, INT32 y, INT32 count,
+                             UINT32 style, const GDI_ROP3* rop3, const gdiPalette* palette)
+{
+	UINT32 colorA[GDI_ROP3_CHUNK] = { 0 };
+	UINT32 colorB[GDI_ROP3_CHUNK] = { 0 };
+	UINT32 colorC[GDI_ROP3_CHUNK] = { 0 };
+	const size_t dstBpp = FreeRDPGetBytesPerPixel(hdcDest->format);
+	BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, nXDest + x, nYDest + y);
+
+	WINPR_ASSERT((count > 0) && (count <= GDI_ROP3_CHUNK));
+
+	if (!dstp || !gdi_get_bitmap_pointer(hdcDest, nXDest + x + count - 1, nYDest + y))
 	{
 		WLog_ERR(TAG, "dstp=%p", (const void*)dstp);
 		return FALSE;
 	}
 
-	colorA = FreeRDPReadColor(dstp, hdcDest->format);
+	for (INT32 i = 0; i < count; i++)
+		colorA[i] = FreeRDPReadColor(&dstp[i * dstBpp], hdcDest->format);
 
-	if (useSrc)
+	if (rop3->useSrc)
 	{
 		const BYTE* srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc + x, nYSrc + y);
+		const size_t srcBpp = FreeRDPGetBytesPerPixel(hdcSrc->format);
 
-		if (!srcp)
+		if (!srcp || !gdi_get_bitmap_pointer(hdcSrc, nXSrc + x + count - 1, nYSrc + y))
 		{
 			WLog_ERR(TAG, "srcp=%p", (const void*)srcp);
 			return FALSE;
 		}
 
-		colorC = FreeRDPReadColor(srcp, hdcSrc->format);
-		colorC = FreeRDPConvertColor(colorC, hdcSrc->format, hdcDest->format, palette);
+		for (INT32 i = 0; i < count; i++)
+			colorC[i] = FreeRDPReadColor(&srcp[i * srcBpp], hdcSrc->format);
+
+		if (hdcSrc->format != hdcDest->format)
+		{
+			for (INT32 i = 0; i < count; i++)
+				colorC[i] =
+				    FreeRDPConvertColor(colorC[i], hdcSrc->format, hdcDest->format, palette);
+		}
 	}
 
-	if (usePat)
+	if (rop3->usePat)
 	{
 		switch (style)
 		{
 			case GDI_BS_SOLID:
-				colorB = hdcDest->brush->color;
+				for (INT32 i = 0; i < count; i++)
+					colorB[i] = hdcDest->brush->color;
 				break;
 
 			case GDI_BS_HATCHED:
 			case GDI_BS_PATTERN:
-			{
-				const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest + y);
-
-				if (!patp)
+				for (INT32 i = 0; i < count; i++)
 				{
-					WLog_ERR(TAG, "patp=%p", (const void*)patp);
-					return FALSE;
-				}
+					const BYTE* patp =
+					    gdi_get_brush_pointer(hdcDest, nXDest + x + i, nYDest + y);
 
-				colorB = FreeRDPReadColor(patp, hdcDest->format);
-			}
-			break;
+					if (!patp)
+					{
+						WLog_ERR(TAG, "patp=%p", (const void*)patp);
+						return FALSE;
+					}
+
+					colorB[i] = FreeRDPReadColor(patp, hdcDest->format);
+				}
+				break;
 
 			default:
 				break;
 		}
 	}
 
-	dstColor = process_rop(colorC, colorA, colorB, rop, hdcDest->format);
-	return FreeRDPWriteColor(dstp, hdcDest->format, dstColor);
+	rop3->row(rop3, colorA, colorC, colorB, (size_t)count);
+
+	for (INT32 i = 0; i < count; i++)
+	{
+		if (!FreeRDPWriteColor(&dstp[i * dstBpp], hdcDest->format, colorA[i]))
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL adjust_src_coordinates(HGDI_DC hdcSrc, INT32 nWidth, INT32 nHeight, INT32* px,
@@ -460,43 +657,27 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nW
                            const gdiPalette* palette)
 {
 	UINT32 style = 0;
-	BOOL useSrc = FALSE;
-	BOOL usePat = FALSE;
-	const char* iter = rop;
-
-	while (*iter != '\0')
-	{
-		switch (*iter++)
-		{
-			case 'P':
-				usePat = TRUE;
-				break;
-
-			case 'S':
-				useSrc = TRUE;
-				break;
-
-			default:
-				break;
-		}
-	}
+	GDI_ROP3 rop3 = { 0 };
 
 	if (!hdcDest)
 		return FALSE;
 
+	if (!gdi_rop3_compile(&rop3, rop, hdcDest->format))
+		return FALSE;
+
 	if (!adjust_src_dst_coordinates(hdcDest, &nXSrc, &nYSrc, &nXDest, &nYDest, &nWidth, &nHeight))
 		return FALSE;
 
-	if (useSrc && !hdcSrc)
+	if (rop3.useSrc && !hdcSrc)
 		return FALSE;
 
-	if (useSrc)
+	if (rop3.useSrc)
 	{
 		if (!adjust_src_coordinates(hdcSrc, nWidth, nHeight, &nXSrc, &nYSrc))
 			return FALSE;
 	}
 
-	if (usePat)
+	if (rop3.usePat)
 	{
 		style = gdi_GetBrushStyle(hdcDest);
 
@@ -513,52 +694,23 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nW
 		}
 	}
 
-	if ((nXDest > nXSrc) && (nYDest > nYSrc))
-	{
-		for (INT32 y = nHeight - 1; y >= 0; y--)
-		{
-			for (INT32 x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
-	}
-	else if (nXDest > nXSrc)
-	{
-		for (INT32 y = 0; y < nHeight; y++)
-		{
-			for (INT32 x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
-	}
-	else if (nYDest > nYSrc)
-	{
-		for (INT32 y = nHeight - 1; y >= 0; y--)
-		{
-			for (INT32 x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
-	}
-	else
+	/* Source and destination may overlap, walk rows and chunks so that every source pixel
+	 * is read before it is overwritten. Each chunk is read completely before it is written. */
+	const BOOL reverseX = nXDest > nXSrc;
+	const BOOL reverseY = nYDest > nYSrc;
+
+	for (INT32 i = 0; i < nHeight; i++)
 	{
-		for (INT32 y = 0; y < nHeight; y++)
+		const INT32 y = reverseY ? nHeight - 1 - i : i;
+
+		for (INT32 j = 0; j < nWidth; j += GDI_ROP3_CHUNK)
 		{
-			for (INT32 x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+			const INT32 count = MIN(GDI_ROP3_CHUNK, nWidth - j);
+			const INT32 x = reverseX ? nWidth - j - count : j;
+
+			if (!BitBlt_write_row(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, count,
+			                      style, &rop3, palette))
+				return FALSE;
 		}
 	}
 
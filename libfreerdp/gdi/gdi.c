@@ -1346,11 +1346,13 @@ BOOL gdi_init_ex(freerdp* instance, UINT32 format, UINT32 stride, BYTE* buffer,
 
 	const UINT32 ColorDepth = freerdp_settings_get_uint32(context->settings, FreeRDP_ColorDepth);
 	SrcFormat = gdi_get_pixel_format(ColorDepth);
-	gdi = (rdpGdi*)calloc(1, sizeof(rdpGdi));
+	rdp_gdi_internal* internal = (rdp_gdi_internal*)calloc(1, sizeof(rdp_gdi_internal));
 
-	if (!gdi)
+	if (!internal)
 		goto fail;
 
+	gdi = &internal->common;
+
 	context->gdi = gdi;
 	gdi->log = WLog_Get(TAG);
 
@@ -1407,6 +1409,7 @@ void gdi_free(freerdp* instance)
 
 	if (gdi)
 	{
+		gdi_gfx_pipeline_free(gdi_cast(gdi)->pipeline);
 		gdi_bitmap_free_ex(gdi->primary);
 		gdi_DeleteDC(gdi->hdc);
 		free(gdi);
@@ -25,6 +25,30 @@
 
 #include <freerdp/api.h>
 
+typedef struct gdi_gfx_pipeline gdiGfxPipeline;
+
+typedef struct
+{
+	rdpGdi common;
+
+	gdiGfxPipeline* pipeline;
+} rdp_gdi_internal;
+
+static INLINE rdp_gdi_internal* gdi_cast(rdpGdi* gdi)
+{
+	union
+	{
+		rdpGdi* pub;
+		rdp_gdi_internal* internal;
+	} cnv;
+
+	WINPR_ASSERT(gdi);
+	cnv.pub = gdi;
+	return cnv.internal;
+}
+
+FREERDP_LOCAL void gdi_gfx_pipeline_free(gdiGfxPipeline* pipeline);
+
 FREERDP_LOCAL BOOL gdi_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmapUpdate);
 
 FREERDP_LOCAL gdiBitmap* gdi_bitmap_new_ex(rdpGdi* gdi, int width, int height, int bpp, BYTE* data);
@@ -21,7 +21,11 @@
 
 #include <freerdp/config.h>
 
+#include <winpr/pool.h>
+#include <winpr/collections.h>
+
 #include "../core/update.h"
+#include "gdi.h"
 
 #include <freerdp/api.h>
 #include <freerdp/log.h>
@@ -76,6 +80,9 @@ static DWORD gfx_align_scanline(DWORD widthInBytes, DWORD alignment)
 	return scanline;
 }
 
+static UINT gdi_decode_surface_commit(RdpgfxClientContext* context, gdiGfxSurface* surface);
+static UINT gdi_decode_lanes_commit(RdpgfxClientContext* context);
+
 /**
  * Function description
  *
@@ -105,6 +112,10 @@ static UINT gdi_ResetGraphics(RdpgfxClientContext* context,
 	settings = gdi->context->settings;
 	WINPR_ASSERT(settings);
 	EnterCriticalSection(&context->mux);
+
+	if (gdi_decode_lanes_commit(context) != CHANNEL_RC_OK)
+		goto fail;
+
 	DesktopWidth = resetGraphics->width;
 	DesktopHeight = resetGraphics->height;
 
@@ -195,6 +206,10 @@ static UINT gdi_OutputUpdate(rdpGdi* gdi, gdiGfxSurface* surface)
 	if (!(rects = region16_rects(&surface->invalidRegion, &nbRects)) || !nbRects)
 		return CHANNEL_RC_OK;
 
+	/* The invalid rectangles mostly repeat in size, keep the scaler setup between updates */
+	if (!surface->scaler && !(surface->scaler = freerdp_image_scaler_new()))
+		return CHANNEL_RC_NO_MEMORY;
+
 	if (!update_begin_paint(update))
 		goto fail;
 
@@ -209,9 +224,10 @@ static UINT gdi_OutputUpdate(rdpGdi* gdi, gdiGfxSurface* surface)
 		const UINT32 dwidth = MIN((UINT32)(swidth * sx), (UINT32)gdi->width - nXDst);
 		const UINT32 dheight = MIN((UINT32)(sheight * sy), (UINT32)gdi->height - nYDst);
 
-		if (!freerdp_image_scale(gdi->primary_buffer, gdi->dstFormat, gdi->stride, nXDst, nYDst,
-		                         dwidth, dheight, surface->data, surface->format, surface->scanline,
-		                         nXSrc, nYSrc, swidth, sheight))
+		if (!freerdp_image_scaler_scale(surface->scaler, gdi->primary_buffer, gdi->dstFormat,
+		                                gdi->stride, nXDst, nYDst, dwidth, dheight, surface->data,
+		                                surface->format, surface->scanline, nXSrc, nYSrc, swidth,
+		                                sheight))
 		{
 			rc = CHANNEL_RC_NULL_DATA;
 			goto fail;
@@ -265,6 +281,11 @@ static UINT gdi_UpdateSurfaces(RdpgfxClientContext* context)
 		if (!surface)
 			continue;
 
+		status = gdi_decode_surface_commit(context, surface);
+
+		if (status != CHANNEL_RC_OK)
+			break;
+
 		/* Already handled in UpdateSurfaceArea callbacks */
 		if (context->UpdateSurfaceArea)
 		{
@@ -323,7 +344,14 @@ static UINT gdi_EndFrame(RdpgfxClientContext* context, const RDPGFX_END_FRAME_PD
 
 	rdpGdi* gdi = (rdpGdi*)context->custom;
 	WINPR_ASSERT(gdi);
-	const UINT status = gdi_call_update_surfaces(context);
+
+	EnterCriticalSection(&context->mux);
+	UINT status = gdi_decode_lanes_commit(context);
+	LeaveCriticalSection(&context->mux);
+
+	if (status == CHANNEL_RC_OK)
+		status = gdi_call_update_surfaces(context);
+
 	gdi->inGfxFrame = FALSE;
 	return status;
 }
@@ -342,27 +370,49 @@ static UINT gdi_interFrameUpdate(rdpGdi* gdi, RdpgfxClientContext* context)
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_Uncompressed(rdpGdi* gdi, RdpgfxClientContext* context,
-                                            const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_Invalidate(RdpgfxClientContext* context, gdiGfxSurface* surface,
+                                          const REGION16* invalidRegion)
 {
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface = NULL;
-	RECTANGLE_16 invalidRect;
-	DWORD bpp = 0;
-	size_t size = 0;
-	WINPR_ASSERT(gdi);
+	UINT32 nrRects = 0;
 	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(invalidRegion);
+
+	const RECTANGLE_16* rects = region16_rects(invalidRegion, &nrRects);
+
+	if (nrRects == 0)
+		return CHANNEL_RC_OK;
+
+	if (!region16_union_rects(&surface->invalidRegion, &surface->invalidRegion, rects, nrRects))
+		return ERROR_INTERNAL_ERROR;
+
+	return IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
+	                    nrRects, rects);
+}
+
+static UINT gdi_invalidate_command_rect(const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
+{
+	RECTANGLE_16 invalidRect;
 	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(invalidRegion);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
+	invalidRect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
+	invalidRect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
+	invalidRect.right = (UINT16)MIN(UINT16_MAX, cmd->right);
+	invalidRect.bottom = (UINT16)MIN(UINT16_MAX, cmd->bottom);
 
-	if (!surface)
-	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
+	if (!region16_union_rect(invalidRegion, invalidRegion, &invalidRect))
+		return ERROR_INTERNAL_ERROR;
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT gdi_decode_uncompressed(gdiGfxSurface* surface, const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	DWORD bpp = 0;
+	size_t size = 0;
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(cmd);
 
 	if (!is_within_surface(surface, cmd))
 		return ERROR_INVALID_DATA;
@@ -380,109 +430,36 @@ static UINT gdi_SurfaceCommand_Uncompressed(rdpGdi* gdi, RdpgfxClientContext* co
 	                                   0, 0, NULL, FREERDP_FLIP_NONE))
 		return ERROR_INTERNAL_ERROR;
 
-	invalidRect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
-	invalidRect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
-	invalidRect.right = (UINT16)MIN(UINT16_MAX, cmd->right);
-	invalidRect.bottom = (UINT16)MIN(UINT16_MAX, cmd->bottom);
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	status = gdi_interFrameUpdate(gdi, context);
-
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 }
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT gdi_SurfaceCommand_RemoteFX(rdpGdi* gdi, RdpgfxClientContext* context,
-                                        const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_decode_remotefx(gdiGfxSurface* surface, RFX_CONTEXT* rfx,
+                               const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
 {
-	UINT status = ERROR_INTERNAL_ERROR;
-	gdiGfxSurface* surface = NULL;
-	REGION16 invalidRegion;
-	const RECTANGLE_16* rects = NULL;
-	UINT32 nrRects = 0;
-	WINPR_ASSERT(gdi);
-	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
 	WINPR_ASSERT(cmd);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
+	rfx_context_set_pixel_format(rfx, cmd->format);
 
-	WINPR_ASSERT(surface->codecs);
-	rfx_context_set_pixel_format(surface->codecs->rfx, cmd->format);
-	region16_init(&invalidRegion);
-
-	if (!rfx_process_message(surface->codecs->rfx, cmd->data, cmd->length, cmd->left, cmd->top,
-	                         surface->data, surface->format, surface->scanline, surface->height,
-	                         &invalidRegion))
+	if (!rfx_process_message(rfx, cmd->data, cmd->length, cmd->left, cmd->top, surface->data,
+	                         surface->format, surface->scanline, surface->height, invalidRegion))
 	{
 		WLog_ERR(TAG, "Failed to process RemoteFX message");
-		goto fail;
+		return ERROR_INTERNAL_ERROR;
 	}
 
-	rects = region16_rects(&invalidRegion, &nrRects);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      nrRects, rects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	for (UINT32 x = 0; x < nrRects; x++)
-		region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, &rects[x]);
-
-	status = gdi_interFrameUpdate(gdi, context);
-
-fail:
-	region16_uninit(&invalidRegion);
-	return status;
+	return CHANNEL_RC_OK;
 }
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT gdi_SurfaceCommand_ClearCodec(rdpGdi* gdi, RdpgfxClientContext* context,
-                                          const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_decode_clear(gdiGfxSurface* surface, CLEAR_CONTEXT* clear,
+                             const gdiPalette* palette, const RDPGFX_SURFACE_COMMAND* cmd)
 {
-	INT32 rc = 0;
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface = NULL;
-	RECTANGLE_16 invalidRect;
-	WINPR_ASSERT(gdi);
-	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
 	WINPR_ASSERT(cmd);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
-	WINPR_ASSERT(surface->codecs);
-	rc = clear_decompress(surface->codecs->clear, cmd->data, cmd->length, cmd->width, cmd->height,
-	                      surface->data, surface->format, surface->scanline, cmd->left, cmd->top,
-	                      surface->width, surface->height, &gdi->palette);
+	const INT32 rc = clear_decompress(clear, cmd->data, cmd->length, cmd->width, cmd->height,
+	                                  surface->data, surface->format, surface->scanline, cmd->left,
+	                                  cmd->top, surface->width, surface->height, palette);
 
 	if (rc < 0)
 	{
@@ -490,130 +467,70 @@ static UINT gdi_SurfaceCommand_ClearCodec(rdpGdi* gdi, RdpgfxClientContext* cont
 		return ERROR_INTERNAL_ERROR;
 	}
 
-	invalidRect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
-	invalidRect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
-	invalidRect.right = (UINT16)MIN(UINT16_MAX, cmd->right);
-	invalidRect.bottom = (UINT16)MIN(UINT16_MAX, cmd->bottom);
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	status = gdi_interFrameUpdate(gdi, context);
-
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 }
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT gdi_SurfaceCommand_Planar(rdpGdi* gdi, RdpgfxClientContext* context,
-                                      const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_decode_planar(gdiGfxSurface* surface, BITMAP_PLANAR_CONTEXT* planar,
+                              const RDPGFX_SURFACE_COMMAND* cmd)
 {
-	UINT status = CHANNEL_RC_OK;
-	BYTE* DstData = NULL;
-	gdiGfxSurface* surface = NULL;
-	RECTANGLE_16 invalidRect;
-	WINPR_ASSERT(gdi);
-	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
 	WINPR_ASSERT(cmd);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
-	DstData = surface->data;
-
 	if (!is_within_surface(surface, cmd))
 		return ERROR_INVALID_DATA;
 
-	if (!planar_decompress(surface->codecs->planar, cmd->data, cmd->length, cmd->width, cmd->height,
-	                       DstData, surface->format, surface->scanline, cmd->left, cmd->top,
-	                       cmd->width, cmd->height, FALSE))
+	if (!planar_decompress(planar, cmd->data, cmd->length, cmd->width, cmd->height, surface->data,
+	                       surface->format, surface->scanline, cmd->left, cmd->top, cmd->width,
+	                       cmd->height, FALSE))
 		return ERROR_INTERNAL_ERROR;
 
-	invalidRect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
-	invalidRect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
-	invalidRect.right = (UINT16)MIN(UINT16_MAX, cmd->right);
-	invalidRect.bottom = (UINT16)MIN(UINT16_MAX, cmd->bottom);
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	status = gdi_interFrameUpdate(gdi, context);
-
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 }
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT gdi_SurfaceCommand_AVC420(rdpGdi* gdi, RdpgfxClientContext* context,
-                                      const RDPGFX_SURFACE_COMMAND* cmd)
-{
 #ifdef WITH_GFX_H264
-	INT32 rc = 0;
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface = NULL;
-	RDPGFX_H264_METABLOCK* meta = NULL;
-	RDPGFX_AVC420_BITMAP_STREAM* bs = NULL;
-	WINPR_ASSERT(gdi);
-	WINPR_ASSERT(context);
-	WINPR_ASSERT(cmd);
+static UINT gdi_decode_h264_prepare(gdiGfxSurface* surface)
+{
+	WINPR_ASSERT(surface);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
+	if (surface->h264)
+		return CHANNEL_RC_OK;
 
-	if (!surface)
-	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
+	surface->h264 = h264_context_new(FALSE);
 
 	if (!surface->h264)
 	{
-		surface->h264 = h264_context_new(FALSE);
+		WLog_ERR(TAG, "unable to create h264 context");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
 
-		if (!surface->h264)
-		{
-			WLog_ERR(TAG, "unable to create h264 context");
-			return ERROR_NOT_ENOUGH_MEMORY;
-		}
+	if (!h264_context_reset(surface->h264, surface->width, surface->height))
+		return ERROR_INTERNAL_ERROR;
 
-		if (!h264_context_reset(surface->h264, surface->width, surface->height))
-			return ERROR_INTERNAL_ERROR;
-	}
+	return CHANNEL_RC_OK;
+}
+#endif
 
-	if (!surface->h264)
-		return ERROR_NOT_SUPPORTED;
+static UINT gdi_decode_avc420(gdiGfxSurface* surface, const RDPGFX_SURFACE_COMMAND* cmd,
+                              REGION16* invalidRegion)
+{
+#ifdef WITH_GFX_H264
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(cmd);
 
-	bs = (RDPGFX_AVC420_BITMAP_STREAM*)cmd->extra;
+	const RDPGFX_AVC420_BITMAP_STREAM* bs = (const RDPGFX_AVC420_BITMAP_STREAM*)cmd->extra;
 
 	if (!bs)
 		return ERROR_INTERNAL_ERROR;
 
-	meta = &(bs->meta);
-	rc = avc420_decompress(surface->h264, bs->data, bs->length, surface->data, surface->format,
-	                       surface->scanline, surface->width, surface->height, meta->regionRects,
-	                       meta->numRegionRects);
+	const UINT status = gdi_decode_h264_prepare(surface);
+
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	const RDPGFX_H264_METABLOCK* meta = &(bs->meta);
+	const INT32 rc = avc420_decompress(surface->h264, bs->data, bs->length, surface->data,
+	                                   surface->format, surface->scanline, surface->width,
+	                                   surface->height, meta->regionRects, meta->numRegionRects);
 
 	if (rc < 0)
 	{
@@ -621,124 +538,65 @@ static UINT gdi_SurfaceCommand_AVC420(rdpGdi* gdi, RdpgfxClientContext* context,
 		return CHANNEL_RC_OK;
 	}
 
-	for (UINT32 i = 0; i < meta->numRegionRects; i++)
-	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    (RECTANGLE_16*)&(meta->regionRects[i]));
-	}
-
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      meta->numRegionRects, meta->regionRects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	status = gdi_interFrameUpdate(gdi, context);
+	if (!region16_union_rects(invalidRegion, invalidRegion, meta->regionRects,
+	                          meta->numRegionRects))
+		return ERROR_INTERNAL_ERROR;
 
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 #else
+	WINPR_UNUSED(surface);
+	WINPR_UNUSED(cmd);
+	WINPR_UNUSED(invalidRegion);
 	return ERROR_NOT_SUPPORTED;
 #endif
 }
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT gdi_SurfaceCommand_AVC444(rdpGdi* gdi, RdpgfxClientContext* context,
-                                      const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_decode_avc444(gdiGfxSurface* surface, const RDPGFX_SURFACE_COMMAND* cmd,
+                              REGION16* invalidRegion)
 {
 #ifdef WITH_GFX_H264
-	INT32 rc = 0;
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface = NULL;
-	RDPGFX_AVC444_BITMAP_STREAM* bs = NULL;
-	RDPGFX_AVC420_BITMAP_STREAM* avc1 = NULL;
-	RDPGFX_H264_METABLOCK* meta1 = NULL;
-	RDPGFX_AVC420_BITMAP_STREAM* avc2 = NULL;
-	RDPGFX_H264_METABLOCK* meta2 = NULL;
-	WINPR_ASSERT(gdi);
-	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
 	WINPR_ASSERT(cmd);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
-	if (!surface->h264)
-	{
-		surface->h264 = h264_context_new(FALSE);
-
-		if (!surface->h264)
-		{
-			WLog_ERR(TAG, "unable to create h264 context");
-			return ERROR_NOT_ENOUGH_MEMORY;
-		}
-
-		if (!h264_context_reset(surface->h264, surface->width, surface->height))
-			return ERROR_INTERNAL_ERROR;
-	}
-
-	if (!surface->h264)
-		return ERROR_NOT_SUPPORTED;
-
-	bs = (RDPGFX_AVC444_BITMAP_STREAM*)cmd->extra;
+	const RDPGFX_AVC444_BITMAP_STREAM* bs = (const RDPGFX_AVC444_BITMAP_STREAM*)cmd->extra;
 
 	if (!bs)
 		return ERROR_INTERNAL_ERROR;
 
-	avc1 = &bs->bitstream[0];
-	avc2 = &bs->bitstream[1];
-	meta1 = &avc1->meta;
-	meta2 = &avc2->meta;
-	rc = avc444_decompress(surface->h264, bs->LC, meta1->regionRects, meta1->numRegionRects,
-	                       avc1->data, avc1->length, meta2->regionRects, meta2->numRegionRects,
-	                       avc2->data, avc2->length, surface->data, surface->format,
-	                       surface->scanline, surface->width, surface->height, cmd->codecId);
+	const UINT status = gdi_decode_h264_prepare(surface);
+
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	const RDPGFX_AVC420_BITMAP_STREAM* avc1 = &bs->bitstream[0];
+	const RDPGFX_AVC420_BITMAP_STREAM* avc2 = &bs->bitstream[1];
+	const RDPGFX_H264_METABLOCK* meta1 = &avc1->meta;
+	const RDPGFX_H264_METABLOCK* meta2 = &avc2->meta;
+	const INT32 rc =
+	    avc444_decompress(surface->h264, bs->LC, meta1->regionRects, meta1->numRegionRects,
+	                      avc1->data, avc1->length, meta2->regionRects, meta2->numRegionRects,
+	                      avc2->data, avc2->length, surface->data, surface->format,
+	                      surface->scanline, surface->width, surface->height, cmd->codecId);
 
 	if (rc < 0)
 	{
-		WLog_WARN(TAG, "avc444_decompress failure: %" PRIu32 ", ignoring update.", status);
+		WLog_WARN(TAG, "avc444_decompress failure: %" PRId32 ", ignoring update.", rc);
 		return CHANNEL_RC_OK;
 	}
 
-	for (UINT32 i = 0; i < meta1->numRegionRects; i++)
-	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    &(meta1->regionRects[i]));
-	}
+	if (!region16_union_rects(invalidRegion, invalidRegion, meta1->regionRects,
+	                          meta1->numRegionRects))
+		return ERROR_INTERNAL_ERROR;
 
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      meta1->numRegionRects, meta1->regionRects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	for (UINT32 i = 0; i < meta2->numRegionRects; i++)
-	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    &(meta2->regionRects[i]));
-	}
-
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      meta2->numRegionRects, meta2->regionRects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	status = gdi_interFrameUpdate(gdi, context);
+	if (!region16_union_rects(invalidRegion, invalidRegion, meta2->regionRects,
+	                          meta2->numRegionRects))
+		return ERROR_INTERNAL_ERROR;
 
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 #else
+	WINPR_UNUSED(surface);
+	WINPR_UNUSED(cmd);
+	WINPR_UNUSED(invalidRegion);
 	return ERROR_NOT_SUPPORTED;
 #endif
 }
@@ -775,201 +633,819 @@ static BOOL gdi_apply_alpha(BYTE* data, UINT32 format, UINT32 stride, RECTANGLE_
 		first = FALSE;
 	}
 
-	return TRUE;
+	return TRUE;
+}
+
+static UINT gdi_decode_alpha(gdiGfxSurface* surface, const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	UINT16 alphaSig = 0;
+	UINT16 compressed = 0;
+	wStream buffer;
+	wStream* s = NULL;
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(cmd);
+
+	s = Stream_StaticConstInit(&buffer, cmd->data, cmd->length);
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
+		return ERROR_INVALID_DATA;
+
+	if (!is_within_surface(surface, cmd))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT16(s, alphaSig);
+	Stream_Read_UINT16(s, compressed);
+
+	if (alphaSig != 0x414C)
+		return ERROR_INVALID_DATA;
+
+	if (compressed == 0)
+	{
+		if (!Stream_CheckAndLogRequiredLengthOfSize(TAG, s, cmd->height, cmd->width))
+			return ERROR_INVALID_DATA;
+
+		for (UINT32 y = cmd->top; y < cmd->top + cmd->height; y++)
+		{
+			BYTE* line = &surface->data[surface->scanline * y];
+
+			for (UINT32 x = cmd->left; x < cmd->left + cmd->width; x++)
+			{
+				UINT32 color = 0;
+				BYTE r = 0;
+				BYTE g = 0;
+				BYTE b = 0;
+				BYTE a = 0;
+				BYTE* src = &line[x * FreeRDPGetBytesPerPixel(surface->format)];
+				Stream_Read_UINT8(s, a);
+				color = FreeRDPReadColor(src, surface->format);
+				FreeRDPSplitColor(color, surface->format, &r, &g, &b, NULL, NULL);
+				color = FreeRDPGetColor(surface->format, r, g, b, a);
+				FreeRDPWriteColor(src, surface->format, color);
+			}
+		}
+	}
+	else
+	{
+		UINT32 startOffsetX = 0;
+		RECTANGLE_16 rect = { 0 };
+		rect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
+		rect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
+		rect.right = (UINT16)MIN(UINT16_MAX, cmd->left + cmd->width);
+		rect.bottom = (UINT16)MIN(UINT16_MAX, cmd->top + cmd->height);
+
+		while (rect.top < rect.bottom)
+		{
+			UINT32 count = 0;
+			BYTE a = 0;
+
+			if (!Stream_CheckAndLogRequiredLength(TAG, s, 2))
+				return ERROR_INVALID_DATA;
+
+			Stream_Read_UINT8(s, a);
+			Stream_Read_UINT8(s, count);
+
+			if (count >= 0xFF)
+			{
+				if (!Stream_CheckAndLogRequiredLength(TAG, s, 2))
+					return ERROR_INVALID_DATA;
+
+				Stream_Read_UINT16(s, count);
+
+				if (count >= 0xFFFF)
+				{
+					if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
+						return ERROR_INVALID_DATA;
+
+					Stream_Read_UINT32(s, count);
+				}
+			}
+
+			if (!gdi_apply_alpha(surface->data, surface->format, surface->scanline, &rect,
+			                     startOffsetX, count, a))
+				return ERROR_INTERNAL_ERROR;
+
+			startOffsetX += count;
+
+			while (startOffsetX >= cmd->width)
+			{
+				startOffsetX -= cmd->width;
+				rect.top++;
+			}
+		}
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+#if defined(WITH_GFX_FRAME_DUMP)
+static void dump_cmd(const RDPGFX_SURFACE_COMMAND* cmd, UINT32 frameId)
+{
+	static UINT64 xxx = 0;
+	const char* path = "/tmp/dump/";
+	WINPR_ASSERT(cmd);
+	char fname[1024] = { 0 };
+
+	snprintf(fname, sizeof(fname), "%s/%08" PRIx64 ".raw", path, xxx++);
+	FILE* fp = fopen(fname, "w");
+	if (!fp)
+		return;
+	fprintf(fp, "frameid: %" PRIu32 "\n", frameId);
+	fprintf(fp, "surfaceId: %" PRIu32 "\n", cmd->surfaceId);
+	fprintf(fp, "codecId: %" PRIu32 "\n", cmd->codecId);
+	fprintf(fp, "contextId: %" PRIu32 "\n", cmd->contextId);
+	fprintf(fp, "format: %" PRIu32 "\n", cmd->format);
+	fprintf(fp, "left: %" PRIu32 "\n", cmd->left);
+	fprintf(fp, "top: %" PRIu32 "\n", cmd->top);
+	fprintf(fp, "right: %" PRIu32 "\n", cmd->right);
+	fprintf(fp, "bottom: %" PRIu32 "\n", cmd->bottom);
+	fprintf(fp, "width: %" PRIu32 "\n", cmd->width);
+	fprintf(fp, "height: %" PRIu32 "\n", cmd->height);
+	fprintf(fp, "length: %" PRIu32 "\n", cmd->length);
+
+	char* bdata = crypto_base64_encode_ex(cmd->data, cmd->length, FALSE);
+	fprintf(fp, "data: %s\n", bdata);
+	free(bdata);
+	fclose(fp);
+}
+#endif
+
+static UINT gdi_decode_progressive(gdiGfxSurface* surface, PROGRESSIVE_CONTEXT* progressive,
+                                   const RDPGFX_SURFACE_COMMAND* cmd, UINT32 frameId,
+                                   REGION16* invalidRegion)
+{
+	/**
+	 * Note: Since this comes via a Wire-To-Surface-2 PDU the
+	 * cmd's top/left/right/bottom/width/height members are always zero!
+	 * The update region is determined during decompression.
+	 */
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(cmd);
+
+	if (!is_within_surface(surface, cmd))
+		return ERROR_INVALID_DATA;
+
+	INT32 rc = progressive_create_surface_context(progressive, surface->surfaceId, surface->width,
+	                                              surface->height);
+
+	if (rc < 0)
+	{
+		WLog_ERR(TAG, "progressive_create_surface_context failure: %" PRId32 "", rc);
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	rc = progressive_decompress(progressive, cmd->data, cmd->length, surface->data, surface->format,
+	                            surface->scanline, cmd->left, cmd->top, invalidRegion,
+	                            surface->surfaceId, frameId);
+
+	if (rc < 0)
+	{
+		WLog_ERR(TAG, "progressive_decompress failure: %" PRId32 "", rc);
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+typedef struct
+{
+	BITMAP_PLANAR_CONTEXT* planar;
+	RFX_CONTEXT* rfx;
+	CLEAR_CONTEXT* clear;
+	PROGRESSIVE_CONTEXT* progressive;
+} gdiGfxDecoders;
+
+/**
+ * Decodes a surface command into the surface data and adds the changed area to invalidRegion
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_decode_surface_command(gdiGfxSurface* surface, const gdiGfxDecoders* decoders,
+                                       const RDPGFX_SURFACE_COMMAND* cmd, UINT32 frameId,
+                                       const gdiPalette* palette, REGION16* invalidRegion)
+{
+	UINT status = ERROR_INTERNAL_ERROR;
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(decoders);
+	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(invalidRegion);
+
+	switch (cmd->codecId)
+	{
+		case RDPGFX_CODECID_UNCOMPRESSED:
+			status = gdi_decode_uncompressed(surface, cmd);
+			break;
+
+		case RDPGFX_CODECID_CAVIDEO:
+			return gdi_decode_remotefx(surface, decoders->rfx, cmd, invalidRegion);
+
+		case RDPGFX_CODECID_CLEARCODEC:
+			status = gdi_decode_clear(surface, decoders->clear, palette, cmd);
+			break;
+
+		case RDPGFX_CODECID_PLANAR:
+			status = gdi_decode_planar(surface, decoders->planar, cmd);
+			break;
+
+		case RDPGFX_CODECID_AVC420:
+			return gdi_decode_avc420(surface, cmd, invalidRegion);
+
+		case RDPGFX_CODECID_AVC444v2:
+		case RDPGFX_CODECID_AVC444:
+			return gdi_decode_avc444(surface, cmd, invalidRegion);
+
+		case RDPGFX_CODECID_ALPHA:
+			status = gdi_decode_alpha(surface, cmd);
+			break;
+
+		case RDPGFX_CODECID_CAPROGRESSIVE:
+			return gdi_decode_progressive(surface, decoders->progressive, cmd, frameId,
+			                              invalidRegion);
+
+		default:
+			return ERROR_NOT_SUPPORTED;
+	}
+
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	return gdi_invalidate_command_rect(cmd, invalidRegion);
+}
+
+/* Surface commands are decoded on the lane of their surface. Lanes of different surfaces run
+ * concurrently on the thread pool, the commands of one lane are decoded in order. Each lane has
+ * its own planar and progressive decoder. The ClearCodec glyph and vbar caches span surfaces and
+ * a RemoteFX encoder sends its header blocks once for all surfaces, so ClearCodec and RemoteFX
+ * commands of all surfaces share one lane with the decoders of the codecs.
+ * The commands of a surface are pending on one lane at a time. Their invalidation is committed
+ * on the channel thread, at EndFrame or before any other PDU touches the surface. */
+typedef struct gdi_gfx_decode_lane gdiGfxDecodeLane;
+
+struct gdi_gfx_decode_lane
+{
+	CRITICAL_SECTION lock;
+	wArrayList* jobs;
+	size_t next;
+	BOOL running;
+	PTP_WORK work;
+	gdiGfxDecoders decoders;
+	UINT32 planarWidth;
+	UINT32 planarHeight;
+	gdiGfxDecodeLane* pending;
+};
+
+struct gdi_gfx_pipeline
+{
+	wHashTable* lanes;
+	gdiGfxDecodeLane* shared;
+};
+
+typedef struct
+{
+	gdiGfxSurface* surface;
+	RDPGFX_SURFACE_COMMAND cmd;
+	UINT32 frameId;
+	gdiPalette palette;
+	RDPGFX_AVC444_BITMAP_STREAM avc;
+	REGION16 invalidRegion;
+	UINT status;
+} gdiGfxDecodeJob;
+
+static void gdi_decode_job_free(void* obj)
+{
+	gdiGfxDecodeJob* job = obj;
+
+	if (!job)
+		return;
+
+	for (size_t x = 0; x < ARRAYSIZE(job->avc.bitstream); x++)
+	{
+		free(job->avc.bitstream[x].meta.regionRects);
+		free(job->avc.bitstream[x].meta.quantQualityVals);
+	}
+
+	region16_uninit(&job->invalidRegion);
+	free(job->cmd.data);
+	free(job);
+}
+
+static BOOL gdi_decode_job_copy_avc420(gdiGfxDecodeJob* job, const RDPGFX_SURFACE_COMMAND* cmd,
+                                       RDPGFX_AVC420_BITMAP_STREAM* dst,
+                                       const RDPGFX_AVC420_BITMAP_STREAM* src)
+{
+	WINPR_ASSERT(job);
+	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(dst);
+	WINPR_ASSERT(src);
+
+	const RDPGFX_H264_METABLOCK* meta = &src->meta;
+	const UINT32 count = meta->numRegionRects;
+
+	if (count > 0)
+	{
+		dst->meta.regionRects = (RECTANGLE_16*)calloc(count, sizeof(RECTANGLE_16));
+		dst->meta.quantQualityVals =
+		    (RDPGFX_H264_QUANT_QUALITY*)calloc(count, sizeof(RDPGFX_H264_QUANT_QUALITY));
+
+		if (!dst->meta.regionRects || !dst->meta.quantQualityVals)
+			return FALSE;
+
+		if (meta->regionRects)
+			CopyMemory(dst->meta.regionRects, meta->regionRects, count * sizeof(RECTANGLE_16));
+
+		if (meta->quantQualityVals)
+			CopyMemory(dst->meta.quantQualityVals, meta->quantQualityVals,
+			           count * sizeof(RDPGFX_H264_QUANT_QUALITY));
+	}
+
+	dst->meta.numRegionRects = count;
+
+	/* The bitstream points into the PDU, point it to the same offset of the copy */
+	if (src->data)
+	{
+		if ((src->data < cmd->data) || (src->data > cmd->data + cmd->length))
+			return FALSE;
+
+		const size_t offset = (size_t)(src->data - cmd->data);
+
+		if (src->length > cmd->length - offset)
+			return FALSE;
+
+		dst->data = &job->cmd.data[offset];
+	}
+
+	dst->length = src->length;
+	return TRUE;
+}
+
+static gdiGfxDecodeJob* gdi_decode_job_new(gdiGfxSurface* surface,
+                                           const RDPGFX_SURFACE_COMMAND* cmd, UINT32 frameId,
+                                           const gdiPalette* palette)
+{
+	WINPR_ASSERT(surface);
+	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(palette);
+	gdiGfxDecodeJob* job = (gdiGfxDecodeJob*)calloc(1, sizeof(gdiGfxDecodeJob));
+
+	if (!job)
+		return NULL;
+
+	job->surface = surface;
+	job->frameId = frameId;
+	job->palette = *palette;
+	region16_init(&job->invalidRegion);
+
+	/* The PDU is released when the channel callback returns, keep a copy of the payload */
+	job->cmd = *cmd;
+	job->cmd.extra = NULL;
+	job->cmd.data = (BYTE*)malloc(cmd->length ? cmd->length : 1);
+
+	if (!job->cmd.data)
+		goto fail;
+
+	if (cmd->length > 0)
+		CopyMemory(job->cmd.data, cmd->data, cmd->length);
+
+	if (cmd->extra)
+	{
+		switch (cmd->codecId)
+		{
+			case RDPGFX_CODECID_AVC420:
+				if (!gdi_decode_job_copy_avc420(job, cmd, &job->avc.bitstream[0], cmd->extra))
+					goto fail;
+
+				job->cmd.extra = &job->avc.bitstream[0];
+				break;
+
+			case RDPGFX_CODECID_AVC444v2:
+			case RDPGFX_CODECID_AVC444:
+			{
+				const RDPGFX_AVC444_BITMAP_STREAM* bs = cmd->extra;
+				job->avc.cbAvc420EncodedBitstream1 = bs->cbAvc420EncodedBitstream1;
+				job->avc.LC = bs->LC;
+
+				for (size_t x = 0; x < ARRAYSIZE(job->avc.bitstream); x++)
+				{
+					if (!gdi_decode_job_copy_avc420(job, cmd, &job->avc.bitstream[x],
+					                                &bs->bitstream[x]))
+						goto fail;
+				}
+
+				job->cmd.extra = &job->avc;
+			}
+			break;
+
+			default:
+				break;
+		}
+	}
+
+	return job;
+fail:
+	gdi_decode_job_free(job);
+	return NULL;
+}
+
+/* Creates the decoder needed by a command, called on the lane so setup is not serialized */
+static UINT gdi_decode_lane_prepare(gdiGfxDecodeLane* lane, const gdiGfxDecodeJob* job)
+{
+	WINPR_ASSERT(lane);
+	WINPR_ASSERT(job);
+	const RDPGFX_SURFACE_COMMAND* cmd = &job->cmd;
+
+	/* The lanes already decode in parallel, their decoders run single threaded */
+	switch (cmd->codecId)
+	{
+		case RDPGFX_CODECID_PLANAR:
+			if (!is_within_surface(job->surface, cmd))
+				return ERROR_INVALID_DATA;
+
+			/* Sized to the largest command seen so far */
+			if ((cmd->width > lane->planarWidth) || (cmd->height > lane->planarHeight))
+			{
+				const UINT32 width = MAX(cmd->width, lane->planarWidth);
+				const UINT32 height = MAX(cmd->height, lane->planarHeight);
+
+				if (!lane->decoders.planar)
+					lane->decoders.planar = freerdp_bitmap_planar_context_new(0, width, height);
+				else if (!freerdp_bitmap_planar_context_reset(lane->decoders.planar, width,
+				                                              height))
+					return ERROR_INTERNAL_ERROR;
+
+				if (!lane->decoders.planar)
+					return CHANNEL_RC_NO_MEMORY;
+
+				lane->planarWidth = width;
+				lane->planarHeight = height;
+			}
+			break;
+
+		case RDPGFX_CODECID_CAPROGRESSIVE:
+			if (!lane->decoders.progressive)
+				lane->decoders.progressive =
+				    progressive_context_new_ex(FALSE, THREADING_FLAGS_DISABLE_THREADS);
+
+			if (!lane->decoders.progressive)
+				return CHANNEL_RC_NO_MEMORY;
+			break;
+
+		default:
+			break;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT gdi_decode_lane_decode(gdiGfxDecodeLane* lane, gdiGfxDecodeJob* job)
+{
+	WINPR_ASSERT(lane);
+	WINPR_ASSERT(job);
+	WINPR_ASSERT(job->surface);
+	WINPR_ASSERT(job->surface->codecs);
+
+	const UINT status = gdi_decode_lane_prepare(lane, job);
+
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	gdiGfxDecoders decoders = lane->decoders;
+	decoders.rfx = job->surface->codecs->rfx;
+	decoders.clear = job->surface->codecs->clear;
+	return gdi_decode_surface_command(job->surface, &decoders, &job->cmd, job->frameId,
+	                                  &job->palette, &job->invalidRegion);
+}
+
+static void CALLBACK gdi_decode_lane_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                                   PTP_WORK work)
+{
+	gdiGfxDecodeLane* lane = (gdiGfxDecodeLane*)context;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	WINPR_ASSERT(lane);
+
+	for (;;)
+	{
+		gdiGfxDecodeJob* job = NULL;
+
+		EnterCriticalSection(&lane->lock);
+
+		if (lane->next < ArrayList_Count(lane->jobs))
+			job = ArrayList_GetItem(lane->jobs, lane->next++);
+		else
+			lane->running = FALSE;
+
+		LeaveCriticalSection(&lane->lock);
+
+		if (!job)
+			break;
+
+		job->status = gdi_decode_lane_decode(lane, job);
+	}
+}
+
+static void gdi_decode_lane_free(void* obj)
+{
+	gdiGfxDecodeLane* lane = obj;
+
+	if (!lane)
+		return;
+
+	if (lane->work)
+	{
+		WaitForThreadpoolWorkCallbacks(lane->work, FALSE);
+		CloseThreadpoolWork(lane->work);
+	}
+
+	ArrayList_Free(lane->jobs);
+	freerdp_bitmap_planar_context_free(lane->decoders.planar);
+	progressive_context_free(lane->decoders.progressive);
+	DeleteCriticalSection(&lane->lock);
+	free(lane);
+}
+
+static gdiGfxDecodeLane* gdi_decode_lane_new(void)
+{
+	gdiGfxDecodeLane* lane = (gdiGfxDecodeLane*)calloc(1, sizeof(gdiGfxDecodeLane));
+
+	if (!lane)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&lane->lock, 4000))
+	{
+		free(lane);
+		return NULL;
+	}
+
+	lane->jobs = ArrayList_New(FALSE);
+
+	if (!lane->jobs)
+		goto fail;
+
+	wObject* obj = ArrayList_Object(lane->jobs);
+	WINPR_ASSERT(obj);
+	obj->fnObjectFree = gdi_decode_job_free;
+	lane->work = CreateThreadpoolWork(gdi_decode_lane_work_callback, lane, NULL);
+
+	if (!lane->work)
+		goto fail;
+
+	return lane;
+fail:
+	gdi_decode_lane_free(lane);
+	return NULL;
+}
+
+void gdi_gfx_pipeline_free(gdiGfxPipeline* pipeline)
+{
+	if (!pipeline)
+		return;
+
+	HashTable_Free(pipeline->lanes);
+	gdi_decode_lane_free(pipeline->shared);
+	free(pipeline);
+}
+
+static gdiGfxPipeline* gdi_gfx_pipeline_new(void)
+{
+	gdiGfxPipeline* pipeline = (gdiGfxPipeline*)calloc(1, sizeof(gdiGfxPipeline));
+
+	if (!pipeline)
+		return NULL;
+
+	pipeline->lanes = HashTable_New(FALSE);
+
+	if (!pipeline->lanes)
+		goto fail;
+
+	wObject* obj = HashTable_ValueObject(pipeline->lanes);
+	WINPR_ASSERT(obj);
+	obj->fnObjectFree = gdi_decode_lane_free;
+	pipeline->shared = gdi_decode_lane_new();
+
+	if (!pipeline->shared)
+		goto fail;
+
+	return pipeline;
+fail:
+	gdi_gfx_pipeline_free(pipeline);
+	return NULL;
+}
+
+static gdiGfxPipeline* gdi_gfx_pipeline_get(RdpgfxClientContext* context)
+{
+	WINPR_ASSERT(context);
+	rdpGdi* gdi = (rdpGdi*)context->custom;
+
+	if (!gdi)
+		return NULL;
+
+	return gdi_cast(gdi)->pipeline;
+}
+
+static BOOL gdi_decode_uses_shared_lane(const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	WINPR_ASSERT(cmd);
+
+	switch (cmd->codecId)
+	{
+		case RDPGFX_CODECID_CAVIDEO:
+		case RDPGFX_CODECID_CLEARCODEC:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+static gdiGfxDecodeLane* gdi_decode_lane_get(gdiGfxPipeline* pipeline,
+                                             const gdiGfxSurface* surface)
+{
+	if (!pipeline)
+		return NULL;
+
+	return HashTable_GetItemValue(pipeline->lanes, surface);
 }
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT gdi_SurfaceCommand_Alpha(rdpGdi* gdi, RdpgfxClientContext* context,
-                                     const RDPGFX_SURFACE_COMMAND* cmd)
+
+static UINT gdi_decode_lane_commit(RdpgfxClientContext* context, gdiGfxPipeline* pipeline,
+                                   gdiGfxDecodeLane* lane)
 {
 	UINT status = CHANNEL_RC_OK;
-	UINT16 alphaSig = 0;
-	UINT16 compressed = 0;
-	gdiGfxSurface* surface = NULL;
-	RECTANGLE_16 invalidRect;
-	wStream buffer;
-	wStream* s = NULL;
-	WINPR_ASSERT(gdi);
-	WINPR_ASSERT(context);
-	WINPR_ASSERT(cmd);
-
-	s = Stream_StaticConstInit(&buffer, cmd->data, cmd->length);
+	WINPR_ASSERT(lane);
 
-	if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
-		return ERROR_INVALID_DATA;
+	WaitForThreadpoolWorkCallbacks(lane->work, FALSE);
 
-	WINPR_ASSERT(context->GetSurfaceData);
-	surface =
-	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
+	/* The lane is idle, report the decoded areas in submission order */
+	const size_t count = ArrayList_Count(lane->jobs);
 
-	if (!surface)
+	for (size_t x = 0; x < count; x++)
 	{
-		WLog_ERR(TAG, "unable to retrieve surfaceData for surfaceId=%" PRIu32 "", cmd->surfaceId);
-		return ERROR_NOT_FOUND;
+		gdiGfxDecodeJob* job = ArrayList_GetItem(lane->jobs, x);
+		gdiGfxDecodeLane* own = gdi_decode_lane_get(pipeline, job->surface);
+		UINT rc = job->status;
+
+		if (own)
+			own->pending = NULL;
+
+		if (rc == CHANNEL_RC_OK)
+			rc = gdi_SurfaceCommand_Invalidate(context, job->surface, &job->invalidRegion);
+		else
+			WLog_ERR(TAG, "%s surface command for surfaceId=%" PRIu32 " failed with %" PRIu32,
+			         rdpgfx_get_codec_id_string(job->cmd.codecId), job->cmd.surfaceId, rc);
+
+		if (status == CHANNEL_RC_OK)
+			status = rc;
 	}
 
-	if (!is_within_surface(surface, cmd))
-		return ERROR_INVALID_DATA;
+	ArrayList_Clear(lane->jobs);
+	lane->next = 0;
+	return status;
+}
 
-	Stream_Read_UINT16(s, alphaSig);
-	Stream_Read_UINT16(s, compressed);
+static UINT gdi_decode_surface_commit(RdpgfxClientContext* context, gdiGfxSurface* surface)
+{
+	WINPR_ASSERT(surface);
+	gdiGfxPipeline* pipeline = gdi_gfx_pipeline_get(context);
+	gdiGfxDecodeLane* lane = gdi_decode_lane_get(pipeline, surface);
 
-	if (alphaSig != 0x414C)
-		return ERROR_INVALID_DATA;
+	if (!lane || !lane->pending)
+		return CHANNEL_RC_OK;
 
-	if (compressed == 0)
+	return gdi_decode_lane_commit(context, pipeline, lane->pending);
+}
+
+static UINT gdi_decode_lanes_commit(RdpgfxClientContext* context)
+{
+	UINT16 count = 0;
+	UINT16* pSurfaceIds = NULL;
+	UINT status = CHANNEL_RC_OK;
+	WINPR_ASSERT(context);
+
+	WINPR_ASSERT(context->GetSurfaceIds);
+	context->GetSurfaceIds(context, &pSurfaceIds, &count);
+
+	for (UINT32 index = 0; index < count; index++)
 	{
-		if (!Stream_CheckAndLogRequiredLengthOfSize(TAG, s, cmd->height, cmd->width))
-			return ERROR_INVALID_DATA;
+		WINPR_ASSERT(context->GetSurfaceData);
+		gdiGfxSurface* surface =
+		    (gdiGfxSurface*)context->GetSurfaceData(context, pSurfaceIds[index]);
 
-		for (UINT32 y = cmd->top; y < cmd->top + cmd->height; y++)
-		{
-			BYTE* line = &surface->data[surface->scanline * y];
+		if (!surface)
+			continue;
 
-			for (UINT32 x = cmd->left; x < cmd->left + cmd->width; x++)
-			{
-				UINT32 color = 0;
-				BYTE r = 0;
-				BYTE g = 0;
-				BYTE b = 0;
-				BYTE a = 0;
-				BYTE* src = &line[x * FreeRDPGetBytesPerPixel(surface->format)];
-				Stream_Read_UINT8(s, a);
-				color = FreeRDPReadColor(src, surface->format);
-				FreeRDPSplitColor(color, surface->format, &r, &g, &b, NULL, NULL);
-				color = FreeRDPGetColor(surface->format, r, g, b, a);
-				FreeRDPWriteColor(src, surface->format, color);
-			}
-		}
+		const UINT rc = gdi_decode_surface_commit(context, surface);
+
+		if (status == CHANNEL_RC_OK)
+			status = rc;
 	}
-	else
-	{
-		UINT32 startOffsetX = 0;
-		RECTANGLE_16 rect = { 0 };
-		rect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
-		rect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
-		rect.right = (UINT16)MIN(UINT16_MAX, cmd->left + cmd->width);
-		rect.bottom = (UINT16)MIN(UINT16_MAX, cmd->top + cmd->height);
 
-		while (rect.top < rect.bottom)
-		{
-			UINT32 count = 0;
-			BYTE a = 0;
+	free(pSurfaceIds);
+	return status;
+}
 
-			if (!Stream_CheckAndLogRequiredLength(TAG, s, 2))
-				return ERROR_INVALID_DATA;
+static UINT gdi_decode_lane_submit(RdpgfxClientContext* context, gdiGfxPipeline* pipeline,
+                                   gdiGfxDecodeLane* own, gdiGfxDecodeLane* lane,
+                                   gdiGfxSurface* surface, const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	UINT rc = CHANNEL_RC_OK;
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(own);
+	WINPR_ASSERT(lane);
 
-			Stream_Read_UINT8(s, a);
-			Stream_Read_UINT8(s, count);
+	rdpGdi* gdi = (rdpGdi*)context->custom;
+	WINPR_ASSERT(gdi);
 
-			if (count >= 0xFF)
-			{
-				if (!Stream_CheckAndLogRequiredLength(TAG, s, 2))
-					return ERROR_INVALID_DATA;
+	/* Moving to another lane, wait for the commands still pending on the current one */
+	if (own->pending && (own->pending != lane))
+	{
+		rc = gdi_decode_lane_commit(context, pipeline, own->pending);
 
-				Stream_Read_UINT16(s, count);
+		if (rc != CHANNEL_RC_OK)
+			return rc;
+	}
 
-				if (count >= 0xFFFF)
-				{
-					if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
-						return ERROR_INVALID_DATA;
+	gdiGfxDecodeJob* job = gdi_decode_job_new(surface, cmd, gdi->frameId, &gdi->palette);
 
-					Stream_Read_UINT32(s, count);
-				}
-			}
+	if (!job)
+		return CHANNEL_RC_NO_MEMORY;
 
-			if (!gdi_apply_alpha(surface->data, surface->format, surface->scanline, &rect,
-			                     startOffsetX, count, a))
-				return ERROR_INTERNAL_ERROR;
+	EnterCriticalSection(&lane->lock);
 
-			startOffsetX += count;
+	if (!ArrayList_Append(lane->jobs, job))
+	{
+		gdi_decode_job_free(job);
+		rc = CHANNEL_RC_NO_MEMORY;
+	}
+	else
+	{
+		own->pending = lane;
 
-			while (startOffsetX >= cmd->width)
-			{
-				startOffsetX -= cmd->width;
-				rect.top++;
-			}
+		if (!lane->running)
+		{
+			lane->running = TRUE;
+			SubmitThreadpoolWork(lane->work);
 		}
 	}
 
-	invalidRect.left = (UINT16)MIN(UINT16_MAX, cmd->left);
-	invalidRect.top = (UINT16)MIN(UINT16_MAX, cmd->top);
-	invalidRect.right = (UINT16)MIN(UINT16_MAX, cmd->right);
-	invalidRect.bottom = (UINT16)MIN(UINT16_MAX, cmd->bottom);
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
+	LeaveCriticalSection(&lane->lock);
+	return rc;
+}
 
-	if (status != CHANNEL_RC_OK)
-		goto fail;
+BOOL gdi_graphics_pipeline_add_surface(RdpgfxClientContext* context, gdiGfxSurface* surface)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
+	gdiGfxPipeline* pipeline = gdi_gfx_pipeline_get(context);
 
-	status = gdi_interFrameUpdate(gdi, context);
+	/* Without a pipeline the commands of the surface are decoded on the channel thread */
+	if (!pipeline || !surface->codecs)
+		return TRUE;
 
-fail:
-	return status;
+	gdiGfxDecodeLane* lane = gdi_decode_lane_new();
+
+	if (!lane)
+		return FALSE;
+
+	if (!HashTable_Insert(pipeline->lanes, surface, lane))
+	{
+		gdi_decode_lane_free(lane);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
-#if defined(WITH_GFX_FRAME_DUMP)
-static void dump_cmd(const RDPGFX_SURFACE_COMMAND* cmd, UINT32 frameId)
+void gdi_graphics_pipeline_remove_surface(RdpgfxClientContext* context, gdiGfxSurface* surface)
 {
-	static UINT64 xxx = 0;
-	const char* path = "/tmp/dump/";
-	WINPR_ASSERT(cmd);
-	char fname[1024] = { 0 };
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(surface);
+	gdiGfxPipeline* pipeline = gdi_gfx_pipeline_get(context);
 
-	snprintf(fname, sizeof(fname), "%s/%08" PRIx64 ".raw", path, xxx++);
-	FILE* fp = fopen(fname, "w");
-	if (!fp)
+	if (!gdi_decode_lane_get(pipeline, surface))
 		return;
-	fprintf(fp, "frameid: %" PRIu32 "\n", frameId);
-	fprintf(fp, "surfaceId: %" PRIu32 "\n", cmd->surfaceId);
-	fprintf(fp, "codecId: %" PRIu32 "\n", cmd->codecId);
-	fprintf(fp, "contextId: %" PRIu32 "\n", cmd->contextId);
-	fprintf(fp, "format: %" PRIu32 "\n", cmd->format);
-	fprintf(fp, "left: %" PRIu32 "\n", cmd->left);
-	fprintf(fp, "top: %" PRIu32 "\n", cmd->top);
-	fprintf(fp, "right: %" PRIu32 "\n", cmd->right);
-	fprintf(fp, "bottom: %" PRIu32 "\n", cmd->bottom);
-	fprintf(fp, "width: %" PRIu32 "\n", cmd->width);
-	fprintf(fp, "height: %" PRIu32 "\n", cmd->height);
-	fprintf(fp, "length: %" PRIu32 "\n", cmd->length);
 
-	char* bdata = crypto_base64_encode_ex(cmd->data, cmd->length, FALSE);
-	fprintf(fp, "data: %s\n", bdata);
-	free(bdata);
-	fclose(fp);
+	const UINT rc = gdi_decode_surface_commit(context, surface);
+
+	if (rc != CHANNEL_RC_OK)
+		WLog_WARN(TAG, "surfaceId=%" PRIu32 " removed with failed commands [%" PRIu32 "]",
+		          surface->surfaceId, rc);
+
+	HashTable_Remove(pipeline->lanes, surface);
 }
-#endif
 
 /**
  * Function description
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_Progressive(rdpGdi* gdi, RdpgfxClientContext* context,
-                                           const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_Decode(rdpGdi* gdi, RdpgfxClientContext* context,
+                                      const RDPGFX_SURFACE_COMMAND* cmd)
 {
-	INT32 rc = 0;
 	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface = NULL;
-	REGION16 invalidRegion;
-	const RECTANGLE_16* rects = NULL;
-	UINT32 nrRects = 0;
-	/**
-	 * Note: Since this comes via a Wire-To-Surface-2 PDU the
-	 * cmd's top/left/right/bottom/width/height members are always zero!
-	 * The update region is determined during decompression.
-	 */
 	WINPR_ASSERT(gdi);
 	WINPR_ASSERT(context);
 	WINPR_ASSERT(cmd);
-	const UINT16 surfaceId = (UINT16)MIN(UINT16_MAX, cmd->surfaceId);
 
 	WINPR_ASSERT(context->GetSurfaceData);
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, surfaceId);
+	gdiGfxSurface* surface =
+	    (gdiGfxSurface*)context->GetSurfaceData(context, (UINT16)MIN(UINT16_MAX, cmd->surfaceId));
 
 	if (!surface)
 	{
@@ -977,48 +1453,46 @@ static UINT gdi_SurfaceCommand_Progressive(rdpGdi* gdi, RdpgfxClientContext* con
 		return ERROR_NOT_FOUND;
 	}
 
-	if (!is_within_surface(surface, cmd))
-		return ERROR_INVALID_DATA;
-
 	WINPR_ASSERT(surface->codecs);
-	rc = progressive_create_surface_context(surface->codecs->progressive, surfaceId, surface->width,
-	                                        surface->height);
+	gdiGfxPipeline* pipeline = gdi_cast(gdi)->pipeline;
+	gdiGfxDecodeLane* own = gdi_decode_lane_get(pipeline, surface);
 
-	if (rc < 0)
+	if (own)
 	{
-		WLog_ERR(TAG, "progressive_create_surface_context failure: %" PRId32 "", rc);
-		return ERROR_INTERNAL_ERROR;
+		gdiGfxDecodeLane* lane = gdi_decode_uses_shared_lane(cmd) ? pipeline->shared : own;
+		status = gdi_decode_lane_submit(context, pipeline, own, lane, surface, cmd);
+
+		/* Outside of a frame there is nothing to overlap with, commit right away */
+		if ((status == CHANNEL_RC_OK) && !gdi->inGfxFrame)
+			status = gdi_decode_surface_commit(context, surface);
 	}
+	else
+	{
+		REGION16 invalidRegion;
+		const gdiGfxDecoders decoders = { surface->codecs->planar, surface->codecs->rfx,
+			                              surface->codecs->clear, surface->codecs->progressive };
 
-	region16_init(&invalidRegion);
+		/* The ClearCodec and RemoteFX decoders are shared with the surfaces decoded on lanes */
+		if (pipeline && gdi_decode_uses_shared_lane(cmd))
+			status = gdi_decode_lane_commit(context, pipeline, pipeline->shared);
 
-	rc = progressive_decompress(surface->codecs->progressive, cmd->data, cmd->length, surface->data,
-	                            surface->format, surface->scanline, cmd->left, cmd->top,
-	                            &invalidRegion, surfaceId, gdi->frameId);
+		if (status != CHANNEL_RC_OK)
+			return status;
+
+		region16_init(&invalidRegion);
+		status = gdi_decode_surface_command(surface, &decoders, cmd, gdi->frameId, &gdi->palette,
+		                                    &invalidRegion);
+
+		if (status == CHANNEL_RC_OK)
+			status = gdi_SurfaceCommand_Invalidate(context, surface, &invalidRegion);
 
-	if (rc < 0)
-	{
-		WLog_ERR(TAG, "progressive_decompress failure: %" PRId32 "", rc);
 		region16_uninit(&invalidRegion);
-		return ERROR_INTERNAL_ERROR;
 	}
 
-	rects = region16_rects(&invalidRegion, &nrRects);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      nrRects, rects);
-
 	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	for (UINT32 x = 0; x < nrRects; x++)
-		region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, &rects[x]);
+		return status;
 
-	region16_uninit(&invalidRegion);
-
-	status = gdi_interFrameUpdate(gdi, context);
-
-fail:
-	return status;
+	return gdi_interFrameUpdate(gdi, context);
 }
 
 /**
@@ -1053,36 +1527,15 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context, const RDPGFX_SURFAC
 	switch (cmd->codecId)
 	{
 		case RDPGFX_CODECID_UNCOMPRESSED:
-			status = gdi_SurfaceCommand_Uncompressed(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_CAVIDEO:
-			status = gdi_SurfaceCommand_RemoteFX(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_CLEARCODEC:
-			status = gdi_SurfaceCommand_ClearCodec(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_PLANAR:
-			status = gdi_SurfaceCommand_Planar(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_AVC420:
-			status = gdi_SurfaceCommand_AVC420(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_AVC444v2:
 		case RDPGFX_CODECID_AVC444:
-			status = gdi_SurfaceCommand_AVC444(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_ALPHA:
-			status = gdi_SurfaceCommand_Alpha(gdi, context, cmd);
-			break;
-
 		case RDPGFX_CODECID_CAPROGRESSIVE:
-			status = gdi_SurfaceCommand_Progressive(gdi, context, cmd);
+			status = gdi_SurfaceCommand_Decode(gdi, context, cmd);
 			break;
 
 		case RDPGFX_CODECID_CAPROGRESSIVE_V2:
@@ -1185,6 +1638,14 @@ static UINT gdi_CreateSurface(RdpgfxClientContext* context,
 	memset(surface->data, 0xFF, (size_t)surface->scanline * surface->height);
 	region16_init(&surface->invalidRegion);
 
+	if (!gdi_graphics_pipeline_add_surface(context, surface))
+	{
+		region16_uninit(&surface->invalidRegion);
+		winpr_aligned_free(surface->data);
+		free(surface);
+		goto fail;
+	}
+
 	WINPR_ASSERT(context->SetSurfaceData);
 	rc = context->SetSurfaceData(context, surface->surfaceId, (void*)surface);
 fail:
@@ -1215,11 +1676,14 @@ static UINT gdi_DeleteSurface(RdpgfxClientContext* context,
 			rc = IFCALLRESULT(CHANNEL_RC_OK, context->UnmapWindowForSurface, context,
 			                  surface->windowId);
 
+		gdi_graphics_pipeline_remove_surface(context, surface);
+
 #ifdef WITH_GFX_H264
 		h264_context_free(surface->h264);
 #endif
 		region16_uninit(&surface->invalidRegion);
 		codecs = surface->codecs;
+		freerdp_image_scaler_free(surface->scaler);
 		winpr_aligned_free(surface->data);
 		free(surface);
 	}
@@ -1278,6 +1742,9 @@ static UINT gdi_SolidFill(RdpgfxClientContext* context, const RDPGFX_SOLID_FILL_
 	if (!surface)
 		goto fail;
 
+	if (gdi_decode_surface_commit(context, surface) != CHANNEL_RC_OK)
+		goto fail;
+
 	const BYTE b = solidFill->fillPixel.B;
 	const BYTE g = solidFill->fillPixel.G;
 	const BYTE r = solidFill->fillPixel.R;
@@ -1352,6 +1819,10 @@ static UINT gdi_SurfaceToSurface(RdpgfxClientContext* context,
 	if (!surfaceSrc || !surfaceDst)
 		goto fail;
 
+	if ((gdi_decode_surface_commit(context, surfaceSrc) != CHANNEL_RC_OK) ||
+	    (gdi_decode_surface_commit(context, surfaceDst) != CHANNEL_RC_OK))
+		goto fail;
+
 	if (!is_rect_valid(rectSrc, surfaceSrc->width, surfaceSrc->height))
 		goto fail;
 
@@ -1456,6 +1927,9 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	if (!surface)
 		goto fail;
 
+	if (gdi_decode_surface_commit(context, surface) != CHANNEL_RC_OK)
+		goto fail;
+
 	if (!is_rect_valid(rect, surface->width, surface->height))
 		goto fail;
 
@@ -1512,6 +1986,9 @@ static UINT gdi_CacheToSurface(RdpgfxClientContext* context,
 	if (!surface || !cacheEntry)
 		goto fail;
 
+	if (gdi_decode_surface_commit(context, surface) != CHANNEL_RC_OK)
+		goto fail;
+
 	for (UINT16 index = 0; index < cacheToSurface->destPtsCount; index++)
 	{
 		const RDPGFX_POINT16* destPt = &cacheToSurface->destPts[index];
@@ -1898,6 +2375,15 @@ BOOL gdi_graphics_pipeline_init_ex(rdpGdi* gdi, RdpgfxClientContext* gfx,
 			return FALSE;
 		if (!freerdp_client_codecs_prepare(gfx->codecs, FREERDP_CODEC_ALL, w, h))
 			return FALSE;
+
+		if (!(flags & THREADING_FLAGS_DISABLE_THREADS))
+		{
+			rdp_gdi_internal* internal = gdi_cast(gdi);
+			gdi_gfx_pipeline_free(internal->pipeline);
+			internal->pipeline = gdi_gfx_pipeline_new();
+			if (!internal->pipeline)
+				return FALSE;
+		}
 	}
 	InitializeCriticalSection(&gfx->mux);
 	PROFILER_CREATE(gfx->SurfaceProfiler, "GFX-PROFILER")
@@ -1922,7 +2408,12 @@ BOOL gdi_graphics_pipeline_init_ex(rdpGdi* gdi, RdpgfxClientContext* gfx,
 void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx)
 {
 	if (gdi)
+	{
+		rdp_gdi_internal* internal = gdi_cast(gdi);
+		gdi_gfx_pipeline_free(internal->pipeline);
+		internal->pipeline = NULL;
 		gdi->gfx = NULL;
+	}
 
 	if (!gfx)
 		return;
@@ -7,6 +7,7 @@
 #include <freerdp/gdi/bitmap.h>
 
 #include <winpr/crt.h>
+#include <winpr/crypto.h>
 
 #include "line.h"
 #include "brush.h"
@@ -546,6 +547,164 @@ fail:
 	return rc;
 }
 
+/* Per pixel RPN interpreter, the reference the compiled raster operations are checked against */
+static UINT32 test_rop_rpn(UINT32 src, UINT32 dst, UINT32 pat, const char* rop, UINT32 format)
+{
+	UINT32 stack[10] = { 0 };
+	size_t stackp = 0;
+
+	for (; *rop != '\0'; rop++)
+	{
+		switch (*rop)
+		{
+			case '0':
+				stack[stackp++] = FreeRDPGetColor(format, 0, 0, 0, 0xFF);
+				break;
+			case '1':
+				stack[stackp++] = FreeRDPGetColor(format, 0xFF, 0xFF, 0xFF, 0xFF);
+				break;
+			case 'D':
+				stack[stackp++] = dst;
+				break;
+			case 'S':
+				stack[stackp++] = src;
+				break;
+			case 'P':
+				stack[stackp++] = pat;
+				break;
+			case 'n':
+				stack[stackp - 1] = ~stack[stackp - 1];
+				break;
+			case 'a':
+				stackp--;
+				stack[stackp - 1] &= stack[stackp];
+				break;
+			case 'o':
+				stackp--;
+				stack[stackp - 1] |= stack[stackp];
+				break;
+			case 'x':
+				stackp--;
+				stack[stackp - 1] ^= stack[stackp];
+				break;
+			default:
+				break;
+		}
+	}
+
+	return stack[0];
+}
+
+/* All 256 ROP3 codes with random data, wide enough to span several row chunks.
+ * With overlap set the blit copies within one bitmap towards higher coordinates. */
+static BOOL test_gdi_BitBlt_rop3(UINT32 format, BOOL overlap)
+{
+	BOOL rc = FALSE;
+	const INT32 width = 150;
+	const INT32 height = 8;
+	const INT32 nWidth = 140;
+	const INT32 nHeight = 6;
+	const INT32 nXSrc = overlap ? 0 : 7;
+	const INT32 nYSrc = overlap ? 0 : 2;
+	const INT32 nXDst = overlap ? 5 : 3;
+	const INT32 nYDst = overlap ? 1 : 0;
+	const size_t bpp = FreeRDPGetBytesPerPixel(format);
+	HGDI_DC hdcSrc = NULL;
+	HGDI_DC hdcDst = NULL;
+	HGDI_BITMAP hBmpSrc = NULL;
+	HGDI_BITMAP hBmpDst = NULL;
+	HGDI_BRUSH brush = NULL;
+	BYTE* origSrc = NULL;
+	BYTE* origDst = NULL;
+	BYTE* expected = NULL;
+	gdiPalette palette = { 0 };
+	const size_t size = 1ull * width * height * bpp;
+
+	palette.format = format;
+
+	if (!(hdcDst = gdi_GetDC()) || !(hdcSrc = gdi_GetDC()))
+		goto fail;
+
+	hdcDst->format = format;
+	hdcSrc->format = format;
+
+	if (!(hBmpDst = gdi_CreateCompatibleBitmap(hdcDst, width, height)))
+		goto fail;
+	if (!(hBmpSrc = gdi_CreateCompatibleBitmap(hdcSrc, width, height)))
+		goto fail;
+
+	gdi_SelectObject(hdcDst, (HGDIOBJECT)hBmpDst);
+	gdi_SelectObject(hdcSrc, (HGDIOBJECT)(overlap ? hBmpDst : hBmpSrc));
+
+	brush = gdi_CreateSolidBrush(0x123456);
+	if (!brush)
+		goto fail;
+	gdi_SelectObject(hdcDst, (HGDIOBJECT)brush);
+
+	origSrc = malloc(size);
+	origDst = malloc(size);
+	expected = malloc(size);
+	if (!origSrc || !origDst || !expected)
+		goto fail;
+
+	for (UINT32 code = 0; code < 256; code++)
+	{
+		const DWORD rop = gdi_rop3_code((BYTE)code);
+		const char* rpn = gdi_rop_to_string(rop);
+		const BYTE* src = overlap ? origDst : origSrc;
+
+		/* Copies take the freerdp_image_copy path, they are covered by test_gdi_BitBlt */
+		if ((rop == GDI_SRCCOPY) || (rop == GDI_DSTCOPY))
+			continue;
+
+		if (winpr_RAND(hBmpSrc->data, size) < 0)
+			goto fail;
+		if (winpr_RAND(hBmpDst->data, size) < 0)
+			goto fail;
+
+		CopyMemory(origSrc, hBmpSrc->data, size);
+		CopyMemory(origDst, hBmpDst->data, size);
+		CopyMemory(expected, origDst, size);
+
+		for (INT32 y = 0; y < nHeight; y++)
+		{
+			for (INT32 x = 0; x < nWidth; x++)
+			{
+				const size_t so = 1ull * (nYSrc + y) * width + nXSrc + x;
+				const size_t dO = 1ull * (nYDst + y) * width + nXDst + x;
+				const UINT32 S = FreeRDPReadColor(&src[so * bpp], format);
+				const UINT32 D = FreeRDPReadColor(&origDst[dO * bpp], format);
+				const UINT32 color = test_rop_rpn(S, D, hdcDst->brush->color, rpn, format);
+				FreeRDPWriteColor(&expected[dO * bpp], format, color);
+			}
+		}
+
+		if (!gdi_BitBlt(hdcDst, nXDst, nYDst, nWidth, nHeight, hdcSrc, nXSrc, nYSrc, rop,
+		                &palette))
+			goto fail;
+
+		if (memcmp(expected, hBmpDst->data, size) != 0)
+		{
+			fprintf(stderr, "[%s] %s ROP=%s (0x%02" PRIx32 ") overlap=%d mismatch\n", __func__,
+			        FreeRDPGetColorFormatName(format), rpn, code, overlap);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(origSrc);
+	free(origDst);
+	free(expected);
+	gdi_SelectObject(hdcDst, NULL);
+	gdi_DeleteObject((HGDIOBJECT)brush);
+	gdi_DeleteObject((HGDIOBJECT)hBmpSrc);
+	gdi_DeleteObject((HGDIOBJECT)hBmpDst);
+	gdi_DeleteDC(hdcSrc);
+	gdi_DeleteDC(hdcDst);
+	return rc;
+}
+
 int TestGdiBitBlt(int argc, char* argv[])
 {
 	int rc = 0;
@@ -573,5 +732,12 @@ int TestGdiBitBlt(int argc, char* argv[])
 		}
 	}
 
+	for (size_t x = 1; x < ARRAYSIZE(formatList); x++)
+	{
+		if (!test_gdi_BitBlt_rop3(formatList[x], FALSE) ||
+		    !test_gdi_BitBlt_rop3(formatList[x], TRUE))
+			rc = -1;
+	}
+
 	return rc;
 }
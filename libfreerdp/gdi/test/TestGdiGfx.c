@@ -0,0 +1,532 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/codec/rfx.h>
+#include <freerdp/client/rdpgfx.h>
+
+#define TEST_SURFACE_SIZE 64
+#define TEST_TILE_SIZE 16
+#define TEST_MAX_SURFACES 4
+#define TEST_MAX_SLOTS 4
+#define TEST_MAX_UPDATES 32
+
+typedef struct
+{
+	RdpgfxClientContext gfx;
+
+	void* surfaces[TEST_MAX_SURFACES];
+	void* slots[TEST_MAX_SLOTS];
+	UINT16 updateSurfaceIds[TEST_MAX_UPDATES];
+	RECTANGLE_16 updates[TEST_MAX_UPDATES];
+	size_t updateCount;
+} test_gfx;
+
+typedef struct
+{
+	UINT16 surfaceId;
+	RECTANGLE_16 rect;
+} test_update;
+
+static UINT test_set_surface_data(RdpgfxClientContext* context, UINT16 surfaceId, void* pData)
+{
+	test_gfx* test = (test_gfx*)context;
+
+	if (surfaceId >= TEST_MAX_SURFACES)
+		return ERROR_INVALID_INDEX;
+
+	test->surfaces[surfaceId] = pData;
+	return CHANNEL_RC_OK;
+}
+
+static void* test_get_surface_data(RdpgfxClientContext* context, UINT16 surfaceId)
+{
+	test_gfx* test = (test_gfx*)context;
+
+	if (surfaceId >= TEST_MAX_SURFACES)
+		return NULL;
+
+	return test->surfaces[surfaceId];
+}
+
+static UINT test_get_surface_ids(RdpgfxClientContext* context, UINT16** ppSurfaceIds,
+                                 UINT16* count)
+{
+	test_gfx* test = (test_gfx*)context;
+	UINT16* ids = calloc(TEST_MAX_SURFACES, sizeof(UINT16));
+
+	*count = 0;
+	*ppSurfaceIds = ids;
+
+	if (!ids)
+		return CHANNEL_RC_NO_MEMORY;
+
+	for (UINT16 x = 0; x < TEST_MAX_SURFACES; x++)
+	{
+		if (test->surfaces[x])
+			ids[(*count)++] = x;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT test_set_cache_slot_data(RdpgfxClientContext* context, UINT16 cacheSlot, void* pData)
+{
+	test_gfx* test = (test_gfx*)context;
+
+	if (cacheSlot >= TEST_MAX_SLOTS)
+		return ERROR_INVALID_INDEX;
+
+	test->slots[cacheSlot] = pData;
+	return CHANNEL_RC_OK;
+}
+
+static void* test_get_cache_slot_data(RdpgfxClientContext* context, UINT16 cacheSlot)
+{
+	test_gfx* test = (test_gfx*)context;
+
+	if (cacheSlot >= TEST_MAX_SLOTS)
+		return NULL;
+
+	return test->slots[cacheSlot];
+}
+
+static UINT test_update_surface_area(RdpgfxClientContext* context, UINT16 surfaceId,
+                                     UINT32 nrRects, const RECTANGLE_16* rects)
+{
+	test_gfx* test = (test_gfx*)context;
+
+	for (UINT32 x = 0; x < nrRects; x++)
+	{
+		if (test->updateCount >= TEST_MAX_UPDATES)
+			return ERROR_INSUFFICIENT_BUFFER;
+
+		test->updateSurfaceIds[test->updateCount] = surfaceId;
+		test->updates[test->updateCount++] = rects[x];
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+static BOOL test_create_surface(test_gfx* test, UINT16 surfaceId)
+{
+	const RDPGFX_CREATE_SURFACE_PDU pdu = { surfaceId, TEST_SURFACE_SIZE, TEST_SURFACE_SIZE,
+		                                    GFX_PIXEL_FORMAT_XRGB_8888 };
+	return test->gfx.CreateSurface(&test->gfx, &pdu) == CHANNEL_RC_OK;
+}
+
+static void test_delete_surfaces(test_gfx* test)
+{
+	for (UINT16 x = 0; x < TEST_MAX_SURFACES; x++)
+	{
+		const RDPGFX_DELETE_SURFACE_PDU pdu = { x };
+
+		if (test->surfaces[x])
+			test->gfx.DeleteSurface(&test->gfx, &pdu);
+	}
+
+	for (UINT16 x = 0; x < TEST_MAX_SLOTS; x++)
+	{
+		const RDPGFX_EVICT_CACHE_ENTRY_PDU pdu = { x };
+
+		if (test->slots[x])
+			test->gfx.EvictCacheEntry(&test->gfx, &pdu);
+	}
+}
+
+static void test_fill(BYTE* data, UINT32 color)
+{
+	for (size_t x = 0; x < TEST_TILE_SIZE * TEST_TILE_SIZE; x++)
+		FreeRDPWriteColor(&data[x * 4], PIXEL_FORMAT_BGRX32, color);
+}
+
+static BOOL test_uncompressed(test_gfx* test, UINT16 surfaceId, UINT16 x, UINT16 y, UINT32 color)
+{
+	BYTE data[TEST_TILE_SIZE * TEST_TILE_SIZE * 4] = { 0 };
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+
+	test_fill(data, color);
+	cmd.surfaceId = surfaceId;
+	cmd.codecId = RDPGFX_CODECID_UNCOMPRESSED;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = x;
+	cmd.top = y;
+	cmd.right = x + TEST_TILE_SIZE;
+	cmd.bottom = y + TEST_TILE_SIZE;
+	cmd.width = TEST_TILE_SIZE;
+	cmd.height = TEST_TILE_SIZE;
+	cmd.length = sizeof(data);
+	cmd.data = data;
+	return test->gfx.SurfaceCommand(&test->gfx, &cmd) == CHANNEL_RC_OK;
+}
+
+static BOOL test_planar(test_gfx* test, UINT16 surfaceId, UINT16 x, UINT16 y, UINT32 color)
+{
+	BOOL rc = FALSE;
+	UINT32 size = 0;
+	BYTE data[TEST_TILE_SIZE * TEST_TILE_SIZE * 4] = { 0 };
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(
+	    PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE, TEST_TILE_SIZE, TEST_TILE_SIZE);
+
+	if (!planar)
+		return FALSE;
+
+	test_fill(data, color);
+	BYTE* compressed = freerdp_bitmap_compress_planar(planar, data, PIXEL_FORMAT_BGRX32,
+	                                                  TEST_TILE_SIZE, TEST_TILE_SIZE,
+	                                                  TEST_TILE_SIZE * 4, NULL, &size);
+
+	if (!compressed)
+		goto fail;
+
+	cmd.surfaceId = surfaceId;
+	cmd.codecId = RDPGFX_CODECID_PLANAR;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = x;
+	cmd.top = y;
+	cmd.right = x + TEST_TILE_SIZE;
+	cmd.bottom = y + TEST_TILE_SIZE;
+	cmd.width = TEST_TILE_SIZE;
+	cmd.height = TEST_TILE_SIZE;
+	cmd.length = size;
+	cmd.data = compressed;
+	rc = test->gfx.SurfaceCommand(&test->gfx, &cmd) == CHANNEL_RC_OK;
+fail:
+	free(compressed);
+	freerdp_bitmap_planar_context_free(planar);
+	return rc;
+}
+
+static BOOL test_remotefx(test_gfx* test, RFX_CONTEXT* rfx, UINT16 surfaceId, UINT32 color)
+{
+	BOOL rc = FALSE;
+	const RFX_RECT rect = { 0, 0, TEST_SURFACE_SIZE, TEST_SURFACE_SIZE };
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	BYTE* data = calloc(TEST_SURFACE_SIZE * TEST_SURFACE_SIZE, 4);
+	wStream* s = Stream_New(NULL, 4096);
+
+	if (!data || !s)
+		goto fail;
+
+	for (size_t x = 0; x < TEST_SURFACE_SIZE * TEST_SURFACE_SIZE; x++)
+		FreeRDPWriteColor(&data[x * 4], PIXEL_FORMAT_BGRX32, color);
+
+	if (!rfx_compose_message(rfx, s, &rect, 1, data, TEST_SURFACE_SIZE, TEST_SURFACE_SIZE,
+	                         TEST_SURFACE_SIZE * 4))
+		goto fail;
+
+	cmd.surfaceId = surfaceId;
+	cmd.codecId = RDPGFX_CODECID_CAVIDEO;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.right = TEST_SURFACE_SIZE;
+	cmd.bottom = TEST_SURFACE_SIZE;
+	cmd.width = TEST_SURFACE_SIZE;
+	cmd.height = TEST_SURFACE_SIZE;
+	cmd.length = (UINT32)Stream_GetPosition(s);
+	cmd.data = Stream_Buffer(s);
+	rc = test->gfx.SurfaceCommand(&test->gfx, &cmd) == CHANNEL_RC_OK;
+fail:
+	Stream_Free(s, TRUE);
+	free(data);
+	return rc;
+}
+
+static BOOL test_surface_to_surface(test_gfx* test, UINT16 src, UINT16 dst, UINT16 x, UINT16 y)
+{
+	RDPGFX_POINT16 pt = { (INT16)x, (INT16)y };
+	const RDPGFX_SURFACE_TO_SURFACE_PDU pdu = { src, dst, { 0, 0, TEST_TILE_SIZE, TEST_TILE_SIZE },
+		                                        1, &pt };
+	return test->gfx.SurfaceToSurface(&test->gfx, &pdu) == CHANNEL_RC_OK;
+}
+
+static BOOL test_surface_to_cache(test_gfx* test, UINT16 surfaceId, UINT16 slot)
+{
+	const RDPGFX_SURFACE_TO_CACHE_PDU pdu = { surfaceId, slot, slot,
+		                                      { 0, 0, TEST_TILE_SIZE, TEST_TILE_SIZE } };
+	return test->gfx.SurfaceToCache(&test->gfx, &pdu) == CHANNEL_RC_OK;
+}
+
+static BOOL test_cache_to_surface(test_gfx* test, UINT16 slot, UINT16 surfaceId, UINT16 x,
+                                  UINT16 y)
+{
+	RDPGFX_POINT16 pt = { (INT16)x, (INT16)y };
+	const RDPGFX_CACHE_TO_SURFACE_PDU pdu = { slot, surfaceId, 1, &pt };
+	return test->gfx.CacheToSurface(&test->gfx, &pdu) == CHANNEL_RC_OK;
+}
+
+static BOOL test_pixel_near(test_gfx* test, UINT16 surfaceId, UINT32 x, UINT32 y, UINT32 expect,
+                            int margin)
+{
+	BYTE r[2] = { 0 };
+	BYTE g[2] = { 0 };
+	BYTE b[2] = { 0 };
+	const gdiGfxSurface* surface = test->surfaces[surfaceId];
+	const UINT32 color =
+	    FreeRDPReadColor(&surface->data[y * surface->scanline + x * 4], surface->format);
+
+	FreeRDPSplitColor(color, surface->format, &r[0], &g[0], &b[0], NULL, NULL);
+	FreeRDPSplitColor(expect, PIXEL_FORMAT_BGRX32, &r[1], &g[1], &b[1], NULL, NULL);
+
+	if ((abs(r[0] - r[1]) > margin) || (abs(g[0] - g[1]) > margin) || (abs(b[0] - b[1]) > margin))
+	{
+		fprintf(stderr, "surface %" PRIu16 " pixel %" PRIu32 "x%" PRIu32 ": got 0x%08" PRIx32
+		                ", expected 0x%08" PRIx32 "\n",
+		        surfaceId, x, y, color, expect);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_pixel(test_gfx* test, UINT16 surfaceId, UINT32 x, UINT32 y, UINT32 expect)
+{
+	return test_pixel_near(test, surfaceId, x, y, expect, 0);
+}
+
+static BOOL test_updates(test_gfx* test, const test_update* expect, size_t count)
+{
+	if (test->updateCount != count)
+	{
+		fprintf(stderr, "got %" PRIuz " updates, expected %" PRIuz "\n", test->updateCount,
+		        count);
+		return FALSE;
+	}
+
+	for (size_t x = 0; x < count; x++)
+	{
+		if ((test->updateSurfaceIds[x] != expect[x].surfaceId) ||
+		    (memcmp(&test->updates[x], &expect[x].rect, sizeof(RECTANGLE_16)) != 0))
+		{
+			fprintf(stderr, "update %" PRIuz " out of order\n", x);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Commands queued on the surface lanes must be drained before SurfaceToSurface, SurfaceToCache
+ * and CacheToSurface touch the surfaces. The decoded areas are reported when a lane is drained,
+ * so the order of the reports shows whether the drain happened first. */
+static BOOL test_frame_ordering(test_gfx* test)
+{
+	const UINT32 red = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0xFF, 0, 0, 0xFF);
+	const UINT32 green = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0, 0xFF, 0, 0xFF);
+	const UINT32 blue = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0, 0, 0xFF, 0xFF);
+	const UINT32 yellow = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0xFF, 0xFF, 0, 0xFF);
+	const UINT32 white = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0xFF, 0xFF, 0xFF, 0xFF);
+	const RDPGFX_START_FRAME_PDU start = { 0, 1 };
+	const RDPGFX_END_FRAME_PDU end = { 1 };
+	const test_update updates[] = {
+		{ 1, { 0, 0, 16, 16 } },   { 2, { 8, 8, 24, 24 } },   { 1, { 0, 0, 16, 16 } },
+		{ 2, { 32, 32, 48, 48 } }, { 2, { 32, 32, 48, 48 } }, { 1, { 0, 0, 16, 16 } },
+		{ 2, { 40, 0, 56, 16 } }
+	};
+
+	if (test->gfx.StartFrame(&test->gfx, &start) != CHANNEL_RC_OK)
+		return FALSE;
+
+	if (!test_uncompressed(test, 1, 0, 0, red))
+		return FALSE;
+	if (!test_surface_to_surface(test, 1, 2, 8, 8))
+		return FALSE;
+	if (!test_planar(test, 1, 0, 0, green))
+		return FALSE;
+	if (!test_surface_to_cache(test, 1, 1))
+		return FALSE;
+	if (!test_uncompressed(test, 1, 0, 0, blue))
+		return FALSE;
+	if (!test_planar(test, 2, 32, 32, yellow))
+		return FALSE;
+	if (!test_cache_to_surface(test, 1, 2, 32, 32))
+		return FALSE;
+	if (!test_planar(test, 2, 40, 0, yellow))
+		return FALSE;
+
+	if (test->gfx.EndFrame(&test->gfx, &end) != CHANNEL_RC_OK)
+		return FALSE;
+
+	if (!test_pixel(test, 1, 0, 0, blue) || !test_pixel(test, 1, 15, 15, blue))
+		return FALSE;
+	if (!test_pixel(test, 2, 8, 8, red) || !test_pixel(test, 2, 23, 23, red))
+		return FALSE;
+	if (!test_pixel(test, 2, 32, 32, green) || !test_pixel(test, 2, 47, 47, green))
+		return FALSE;
+	if (!test_pixel(test, 2, 40, 0, yellow) || !test_pixel(test, 2, 55, 15, yellow))
+		return FALSE;
+	if (!test_pixel(test, 2, 0, 0, white))
+		return FALSE;
+
+	if (!test_updates(test, updates, ARRAYSIZE(updates)))
+		return FALSE;
+
+	/* Outside of a frame a command is visible when the callback returns */
+	if (!test_planar(test, 2, 0, 0, blue))
+		return FALSE;
+
+	return test_pixel(test, 2, 0, 0, blue);
+}
+
+/* A RemoteFX encoder sends the header blocks with its first message only, the messages of all
+ * surfaces must be decoded with the context that saw them. */
+static BOOL test_remotefx_surfaces(test_gfx* test)
+{
+	BOOL rc = FALSE;
+	const UINT32 red = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0xFF, 0, 0, 0xFF);
+	const UINT32 green = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0, 0xFF, 0, 0xFF);
+	const UINT32 blue = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0, 0, 0xFF, 0xFF);
+	const RDPGFX_START_FRAME_PDU start = { 0, 2 };
+	const RDPGFX_END_FRAME_PDU end = { 2 };
+	const RDPGFX_DELETE_SURFACE_PDU del = { 2 };
+	RFX_CONTEXT* rfx = rfx_context_new(TRUE);
+
+	if (!rfx || !rfx_context_reset(rfx, TEST_SURFACE_SIZE, TEST_SURFACE_SIZE))
+		goto fail;
+
+	rfx_context_set_pixel_format(rfx, PIXEL_FORMAT_BGRX32);
+
+	if (test->gfx.StartFrame(&test->gfx, &start) != CHANNEL_RC_OK)
+		goto fail;
+
+	if (!test_remotefx(test, rfx, 1, red) || !test_remotefx(test, rfx, 2, green))
+		goto fail;
+
+	if (test->gfx.EndFrame(&test->gfx, &end) != CHANNEL_RC_OK)
+		goto fail;
+
+	if (!test_pixel_near(test, 1, 0, 0, red, 4) || !test_pixel_near(test, 1, 63, 63, red, 4) ||
+	    !test_pixel_near(test, 2, 0, 0, green, 4) || !test_pixel_near(test, 2, 63, 63, green, 4))
+		goto fail;
+
+	/* A surface created later gets the messages of the same encoder */
+	if ((test->gfx.DeleteSurface(&test->gfx, &del) != CHANNEL_RC_OK) ||
+	    !test_create_surface(test, 3) || !test_remotefx(test, rfx, 3, blue))
+		goto fail;
+
+	if (!test_pixel_near(test, 3, 0, 0, blue, 4) || !test_pixel_near(test, 3, 63, 63, blue, 4))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	rfx_context_free(rfx);
+	return rc;
+}
+
+static BOOL test_output_pixel(rdpGdi* gdi, UINT32 x, UINT32 y, UINT32 expect)
+{
+	const UINT32 color =
+	    FreeRDPReadColor(&gdi->primary_buffer[y * gdi->stride + x * 4], gdi->dstFormat);
+
+	if (FreeRDPConvertColor(color, gdi->dstFormat, PIXEL_FORMAT_BGRX32, NULL) != expect)
+	{
+		fprintf(stderr, "output pixel %" PRIu32 "x%" PRIu32 ": got 0x%08" PRIx32
+		                ", expected 0x%08" PRIx32 "\n",
+		        x, y, color, expect);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* A surface mapped to scaled output is drawn at half size, the scaler of the surface is reused
+ * by every update. */
+static BOOL test_scaled_output(test_gfx* test, rdpGdi* gdi)
+{
+	const UINT32 red = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0xFF, 0, 0, 0xFF);
+	const UINT32 green = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0, 0xFF, 0, 0xFF);
+	const UINT32 blue = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0, 0, 0xFF, 0xFF);
+	const RDPGFX_MAP_SURFACE_TO_SCALED_OUTPUT_PDU map = { 0, 0, 0, 0, TEST_SURFACE_SIZE / 2,
+		                                                  TEST_SURFACE_SIZE / 2 };
+
+	test->updateCount = 0;
+
+	if (!test_create_surface(test, 0) ||
+	    (test->gfx.MapSurfaceToScaledOutput(&test->gfx, &map) != CHANNEL_RC_OK))
+		return FALSE;
+
+	if (!test_uncompressed(test, 0, 0, 0, red) || !test_uncompressed(test, 0, 16, 16, green))
+		return FALSE;
+	if (test->gfx.UpdateSurfaces(&test->gfx) != CHANNEL_RC_OK)
+		return FALSE;
+
+	if (!test_output_pixel(gdi, 0, 0, red) || !test_output_pixel(gdi, 7, 7, red) ||
+	    !test_output_pixel(gdi, 8, 8, green) || !test_output_pixel(gdi, 15, 15, green))
+		return FALSE;
+
+	if (!test_uncompressed(test, 0, 32, 0, blue))
+		return FALSE;
+	if (test->gfx.UpdateSurfaces(&test->gfx) != CHANNEL_RC_OK)
+		return FALSE;
+
+	return test_output_pixel(gdi, 16, 0, blue) && test_output_pixel(gdi, 23, 7, blue) &&
+	       test_output_pixel(gdi, 0, 0, red);
+}
+
+int TestGdiGfx(int argc, char* argv[])
+{
+	int rc = -1;
+	test_gfx* test = NULL;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	freerdp* instance = freerdp_new();
+
+	if (!instance)
+		return -1;
+
+	if (!freerdp_context_new(instance))
+		goto fail;
+
+	if (!freerdp_settings_set_uint32(instance->context->settings, FreeRDP_DesktopWidth,
+	                                 TEST_SURFACE_SIZE) ||
+	    !freerdp_settings_set_uint32(instance->context->settings, FreeRDP_DesktopHeight,
+	                                 TEST_SURFACE_SIZE))
+		goto fail;
+
+	if (!gdi_init(instance, PIXEL_FORMAT_BGRX32))
+		goto fail;
+
+	test = calloc(1, sizeof(test_gfx));
+
+	if (!test)
+		goto fail;
+
+	test->gfx.GetSurfaceIds = test_get_surface_ids;
+	test->gfx.SetSurfaceData = test_set_surface_data;
+	test->gfx.GetSurfaceData = test_get_surface_data;
+	test->gfx.SetCacheSlotData = test_set_cache_slot_data;
+	test->gfx.GetCacheSlotData = test_get_cache_slot_data;
+
+	if (!gdi_graphics_pipeline_init_ex(instance->context->gdi, &test->gfx, NULL, NULL,
+	                                   test_update_surface_area))
+		goto fail;
+
+	if (!test_create_surface(test, 1) || !test_create_surface(test, 2))
+		goto uninit;
+
+	if (!test_frame_ordering(test))
+		goto uninit;
+
+	if (!test_remotefx_surfaces(test))
+		goto uninit;
+
+	if (!test_scaled_output(test, instance->context->gdi))
+		goto uninit;
+
+	rc = 0;
+uninit:
+	test_delete_surfaces(test);
+	gdi_graphics_pipeline_uninit(instance->context->gdi, &test->gfx);
+fail:
+	free(test);
+	gdi_free(instance);
+	freerdp_context_free(instance);
+	freerdp_free(instance);
+	return rc;
+}
@@ -26,9 +26,16 @@
 #include <freerdp/gdi/gdi.h>
 #include <freerdp/gdi/video.h>
 #include <freerdp/gdi/region.h>
+#include <freerdp/codec/color.h>
 
 #define TAG FREERDP_TAG("video")
 
+typedef struct
+{
+	VideoSurface base;
+	FREERDP_IMAGE_SCALER* scaler;
+} gdiVideoSurface;
+
 void gdi_video_geometry_init(rdpGdi* gdi, GeometryClientContext* geom)
 {
 	WINPR_ASSERT(gdi);
@@ -57,7 +64,22 @@ void gdi_video_geometry_uninit(rdpGdi* gdi, GeometryClientContext* geom)
 static VideoSurface* gdiVideoCreateSurface(VideoClientContext* video, UINT32 x, UINT32 y,
                                            UINT32 width, UINT32 height)
 {
-	return VideoClient_CreateCommonContext(sizeof(VideoSurface), x, y, width, height);
+	gdiVideoSurface* ret = (gdiVideoSurface*)VideoClient_CreateCommonContext(
+	    sizeof(gdiVideoSurface), x, y, width, height);
+
+	if (!ret)
+		return NULL;
+
+	/* frames are usually shown at a fixed size, keep the scaler setup around */
+	ret->scaler = freerdp_image_scaler_new();
+
+	if (!ret->scaler)
+	{
+		VideoClient_DestroyCommonContext(&ret->base);
+		return NULL;
+	}
+
+	return &ret->base;
 }
 
 static BOOL gdiVideoShowSurface(VideoClientContext* video, const VideoSurface* surface,
@@ -66,6 +88,7 @@ static BOOL gdiVideoShowSurface(VideoClientContext* video, const VideoSurface* s
 	BOOL rc = FALSE;
 	rdpGdi* gdi = NULL;
 	rdpUpdate* update = NULL;
+	const gdiVideoSurface* gdiSurface = (const gdiVideoSurface*)surface;
 
 	WINPR_ASSERT(video);
 	WINPR_ASSERT(surface);
@@ -99,9 +122,10 @@ static BOOL gdiVideoShowSurface(VideoClientContext* video, const VideoSurface* s
 		WINPR_ASSERT(gdi->primary);
 		WINPR_ASSERT(gdi->primary->hdc);
 
-		if (!freerdp_image_scale(gdi->primary_buffer, gdi->primary->hdc->format, gdi->stride, nXDst,
-		                         nYDst, width, height, surface->data, surface->format,
-		                         surface->scanline, 0, 0, surface->w, surface->h))
+		if (!freerdp_image_scaler_scale(gdiSurface->scaler, gdi->primary_buffer,
+		                                gdi->primary->hdc->format, gdi->stride, nXDst, nYDst, width,
+		                                height, surface->data, surface->format, surface->scanline,
+		                                0, 0, surface->w, surface->h))
 			goto fail;
 
 		if ((nXDst > INT32_MAX) || (nYDst > INT32_MAX) || (width > INT32_MAX) ||
@@ -123,7 +147,13 @@ fail:
 
 static BOOL gdiVideoDeleteSurface(VideoClientContext* video, VideoSurface* surface)
 {
+	gdiVideoSurface* gdiSurface = (gdiVideoSurface*)surface;
+
 	WINPR_UNUSED(video);
+
+	if (gdiSurface)
+		freerdp_image_scaler_free(gdiSurface->scaler);
+
 	VideoClient_DestroyCommonContext(surface);
 	return TRUE;
 }
@@ -0,0 +1,87 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Primitives image scaling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+#include "prim_scale.h"
+
+static INLINE BYTE general_scale_lerp(BYTE a, BYTE b, UINT32 w)
+{
+	return (BYTE)((a * (256 - w) + b * w + 128) >> 8);
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t general_scale_8u_AC4r(const BYTE* WINPR_RESTRICT pSrc, UINT32 srcStep,
+                                       UINT32 srcWidth, UINT32 srcHeight,
+                                       BYTE* WINPR_RESTRICT pDst, UINT32 dstStep, UINT32 dstWidth,
+                                       UINT32 dstHeight)
+{
+	prim_scale_axis xAxis = { 0 };
+	prim_scale_axis yAxis = { 0 };
+
+	if (!pSrc || !pDst)
+		return -1;
+
+	if (!prim_scale_axis_init(&xAxis, srcWidth, dstWidth) ||
+	    !prim_scale_axis_init(&yAxis, srcHeight, dstHeight))
+		return -1;
+
+	for (UINT32 y = 0; y < dstHeight; y++)
+	{
+		UINT32 y0 = 0;
+		UINT32 y1 = 0;
+		UINT32 wy = 0;
+		prim_scale_axis_get(&yAxis, y, srcHeight, &y0, &y1, &wy);
+
+		const BYTE* row0 = &pSrc[1ULL * y0 * srcStep];
+		const BYTE* row1 = &pSrc[1ULL * y1 * srcStep];
+		BYTE* dst = &pDst[1ULL * y * dstStep];
+
+		for (UINT32 x = 0; x < dstWidth; x++)
+		{
+			UINT32 x0 = 0;
+			UINT32 x1 = 0;
+			UINT32 wx = 0;
+			prim_scale_axis_get(&xAxis, x, srcWidth, &x0, &x1, &wx);
+
+			for (size_t c = 0; c < 4; c++)
+			{
+				const BYTE top = general_scale_lerp(row0[4ULL * x0 + c], row0[4ULL * x1 + c], wx);
+				const BYTE bottom =
+				    general_scale_lerp(row1[4ULL * x0 + c], row1[4ULL * x1 + c], wx);
+				*dst++ = general_scale_lerp(top, bottom, wy);
+			}
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_scale(primitives_t* prims)
+{
+	prims->scale_8u_AC4r = general_scale_8u_AC4r;
+}
+
+void primitives_init_scale_opt(primitives_t* prims)
+{
+	primitives_init_scale_sse2(prims);
+}
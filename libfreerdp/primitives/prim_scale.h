@@ -0,0 +1,68 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Primitives image scaling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_PRIM_SCALE_H
+#define FREERDP_LIB_PRIM_SCALE_H
+
+#include <winpr/wtypes.h>
+#include <freerdp/config.h>
+#include <freerdp/primitives.h>
+
+/* Source positions are tracked in 16.16 fixed point, sampling at pixel centers.
+ * The interpolation weights keep 8 fractional bits, so every stage of the
+ * bilinear filter fits a 16bit lane and all implementations are bit exact. */
+typedef struct
+{
+	INT64 start;
+	INT64 step;
+} prim_scale_axis;
+
+static INLINE BOOL prim_scale_axis_init(prim_scale_axis* axis, UINT32 srcSize, UINT32 dstSize)
+{
+	if ((srcSize == 0) || (dstSize == 0))
+		return FALSE;
+
+	axis->step = (((INT64)srcSize) << 16) / dstSize;
+	axis->start = axis->step / 2 - 0x8000;
+	return TRUE;
+}
+
+static INLINE void prim_scale_axis_get(const prim_scale_axis* axis, UINT32 index, UINT32 srcSize,
+                                       UINT32* pos0, UINT32* pos1, UINT32* weight)
+{
+	INT64 pos = axis->start + axis->step * index;
+
+	if (pos < 0)
+		pos = 0;
+
+	UINT32 p0 = (UINT32)(pos >> 16);
+	UINT32 w = (UINT32)((pos >> 8) & 0xFF);
+
+	if (p0 >= srcSize - 1)
+	{
+		p0 = srcSize - 1;
+		w = 0;
+	}
+
+	*pos0 = p0;
+	*pos1 = (w > 0) ? p0 + 1 : p0;
+	*weight = w;
+}
+
+void primitives_init_scale_sse2(primitives_t* prims);
+
+#endif /* FREERDP_LIB_PRIM_SCALE_H */
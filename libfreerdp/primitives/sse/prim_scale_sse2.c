@@ -0,0 +1,162 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Optimized image scaling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/log.h>
+
+#include "prim_internal.h"
+#include "prim_scale.h"
+
+#if defined(SSE2_ENABLED)
+#include <emmintrin.h>
+
+static INLINE __m128i sse2_scale_load4(const BYTE* WINPR_RESTRICT row, const UINT32* x)
+{
+	UINT32 p[4] = { 0 };
+
+	for (size_t i = 0; i < 4; i++)
+		memcpy(&p[i], &row[4ULL * x[i]], sizeof(p[i]));
+
+	return _mm_set_epi32((int)p[3], (int)p[2], (int)p[1], (int)p[0]);
+}
+
+/* (a * wa + b * wb + 128) >> 8 on 16bit lanes, wa + wb == 256 so the sum is
+ * at most 255 * 256 + 128 and never overflows */
+static INLINE __m128i sse2_scale_lerp(__m128i a, __m128i b, __m128i wa, __m128i wb, __m128i round)
+{
+	const __m128i v = _mm_add_epi16(_mm_mullo_epi16(a, wa), _mm_mullo_epi16(b, wb));
+	return _mm_srli_epi16(_mm_add_epi16(v, round), 8);
+}
+
+static INLINE BYTE sse2_scale_lerp_8u(BYTE a, BYTE b, UINT32 w)
+{
+	return (BYTE)((a * (256 - w) + b * w + 128) >> 8);
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_scale_8u_AC4r(const BYTE* WINPR_RESTRICT pSrc, UINT32 srcStep,
+                                    UINT32 srcWidth, UINT32 srcHeight, BYTE* WINPR_RESTRICT pDst,
+                                    UINT32 dstStep, UINT32 dstWidth, UINT32 dstHeight)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i full = _mm_set1_epi16(256);
+	prim_scale_axis xAxis = { 0 };
+	prim_scale_axis yAxis = { 0 };
+
+	if (!pSrc || !pDst)
+		return -1;
+
+	if (!prim_scale_axis_init(&xAxis, srcWidth, dstWidth) ||
+	    !prim_scale_axis_init(&yAxis, srcHeight, dstHeight))
+		return -1;
+
+	for (UINT32 y = 0; y < dstHeight; y++)
+	{
+		UINT32 y0 = 0;
+		UINT32 y1 = 0;
+		UINT32 wy = 0;
+		UINT32 x = 0;
+		prim_scale_axis_get(&yAxis, y, srcHeight, &y0, &y1, &wy);
+
+		const BYTE* row0 = &pSrc[1ULL * y0 * srcStep];
+		const BYTE* row1 = &pSrc[1ULL * y1 * srcStep];
+		BYTE* dst = &pDst[1ULL * y * dstStep];
+		const __m128i wyb = _mm_set1_epi16((short)wy);
+		const __m128i wyt = _mm_sub_epi16(full, wyb);
+
+		/* four destination pixels per iteration, two of them per 16bit register */
+		for (; x + 4 <= dstWidth; x += 4)
+		{
+			UINT32 x0[4] = { 0 };
+			UINT32 x1[4] = { 0 };
+			UINT32 wx[4] = { 0 };
+
+			for (UINT32 i = 0; i < 4; i++)
+				prim_scale_axis_get(&xAxis, x + i, srcWidth, &x0[i], &x1[i], &wx[i]);
+
+			const __m128i wxLo = _mm_set_epi16((short)wx[1], (short)wx[1], (short)wx[1],
+			                                   (short)wx[1], (short)wx[0], (short)wx[0],
+			                                   (short)wx[0], (short)wx[0]);
+			const __m128i wxHi = _mm_set_epi16((short)wx[3], (short)wx[3], (short)wx[3],
+			                                   (short)wx[3], (short)wx[2], (short)wx[2],
+			                                   (short)wx[2], (short)wx[2]);
+			const __m128i iwxLo = _mm_sub_epi16(full, wxLo);
+			const __m128i iwxHi = _mm_sub_epi16(full, wxHi);
+			const __m128i tl = sse2_scale_load4(row0, x0);
+			const __m128i tr = sse2_scale_load4(row0, x1);
+			const __m128i bl = sse2_scale_load4(row1, x0);
+			const __m128i br = sse2_scale_load4(row1, x1);
+
+			/* horizontal pass */
+			const __m128i topLo = sse2_scale_lerp(_mm_unpacklo_epi8(tl, zero),
+			                                      _mm_unpacklo_epi8(tr, zero), iwxLo, wxLo, round);
+			const __m128i topHi = sse2_scale_lerp(_mm_unpackhi_epi8(tl, zero),
+			                                      _mm_unpackhi_epi8(tr, zero), iwxHi, wxHi, round);
+			const __m128i botLo = sse2_scale_lerp(_mm_unpacklo_epi8(bl, zero),
+			                                      _mm_unpacklo_epi8(br, zero), iwxLo, wxLo, round);
+			const __m128i botHi = sse2_scale_lerp(_mm_unpackhi_epi8(bl, zero),
+			                                      _mm_unpackhi_epi8(br, zero), iwxHi, wxHi, round);
+
+			/* vertical pass */
+			const __m128i lo = sse2_scale_lerp(topLo, botLo, wyt, wyb, round);
+			const __m128i hi = sse2_scale_lerp(topHi, botHi, wyt, wyb, round);
+
+			_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+			dst += 16;
+		}
+
+		for (; x < dstWidth; x++)
+		{
+			UINT32 x0 = 0;
+			UINT32 x1 = 0;
+			UINT32 wx = 0;
+			prim_scale_axis_get(&xAxis, x, srcWidth, &x0, &x1, &wx);
+
+			for (size_t c = 0; c < 4; c++)
+			{
+				const BYTE top = sse2_scale_lerp_8u(row0[4ULL * x0 + c], row0[4ULL * x1 + c], wx);
+				const BYTE bottom =
+				    sse2_scale_lerp_8u(row1[4ULL * x0 + c], row1[4ULL * x1 + c], wx);
+				*dst++ = sse2_scale_lerp_8u(top, bottom, wy);
+			}
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_scale_sse2(primitives_t* prims)
+{
+#if defined(SSE2_ENABLED)
+	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
+	{
+		WLog_VRB(PRIM_TAG, "SSE2 optimizations");
+		prims->scale_8u_AC4r = sse2_scale_8u_AC4r;
+	}
+#else
+	WLog_VRB(PRIM_TAG, "undefined WITH_SSE2");
+	WINPR_UNUSED(prims);
+#endif
+}
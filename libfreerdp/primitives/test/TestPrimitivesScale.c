@@ -0,0 +1,163 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Primitives image scaling test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+#include "prim_test.h"
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_scale_8u_AC4r_known(void)
+{
+	/* 2x2 checker scaled down to a single pixel averages all channels */
+	const BYTE src[16] = { 0x00, 0x10, 0x20, 0xFF, 0xFF, 0x30, 0x40, 0xFF,
+		                   0xFF, 0x50, 0x60, 0xFF, 0x00, 0x70, 0x80, 0xFF };
+	const BYTE expect[4] = { 0x80, 0x40, 0x50, 0xFF };
+	BYTE dst[4] = { 0 };
+	BYTE big[8 * 8 * 4] = { 0 };
+
+	if (generic->scale_8u_AC4r(src, 8, 2, 2, dst, 4, 1, 1) != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	if (memcmp(dst, expect, sizeof(expect)) != 0)
+	{
+		printf("scale_8u_AC4r: downscale got %02" PRIx8 "%02" PRIx8 "%02" PRIx8 "%02" PRIx8 "\n",
+		       dst[0], dst[1], dst[2], dst[3]);
+		return FALSE;
+	}
+
+	/* upscaling keeps the corner pixels */
+	if (generic->scale_8u_AC4r(src, 8, 2, 2, big, 8 * 4, 8, 8) != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	if ((memcmp(&big[0], &src[0], 4) != 0) || (memcmp(&big[7 * 4], &src[4], 4) != 0) ||
+	    (memcmp(&big[7 * 8 * 4], &src[8], 4) != 0) ||
+	    (memcmp(&big[(7 * 8 + 7) * 4], &src[12], 4) != 0))
+	{
+		printf("scale_8u_AC4r: upscale changed corner pixels\n");
+		return FALSE;
+	}
+
+	/* invalid sizes are rejected */
+	if (generic->scale_8u_AC4r(src, 8, 0, 2, dst, 4, 1, 1) == PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	if (optimized->scale_8u_AC4r(src, 8, 2, 2, dst, 4, 1, 0) == PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL test_scale_8u_AC4r_func(void)
+{
+	const UINT32 sizes[][4] = { { 64, 64, 32, 32 },   { 64, 48, 128, 96 }, { 17, 9, 40, 3 },
+		                        { 1, 1, 13, 7 },      { 333, 77, 100, 211 }, { 100, 100, 99, 101 },
+		                        { 1920, 8, 1280, 5 } };
+
+	for (size_t x = 0; x < ARRAYSIZE(sizes); x++)
+	{
+		const UINT32 srcWidth = sizes[x][0];
+		const UINT32 srcHeight = sizes[x][1];
+		const UINT32 dstWidth = sizes[x][2];
+		const UINT32 dstHeight = sizes[x][3];
+		/* add some padding to the strides to catch stepping errors */
+		const UINT32 srcStep = srcWidth * 4 + 12;
+		const UINT32 dstStep = dstWidth * 4 + 20;
+		BYTE* src = winpr_aligned_malloc(1ULL * srcStep * srcHeight, 16);
+		BYTE* d1 = winpr_aligned_calloc(dstStep, dstHeight, 16);
+		BYTE* d2 = winpr_aligned_calloc(dstStep, dstHeight, 16);
+
+		if (!src || !d1 || !d2)
+			goto fail;
+
+		winpr_RAND(src, 1ULL * srcStep * srcHeight);
+
+		if (generic->scale_8u_AC4r(src, srcStep, srcWidth, srcHeight, d1, dstStep, dstWidth,
+		                           dstHeight) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (optimized->scale_8u_AC4r(src, srcStep, srcWidth, srcHeight, d2, dstStep, dstWidth,
+		                             dstHeight) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (memcmp(d1, d2, 1ULL * dstStep * dstHeight) != 0)
+		{
+			printf("scale_8u_AC4r: %" PRIu32 "x%" PRIu32 " -> %" PRIu32 "x%" PRIu32
+			       " generic and optimized differ\n",
+			       srcWidth, srcHeight, dstWidth, dstHeight);
+			goto fail;
+		}
+
+		winpr_aligned_free(src);
+		winpr_aligned_free(d1);
+		winpr_aligned_free(d2);
+		continue;
+	fail:
+		winpr_aligned_free(src);
+		winpr_aligned_free(d1);
+		winpr_aligned_free(d2);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_scale_8u_AC4r_speed(void)
+{
+	const UINT32 srcWidth = 1920;
+	const UINT32 srcHeight = 1080;
+	const UINT32 dstWidth = 1280;
+	const UINT32 dstHeight = 720;
+	BOOL rc = FALSE;
+	BYTE* src = winpr_aligned_malloc(4ULL * srcWidth * srcHeight, 16);
+	BYTE* dst = winpr_aligned_malloc(4ULL * dstWidth * dstHeight, 16);
+
+	if (!src || !dst)
+		goto fail;
+
+	winpr_RAND(src, 4ULL * srcWidth * srcHeight);
+	rc = speed_test("scale_8u_AC4r", "1080p->720p", g_Iterations,
+	                (speed_test_fkt)generic->scale_8u_AC4r,
+	                (speed_test_fkt)optimized->scale_8u_AC4r, src, srcWidth * 4, srcWidth,
+	                srcHeight, dst, dstWidth * 4, dstWidth, dstHeight);
+fail:
+	winpr_aligned_free(src);
+	winpr_aligned_free(dst);
+	return rc;
+}
+
+int TestPrimitivesScale(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	prim_test_setup(FALSE);
+
+	if (!test_scale_8u_AC4r_known())
+		return 1;
+
+	if (!test_scale_8u_AC4r_func())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_scale_8u_AC4r_speed())
+			return 1;
+	}
+
+	return 0;
+}
@@ -68,6 +68,7 @@ struct server_info
 	const char* replay_dump;
 	const char* cert;
 	const char* key;
+	rdpPeerReactor* reactor;
 };
 
 static void test_peer_context_free(freerdp_peer* client, rdpContext* ctx)
@@ -1053,31 +1054,20 @@ fail:
 	return -1;
 }
 
-static DWORD WINAPI test_peer_mainloop(LPVOID arg)
+/* Applies the server settings and callbacks and initializes the connection */
+static BOOL test_peer_start(freerdp_peer* client)
 {
-	BOOL rc = 0;
-	DWORD error = CHANNEL_RC_OK;
-	HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
-	DWORD count = 0;
-	DWORD status = 0;
 	testPeerContext* context = NULL;
 	struct server_info* info = NULL;
 	rdpSettings* settings = NULL;
 	rdpInput* input = NULL;
 	rdpUpdate* update = NULL;
-	freerdp_peer* client = (freerdp_peer*)arg;
 
 	WINPR_ASSERT(client);
 
 	info = client->ContextExtra;
 	WINPR_ASSERT(info);
 
-	if (!test_peer_init(client))
-	{
-		freerdp_peer_free(client);
-		return 0;
-	}
-
 	/* Initialize the real server settings here */
 	WINPR_ASSERT(client->context);
 	settings = client->context->settings;
@@ -1086,42 +1076,42 @@ static DWORD WINAPI test_peer_mainloop(LPVOID arg)
 	{
 		if (!freerdp_settings_set_bool(settings, FreeRDP_TransportDumpReplay, TRUE) ||
 		    !freerdp_settings_set_string(settings, FreeRDP_TransportDumpFile, info->replay_dump))
-			goto fail;
+			return FALSE;
 	}
 
 	rdpPrivateKey* key = freerdp_key_new_from_file(info->key);
 	if (!key)
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_pointer_len(settings, FreeRDP_RdpServerRsaKey, key, 1))
-		goto fail;
+		return FALSE;
 	rdpCertificate* cert = freerdp_certificate_new_from_file(info->cert);
 	if (!cert)
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_pointer_len(settings, FreeRDP_RdpServerCertificate, cert, 1))
-		goto fail;
+		return FALSE;
 
 	if (!freerdp_settings_set_bool(settings, FreeRDP_RdpSecurity, TRUE))
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_bool(settings, FreeRDP_TlsSecurity, TRUE))
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_bool(settings, FreeRDP_NlaSecurity, FALSE))
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_uint32(settings, FreeRDP_EncryptionLevel,
 	                                 ENCRYPTION_LEVEL_CLIENT_COMPATIBLE))
-		goto fail;
+		return FALSE;
 	/*  ENCRYPTION_LEVEL_HIGH; */
 	/*  ENCRYPTION_LEVEL_LOW; */
 	/*  ENCRYPTION_LEVEL_FIPS; */
 	if (!freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, TRUE))
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_bool(settings, FreeRDP_NSCodec, TRUE) ||
 	    !freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32))
-		goto fail;
+		return FALSE;
 
 	if (!freerdp_settings_set_bool(settings, FreeRDP_SuppressOutput, TRUE))
-		goto fail;
+		return FALSE;
 	if (!freerdp_settings_set_bool(settings, FreeRDP_RefreshRect, TRUE))
-		goto fail;
+		return FALSE;
 
 	client->PostConnect = tf_peer_post_connect;
 	client->Activate = tf_peer_activate;
@@ -1143,12 +1133,11 @@ static DWORD WINAPI test_peer_mainloop(LPVOID arg)
 	update->SuppressOutput = tf_peer_suppress_output;
 	if (!freerdp_settings_set_uint32(settings, FreeRDP_MultifragMaxRequestSize,
 	                                 0xFFFFFF /* FIXME */))
-		goto fail;
+		return FALSE;
 
 	WINPR_ASSERT(client->Initialize);
-	rc = client->Initialize(client);
-	if (!rc)
-		goto fail;
+	if (!client->Initialize(client))
+		return FALSE;
 
 	context = (testPeerContext*)client->context;
 	WINPR_ASSERT(context);
@@ -1166,6 +1155,96 @@ static DWORD WINAPI test_peer_mainloop(LPVOID arg)
 	}
 
 	WLog_INFO(TAG, "We've got a client %s", client->local ? "(local)" : client->hostname);
+	return TRUE;
+}
+
+/* Called after the transport was checked, services the virtual channels */
+static BOOL test_peer_check_channels(freerdp_peer* client)
+{
+	testPeerContext* context = (testPeerContext*)client->context;
+	WINPR_ASSERT(context);
+
+	HANDLE channelHandle = WTSVirtualChannelManagerGetEventHandle(context->vcm);
+
+	if (WaitForSingleObject(channelHandle, 0) != WAIT_OBJECT_0)
+		return TRUE;
+
+	if (WTSVirtualChannelManagerCheckFileDescriptor(context->vcm) != TRUE)
+		return FALSE;
+
+	/* Handle dynamic virtual channel intializations */
+	if (WTSVirtualChannelManagerIsChannelJoined(context->vcm, DRDYNVC_SVC_CHANNEL_NAME))
+	{
+		switch (WTSVirtualChannelManagerGetDrdynvcState(context->vcm))
+		{
+			case DRDYNVC_STATE_NONE:
+				break;
+
+			case DRDYNVC_STATE_INITIALIZED:
+				break;
+
+			case DRDYNVC_STATE_READY:
+
+				/* Here is the correct state to start dynamic virtual channels */
+				if (sf_peer_audin_running(context) != context->audin_open)
+				{
+					if (!sf_peer_audin_running(context))
+						sf_peer_audin_start(context);
+					else
+						sf_peer_audin_stop(context);
+				}
+
+#if defined(CHANNEL_AINPUT_SERVER)
+				if (sf_peer_ainput_running(context) != context->ainput_open)
+				{
+					if (!sf_peer_ainput_running(context))
+						sf_peer_ainput_start(context);
+					else
+						sf_peer_ainput_stop(context);
+				}
+#endif
+
+				break;
+
+			case DRDYNVC_STATE_FAILED:
+			default:
+				break;
+		}
+	}
+
+	return TRUE;
+}
+
+static void test_peer_disconnect(freerdp_peer* client)
+{
+	WLog_INFO(TAG, "Client %s disconnected.", client->local ? "(local)" : client->hostname);
+
+	WINPR_ASSERT(client->Disconnect);
+	client->Disconnect(client);
+}
+
+static DWORD WINAPI test_peer_mainloop(LPVOID arg)
+{
+	DWORD error = CHANNEL_RC_OK;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	DWORD count = 0;
+	DWORD status = 0;
+	testPeerContext* context = NULL;
+	freerdp_peer* client = (freerdp_peer*)arg;
+
+	WINPR_ASSERT(client);
+
+	if (!test_peer_init(client))
+	{
+		freerdp_peer_free(client);
+		return 0;
+	}
+
+	if (!test_peer_start(client))
+		goto fail;
+
+	context = (testPeerContext*)client->context;
+	WINPR_ASSERT(context);
 
 	while (error == CHANNEL_RC_OK)
 	{
@@ -1183,8 +1262,7 @@ static DWORD WINAPI test_peer_mainloop(LPVOID arg)
 			count += tmp;
 		}
 
-		HANDLE channelHandle = WTSVirtualChannelManagerGetEventHandle(context->vcm);
-		handles[count++] = channelHandle;
+		handles[count++] = WTSVirtualChannelManagerGetEventHandle(context->vcm);
 		status = WaitForMultipleObjects(count, handles, FALSE, INFINITE);
 
 		if (status == WAIT_FAILED)
@@ -1197,61 +1275,65 @@ static DWORD WINAPI test_peer_mainloop(LPVOID arg)
 		if (client->CheckFileDescriptor(client) != TRUE)
 			break;
 
-		if (WaitForSingleObject(channelHandle, 0) != WAIT_OBJECT_0)
-			continue;
-
-		if (WTSVirtualChannelManagerCheckFileDescriptor(context->vcm) != TRUE)
+		if (!test_peer_check_channels(client))
 			break;
+	}
 
-		/* Handle dynamic virtual channel intializations */
-		if (WTSVirtualChannelManagerIsChannelJoined(context->vcm, DRDYNVC_SVC_CHANNEL_NAME))
-		{
-			switch (WTSVirtualChannelManagerGetDrdynvcState(context->vcm))
-			{
-				case DRDYNVC_STATE_NONE:
-					break;
-
-				case DRDYNVC_STATE_INITIALIZED:
-					break;
+	test_peer_disconnect(client);
+fail:
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+	return error;
+}
 
-				case DRDYNVC_STATE_READY:
+static DWORD test_peer_reactor_get_event_handles(freerdp_peer* client, void* arg, HANDLE* events,
+                                                 DWORD count)
+{
+	testPeerContext* context = (testPeerContext*)client->context;
 
-					/* Here is the correct state to start dynamic virtual channels */
-					if (sf_peer_audin_running(context) != context->audin_open)
-					{
-						if (!sf_peer_audin_running(context))
-							sf_peer_audin_start(context);
-						else
-							sf_peer_audin_stop(context);
-					}
+	WINPR_UNUSED(arg);
+	WINPR_ASSERT(context);
 
-#if defined(CHANNEL_AINPUT_SERVER)
-					if (sf_peer_ainput_running(context) != context->ainput_open)
-					{
-						if (!sf_peer_ainput_running(context))
-							sf_peer_ainput_start(context);
-						else
-							sf_peer_ainput_stop(context);
-					}
-#endif
+	if (count < 1)
+		return 0;
 
-					break;
+	events[0] = WTSVirtualChannelManagerGetEventHandle(context->vcm);
+	return 1;
+}
 
-				case DRDYNVC_STATE_FAILED:
-				default:
-					break;
-			}
-		}
-	}
+static BOOL test_peer_reactor_ready(freerdp_peer* client, void* arg)
+{
+	WINPR_UNUSED(arg);
+	return test_peer_check_channels(client);
+}
 
-	WLog_INFO(TAG, "Client %s disconnected.", client->local ? "(local)" : client->hostname);
+static void test_peer_reactor_close(freerdp_peer* client, void* arg)
+{
+	WINPR_UNUSED(arg);
 
-	WINPR_ASSERT(client->Disconnect);
-	client->Disconnect(client);
-fail:
+	test_peer_disconnect(client);
 	freerdp_peer_context_free(client);
 	freerdp_peer_free(client);
-	return error;
+}
+
+/* The connection is set up on the listener thread, from then on the reactor
+ * serves the peer. On failure the listener frees the peer. */
+static BOOL test_peer_accept_reactor(struct server_info* info, freerdp_peer* client)
+{
+	const rdpPeerReactorCallbacks cb = { .GetEventHandles = test_peer_reactor_get_event_handles,
+		                                 .OnReady = test_peer_reactor_ready,
+		                                 .OnClose = test_peer_reactor_close };
+
+	if (!test_peer_init(client))
+		return FALSE;
+
+	if (!test_peer_start(client) || !freerdp_peer_reactor_add(info->reactor, client, &cb, NULL))
+	{
+		freerdp_peer_context_free(client);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
@@ -1267,6 +1349,10 @@ static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
 	info = instance->info;
 	client->ContextExtra = info;
 
+	/* pcap and dump replay sleep in the peer callbacks and need a thread of their own */
+	if (info->reactor && !info->test_pcap_file && !info->replay_dump)
+		return test_peer_accept_reactor(info, client);
+
 	if (!(hThread = CreateThread(NULL, 0, test_peer_mainloop, (void*)client, 0, NULL)))
 		return FALSE;
 
@@ -1416,6 +1502,11 @@ int main(int argc, char* argv[])
 	instance->info = (void*)&info;
 	instance->PeerAccepted = test_peer_accepted;
 
+#if defined(__linux__)
+	/* Serve all peers from a few threads, elsewhere each peer gets its own thread */
+	info.reactor = freerdp_peer_reactor_new(0);
+#endif
+
 	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
 		goto fail;
 
@@ -1447,6 +1538,7 @@ int main(int argc, char* argv[])
 	rc = 0;
 fail:
 	free(file);
+	freerdp_peer_reactor_free(info.reactor);
 	freerdp_listener_free(instance);
 	WSACleanup();
 	return rc;
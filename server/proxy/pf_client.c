@@ -253,6 +253,17 @@ static BOOL pf_client_pre_connect(freerdp* instance)
 	void* OrderSupport = freerdp_settings_get_pointer_writable(settings, FreeRDP_OrderSupport);
 	ZeroMemory(OrderSupport, 32);
 
+	/*
+	 * Bitmap updates and surface commands are forwarded to the client as received.
+	 * Decoding them into a framebuffer is only required if a module wants to look at the
+	 * pixel data, otherwise skip the codecs and GDI entirely.
+	 */
+	pClientContextInternal* internal = pf_client_cast(pc);
+	internal->graphics_passthrough = !pf_modules_requires_client_gdi(pc->pdata->module);
+	if (!freerdp_settings_set_bool(settings, FreeRDP_DeactivateClientDecoding,
+	                               internal->graphics_passthrough))
+		return FALSE;
+
 	if (WTSVirtualChannelManagerIsChannelJoined(ps->vcm, DRDYNVC_SVC_CHANNEL_NAME))
 	{
 		if (!freerdp_settings_set_bool(settings, FreeRDP_SupportDynamicChannels, TRUE))
@@ -592,11 +603,20 @@ static BOOL pf_client_post_connect(freerdp* instance)
 	if (!pf_modules_run_hook(pc->pdata->module, HOOK_TYPE_CLIENT_POST_CONNECT, pc->pdata, pc))
 		return FALSE;
 
-	if (!gdi_init(instance, PIXEL_FORMAT_BGRA32))
-		return FALSE;
+	pClientContextInternal* internal = pf_client_cast(pc);
+	if (internal->graphics_passthrough)
+		WLog_INFO(TAG, "no module requires decoded graphics, forwarding graphics updates as is");
+	else
+	{
+		if (!gdi_init(instance, PIXEL_FORMAT_BGRA32))
+			return FALSE;
 
-	WINPR_ASSERT(freerdp_settings_get_bool(settings, FreeRDP_SoftwareGdi));
+		WINPR_ASSERT(freerdp_settings_get_bool(settings, FreeRDP_SoftwareGdi));
+	}
 
+	/* GDI decodes surface commands before they are forwarded */
+	internal->surface_bits_original = update->SurfaceBits;
+	internal->surface_frame_marker_original = update->SurfaceFrameMarker;
 	pf_client_register_update_callbacks(update);
 
 	/* virtual channels receive data hook */
@@ -1078,7 +1098,7 @@ int RdpClientEntry(RDP_CLIENT_ENTRY_POINTS* pEntryPoints)
 	ZeroMemory(pEntryPoints, sizeof(RDP_CLIENT_ENTRY_POINTS));
 	pEntryPoints->Version = RDP_CLIENT_INTERFACE_VERSION;
 	pEntryPoints->Size = sizeof(RDP_CLIENT_ENTRY_POINTS_V1);
-	pEntryPoints->ContextSize = sizeof(pClientContext);
+	pEntryPoints->ContextSize = sizeof(pClientContextInternal);
 	/* Client init and finish */
 	pEntryPoints->ClientNew = pf_client_client_new;
 	pEntryPoints->ClientFree = pf_client_context_free;
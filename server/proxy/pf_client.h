@@ -23,8 +23,35 @@
 #define FREERDP_SERVER_PROXY_PFCLIENT_H
 
 #include <freerdp/freerdp.h>
+#include <winpr/assert.h>
 #include <winpr/wtypes.h>
 
+#include <freerdp/server/proxy/proxy_context.h>
+
+/* Proxy client state not exposed to modules */
+typedef struct
+{
+	pClientContext common;
+
+	/* Set in pre_connect when no module needs decoded graphics, GDI is not initialized then */
+	BOOL graphics_passthrough;
+	pSurfaceBits surface_bits_original;
+	pSurfaceFrameMarker surface_frame_marker_original;
+} pClientContextInternal;
+
+static INLINE pClientContextInternal* pf_client_cast(pClientContext* pc)
+{
+	union
+	{
+		pClientContext* pub;
+		pClientContextInternal* internal;
+	} cnv;
+
+	WINPR_ASSERT(pc);
+	cnv.pub = pc;
+	return cnv.internal;
+}
+
 int RdpClientEntry(RDP_CLIENT_ENTRY_POINTS* pEntryPoints);
 DWORD WINAPI pf_client_start(LPVOID arg);
 
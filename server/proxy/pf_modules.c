@@ -452,6 +452,35 @@ BOOL pf_modules_is_plugin_loaded(proxyModule* module, const char* plugin_name)
 	return rc;
 }
 
+static BOOL pf_modules_gdi_ArrayList_ForEachFkt(void* data, size_t index, va_list ap)
+{
+	proxyPlugin* plugin = (proxyPlugin*)data;
+
+	WINPR_UNUSED(index);
+
+	BOOL* res = va_arg(ap, BOOL*);
+	WINPR_ASSERT(res);
+
+	if (plugin->ClientEndPaint)
+		*res = TRUE;
+	return TRUE;
+}
+
+/*
+ * Decoded pixel data is only available to plugins through the ClientEndPaint hook.
+ * Without such a plugin graphics updates are forwarded to the client as received.
+ */
+BOOL pf_modules_requires_client_gdi(proxyModule* module)
+{
+	BOOL rc = FALSE;
+	WINPR_ASSERT(module);
+	if (ArrayList_Count(module->plugins) < 1)
+		return FALSE;
+	if (!ArrayList_ForEach(module->plugins, pf_modules_gdi_ArrayList_ForEachFkt, &rc))
+		return TRUE;
+	return rc;
+}
+
 static BOOL pf_modules_print_ArrayList_ForEachFkt(void* data, size_t index, va_list ap)
 {
 	proxyPlugin* plugin = (proxyPlugin*)data;
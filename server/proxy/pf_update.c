@@ -29,12 +29,16 @@
 
 #include <freerdp/server/proxy/proxy_log.h>
 
+#include "pf_client.h"
 #include "pf_update.h"
 #include <freerdp/server/proxy/proxy_context.h>
 #include "proxy_modules.h"
 
 #define TAG PROXY_TAG("update")
 
+/* Size of the bitmap updates decoded surface commands are re-encoded to */
+#define PF_BITMAP_TILE_SIZE 64
+
 static BOOL pf_server_refresh_rect(rdpContext* context, BYTE count, const RECTANGLE_16* areas)
 {
 	pServerContext* ps = (pServerContext*)context;
@@ -129,6 +133,216 @@ static BOOL pf_client_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bi
 	return ps->update->BitmapUpdate(ps, bitmap);
 }
 
+BOOL pf_update_surface_bits_codec_id(const rdpSettings* back, const rdpSettings* front,
+                                     const SURFACE_BITS_COMMAND* cmd, UINT16* codecID)
+{
+	UINT32 cmdFlag = 0;
+
+	WINPR_ASSERT(back);
+	WINPR_ASSERT(front);
+	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(codecID);
+
+	switch (cmd->cmdType)
+	{
+		case CMDTYPE_SET_SURFACE_BITS:
+			cmdFlag = SURFCMDS_SET_SURFACE_BITS;
+			break;
+		case CMDTYPE_STREAM_SURFACE_BITS:
+			cmdFlag = SURFCMDS_STREAM_SURFACE_BITS;
+			break;
+		default:
+			return FALSE;
+	}
+
+	if (!freerdp_settings_get_bool(front, FreeRDP_SurfaceCommandsEnabled) ||
+	    ((freerdp_settings_get_uint32(front, FreeRDP_SurfaceCommandsSupported) & cmdFlag) == 0))
+		return FALSE;
+
+	/*
+	 * The proxy client announces the fixed codec IDs of FreeRDP to the target, the front client
+	 * chooses its own. Map the codec to the ID the front client knows it by.
+	 */
+	switch (cmd->bmp.codecID)
+	{
+		case RDP_CODEC_ID_NONE:
+			*codecID = RDP_CODEC_ID_NONE;
+			return TRUE;
+
+		case RDP_CODEC_ID_REMOTEFX:
+			if (!freerdp_settings_get_bool(back, FreeRDP_RemoteFxCodec) ||
+			    !freerdp_settings_get_bool(front, FreeRDP_RemoteFxCodec))
+				return FALSE;
+
+			*codecID = (UINT16)freerdp_settings_get_uint32(front, FreeRDP_RemoteFxCodecId);
+			return TRUE;
+
+		case RDP_CODEC_ID_NSCODEC:
+			if (!freerdp_settings_get_bool(back, FreeRDP_NSCodec) ||
+			    !freerdp_settings_get_bool(front, FreeRDP_NSCodec))
+				return FALSE;
+
+			*codecID = (UINT16)freerdp_settings_get_uint32(front, FreeRDP_NSCodecId);
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
+}
+
+/*
+ * Send the area of a surface command GDI decoded as uncompressed bitmap updates in the color
+ * depth of the front client.
+ */
+static BOOL pf_client_send_decoded_area(rdpContext* context, rdpContext* ps,
+                                        const SURFACE_BITS_COMMAND* cmd)
+{
+	BOOL rc = FALSE;
+	BYTE* data = NULL;
+	const rdpGdi* gdi = NULL;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(cmd);
+
+	gdi = context->gdi;
+	if (!gdi || !gdi->primary_buffer)
+		return FALSE;
+
+	const UINT32 bpp = freerdp_settings_get_uint32(ps->settings, FreeRDP_ColorDepth);
+	const UINT32 format = gdi_get_pixel_format(bpp);
+	if ((bpp < 15) || (format == 0))
+	{
+		WLog_WARN(TAG, "unable to re-encode surface bits for a %" PRIu32 " bpp client", bpp);
+		return TRUE;
+	}
+
+	const UINT32 bytesPerPixel = FreeRDPGetBytesPerPixel(format);
+	const UINT32 srcBytes = FreeRDPGetBytesPerPixel(gdi->dstFormat);
+	const UINT32 left = MIN(cmd->destLeft, (UINT32)gdi->width);
+	const UINT32 top = MIN(cmd->destTop, (UINT32)gdi->height);
+	const UINT32 right = MIN(cmd->destRight, (UINT32)gdi->width);
+	const UINT32 bottom = MIN(cmd->destBottom, (UINT32)gdi->height);
+
+	data = calloc(PF_BITMAP_TILE_SIZE * PF_BITMAP_TILE_SIZE, bytesPerPixel);
+	if (!data)
+		return FALSE;
+
+	for (UINT32 y = top; y < bottom; y += PF_BITMAP_TILE_SIZE)
+	{
+		for (UINT32 x = left; x < right; x += PF_BITMAP_TILE_SIZE)
+		{
+			BITMAP_DATA rect = { 0 };
+			BITMAP_UPDATE bitmap = { 0 };
+			const UINT32 width = MIN(PF_BITMAP_TILE_SIZE, right - x);
+			const UINT32 height = MIN(PF_BITMAP_TILE_SIZE, bottom - y);
+
+			/* Uncompressed scanlines are padded to 4 bytes and decoders derive their size from
+			 * the bitmap width, so round it up to 4 pixels and clip with destRight */
+			const UINT32 bitmapWidth = (width + 3) & ~3u;
+			const UINT32 step = bitmapWidth * bytesPerPixel;
+
+			/* Uncompressed bitmap data is stored bottom up, the flip is relative to the source
+			 * pointer so point it at the tile */
+			const BYTE* src = &gdi->primary_buffer[1ull * y * gdi->stride + 1ull * x * srcBytes];
+			if (!freerdp_image_copy_no_overlap(data, format, step, 0, 0, width, height, src,
+			                                   gdi->dstFormat, gdi->stride, 0, 0, &gdi->palette,
+			                                   FREERDP_FLIP_VERTICAL))
+				goto fail;
+
+			rect.destLeft = x;
+			rect.destTop = y;
+			rect.destRight = x + width - 1;
+			rect.destBottom = y + height - 1;
+			rect.width = bitmapWidth;
+			rect.height = height;
+			rect.bitsPerPixel = bpp;
+			rect.bitmapLength = step * height;
+			rect.bitmapDataStream = data;
+			rect.compressed = FALSE;
+			bitmap.number = 1;
+			bitmap.rectangles = &rect;
+
+			if (!ps->update->BitmapUpdate(ps, &bitmap))
+				goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(data);
+	return rc;
+}
+
+static BOOL pf_client_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	pClientContext* pc = (pClientContext*)context;
+	pClientContextInternal* internal = NULL;
+	proxyData* pdata = NULL;
+	rdpContext* ps = NULL;
+	UINT16 codecID = 0;
+	WINPR_ASSERT(pc);
+	WINPR_ASSERT(cmd);
+	internal = pf_client_cast(pc);
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+	ps = (rdpContext*)pdata->ps;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->update);
+	WINPR_ASSERT(ps->update->SurfaceBits);
+	WLog_DBG(TAG, "called");
+
+	if (internal->surface_bits_original && !internal->surface_bits_original(context, cmd))
+		return FALSE;
+
+	if (pf_update_surface_bits_codec_id(context->settings, ps->settings, cmd, &codecID))
+	{
+		SURFACE_BITS_COMMAND forward = *cmd;
+
+		forward.bmp.codecID = codecID;
+		return ps->update->SurfaceBits(ps, &forward);
+	}
+
+	/* The front client can not decode the command, send what GDI decoded instead */
+	if (internal->graphics_passthrough)
+	{
+		WLog_WARN(TAG,
+		          "dropping surface bits with codec %" PRIu16
+		          " the client did not negotiate, graphics are not decoded",
+		          cmd->bmp.codecID);
+		return TRUE;
+	}
+
+	return pf_client_send_decoded_area(context, ps, cmd);
+}
+
+static BOOL pf_client_surface_frame_marker(rdpContext* context,
+                                           const SURFACE_FRAME_MARKER* surfaceFrameMarker)
+{
+	pClientContext* pc = (pClientContext*)context;
+	pClientContextInternal* internal = NULL;
+	proxyData* pdata = NULL;
+	rdpContext* ps = NULL;
+	WINPR_ASSERT(pc);
+	internal = pf_client_cast(pc);
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+	ps = (rdpContext*)pdata->ps;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->update);
+	WINPR_ASSERT(ps->update->SurfaceFrameMarker);
+	WLog_DBG(TAG, "called");
+
+	if (internal->surface_frame_marker_original &&
+	    !internal->surface_frame_marker_original(context, surfaceFrameMarker))
+		return FALSE;
+
+	if (!freerdp_settings_get_bool(ps->settings, FreeRDP_SurfaceFrameMarkerEnabled))
+		return TRUE;
+
+	return ps->update->SurfaceFrameMarker(ps, surfaceFrameMarker);
+}
+
 static BOOL pf_client_desktop_resize(rdpContext* context)
 {
 	pClientContext* pc = (pClientContext*)context;
@@ -600,6 +814,8 @@ void pf_client_register_update_callbacks(rdpUpdate* update)
 	update->BeginPaint = pf_client_begin_paint;
 	update->EndPaint = pf_client_end_paint;
 	update->BitmapUpdate = pf_client_bitmap_update;
+	update->SurfaceBits = pf_client_surface_bits;
+	update->SurfaceFrameMarker = pf_client_surface_frame_marker;
 	update->DesktopResize = pf_client_desktop_resize;
 	update->RemoteMonitors = pf_client_remote_monitors;
 	update->SaveSessionInfo = pf_client_save_session_info;
@@ -31,4 +31,9 @@
 void pf_server_register_update_callbacks(rdpUpdate* update);
 void pf_client_register_update_callbacks(rdpUpdate* update);
 
+/* Codec ID the front client expects for a surface command of the target, FALSE if the front
+ * client did not negotiate the command or its codec */
+BOOL pf_update_surface_bits_codec_id(const rdpSettings* back, const rdpSettings* front,
+                                     const SURFACE_BITS_COMMAND* cmd, UINT16* codecID);
+
 #endif /* FREERDP_SERVER_PROXY_PFUPDATE_H */
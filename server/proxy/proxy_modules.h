@@ -84,6 +84,7 @@ extern "C"
 	BOOL pf_modules_add(proxyModule* module, proxyModuleEntryPoint ep, void* userdata);
 
 	BOOL pf_modules_is_plugin_loaded(proxyModule* module, const char* plugin_name);
+	BOOL pf_modules_requires_client_gdi(proxyModule* module);
 	void pf_modules_list_loaded_plugins(proxyModule* module);
 
 	BOOL pf_modules_run_filter(proxyModule* module, PF_FILTER_TYPE type, proxyData* pdata,
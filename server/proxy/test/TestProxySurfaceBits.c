@@ -0,0 +1,359 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/server/proxy/proxy_context.h>
+
+#include "pf_client.h"
+#include "pf_update.h"
+
+#define TEST_FRONT_RFX_ID 5
+#define TEST_FRONT_NSC_ID 2
+#define TEST_GDI_WIDTH 128
+#define TEST_GDI_HEIGHT 96
+#define TEST_MAX_BITMAPS 8
+
+typedef struct
+{
+	UINT32 left;
+	UINT32 top;
+	UINT32 width;
+	UINT32 height;
+	BOOL pixelsMatch;
+} test_bitmap;
+
+typedef struct
+{
+	pClientContextInternal pc;
+	proxyData pdata;
+	pServerContext ps;
+
+	rdpUpdate backUpdate;
+	rdpPointerUpdate backPointer;
+	rdpWindowUpdate backWindow;
+	rdpUpdate frontUpdate;
+	rdpGdi gdi;
+
+	size_t surfaceBitsCount;
+	UINT16 surfaceBitsCodecId;
+	size_t frameMarkerCount;
+	size_t bitmapCount;
+	test_bitmap bitmaps[TEST_MAX_BITMAPS];
+} test_proxy;
+
+static test_proxy* g_Test = NULL;
+
+static UINT32 test_pixel(UINT32 x, UINT32 y)
+{
+	return FreeRDPGetColor(PIXEL_FORMAT_BGRA32, (BYTE)x, (BYTE)y, (BYTE)(x ^ y), 0xFF);
+}
+
+static BOOL test_front_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	WINPR_UNUSED(context);
+	g_Test->surfaceBitsCount++;
+	g_Test->surfaceBitsCodecId = cmd->bmp.codecID;
+	return TRUE;
+}
+
+static BOOL test_front_surface_frame_marker(rdpContext* context,
+                                            const SURFACE_FRAME_MARKER* surfaceFrameMarker)
+{
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(surfaceFrameMarker);
+	g_Test->frameMarkerCount++;
+	return TRUE;
+}
+
+/* Uncompressed bitmap data is bottom up, compare against the framebuffer right away as the
+ * proxy reuses the buffer for the next tile */
+static BOOL test_front_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmap)
+{
+	WINPR_UNUSED(context);
+
+	if ((bitmap->number != 1) || (g_Test->bitmapCount >= TEST_MAX_BITMAPS))
+		return FALSE;
+
+	const BITMAP_DATA* rect = &bitmap->rectangles[0];
+	test_bitmap* cur = &g_Test->bitmaps[g_Test->bitmapCount++];
+	const UINT32 format = gdi_get_pixel_format(rect->bitsPerPixel);
+	const UINT32 bytesPerPixel = FreeRDPGetBytesPerPixel(format);
+	const size_t step = 1ull * rect->width * bytesPerPixel;
+
+	cur->left = rect->destLeft;
+	cur->top = rect->destTop;
+	cur->width = rect->destRight - rect->destLeft + 1;
+	cur->height = rect->height;
+
+	/* Scanlines are padded to 4 bytes, the bitmap width includes the padding */
+	cur->pixelsMatch = (format != 0) && !rect->compressed && ((step % 4) == 0) &&
+	                   (rect->width >= cur->width) && (rect->width < cur->width + 4) &&
+	                   (rect->destBottom == rect->destTop + rect->height - 1) &&
+	                   (rect->bitmapLength == step * rect->height);
+
+	for (UINT32 y = 0; cur->pixelsMatch && (y < rect->height); y++)
+	{
+		const BYTE* line = &rect->bitmapDataStream[step * (rect->height - y - 1)];
+
+		for (UINT32 x = 0; x < cur->width; x++)
+		{
+			const UINT32 color = FreeRDPReadColor(&line[1ull * bytesPerPixel * x], format);
+			const UINT32 expected =
+			    FreeRDPConvertColor(test_pixel(rect->destLeft + x, rect->destTop + y),
+			                        PIXEL_FORMAT_BGRA32, format, NULL);
+
+			if (color != expected)
+			{
+				cur->pixelsMatch = FALSE;
+				break;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/* Stands in for GDI, decodes every command by filling its area with a pattern */
+static BOOL test_gdi_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	rdpGdi* gdi = context->gdi;
+
+	for (UINT32 y = cmd->destTop; y < MIN(cmd->destBottom, (UINT32)gdi->height); y++)
+	{
+		for (UINT32 x = cmd->destLeft; x < MIN(cmd->destRight, (UINT32)gdi->width); x++)
+			FreeRDPWriteColor(&gdi->primary_buffer[y * gdi->stride + 4ull * x],
+			                  PIXEL_FORMAT_BGRA32, test_pixel(x, y));
+	}
+
+	return TRUE;
+}
+
+static BOOL test_proxy_init(test_proxy* test)
+{
+	g_Test = test;
+	test->pc.common.pdata = &test->pdata;
+	test->pdata.ps = &test->ps;
+	test->pdata.pc = &test->pc.common;
+	test->ps.pdata = &test->pdata;
+
+	test->backUpdate.pointer = &test->backPointer;
+	test->backUpdate.window = &test->backWindow;
+	test->pc.common.context.update = &test->backUpdate;
+	pf_client_register_update_callbacks(&test->backUpdate);
+
+	test->frontUpdate.SurfaceBits = test_front_surface_bits;
+	test->frontUpdate.SurfaceFrameMarker = test_front_surface_frame_marker;
+	test->frontUpdate.BitmapUpdate = test_front_bitmap_update;
+	test->ps.context.update = &test->frontUpdate;
+
+	test->pc.common.context.settings = freerdp_settings_new(0);
+	test->ps.context.settings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
+
+	if (!test->pc.common.context.settings || !test->ps.context.settings)
+		return FALSE;
+
+	rdpSettings* back = test->pc.common.context.settings;
+	rdpSettings* front = test->ps.context.settings;
+
+	/* The front client negotiated RemoteFX under its own ID, but not NSCodec */
+	return freerdp_settings_set_bool(back, FreeRDP_RemoteFxCodec, TRUE) &&
+	       freerdp_settings_set_bool(back, FreeRDP_NSCodec, TRUE) &&
+	       freerdp_settings_set_bool(front, FreeRDP_SurfaceCommandsEnabled, TRUE) &&
+	       freerdp_settings_set_uint32(front, FreeRDP_SurfaceCommandsSupported,
+	                                   SURFCMDS_SET_SURFACE_BITS | SURFCMDS_FRAME_MARKER) &&
+	       freerdp_settings_set_bool(front, FreeRDP_SurfaceFrameMarkerEnabled, TRUE) &&
+	       freerdp_settings_set_bool(front, FreeRDP_RemoteFxCodec, TRUE) &&
+	       freerdp_settings_set_uint32(front, FreeRDP_RemoteFxCodecId, TEST_FRONT_RFX_ID) &&
+	       freerdp_settings_set_bool(front, FreeRDP_NSCodec, FALSE) &&
+	       freerdp_settings_set_uint32(front, FreeRDP_NSCodecId, TEST_FRONT_NSC_ID) &&
+	       freerdp_settings_set_uint32(front, FreeRDP_ColorDepth, 32);
+}
+
+static void test_proxy_uninit(test_proxy* test)
+{
+	freerdp_settings_free(test->pc.common.context.settings);
+	freerdp_settings_free(test->ps.context.settings);
+	free(test->gdi.primary_buffer);
+	g_Test = NULL;
+}
+
+static BOOL test_codec_id(test_proxy* test, UINT32 cmdType, UINT16 backId, BOOL expected,
+                          UINT16 expectedId)
+{
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	UINT16 codecID = 0;
+
+	cmd.cmdType = cmdType;
+	cmd.bmp.codecID = backId;
+
+	const BOOL rc = pf_update_surface_bits_codec_id(test->pc.common.context.settings,
+	                                                test->ps.context.settings, &cmd, &codecID);
+
+	if ((rc != expected) || (rc && (codecID != expectedId)))
+	{
+		(void)fprintf(stderr, "[%s] codec %" PRIu16 ": got %d/%" PRIu16 "\n", __func__, backId,
+		              rc, codecID);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_codec_ids(test_proxy* test)
+{
+	rdpSettings* front = test->ps.context.settings;
+
+	if (!test_codec_id(test, CMDTYPE_SET_SURFACE_BITS, RDP_CODEC_ID_NONE, TRUE,
+	                   RDP_CODEC_ID_NONE) ||
+	    !test_codec_id(test, CMDTYPE_SET_SURFACE_BITS, RDP_CODEC_ID_REMOTEFX, TRUE,
+	                   TEST_FRONT_RFX_ID) ||
+	    !test_codec_id(test, CMDTYPE_SET_SURFACE_BITS, RDP_CODEC_ID_NSCODEC, FALSE, 0) ||
+	    !test_codec_id(test, CMDTYPE_SET_SURFACE_BITS, RDP_CODEC_ID_IMAGE_REMOTEFX, FALSE, 0) ||
+	    !test_codec_id(test, CMDTYPE_STREAM_SURFACE_BITS, RDP_CODEC_ID_NONE, FALSE, 0))
+		return FALSE;
+
+	if (!freerdp_settings_set_bool(front, FreeRDP_NSCodec, TRUE) ||
+	    !test_codec_id(test, CMDTYPE_SET_SURFACE_BITS, RDP_CODEC_ID_NSCODEC, TRUE,
+	                   TEST_FRONT_NSC_ID) ||
+	    !freerdp_settings_set_bool(front, FreeRDP_NSCodec, FALSE))
+		return FALSE;
+
+	/* Nothing is passed through to a client without surface commands */
+	if (!freerdp_settings_set_bool(front, FreeRDP_SurfaceCommandsEnabled, FALSE) ||
+	    !test_codec_id(test, CMDTYPE_SET_SURFACE_BITS, RDP_CODEC_ID_NONE, FALSE, 0) ||
+	    !freerdp_settings_set_bool(front, FreeRDP_SurfaceCommandsEnabled, TRUE))
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL test_passthrough(test_proxy* test)
+{
+	rdpContext* context = &test->pc.common.context;
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	SURFACE_FRAME_MARKER marker = { 0 };
+
+	test->pc.graphics_passthrough = TRUE;
+	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
+	cmd.bmp.codecID = RDP_CODEC_ID_REMOTEFX;
+
+	/* Forwarded as is under the ID of the front client */
+	if (!test->backUpdate.SurfaceBits(context, &cmd) || (test->surfaceBitsCount != 1) ||
+	    (test->surfaceBitsCodecId != TEST_FRONT_RFX_ID))
+		return FALSE;
+
+	/* Without GDI a codec the front client does not know can only be dropped */
+	cmd.bmp.codecID = RDP_CODEC_ID_NSCODEC;
+	if (!test->backUpdate.SurfaceBits(context, &cmd) || (test->surfaceBitsCount != 1) ||
+	    (test->bitmapCount != 0))
+		return FALSE;
+
+	if (!test->backUpdate.SurfaceFrameMarker(context, &marker) || (test->frameMarkerCount != 1))
+		return FALSE;
+
+	if (!freerdp_settings_set_bool(test->ps.context.settings, FreeRDP_SurfaceFrameMarkerEnabled,
+	                               FALSE) ||
+	    !test->backUpdate.SurfaceFrameMarker(context, &marker) || (test->frameMarkerCount != 1))
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL test_reencode(test_proxy* test, UINT32 bpp)
+{
+	rdpContext* context = &test->pc.common.context;
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	const test_bitmap expected[] = {
+		{ 11, 20, 64, 64, TRUE },
+		{ 75, 20, 53, 64, TRUE },
+		{ 11, 84, 64, 12, TRUE },
+		{ 75, 84, 53, 12, TRUE },
+	};
+
+	/* GDI decodes the command into the framebuffer */
+	test->gdi.width = TEST_GDI_WIDTH;
+	test->gdi.height = TEST_GDI_HEIGHT;
+	test->gdi.dstFormat = PIXEL_FORMAT_BGRA32;
+	test->gdi.stride = TEST_GDI_WIDTH * 4;
+	if (!test->gdi.primary_buffer)
+		test->gdi.primary_buffer = calloc(TEST_GDI_HEIGHT, test->gdi.stride);
+	if (!test->gdi.primary_buffer)
+		return FALSE;
+
+	/* The edge tiles have an odd width, at 16 and 24 bpp their scanlines need padding */
+	const size_t surfaceBitsCount = test->surfaceBitsCount;
+	test->bitmapCount = 0;
+	if (!freerdp_settings_set_uint32(test->ps.context.settings, FreeRDP_ColorDepth, bpp))
+		return FALSE;
+
+	context->gdi = &test->gdi;
+	test->pc.graphics_passthrough = FALSE;
+	test->pc.surface_bits_original = test_gdi_surface_bits;
+
+	/* The area reaches past the framebuffer and is clipped */
+	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
+	cmd.bmp.codecID = RDP_CODEC_ID_NSCODEC;
+	cmd.destLeft = 11;
+	cmd.destTop = 20;
+	cmd.destRight = TEST_GDI_WIDTH + 30;
+	cmd.destBottom = TEST_GDI_HEIGHT + 40;
+
+	if (!test->backUpdate.SurfaceBits(context, &cmd) ||
+	    (test->surfaceBitsCount != surfaceBitsCount) || (test->bitmapCount != ARRAYSIZE(expected)))
+		return FALSE;
+
+	for (size_t x = 0; x < ARRAYSIZE(expected); x++)
+	{
+		const test_bitmap* cur = &test->bitmaps[x];
+
+		if ((cur->left != expected[x].left) || (cur->top != expected[x].top) ||
+		    (cur->width != expected[x].width) || (cur->height != expected[x].height) ||
+		    !cur->pixelsMatch)
+		{
+			(void)fprintf(stderr, "[%s] %" PRIu32 " bpp bitmap %" PRIuz " mismatch\n", __func__,
+			              bpp, x);
+			return FALSE;
+		}
+	}
+
+	/* Commands the front client understands are decoded and still passed through */
+	cmd.bmp.codecID = RDP_CODEC_ID_REMOTEFX;
+	if (!test->backUpdate.SurfaceBits(context, &cmd) ||
+	    (test->surfaceBitsCount != surfaceBitsCount + 1) ||
+	    (test->bitmapCount != ARRAYSIZE(expected)))
+		return FALSE;
+
+	return TRUE;
+}
+
+int TestProxySurfaceBits(int argc, char* argv[])
+{
+	int rc = -1;
+	test_proxy* test = calloc(1, sizeof(test_proxy));
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test)
+		return -1;
+
+	if (!test_proxy_init(test))
+		goto fail;
+
+	if (!test_codec_ids(test))
+		goto fail;
+
+	if (!test_passthrough(test))
+		goto fail;
+
+	if (!test_reencode(test, 32) || !test_reencode(test, 24) || !test_reencode(test, 16))
+		goto fail;
+
+	rc = 0;
+fail:
+	test_proxy_uninit(test);
+	free(test);
+	return rc;
+}
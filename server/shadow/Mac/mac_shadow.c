@@ -397,6 +397,7 @@ static void (^mac_capture_stream_handler)(
 	  IOSurfaceLock(frameSurface, kIOSurfaceLockReadOnly, NULL);
 	  pSrcData = (BYTE*)IOSurfaceGetBaseAddress(frameSurface);
 	  nSrcStep = (int)IOSurfaceGetBytesPerRow(frameSurface);
+	  EnterCriticalSection(&(surface->lock));
 
 	  if (subsystem->retina)
 	  {
@@ -409,6 +410,7 @@ static void (^mac_capture_stream_handler)(
 			                            width, height, pSrcData, PIXEL_FORMAT_BGRX32, nSrcStep, x,
 			                            y, NULL, FREERDP_FLIP_NONE);
 	  }
+	  shadow_subsystem_surface_changed(&subsystem->common);
 	  LeaveCriticalSection(&(surface->lock));
 
 	  IOSurfaceUnlock(frameSurface, kIOSurfaceLockReadOnly, NULL);
@@ -314,10 +314,18 @@ static int win_shadow_surface_copy(winShadowSubsystem* subsystem)
 	if (status <= 0)
 		return status;
 
+	EnterCriticalSection(&(surface->lock));
+
 	if (!freerdp_image_copy_no_overlap(surface->data, surface->format, surface->scanline, x, y,
 	                                   width, height, pDstData, DstFormat, nDstStep, x, y, NULL,
 	                                   FREERDP_FLIP_NONE))
+	{
+		LeaveCriticalSection(&(surface->lock));
 		return ERROR_INTERNAL_ERROR;
+	}
+
+	shadow_subsystem_surface_changed(&subsystem->base);
+	LeaveCriticalSection(&(surface->lock));
 
 	ArrayList_Lock(server->clients);
 	count = ArrayList_Count(server->clients);
@@ -765,7 +765,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	XImage* image = NULL;
 	rdpShadowServer* server = NULL;
 	rdpShadowSurface* surface = NULL;
-	RECTANGLE_16 invalidRect;
+	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
 	const RECTANGLE_16* extents = NULL;
 	server = subsystem->common.server;
@@ -782,6 +782,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	surfaceRect.bottom = surface->height;
 	LeaveCriticalSection(&surface->lock);
 
+	region16_init(&invalidRegion);
 	XLockDisplay(subsystem->display);
 	/*
 	 * Ignore BadMatch error during image capture. The screen size may be
@@ -796,10 +797,10 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
 
 		EnterCriticalSection(&surface->lock);
-		status = shadow_capture_compare_with_format(
-		    surface->data, surface->format, surface->scanline, surface->width, surface->height,
-		    (BYTE*)&(image->data[surface->width * 4ull]), subsystem->format, image->bytes_per_line,
-		    &invalidRect);
+		status = shadow_capture_compare_region(
+		    server->capture, surface->data, surface->format, surface->scanline, surface->width,
+		    surface->height, (BYTE*)&(image->data[surface->width * 4ull]), subsystem->format,
+		    image->bytes_per_line, &invalidRegion);
 		LeaveCriticalSection(&surface->lock);
 	}
 	else
@@ -811,9 +812,10 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 
 		if (image)
 		{
-			status = shadow_capture_compare_with_format(
-			    surface->data, surface->format, surface->scanline, surface->width, surface->height,
-			    (BYTE*)image->data, subsystem->format, image->bytes_per_line, &invalidRect);
+			status = shadow_capture_compare_region(
+			    server->capture, surface->data, surface->format, surface->scanline,
+			    surface->width, surface->height, (BYTE*)image->data, subsystem->format,
+			    image->bytes_per_line, &invalidRegion);
 		}
 		LeaveCriticalSection(&surface->lock);
 		if (!image)
@@ -831,11 +833,15 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
 
-	if (status)
+	if (status > 0)
 	{
 		BOOL empty = 0;
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects = region16_rects(&invalidRegion, &numRects);
 		EnterCriticalSection(&surface->lock);
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
+		for (UINT32 index = 0; index < numRects; index++)
+			region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+			                    &rects[index]);
 		region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion), &surfaceRect);
 		empty = region16_is_empty(&(surface->invalidRegion));
 		LeaveCriticalSection(&surface->lock);
@@ -857,6 +863,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 			    surface->data, surface->format, surface->scanline, x, y, (UINT32)width,
 			    (UINT32)height, (BYTE*)image->data, subsystem->format,
 			    (UINT32)image->bytes_per_line, x, y, NULL, FREERDP_FLIP_NONE);
+			shadow_subsystem_surface_changed(&subsystem->common);
 			LeaveCriticalSection(&surface->lock);
 			if (!success)
 				goto fail_capture;
@@ -883,6 +890,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 
 	rc = 1;
 fail_capture:
+	region16_uninit(&invalidRegion);
 	if (!subsystem->use_xshm && image)
 		XDestroyImage(image);
 
@@ -20,13 +20,23 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
+#include <freerdp/settings.h>
 
 #include "shadow_surface.h"
 
 #include "shadow_capture.h"
 
+#if defined(WITH_SSE2) && (defined(_M_IX86) || defined(_M_AMD64))
+#define SHADOW_CAPTURE_SSE2
+#include <emmintrin.h>
+#elif defined(WITH_NEON) && (defined(_M_ARM64) || defined(_M_ARM))
+#define SHADOW_CAPTURE_NEON
+#include <arm_neon.h>
+#endif
+
 #define TAG SERVER_TAG("shadow")
 
 int shadow_capture_align_clip_rect(RECTANGLE_16* rect, const RECTANGLE_16* clip)
@@ -173,8 +183,85 @@ static BOOL pixel_equal_same_format(const BYTE* WINPR_RESTRICT a, UINT32 formatA
 	return memcmp(a, b, count * bppA) == 0;
 }
 
-typedef BOOL (*pixel_equal_fn_t)(const BYTE* WINPR_RESTRICT a, UINT32 formatA,
-                                 const BYTE* WINPR_RESTRICT b, UINT32 formatB, size_t count);
+/* Mask of the alpha byte of a 32bpp pixel, independent of the host byte order */
+static INLINE UINT32 alpha_mask_32bpp(UINT32 format)
+{
+	BYTE bytes[4] = { 0 };
+	UINT32 mask = 0;
+
+	switch (format)
+	{
+		case PIXEL_FORMAT_ARGB32:
+		case PIXEL_FORMAT_XRGB32:
+		case PIXEL_FORMAT_ABGR32:
+		case PIXEL_FORMAT_XBGR32:
+			bytes[0] = 0xFF;
+			break;
+		default:
+			bytes[3] = 0xFF;
+			break;
+	}
+
+	memcpy(&mask, bytes, sizeof(mask));
+	return mask;
+}
+
+/**
+ * Same result as pixel_equal for 32bpp formats that only differ in alpha:
+ * the alpha byte of a format without alpha is read as opaque, so it is set
+ * before both pixels are compared as a whole.
+ */
+static BOOL pixel_equal_32bpp(const BYTE* WINPR_RESTRICT a, UINT32 formatA,
+                              const BYTE* WINPR_RESTRICT b, UINT32 formatB, size_t count)
+{
+	const UINT32 mask = alpha_mask_32bpp(formatA);
+	const UINT32 opaqueA = FreeRDPColorHasAlpha(formatA) ? 0 : mask;
+	const UINT32 opaqueB = FreeRDPColorHasAlpha(formatB) ? 0 : mask;
+	size_t x = 0;
+
+#if defined(SHADOW_CAPTURE_SSE2)
+	const __m128i vopaqueA = _mm_set1_epi32((int)opaqueA);
+	const __m128i vopaqueB = _mm_set1_epi32((int)opaqueB);
+
+	for (; x + 4 <= count; x += 4)
+	{
+		const __m128i va = _mm_or_si128(_mm_loadu_si128((const __m128i*)&a[4 * x]), vopaqueA);
+		const __m128i vb = _mm_or_si128(_mm_loadu_si128((const __m128i*)&b[4 * x]), vopaqueB);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF)
+			return FALSE;
+	}
+#elif defined(SHADOW_CAPTURE_NEON)
+	const uint32x4_t vopaqueA = vdupq_n_u32(opaqueA);
+	const uint32x4_t vopaqueB = vdupq_n_u32(opaqueB);
+
+	for (; x + 4 <= count; x += 4)
+	{
+		const uint32x4_t va = vorrq_u32(vreinterpretq_u32_u8(vld1q_u8(&a[4 * x])), vopaqueA);
+		const uint32x4_t vb = vorrq_u32(vreinterpretq_u32_u8(vld1q_u8(&b[4 * x])), vopaqueB);
+		const uint32x4_t diff = veorq_u32(va, vb);
+		const uint32x2_t half = vorr_u32(vget_low_u32(diff), vget_high_u32(diff));
+
+		if (vget_lane_u32(vpmax_u32(half, half), 0) != 0)
+			return FALSE;
+	}
+#endif
+
+	for (; x < count; x++)
+	{
+		UINT32 va = 0;
+		UINT32 vb = 0;
+		memcpy(&va, &a[4 * x], sizeof(va));
+		memcpy(&vb, &b[4 * x], sizeof(vb));
+
+		if ((va | opaqueA) != (vb | opaqueB))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+typedef pShadowCapturePixelEqual pixel_equal_fn_t;
 
 static pixel_equal_fn_t get_comparison_fn(DWORD format1, DWORD format2)
 {
@@ -186,8 +273,8 @@ static pixel_equal_fn_t get_comparison_fn(DWORD format1, DWORD format2)
 
 	if (!FreeRDPColorHasAlpha(format1) || !FreeRDPColorHasAlpha(format2))
 	{
-		/* In case we have RGBA32 and RGBX32 or similar assume the alpha data is equal.
-		 * This allows us to use the fast memcmp comparison. */
+		/* In case we have RGBA32 and RGBX32 or similar the whole pixel can be compared
+		 * once the missing alpha is filled in. */
 		if ((bpp1 == 32) && FreeRDPAreColorFormatsEqualNoAlpha(format1, format2))
 		{
 			switch (format1)
@@ -196,12 +283,12 @@ static pixel_equal_fn_t get_comparison_fn(DWORD format1, DWORD format2)
 				case PIXEL_FORMAT_XRGB32:
 				case PIXEL_FORMAT_ABGR32:
 				case PIXEL_FORMAT_XBGR32:
-					return pixel_equal;
+					return pixel_equal_32bpp;
 				case PIXEL_FORMAT_RGBA32:
 				case PIXEL_FORMAT_RGBX32:
 				case PIXEL_FORMAT_BGRA32:
 				case PIXEL_FORMAT_BGRX32:
-					return pixel_equal;
+					return pixel_equal_32bpp;
 				default:
 					break;
 			}
@@ -214,102 +301,251 @@ static pixel_equal_fn_t get_comparison_fn(DWORD format1, DWORD format2)
 	return pixel_equal;
 }
 
-int shadow_capture_compare_with_format(const BYTE* WINPR_RESTRICT pData1, UINT32 format1,
-                                       UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
-                                       const BYTE* WINPR_RESTRICT pData2, UINT32 format2,
-                                       UINT32 nStep2, RECTANGLE_16* WINPR_RESTRICT rect)
+/**
+ * Compare the tile rows [firstRow, lastRow) scanline by scanline and mark the
+ * tiles that differ. Tiles already known to be dirty are skipped.
+ */
+static void shadow_capture_compare_band(SHADOW_CAPTURE_BAND* WINPR_RESTRICT band)
 {
-	pixel_equal_fn_t pixel_equal_fn = get_comparison_fn(format1, format2);
-	BOOL allEqual = TRUE;
-	UINT32 tw = 0;
-	const UINT32 nrow = (nHeight + 15) / 16;
-	const UINT32 ncol = (nWidth + 15) / 16;
-	UINT32 l = ncol + 1;
-	UINT32 t = nrow + 1;
-	UINT32 r = 0;
-	UINT32 b = 0;
-	const size_t bppA = FreeRDPGetBytesPerPixel(format1);
-	const size_t bppB = FreeRDPGetBytesPerPixel(format2);
-	const RECTANGLE_16 empty = { 0 };
-	WINPR_ASSERT(rect);
+	const SHADOW_CAPTURE_COMPARE* cmp = band->compare;
+	const size_t bppA = FreeRDPGetBytesPerPixel(cmp->format1);
+	const size_t bppB = FreeRDPGetBytesPerPixel(cmp->format2);
 
-	*rect = empty;
+	band->dirty = FALSE;
 
-	for (size_t ty = 0; ty < nrow; ty++)
+	for (UINT32 ty = band->firstRow; ty < band->lastRow; ty++)
 	{
-		BOOL rowEqual = TRUE;
-		size_t th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
+		BYTE* tiles = &cmp->tiles[1ull * ty * cmp->ncol];
+		const UINT32 yStart = ty * SHADOW_CAPTURE_TILE_SIZE;
+		const UINT32 yEnd = MIN(yStart + SHADOW_CAPTURE_TILE_SIZE, cmp->nHeight);
+		UINT32 clean = cmp->ncol;
 
-		if (!th)
-			th = 16;
-
-		for (size_t tx = 0; tx < ncol; tx++)
+		for (UINT32 y = yStart; (y < yEnd) && (clean > 0); y++)
 		{
-			BOOL equal = TRUE;
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+			const BYTE* p1 = &cmp->pData1[1ull * y * cmp->nStep1];
+			const BYTE* p2 = &cmp->pData2[1ull * y * cmp->nStep2];
 
-			if (!tw)
-				tw = 16;
+			for (UINT32 tx = 0; tx < cmp->ncol; tx++)
+			{
+				const UINT32 x = tx * SHADOW_CAPTURE_TILE_SIZE;
+				const UINT32 tw = MIN(SHADOW_CAPTURE_TILE_SIZE, cmp->nWidth - x);
 
-			const BYTE* p1 = &pData1[(ty * 16 * nStep1) + (tx * 16ull * bppA)];
-			const BYTE* p2 = &pData2[(ty * 16 * nStep2) + (tx * 16ull * bppB)];
+				if (tiles[tx])
+					continue;
 
-			for (size_t k = 0; k < th; k++)
-			{
-				if (!pixel_equal_fn(p1, format1, p2, format2, tw))
+				if (!cmp->fn(&p1[x * bppA], cmp->format1, &p2[x * bppB], cmp->format2, tw))
 				{
-					equal = FALSE;
-					break;
+					tiles[tx] = 1;
+					band->dirty = TRUE;
+					clean--;
 				}
-
-				p1 += nStep1;
-				p2 += nStep2;
 			}
+		}
+	}
+}
 
-			if (!equal)
-			{
-				rowEqual = FALSE;
-				if (l > tx)
-					l = tx;
+static void CALLBACK shadow_capture_compare_work_callback(PTP_CALLBACK_INSTANCE instance,
+                                                          void* context, PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	shadow_capture_compare_band((SHADOW_CAPTURE_BAND*)context);
+}
 
-				if (r < tx)
-					r = tx;
+/* Merge the dirty tiles of each tile row into runs, the region coalesces equal bands */
+static BOOL shadow_capture_tiles_to_region(const SHADOW_CAPTURE_COMPARE* WINPR_RESTRICT cmp,
+                                           REGION16* WINPR_RESTRICT region)
+{
+	for (UINT32 ty = 0; ty < cmp->nrow; ty++)
+	{
+		const BYTE* tiles = &cmp->tiles[1ull * ty * cmp->ncol];
+		UINT32 tx = 0;
+
+		while (tx < cmp->ncol)
+		{
+			RECTANGLE_16 rect = { 0 };
+			const UINT32 first = tx;
+
+			if (!tiles[tx])
+			{
+				tx++;
+				continue;
 			}
+
+			while ((tx < cmp->ncol) && tiles[tx])
+				tx++;
+
+			rect.left = (UINT16)(first * SHADOW_CAPTURE_TILE_SIZE);
+			rect.top = (UINT16)(ty * SHADOW_CAPTURE_TILE_SIZE);
+			rect.right = (UINT16)MIN(tx * SHADOW_CAPTURE_TILE_SIZE, cmp->nWidth);
+			rect.bottom = (UINT16)MIN((ty + 1) * SHADOW_CAPTURE_TILE_SIZE, cmp->nHeight);
+
+			if (!region16_union_rect(region, region, &rect))
+				return FALSE;
 		}
+	}
 
-		if (!rowEqual)
-		{
-			allEqual = FALSE;
+	return TRUE;
+}
+
+static BOOL shadow_capture_compare_parallel(rdpShadowCapture* WINPR_RESTRICT capture,
+                                            SHADOW_CAPTURE_COMPARE* WINPR_RESTRICT cmp)
+{
+	BOOL dirty = FALSE;
+	UINT32 numBands = 1;
+	UINT32 submitted = 0;
+
+	/* Bands of a few tile rows amortize the work item overhead */
+	if (capture && capture->ThreadPool)
+		numBands = MIN(capture->MaxBands, (cmp->nrow + SHADOW_CAPTURE_BAND_ROWS - 1) /
+		                                      SHADOW_CAPTURE_BAND_ROWS);
+
+	if (numBands <= 1)
+	{
+		SHADOW_CAPTURE_BAND band = { cmp, 0, cmp->nrow, FALSE };
+		shadow_capture_compare_band(&band);
+		return band.dirty;
+	}
 
-			if (t > ty)
-				t = ty;
+	const UINT32 rowsPerBand = (cmp->nrow + numBands - 1) / numBands;
 
-			if (b < ty)
-				b = ty;
+	for (UINT32 x = 0; x < numBands; x++)
+	{
+		SHADOW_CAPTURE_BAND* band = &capture->Bands[x];
+
+		band->compare = cmp;
+		band->firstRow = MIN(x * rowsPerBand, cmp->nrow);
+		band->lastRow = MIN(band->firstRow + rowsPerBand, cmp->nrow);
+		band->dirty = FALSE;
+	}
+
+	/* The calling thread takes the last band itself */
+	for (; submitted + 1 < numBands; submitted++)
+	{
+		capture->WorkObjects[submitted] =
+		    CreateThreadpoolWork(shadow_capture_compare_work_callback, &capture->Bands[submitted],
+		                         &capture->ThreadPoolEnv);
+
+		if (!capture->WorkObjects[submitted])
+		{
+			WLog_ERR(TAG, "CreateThreadpoolWork failed.");
+			break;
 		}
+
+		SubmitThreadpoolWork(capture->WorkObjects[submitted]);
 	}
 
-	if (allEqual)
+	/* Bands that could not be submitted are compared here */
+	for (UINT32 x = submitted; x < numBands; x++)
+		shadow_capture_compare_band(&capture->Bands[x]);
+
+	for (UINT32 x = 0; x < submitted; x++)
+	{
+		WaitForThreadpoolWorkCallbacks(capture->WorkObjects[x], FALSE);
+		CloseThreadpoolWork(capture->WorkObjects[x]);
+		capture->WorkObjects[x] = NULL;
+	}
+
+	for (UINT32 x = 0; x < numBands; x++)
+		dirty |= capture->Bands[x].dirty;
+
+	return dirty;
+}
+
+int shadow_capture_compare_region(rdpShadowCapture* capture, const BYTE* WINPR_RESTRICT pData1,
+                                  UINT32 format1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
+                                  const BYTE* WINPR_RESTRICT pData2, UINT32 format2,
+                                  UINT32 nStep2, REGION16* WINPR_RESTRICT region)
+{
+	int status = -1;
+	BYTE* tiles = NULL;
+	SHADOW_CAPTURE_COMPARE cmp = { 0 };
+
+	if (!pData1 || !pData2 || !region || (nWidth > UINT16_MAX) || (nHeight > UINT16_MAX))
+		return -1;
+
+	region16_clear(region);
+
+	cmp.fn = get_comparison_fn(format1, format2);
+	cmp.pData1 = pData1;
+	cmp.format1 = format1;
+	cmp.nStep1 = nStep1;
+	cmp.pData2 = pData2;
+	cmp.format2 = format2;
+	cmp.nStep2 = nStep2;
+	cmp.nWidth = nWidth;
+	cmp.nHeight = nHeight;
+	cmp.nrow = (nHeight + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	cmp.ncol = (nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+
+	const size_t count = 1ull * cmp.nrow * cmp.ncol;
+
+	if (count == 0)
 		return 0;
 
-	WINPR_ASSERT(l * 16 <= UINT16_MAX);
-	WINPR_ASSERT(t * 16 <= UINT16_MAX);
-	WINPR_ASSERT((r + 1) * 16 <= UINT16_MAX);
-	WINPR_ASSERT((b + 1) * 16 <= UINT16_MAX);
-	rect->left = (UINT16)l * 16;
-	rect->top = (UINT16)t * 16;
-	rect->right = (UINT16)(r + 1) * 16;
-	rect->bottom = (UINT16)(b + 1) * 16;
+	if (capture)
+	{
+		EnterCriticalSection(&capture->lock);
 
-	WINPR_ASSERT(nWidth <= UINT16_MAX);
-	if (rect->right > nWidth)
-		rect->right = (UINT16)nWidth;
+		if (count > capture->TilesSize)
+		{
+			BYTE* tmp = (BYTE*)realloc(capture->Tiles, count);
 
-	WINPR_ASSERT(nHeight <= UINT16_MAX);
-	if (rect->bottom > nHeight)
-		rect->bottom = (UINT16)nHeight;
+			if (!tmp)
+				goto out;
 
-	return 1;
+			capture->Tiles = tmp;
+			capture->TilesSize = count;
+		}
+
+		cmp.tiles = capture->Tiles;
+	}
+	else
+	{
+		tiles = (BYTE*)malloc(count);
+
+		if (!tiles)
+			return -1;
+
+		cmp.tiles = tiles;
+	}
+
+	ZeroMemory(cmp.tiles, count);
+
+	if (!shadow_capture_compare_parallel(capture, &cmp))
+		status = 0;
+	else if (shadow_capture_tiles_to_region(&cmp, region))
+		status = 1;
+
+out:
+	if (capture)
+		LeaveCriticalSection(&capture->lock);
+
+	free(tiles);
+	return status;
+}
+
+int shadow_capture_compare_with_format(const BYTE* WINPR_RESTRICT pData1, UINT32 format1,
+                                       UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
+                                       const BYTE* WINPR_RESTRICT pData2, UINT32 format2,
+                                       UINT32 nStep2, RECTANGLE_16* WINPR_RESTRICT rect)
+{
+	int status = 0;
+	REGION16 region = { 0 };
+	const RECTANGLE_16 empty = { 0 };
+	WINPR_ASSERT(rect);
+
+	*rect = empty;
+	region16_init(&region);
+	status = shadow_capture_compare_region(NULL, pData1, format1, nStep1, nWidth, nHeight, pData2,
+	                                       format2, nStep2, &region);
+
+	if (status > 0)
+		*rect = *region16_extents(&region);
+
+	region16_uninit(&region);
+	return status;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
@@ -324,15 +560,38 @@ rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 	capture->server = server;
 
 	if (!InitializeCriticalSectionAndSpinCount(&(capture->lock), 4000))
+		goto fail;
+
+	if (!(freerdp_settings_get_uint32(server->settings, FreeRDP_ThreadingFlags) &
+	      THREADING_FLAGS_DISABLE_THREADS))
 	{
-		WINPR_PRAGMA_DIAG_PUSH
-		WINPR_PRAGMA_DIAG_IGNORED_MISMATCHED_DEALLOC
-		shadow_capture_free(capture);
-		WINPR_PRAGMA_DIAG_POP
-		return NULL;
+		SYSTEM_INFO sysinfo = { 0 };
+		GetNativeSystemInfo(&sysinfo);
+
+		if (sysinfo.dwNumberOfProcessors > 1)
+		{
+			capture->MaxBands = sysinfo.dwNumberOfProcessors;
+			capture->Bands =
+			    (SHADOW_CAPTURE_BAND*)calloc(capture->MaxBands, sizeof(SHADOW_CAPTURE_BAND));
+			capture->WorkObjects = (PTP_WORK*)calloc(capture->MaxBands, sizeof(PTP_WORK));
+			capture->ThreadPool = CreateThreadpool(NULL);
+
+			if (!capture->Bands || !capture->WorkObjects || !capture->ThreadPool)
+				goto fail;
+
+			InitializeThreadpoolEnvironment(&capture->ThreadPoolEnv);
+			SetThreadpoolCallbackPool(&capture->ThreadPoolEnv, capture->ThreadPool);
+		}
 	}
 
 	return capture;
+
+fail:
+	WINPR_PRAGMA_DIAG_PUSH
+	WINPR_PRAGMA_DIAG_IGNORED_MISMATCHED_DEALLOC
+	shadow_capture_free(capture);
+	WINPR_PRAGMA_DIAG_POP
+	return NULL;
 }
 
 void shadow_capture_free(rdpShadowCapture* capture)
@@ -340,6 +599,15 @@ void shadow_capture_free(rdpShadowCapture* capture)
 	if (!capture)
 		return;
 
+	if (capture->ThreadPool)
+	{
+		DestroyThreadpoolEnvironment(&capture->ThreadPoolEnv);
+		CloseThreadpool(capture->ThreadPool);
+	}
+
+	free(capture->Bands);
+	free(capture->WorkObjects);
+	free(capture->Tiles);
 	DeleteCriticalSection(&(capture->lock));
 	free(capture);
 }
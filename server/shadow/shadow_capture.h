@@ -24,6 +24,38 @@
 #include <winpr/crt.h>
 #include <winpr/winpr.h>
 #include <winpr/synch.h>
+#include <winpr/pool.h>
+
+#define SHADOW_CAPTURE_TILE_SIZE 16
+#define SHADOW_CAPTURE_BAND_ROWS 8
+
+typedef BOOL (*pShadowCapturePixelEqual)(const BYTE* WINPR_RESTRICT a, UINT32 formatA,
+                                          const BYTE* WINPR_RESTRICT b, UINT32 formatB,
+                                          size_t count);
+
+typedef struct
+{
+	pShadowCapturePixelEqual fn;
+	const BYTE* pData1;
+	UINT32 format1;
+	UINT32 nStep1;
+	const BYTE* pData2;
+	UINT32 format2;
+	UINT32 nStep2;
+	UINT32 nWidth;
+	UINT32 nHeight;
+	UINT32 nrow;
+	UINT32 ncol;
+	BYTE* tiles; /* one byte per tile, non zero if the tile changed */
+} SHADOW_CAPTURE_COMPARE;
+
+typedef struct
+{
+	const SHADOW_CAPTURE_COMPARE* compare;
+	UINT32 firstRow;
+	UINT32 lastRow;
+	BOOL dirty;
+} SHADOW_CAPTURE_BAND;
 
 struct rdp_shadow_capture
 {
@@ -33,6 +65,15 @@ struct rdp_shadow_capture
 	int height;
 
 	CRITICAL_SECTION lock;
+
+	BYTE* Tiles;
+	size_t TilesSize;
+
+	PTP_POOL ThreadPool;
+	TP_CALLBACK_ENVIRON ThreadPoolEnv;
+	UINT32 MaxBands;
+	SHADOW_CAPTURE_BAND* Bands;
+	PTP_WORK* WorkObjects;
 };
 
 #ifdef __cplusplus
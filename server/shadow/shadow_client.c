@@ -40,6 +40,7 @@ typedef struct
 {
 	BOOL gfxOpened;
 	BOOL gfxSurfaceCreated;
+	BOOL progressiveUpgrade;
 } SHADOW_GFX_STATUS;
 
 static INLINE BOOL shadow_client_rdpgfx_new_surface(rdpShadowClient* client)
@@ -296,10 +297,7 @@ static INLINE void shadow_client_mark_invalid(rdpShadowClient* client, UINT32 nu
 	/* Mark client invalid region. No rectangle means full screen */
 	if (numRects > 0)
 	{
-		for (UINT32 index = 0; index < numRects; index++)
-		{
-			region16_union_rect(&(client->invalidRegion), &(client->invalidRegion), &rects[index]);
-		}
+		region16_union_rects(&(client->invalidRegion), &(client->invalidRegion), rects, numRects);
 	}
 	else
 	{
@@ -1049,14 +1047,180 @@ static INLINE UINT32 rdpgfx_estimate_h264_avc420(RDPGFX_AVC420_BITMAP_STREAM* ha
 	       havc420->length;
 }
 
+/**
+ * Function description
+ * Move the invalid region into the coordinate space of the GFX surface
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_translate_region(REGION16* dst, const REGION16* src,
+                                           const RECTANGLE_16* subRect, const RECTANGLE_16* bounds)
+{
+	BOOL rc = FALSE;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects = region16_rects(src, &numRects);
+	const UINT16 subX = subRect ? subRect->left : 0;
+	const UINT16 subY = subRect ? subRect->top : 0;
+
+	if (numRects == 0)
+		return region16_intersect_rect(dst, dst, bounds);
+
+	RECTANGLE_16* translated = (RECTANGLE_16*)calloc(numRects, sizeof(RECTANGLE_16));
+
+	if (!translated)
+		return FALSE;
+
+	for (UINT32 index = 0; index < numRects; index++)
+	{
+		RECTANGLE_16* rect = &translated[index];
+
+		*rect = rects[index];
+		WINPR_ASSERT(rect->left >= subX);
+		WINPR_ASSERT(rect->top >= subY);
+		rect->left -= subX;
+		rect->top -= subY;
+		rect->right -= subX;
+		rect->bottom -= subY;
+	}
+
+	if (region16_union_rects(dst, dst, translated, numRects))
+		rc = region16_intersect_rect(dst, dst, bounds);
+
+	free(translated);
+	return rc;
+}
+
+#ifdef WITH_GFX_H264
+/**
+ * Function description
+ * Restrict the region rectangles of an H264 metablock to the invalid region
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_clip_metablock(RDPGFX_H264_METABLOCK* meta, const REGION16* invalidRegion)
+{
+	UINT32 numRects = 0;
+	UINT32 count = 0;
+	RECTANGLE_16* regionRects = NULL;
+	RDPGFX_H264_QUANT_QUALITY* quantQualityVals = NULL;
+	const RECTANGLE_16* rects = region16_rects(invalidRegion, &numRects);
+
+	WINPR_ASSERT(meta);
+
+	if ((meta->numRegionRects == 0) || (numRects == 0))
+		return TRUE;
+
+	regionRects = calloc(1ull * meta->numRegionRects * numRects, sizeof(RECTANGLE_16));
+	quantQualityVals =
+	    calloc(1ull * meta->numRegionRects * numRects, sizeof(RDPGFX_H264_QUANT_QUALITY));
+
+	if (!regionRects || !quantQualityVals)
+	{
+		free(regionRects);
+		free(quantQualityVals);
+		return FALSE;
+	}
+
+	for (UINT32 x = 0; x < meta->numRegionRects; x++)
+	{
+		for (UINT32 y = 0; y < numRects; y++)
+		{
+			if (!rectangles_intersection(&meta->regionRects[x], &rects[y], &regionRects[count]))
+				continue;
+
+			quantQualityVals[count++] = meta->quantQualityVals[x];
+		}
+	}
+
+	free(meta->regionRects);
+	free(meta->quantQualityVals);
+	meta->regionRects = regionRects;
+	meta->quantQualityVals = quantQualityVals;
+	meta->numRegionRects = count;
+	return TRUE;
+}
+#endif
+
+static rdpShadowEncodeCache* shadow_client_encode_cache(rdpShadowClient* client)
+{
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(client->server);
+
+	/* The lobby is not shared between clients, only the desktop surface is cached */
+	if (client->inLobby)
+		return NULL;
+
+	return client->server->encodeCache;
+}
+
+static BOOL shadow_client_encode_planar(rdpShadowClient* client, RDPGFX_SURFACE_COMMAND* cmd,
+                                        const BYTE* pSrcData, UINT32 nSrcStep, UINT32 SrcFormat)
+{
+	rdpShadowEncoder* encoder = client->encoder;
+	rdpShadowEncodeCache* cache = shadow_client_encode_cache(client);
+	const rdpSettings* settings = client->context.settings;
+	const RECTANGLE_16 rect = { (UINT16)cmd->left, (UINT16)cmd->top, (UINT16)cmd->right,
+		                        (UINT16)cmd->bottom };
+	const SHADOW_ENCODE_CACHE_KEY key = {
+		RDPGFX_CODECID_PLANAR, freerdp_settings_get_bool(settings, FreeRDP_DrawAllowSkipAlpha),
+		SrcFormat, &rect, 1
+	};
+	const BYTE* src =
+	    &pSrcData[cmd->top * nSrcStep + cmd->left * FreeRDPGetBytesPerPixel(SrcFormat)];
+
+	cmd->codecId = RDPGFX_CODECID_PLANAR;
+	cmd->data = shadow_encode_cache_lookup(cache, &key, &cmd->length);
+
+	if (cmd->data)
+		return TRUE;
+
+	if (!freerdp_bitmap_planar_context_reset(encoder->planar, cmd->width, cmd->height))
+		return FALSE;
+
+	freerdp_planar_topdown_image(encoder->planar, TRUE);
+
+	cmd->data = freerdp_bitmap_compress_planar(encoder->planar, src, SrcFormat, cmd->width,
+	                                           cmd->height, nSrcStep, NULL, &cmd->length);
+	WINPR_ASSERT(cmd->data || (cmd->length == 0));
+
+	if (cache && cmd->data)
+		(void)shadow_encode_cache_store(cache, &key, cmd->data, cmd->length);
+
+	return TRUE;
+}
+
+static BOOL shadow_client_encode_uncompressed(RDPGFX_SURFACE_COMMAND* cmd, const BYTE* pSrcData,
+                                              UINT32 nSrcStep, UINT32 SrcFormat)
+{
+	const UINT32 length = cmd->width * 4 * cmd->height;
+	BYTE* data = malloc(length);
+
+	if (!data)
+		return FALSE;
+
+	if (!freerdp_image_copy_no_overlap(data, PIXEL_FORMAT_BGRA32, 0, 0, 0, cmd->width,
+	                                   cmd->height, pSrcData, SrcFormat, nSrcStep, cmd->left,
+	                                   cmd->top, NULL, 0))
+	{
+		free(data);
+		return FALSE;
+	}
+
+	cmd->data = data;
+	cmd->length = length;
+	cmd->codecId = RDPGFX_CODECID_UNCOMPRESSED;
+	return TRUE;
+}
+
 /**
  * Function description
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE* pSrcData,
-                                           UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nXSrc,
-                                           UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight)
+static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, SHADOW_GFX_STATUS* pStatus,
+                                           const BYTE* pSrcData, UINT32 nSrcStep,
+                                           UINT32 SrcFormat, UINT16 nWidth, UINT16 nHeight,
+                                           const REGION16* invalidRegion)
 {
 	UINT32 id = 0;
 	UINT error = CHANNEL_RC_OK;
@@ -1068,7 +1232,7 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	RDPGFX_END_FRAME_PDU cmdend = { 0 };
 	SYSTEMTIME sTime = { 0 };
 
-	if (!context || !pSrcData)
+	if (!context || !pStatus || !pSrcData || !invalidRegion)
 		return FALSE;
 
 	settings = context->settings;
@@ -1090,15 +1254,17 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	cmdend.frameId = cmdstart.frameId;
 	cmd.surfaceId = client->surfaceId;
 	cmd.format = PIXEL_FORMAT_BGRX32;
-	cmd.left = nXSrc;
-	cmd.top = nYSrc;
-	cmd.right = cmd.left + nWidth;
-	cmd.bottom = cmd.top + nHeight;
+	cmd.left = 0;
+	cmd.top = 0;
+	cmd.right = nWidth;
+	cmd.bottom = nHeight;
 	cmd.width = nWidth;
 	cmd.height = nHeight;
 
 	id = freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId);
 #ifdef WITH_GFX_H264
+	UINT32 numDamageRects = 0;
+	const RECTANGLE_16* damageRects = region16_rects(invalidRegion, &numDamageRects);
 	const BOOL GfxH264 = freerdp_settings_get_bool(settings, FreeRDP_GfxH264);
 	const BOOL GfxAVC444 = freerdp_settings_get_bool(settings, FreeRDP_GfxAVC444);
 	const BOOL GfxAVC444v2 = freerdp_settings_get_bool(settings, FreeRDP_GfxAVC444v2);
@@ -1123,11 +1289,12 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		regionRect.top = (UINT16)cmd.top;
 		regionRect.right = (UINT16)cmd.right;
 		regionRect.bottom = (UINT16)cmd.bottom;
-		rc = avc444_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
-		                     version, &regionRect, &avc444.LC, &avc444.bitstream[0].data,
-		                     &avc444.bitstream[0].length, &avc444.bitstream[1].data,
-		                     &avc444.bitstream[1].length, &avc444.bitstream[0].meta,
-		                     &avc444.bitstream[1].meta);
+		rc = avc444_compress_damage(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth,
+		                            nHeight, version, &regionRect, damageRects, numDamageRects,
+		                            &avc444.LC, &avc444.bitstream[0].data,
+		                            &avc444.bitstream[0].length, &avc444.bitstream[1].data,
+		                            &avc444.bitstream[1].length, &avc444.bitstream[0].meta,
+		                            &avc444.bitstream[1].meta);
 		if (rc < 0)
 		{
 			WLog_ERR(TAG, "avc420_compress failed for avc444");
@@ -1135,6 +1302,13 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		}
 
 		/* rc > 0 means new data */
+		if ((rc > 0) && (!shadow_client_clip_metablock(&avc444.bitstream[0].meta, invalidRegion) ||
+		                 !shadow_client_clip_metablock(&avc444.bitstream[1].meta, invalidRegion)))
+		{
+			WLog_ERR(TAG, "Failed to clip the avc444 metablock to the invalid region");
+			rc = -1;
+		}
+
 		if (rc > 0)
 		{
 			avc444.cbAvc420EncodedBitstream1 = rdpgfx_estimate_h264_avc420(&avc444.bitstream[0]);
@@ -1146,6 +1320,8 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 
 		free_h264_metablock(&avc444.bitstream[0].meta);
 		free_h264_metablock(&avc444.bitstream[1].meta);
+		if (rc < 0)
+			return FALSE;
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
@@ -1172,8 +1348,9 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		regionRect.top = (UINT16)cmd.top;
 		regionRect.right = (UINT16)cmd.right;
 		regionRect.bottom = (UINT16)cmd.bottom;
-		rc = avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
-		                     &regionRect, &avc420.data, &avc420.length, &avc420.meta);
+		rc = avc420_compress_damage(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth,
+		                            nHeight, &regionRect, damageRects, numDamageRects,
+		                            &avc420.data, &avc420.length, &avc420.meta);
 		if (rc < 0)
 		{
 			WLog_ERR(TAG, "avc420_compress failed");
@@ -1181,6 +1358,13 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		}
 
 		/* rc > 0 means new data */
+		if ((rc > 0) && !shadow_client_clip_metablock(&avc420.meta, invalidRegion))
+		{
+			WLog_ERR(TAG, "Failed to clip the avc420 metablock to the invalid region");
+			free_h264_metablock(&avc420.meta);
+			return FALSE;
+		}
+
 		if (rc > 0)
 		{
 			cmd.codecId = RDPGFX_CODECID_AVC420;
@@ -1203,7 +1387,9 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	{
 		BOOL rc = 0;
 		wStream* s = NULL;
-		RFX_RECT rect;
+		UINT32 numRects = 0;
+		const RECTANGLE_16* regionRects = region16_rects(invalidRegion, &numRects);
+		RFX_RECT* rects = NULL;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
@@ -1211,19 +1397,28 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 
+		rects = (RFX_RECT*)calloc(numRects, sizeof(RFX_RECT));
 		s = Stream_New(NULL, 1024);
-		WINPR_ASSERT(s);
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		rect.x = (UINT16)cmd.left;
-		rect.y = (UINT16)cmd.top;
-		rect.width = (UINT16)cmd.right - cmd.left;
-		rect.height = (UINT16)cmd.bottom - cmd.top;
+		if (!rects || !s)
+		{
+			free(rects);
+			Stream_Free(s, TRUE);
+			return FALSE;
+		}
+
+		/* Only the tiles touched by the invalid region are encoded */
+		for (UINT32 index = 0; index < numRects; index++)
+		{
+			rects[index].x = regionRects[index].left;
+			rects[index].y = regionRects[index].top;
+			rects[index].width = regionRects[index].right - regionRects[index].left;
+			rects[index].height = regionRects[index].bottom - regionRects[index].top;
+		}
 
-		rc = rfx_compose_message(encoder->rfx, s, &rect, 1, pSrcData, nWidth, nHeight, nSrcStep);
+		rc = rfx_compose_message(encoder->rfx, s, rects, numRects, pSrcData, nWidth, nHeight,
+		                         nSrcStep);
+		free(rects);
 
 		if (!rc)
 		{
@@ -1256,8 +1451,6 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive))
 	{
 		INT32 rc = 0;
-		REGION16 region;
-		RECTANGLE_16 regionRect;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
 		{
@@ -1265,26 +1458,20 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		regionRect.left = (UINT16)cmd.left;
-		regionRect.top = (UINT16)cmd.top;
-		regionRect.right = (UINT16)cmd.right;
-		regionRect.bottom = (UINT16)cmd.bottom;
-		region16_init(&region);
-		region16_union_rect(&region, &region, &regionRect);
-		rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight, cmd.format,
-		                          nWidth, nHeight, nSrcStep, &region, &cmd.data, &cmd.length);
-		region16_uninit(&region);
+		/* Tiles are upgraded over the following frames, the bitstream depends on what this
+		 * client received before and can not be shared through the encode cache */
+		rc = progressive_compress_ex(encoder->progressive, cmd.surfaceId, pSrcData,
+		                             nSrcStep * nHeight, cmd.format, nWidth, nHeight, nSrcStep,
+		                             invalidRegion, &cmd.data, &cmd.length);
 		if (rc < 0)
 		{
-			WLog_ERR(TAG, "progressive_compress failed");
+			WLog_ERR(TAG, "progressive_compress_ex failed");
 			return FALSE;
 		}
 
-		/* rc > 0 means new data */
+		/* rc > 0 means new data, further upgrades may be pending */
+		pStatus->progressiveUpgrade = (rc > 0);
+
 		if (rc > 0)
 		{
 			cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
@@ -1299,63 +1486,50 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 	}
-	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxPlanar))
+	else
 	{
-		BOOL rc = 0;
-		const UINT32 w = cmd.right - cmd.left;
-		const UINT32 h = cmd.bottom - cmd.top;
-		const BYTE* src =
-		    &pSrcData[cmd.top * nSrcStep + cmd.left * FreeRDPGetBytesPerPixel(SrcFormat)];
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects = region16_rects(invalidRegion, &numRects);
+		const BOOL planar = freerdp_settings_get_bool(settings, FreeRDP_GfxPlanar);
+
+		if (planar && (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0))
 		{
 			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
 			return FALSE;
 		}
 
-		rc = freerdp_bitmap_planar_context_reset(encoder->planar, w, h);
-		WINPR_ASSERT(rc);
-		freerdp_planar_topdown_image(encoder->planar, TRUE);
-
-		cmd.data = freerdp_bitmap_compress_planar(encoder->planar, src, SrcFormat, w, h, nSrcStep,
-		                                          NULL, &cmd.length);
-		WINPR_ASSERT(cmd.data || (cmd.length == 0));
-
-		cmd.codecId = RDPGFX_CODECID_PLANAR;
-
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-		          &cmdend);
-		free(cmd.data);
-		if (error)
+		/* Each invalid rectangle is sent as its own command within a single frame */
+		for (UINT32 index = 0; index < numRects; index++)
 		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
-			return FALSE;
-		}
-	}
-	else
-	{
-		BOOL rc = 0;
-		const UINT32 w = cmd.right - cmd.left;
-		const UINT32 h = cmd.bottom - cmd.top;
-		const UINT32 length = w * 4 * h;
-		BYTE* data = malloc(length);
-
-		WINPR_ASSERT(data);
-
-		rc = freerdp_image_copy_no_overlap(data, PIXEL_FORMAT_BGRA32, 0, 0, 0, w, h, pSrcData,
-		                                   SrcFormat, nSrcStep, cmd.left, cmd.top, NULL, 0);
-		WINPR_ASSERT(rc);
+			const RECTANGLE_16* rect = &rects[index];
+			const RDPGFX_START_FRAME_PDU* start = (index == 0) ? &cmdstart : NULL;
+			const RDPGFX_END_FRAME_PDU* end = (index + 1 == numRects) ? &cmdend : NULL;
+
+			cmd.left = rect->left;
+			cmd.top = rect->top;
+			cmd.right = rect->right;
+			cmd.bottom = rect->bottom;
+			cmd.width = cmd.right - cmd.left;
+			cmd.height = cmd.bottom - cmd.top;
+
+			if (planar)
+			{
+				if (!shadow_client_encode_planar(client, &cmd, pSrcData, nSrcStep, SrcFormat))
+					return FALSE;
+			}
+			else if (!shadow_client_encode_uncompressed(&cmd, pSrcData, nSrcStep, SrcFormat))
+				return FALSE;
 
-		cmd.data = data;
-		cmd.length = length;
-		cmd.codecId = RDPGFX_CODECID_UNCOMPRESSED;
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, start,
+			          end);
+			free(cmd.data);
+			cmd.data = NULL;
 
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-		          &cmdend);
-		free(data);
-		if (error)
-		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
-			return FALSE;
+			if (error)
+			{
+				WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+				return FALSE;
+			}
 		}
 	}
 	return TRUE;
@@ -1512,6 +1686,17 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 	else if (set_surface_bits_supported(settings) &&
 	         freerdp_settings_get_bool(settings, FreeRDP_NSCodec) && (nsID != 0))
 	{
+		UINT32 length = 0;
+		rdpShadowEncodeCache* cache = shadow_client_encode_cache(client);
+		const RECTANGLE_16 rect = { nXSrc, nYSrc, nXSrc + nWidth, nYSrc + nHeight };
+		const UINT32 params =
+		    freerdp_settings_get_uint32(settings, FreeRDP_NSCodecColorLossLevel) |
+		    (freerdp_settings_get_bool(settings, FreeRDP_NSCodecAllowSubsampling) ? 0x100 : 0) |
+		    (freerdp_settings_get_bool(settings, FreeRDP_NSCodecAllowDynamicColorFidelity) ? 0x200
+		                                                                                    : 0);
+		const SHADOW_ENCODE_CACHE_KEY key = { nsID, params, PIXEL_FORMAT_BGRX32, &rect, 1 };
+		BYTE* cached = NULL;
+
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
 		{
 			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
@@ -1520,8 +1705,34 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 
 		s = encoder->bs;
 		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+		cached = shadow_encode_cache_lookup(cache, &key, &length);
+
+		if (cached)
+		{
+			if (!Stream_EnsureRemainingCapacity(s, length))
+			{
+				free(cached);
+				return FALSE;
+			}
+
+			Stream_Write(s, cached, length);
+			free(cached);
+		}
+		else
+		{
+			pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
+
+			if (!nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep))
+			{
+				WLog_ERR(TAG, "Failed to encode surface bits(NSCodec)");
+				return FALSE;
+			}
+
+			if (cache)
+				(void)shadow_encode_cache_store(cache, &key, Stream_Buffer(s),
+				                                (UINT32)Stream_GetPosition(s));
+		}
+
 		cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
 		cmd.bmp.bpp = 32;
 		WINPR_ASSERT(nsID <= UINT16_MAX);
@@ -1821,9 +2032,7 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 
 	EnterCriticalSection(&surface->lock);
 	rects = region16_rects(&(surface->invalidRegion), &numRects);
-
-	for (UINT32 index = 0; index < numRects; index++)
-		region16_union_rect(&invalidRegion, &invalidRegion, &rects[index]);
+	region16_union_rects(&invalidRegion, &invalidRegion, rects, numRects);
 
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
@@ -1838,7 +2047,9 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 		region16_intersect_rect(&invalidRegion, &invalidRegion, &(server->subRect));
 	}
 
-	if (region16_is_empty(&invalidRegion))
+	/* Pending progressive upgrades are sent even if nothing changed */
+	if (region16_is_empty(&invalidRegion) &&
+	    !(pStatus->gfxOpened && pStatus->progressiveUpgrade))
 	{
 		/* No image region need to be updated. Success */
 		goto out;
@@ -1877,29 +2088,49 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	{
 		if (pStatus->gfxOpened && client->areGfxCapsReady)
 		{
-			/* GFX/h264 always full screen encoded */
+			REGION16 gfxRegion;
+			RECTANGLE_16 gfxRect = { 0 };
+
+			/* The GFX surface always spans the whole desktop, only the damage is encoded */
 			nWidth = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
 			nHeight = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
 
+			WINPR_ASSERT(nWidth >= 0);
+			WINPR_ASSERT(nWidth <= UINT16_MAX);
+			WINPR_ASSERT(nHeight >= 0);
+			WINPR_ASSERT(nHeight <= UINT16_MAX);
+			gfxRect.right = (UINT16)nWidth;
+			gfxRect.bottom = (UINT16)nHeight;
+			region16_init(&gfxRegion);
+
 			/* Create primary surface if have not */
 			if (!pStatus->gfxSurfaceCreated)
 			{
 				/* Only init surface when we have h264 supported */
 				if (!(ret = shadow_client_rdpgfx_reset_graphic(client)))
-					goto out;
+					goto out_gfx;
 
 				if (!(ret = shadow_client_rdpgfx_new_surface(client)))
-					goto out;
+					goto out_gfx;
 
 				pStatus->gfxSurfaceCreated = TRUE;
+
+				/* A new surface has no content yet, refresh all of it */
+				ret = region16_union_rect(&gfxRegion, &gfxRegion, &gfxRect);
+			}
+			else
+			{
+				const RECTANGLE_16* subRect = server->shareSubRect ? &server->subRect : NULL;
+				ret = shadow_client_translate_region(&gfxRegion, &invalidRegion, subRect, &gfxRect);
 			}
 
-			WINPR_ASSERT(nWidth >= 0);
-			WINPR_ASSERT(nWidth <= UINT16_MAX);
-			WINPR_ASSERT(nHeight >= 0);
-			WINPR_ASSERT(nHeight <= UINT16_MAX);
-			ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, SrcFormat, 0, 0,
-			                                     (UINT16)nWidth, (UINT16)nHeight);
+			if (ret && (!region16_is_empty(&gfxRegion) || pStatus->progressiveUpgrade))
+				ret = shadow_client_send_surface_gfx(client, pStatus, pSrcData, nSrcStep,
+				                                     SrcFormat, (UINT16)nWidth, (UINT16)nHeight,
+				                                     &gfxRegion);
+
+		out_gfx:
+			region16_uninit(&gfxRegion);
 		}
 		else
 		{
@@ -2242,11 +2473,25 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 			events[nCount++] = gfxevent;
 #endif
 
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		/* While progressive upgrades are pending a static screen is refined at the frame rate */
+		const DWORD timeout =
+		    gfxstatus.progressiveUpgrade
+		        ? 1000 / MAX(1, shadow_encoder_preferred_fps(client->encoder))
+		        : INFINITE;
+		status = WaitForMultipleObjects(nCount, events, FALSE, timeout);
 
 		if (status == WAIT_FAILED)
 			goto fail;
 
+		if ((status == WAIT_TIMEOUT) && client->activated && !client->suppressOutput)
+		{
+			if (!shadow_client_send_surface_update(client, &gfxstatus))
+			{
+				WLog_ERR(TAG, "Failed to send progressive upgrade");
+				break;
+			}
+		}
+
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
 			/* The UpdateEvent means to start sending current frame. It is
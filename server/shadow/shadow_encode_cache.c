@@ -0,0 +1,225 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <freerdp/log.h>
+
+#include "shadow.h"
+
+#include "shadow_encode_cache.h"
+
+#define TAG SERVER_TAG("shadow.encodecache")
+
+typedef struct
+{
+	UINT32 codecId;
+	UINT32 params;
+	UINT32 format;
+	RECTANGLE_16* rects;
+	UINT32 numRects;
+	BYTE* data;
+	UINT32 length;
+} SHADOW_ENCODE_CACHE_ENTRY;
+
+struct rdp_shadow_encode_cache
+{
+	CRITICAL_SECTION lock;
+	UINT64 generation;
+	SHADOW_ENCODE_CACHE_ENTRY* entries;
+	size_t maxEntries;
+	size_t numEntries;
+	size_t next;
+	UINT64 hits;
+	UINT64 misses;
+};
+
+static void shadow_encode_cache_entry_clear(SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	WINPR_ASSERT(entry);
+
+	free(entry->rects);
+	free(entry->data);
+	ZeroMemory(entry, sizeof(SHADOW_ENCODE_CACHE_ENTRY));
+}
+
+static BOOL shadow_encode_cache_entry_match(const SHADOW_ENCODE_CACHE_ENTRY* entry,
+                                            const SHADOW_ENCODE_CACHE_KEY* key)
+{
+	WINPR_ASSERT(entry);
+	WINPR_ASSERT(key);
+
+	if ((entry->codecId != key->codecId) || (entry->params != key->params) ||
+	    (entry->format != key->format) || (entry->numRects != key->numRects))
+		return FALSE;
+
+	for (UINT32 x = 0; x < key->numRects; x++)
+	{
+		const RECTANGLE_16* a = &entry->rects[x];
+		const RECTANGLE_16* b = &key->rects[x];
+
+		if ((a->left != b->left) || (a->top != b->top) || (a->right != b->right) ||
+		    (a->bottom != b->bottom))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+void shadow_encode_cache_next_generation(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	EnterCriticalSection(&cache->lock);
+	WLog_VRB(TAG, "generation %" PRIu64 ": %" PRIuz " entries, %" PRIu64 " hits, %" PRIu64 " misses",
+	         cache->generation, cache->numEntries, cache->hits, cache->misses);
+
+	for (size_t x = 0; x < cache->numEntries; x++)
+		shadow_encode_cache_entry_clear(&cache->entries[x]);
+
+	cache->numEntries = 0;
+	cache->next = 0;
+	cache->generation++;
+	LeaveCriticalSection(&cache->lock);
+}
+
+BYTE* shadow_encode_cache_lookup(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key,
+                                 UINT32* pLength)
+{
+	BYTE* data = NULL;
+
+	if (!cache || !key || !pLength)
+		return NULL;
+
+	EnterCriticalSection(&cache->lock);
+
+	for (size_t x = 0; x < cache->numEntries; x++)
+	{
+		const SHADOW_ENCODE_CACHE_ENTRY* entry = &cache->entries[x];
+
+		if (!shadow_encode_cache_entry_match(entry, key))
+			continue;
+
+		/* The caller owns the copy, the entry may be evicted once the lock is released */
+		data = malloc(entry->length ? entry->length : 1);
+
+		if (data)
+		{
+			CopyMemory(data, entry->data, entry->length);
+			*pLength = entry->length;
+		}
+
+		break;
+	}
+
+	if (data)
+		cache->hits++;
+	else
+		cache->misses++;
+
+	LeaveCriticalSection(&cache->lock);
+	return data;
+}
+
+BOOL shadow_encode_cache_store(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key,
+                               const BYTE* data, UINT32 length)
+{
+	SHADOW_ENCODE_CACHE_ENTRY entry = { 0 };
+
+	if (!cache || !key || (!data && (length > 0)))
+		return FALSE;
+
+	entry.codecId = key->codecId;
+	entry.params = key->params;
+	entry.format = key->format;
+	entry.numRects = key->numRects;
+	entry.length = length;
+	entry.rects = (RECTANGLE_16*)calloc(key->numRects ? key->numRects : 1, sizeof(RECTANGLE_16));
+	entry.data = (BYTE*)malloc(length ? length : 1);
+
+	if (!entry.rects || !entry.data)
+	{
+		shadow_encode_cache_entry_clear(&entry);
+		return FALSE;
+	}
+
+	if (key->numRects > 0)
+		CopyMemory(entry.rects, key->rects, sizeof(RECTANGLE_16) * key->numRects);
+
+	if (length > 0)
+		CopyMemory(entry.data, data, length);
+
+	EnterCriticalSection(&cache->lock);
+
+	/* Replace the oldest entry once the cache is full */
+	SHADOW_ENCODE_CACHE_ENTRY* slot = &cache->entries[cache->next];
+	shadow_encode_cache_entry_clear(slot);
+	*slot = entry;
+	cache->next = (cache->next + 1) % cache->maxEntries;
+
+	if (cache->numEntries < cache->maxEntries)
+		cache->numEntries++;
+
+	LeaveCriticalSection(&cache->lock);
+	return TRUE;
+}
+
+rdpShadowEncodeCache* shadow_encode_cache_new(size_t maxEntries)
+{
+	rdpShadowEncodeCache* cache = NULL;
+
+	if (maxEntries == 0)
+		return NULL;
+
+	cache = (rdpShadowEncodeCache*)calloc(1, sizeof(rdpShadowEncodeCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->maxEntries = maxEntries;
+	cache->entries =
+	    (SHADOW_ENCODE_CACHE_ENTRY*)calloc(maxEntries, sizeof(SHADOW_ENCODE_CACHE_ENTRY));
+
+	if (!cache->entries)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	if (!InitializeCriticalSectionAndSpinCount(&cache->lock, 4000))
+	{
+		free(cache->entries);
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void shadow_encode_cache_free(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	for (size_t x = 0; x < cache->maxEntries; x++)
+		shadow_encode_cache_entry_clear(&cache->entries[x]);
+
+	free(cache->entries);
+	DeleteCriticalSection(&cache->lock);
+	free(cache);
+}
@@ -0,0 +1,71 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+#define FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include <freerdp/types.h>
+#include <freerdp/server/shadow.h>
+
+/*
+ * Server wide cache of encoded surface data.
+ *
+ * All clients encode the same surface content for a frame, clients that negotiated
+ * the same codec configuration reuse the bitstream encoded by the first one.
+ * Entries are only valid for the current generation, which is advanced under the
+ * surface lock whenever the surface data is written or resized.
+ *
+ * Only GFX planar and NSCodec surface bits are cached. The other codecs either
+ * produce a bitstream that depends on earlier frames of the same client (H264
+ * reference frames, RemoteFX headers and frame index, progressive upgrade passes)
+ * or gain nothing from sharing (uncompressed).
+ * Legacy bitmap updates are split into one buffer per 64x64 tile in the per client
+ * encoder grid, a frame would need hundreds of entries in this small list.
+ */
+typedef struct
+{
+	UINT32 codecId; /* codec identifier as sent on the wire */
+	UINT32 params;  /* codec specific parameters influencing the bitstream */
+	UINT32 format;  /* source pixel format */
+	const RECTANGLE_16* rects;
+	UINT32 numRects;
+} SHADOW_ENCODE_CACHE_KEY;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	void shadow_encode_cache_free(rdpShadowEncodeCache* cache);
+
+	WINPR_ATTR_MALLOC(shadow_encode_cache_free, 1)
+	rdpShadowEncodeCache* shadow_encode_cache_new(size_t maxEntries);
+
+	void shadow_encode_cache_next_generation(rdpShadowEncodeCache* cache);
+
+	BYTE* shadow_encode_cache_lookup(rdpShadowEncodeCache* cache,
+	                                 const SHADOW_ENCODE_CACHE_KEY* key, UINT32* pLength);
+	BOOL shadow_encode_cache_store(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key,
+	                               const BYTE* data, UINT32 length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_ENCODE_CACHE_H */
@@ -911,6 +911,9 @@ int shadow_server_init(rdpShadowServer* server)
 	if (!InitializeCriticalSectionAndSpinCount(&(server->lock), 4000))
 		goto fail;
 
+	if (!(server->encodeCache = shadow_encode_cache_new(64)))
+		goto fail;
+
 	status = shadow_server_init_config_path(server);
 
 	if (status < 0)
@@ -961,6 +964,8 @@ int shadow_server_uninit(rdpShadowServer* server)
 	server->PrivateKeyFile = NULL;
 	free(server->ConfigPath);
 	server->ConfigPath = NULL;
+	shadow_encode_cache_free(server->encodeCache);
+	server->encodeCache = NULL;
 	DeleteCriticalSection(&(server->lock));
 	CloseHandle(server->StopEvent);
 	server->StopEvent = NULL;
@@ -288,5 +288,22 @@ int shadow_subsystem_pointer_convert_alpha_pointer_data_to_format(
 
 void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem)
 {
+	WINPR_ASSERT(subsystem);
+
+	/* Subsystems that do not call shadow_subsystem_surface_changed still must not get data
+	 * encoded from an earlier frame */
+	if (subsystem->server)
+		shadow_encode_cache_next_generation(subsystem->server->encodeCache);
+
 	shadow_multiclient_publish_and_wait(subsystem->updateEvent);
 }
+
+void shadow_subsystem_surface_changed(rdpShadowSubsystem* subsystem)
+{
+	WINPR_ASSERT(subsystem);
+
+	/* Clients encode under the surface lock, none of them may find data encoded from the
+	 * previous content once the writer releases it */
+	if (subsystem->server)
+		shadow_encode_cache_next_generation(subsystem->server->encodeCache);
+}
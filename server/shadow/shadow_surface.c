@@ -87,18 +87,22 @@ BOOL shadow_surface_resize(rdpShadowSurface* surface, UINT16 x, UINT16 y, UINT32
 		return TRUE;
 	}
 
+	EnterCriticalSection(&(surface->lock));
 	buffer = (BYTE*)realloc(surface->data, 1ull * scanline * ALIGN_SCREEN_SIZE(height, 4ull));
 
 	if (buffer)
 	{
+		if (surface->server)
+			shadow_encode_cache_next_generation(surface->server->encodeCache);
+
 		surface->x = x;
 		surface->y = y;
 		surface->width = width;
 		surface->height = height;
 		surface->scanline = scanline;
 		surface->data = buffer;
-		return TRUE;
 	}
 
-	return FALSE;
+	LeaveCriticalSection(&(surface->lock));
+	return buffer != NULL;
 }
@@ -0,0 +1,141 @@
+#include <winpr/crt.h>
+
+#include <freerdp/settings.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/region.h>
+#include <freerdp/server/shadow.h>
+
+#include "../shadow_capture.h"
+
+static void test_fill(BYTE* data, UINT32 width, UINT32 height, BYTE alpha)
+{
+	for (UINT32 y = 0; y < height; y++)
+	{
+		for (UINT32 x = 0; x < width; x++)
+		{
+			BYTE* p = &data[4ull * (1ull * y * width + x)];
+			p[0] = (BYTE)x;
+			p[1] = (BYTE)y;
+			p[2] = (BYTE)(x ^ y);
+			p[3] = alpha;
+		}
+	}
+}
+
+static BOOL test_region(const REGION16* region, const RECTANGLE_16* expected, UINT32 count)
+{
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects = region16_rects(region, &numRects);
+
+	if (numRects != count)
+		return FALSE;
+
+	for (UINT32 x = 0; x < count; x++)
+	{
+		if ((rects[x].left != expected[x].left) || (rects[x].top != expected[x].top) ||
+		    (rects[x].right != expected[x].right) || (rects[x].bottom != expected[x].bottom))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_compare(rdpShadowCapture* capture, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	const size_t size = 4ull * width * height;
+	const UINT32 step = width * 4;
+	BYTE* a = malloc(size);
+	BYTE* b = malloc(size);
+	REGION16 region = { 0 };
+	const RECTANGLE_16 corners[] = {
+		{ 0, 0, 16, 16 },
+		{ (UINT16)((width - 1) & ~15u), (UINT16)((height - 1) & ~15u), (UINT16)width,
+		  (UINT16)height }
+	};
+	const RECTANGLE_16 center = { 32, 48, 48, 64 };
+
+	region16_init(&region);
+
+	if (!a || !b)
+		goto fail;
+
+	/* unchanged */
+	test_fill(a, width, height, 0xFF);
+	test_fill(b, width, height, 0xFF);
+
+	if ((shadow_capture_compare_region(capture, a, PIXEL_FORMAT_BGRX32, step, width, height, b,
+	                                   PIXEL_FORMAT_BGRX32, step, &region) != 0) ||
+	    !region16_is_empty(&region))
+		goto fail;
+
+	/* two changes in opposite corners are reported as two tiles */
+	b[0] ^= 1;
+	b[size - 1] ^= 1;
+
+	if ((shadow_capture_compare_region(capture, a, PIXEL_FORMAT_BGRX32, step, width, height, b,
+	                                   PIXEL_FORMAT_BGRX32, step, &region) != 1) ||
+	    !test_region(&region, corners, ARRAYSIZE(corners)))
+		goto fail;
+
+	/* the alpha byte of a format without alpha is not compared, it reads as opaque */
+	test_fill(b, width, height, 0x00);
+
+	if ((shadow_capture_compare_region(capture, a, PIXEL_FORMAT_BGRA32, step, width, height, b,
+	                                   PIXEL_FORMAT_BGRX32, step, &region) != 0) ||
+	    !region16_is_empty(&region))
+		goto fail;
+
+	/* but a translucent pixel differs from an opaque one */
+	a[4ull * (50ull * width + 40) + 3] = 0x80;
+
+	if ((shadow_capture_compare_region(capture, a, PIXEL_FORMAT_BGRA32, step, width, height, b,
+	                                   PIXEL_FORMAT_BGRX32, step, &region) != 1) ||
+	    !test_region(&region, &center, 1))
+		goto fail;
+
+	if ((shadow_capture_compare_region(capture, b, PIXEL_FORMAT_BGRX32, step, width, height, a,
+	                                   PIXEL_FORMAT_BGRA32, step, &region) != 1) ||
+	    !test_region(&region, &center, 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("%s [%" PRIu32 "x%" PRIu32 "] failed\n", __func__, width, height);
+	region16_uninit(&region);
+	free(a);
+	free(b);
+	return rc;
+}
+
+int TestShadowCapture(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpShadowServer server = { 0 };
+	rdpShadowCapture* capture = NULL;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	server.settings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
+
+	if (!server.settings)
+		goto fail;
+
+	if (!(capture = shadow_capture_new(&server)))
+		goto fail;
+
+	if (!test_compare(NULL, 200, 150))
+		goto fail;
+
+	/* large enough to be split into bands */
+	if (!test_compare(capture, 1000, 700))
+		goto fail;
+
+	rc = 0;
+fail:
+	shadow_capture_free(capture);
+	freerdp_settings_free(server.settings);
+	return rc;
+}
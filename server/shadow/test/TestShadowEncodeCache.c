@@ -0,0 +1,154 @@
+#include <winpr/crt.h>
+
+#include <freerdp/server/shadow.h>
+
+#include "../shadow_encode_cache.h"
+#include "../shadow_surface.h"
+
+static BOOL test_lookup(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key,
+                        const BYTE* expected, UINT32 expectedLength)
+{
+	UINT32 length = 0;
+	BYTE* data = shadow_encode_cache_lookup(cache, key, &length);
+	BOOL rc = FALSE;
+
+	if (!expected)
+		rc = (data == NULL);
+	else if (data)
+		rc = (length == expectedLength) && (memcmp(data, expected, length) == 0);
+
+	free(data);
+	return rc;
+}
+
+static BOOL test_hit_and_miss(void)
+{
+	BOOL rc = FALSE;
+	const BYTE data[] = { 1, 2, 3, 4, 5, 6, 7 };
+	const RECTANGLE_16 rect = { 0, 0, 64, 64 };
+	const RECTANGLE_16 other = { 0, 0, 64, 65 };
+	const SHADOW_ENCODE_CACHE_KEY key = { 1, 0, PIXEL_FORMAT_BGRX32, &rect, 1 };
+	const SHADOW_ENCODE_CACHE_KEY keyCodec = { 2, 0, PIXEL_FORMAT_BGRX32, &rect, 1 };
+	const SHADOW_ENCODE_CACHE_KEY keyParams = { 1, 1, PIXEL_FORMAT_BGRX32, &rect, 1 };
+	const SHADOW_ENCODE_CACHE_KEY keyFormat = { 1, 0, PIXEL_FORMAT_BGRA32, &rect, 1 };
+	const SHADOW_ENCODE_CACHE_KEY keyRect = { 1, 0, PIXEL_FORMAT_BGRX32, &other, 1 };
+	rdpShadowEncodeCache* cache = shadow_encode_cache_new(2);
+
+	if (!cache)
+		goto fail;
+
+	if (!test_lookup(cache, &key, NULL, 0))
+		goto fail;
+
+	if (!shadow_encode_cache_store(cache, &key, data, sizeof(data)))
+		goto fail;
+
+	if (!test_lookup(cache, &key, data, sizeof(data)))
+		goto fail;
+
+	/* every part of the key must match */
+	if (!test_lookup(cache, &keyCodec, NULL, 0) || !test_lookup(cache, &keyParams, NULL, 0) ||
+	    !test_lookup(cache, &keyFormat, NULL, 0) || !test_lookup(cache, &keyRect, NULL, 0))
+		goto fail;
+
+	/* the oldest entry is replaced once the cache is full */
+	if (!shadow_encode_cache_store(cache, &keyCodec, data, 1) ||
+	    !shadow_encode_cache_store(cache, &keyParams, data, 2))
+		goto fail;
+
+	if (!test_lookup(cache, &key, NULL, 0) || !test_lookup(cache, &keyCodec, data, 1) ||
+	    !test_lookup(cache, &keyParams, data, 2))
+		goto fail;
+
+	shadow_encode_cache_next_generation(cache);
+
+	if (!test_lookup(cache, &keyCodec, NULL, 0) || !test_lookup(cache, &keyParams, NULL, 0))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("%s failed\n", __func__);
+	shadow_encode_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_invalidation(void)
+{
+	BOOL rc = FALSE;
+	const BYTE data[] = { 1, 2, 3, 4 };
+	const RECTANGLE_16 rect = { 0, 0, 16, 16 };
+	const SHADOW_ENCODE_CACHE_KEY key = { 1, 0, PIXEL_FORMAT_BGRX32, &rect, 1 };
+	rdpShadowServer server = { 0 };
+	rdpShadowSubsystem subsystem = { 0 };
+	rdpShadowSurface* surface = NULL;
+
+	subsystem.server = &server;
+	server.encodeCache = shadow_encode_cache_new(8);
+	surface = shadow_surface_new(&server, 0, 0, 64, 64);
+
+	if (!server.encodeCache || !surface)
+		goto fail;
+
+	/* a subsystem writing new content drops everything encoded from the old one */
+	if (!shadow_encode_cache_store(server.encodeCache, &key, data, sizeof(data)))
+		goto fail;
+
+	EnterCriticalSection(&surface->lock);
+	shadow_subsystem_surface_changed(&subsystem);
+	LeaveCriticalSection(&surface->lock);
+
+	if (!test_lookup(server.encodeCache, &key, NULL, 0))
+		goto fail;
+
+	/* entries encoded from the new content are served again */
+	if (!shadow_encode_cache_store(server.encodeCache, &key, data, sizeof(data)))
+		goto fail;
+
+	if (!test_lookup(server.encodeCache, &key, data, sizeof(data)))
+		goto fail;
+
+	/* so does publishing a frame, for subsystems that do not report their writes */
+	shadow_subsystem_frame_update(&subsystem);
+
+	if (!test_lookup(server.encodeCache, &key, NULL, 0))
+		goto fail;
+
+	if (!shadow_encode_cache_store(server.encodeCache, &key, data, sizeof(data)))
+		goto fail;
+
+	/* moving the surface keeps the data, resizing it does not */
+	if (!shadow_surface_resize(surface, 16, 16, 64, 64))
+		goto fail;
+
+	if (!test_lookup(server.encodeCache, &key, data, sizeof(data)))
+		goto fail;
+
+	if (!shadow_surface_resize(surface, 0, 0, 128, 64))
+		goto fail;
+
+	if (!test_lookup(server.encodeCache, &key, NULL, 0))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("%s failed\n", __func__);
+	shadow_surface_free(surface);
+	shadow_encode_cache_free(server.encodeCache);
+	return rc;
+}
+
+int TestShadowEncodeCache(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_hit_and_miss())
+		return -1;
+
+	if (!test_invalidation())
+		return -1;
+
+	return 0;
+}
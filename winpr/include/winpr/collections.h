@@ -658,9 +658,13 @@ extern "C"
 	WINPR_API SSIZE_T BufferPool_GetBufferSize(wBufferPool* pool, const void* buffer);
 
 	WINPR_API void* BufferPool_Take(wBufferPool* pool, SSIZE_T bufferSize);
+
+	/* buffer must have been taken from pool, variable size pools read the header in front of it */
 	WINPR_API BOOL BufferPool_Return(wBufferPool* pool, void* buffer);
 	WINPR_API void BufferPool_Clear(wBufferPool* pool);
 
+	WINPR_API BOOL BufferPool_QueryStatistics(wBufferPool* pool, wPoolStatistics* stats);
+
 	WINPR_API void BufferPool_Free(wBufferPool* pool);
 
 	WINPR_ATTR_MALLOC(BufferPool_Free, 1)
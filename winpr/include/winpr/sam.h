@@ -36,6 +36,16 @@ struct winpr_sam_entry
 };
 typedef struct winpr_sam_entry WINPR_SAM_ENTRY;
 
+/* Lookup function of an optional SAM backend, the returned entry is released with SamFreeEntry */
+typedef WINPR_SAM_ENTRY* (*psSamLookupUserA)(void* context, LPCSTR User, UINT32 UserLength,
+                                             LPCSTR Domain, UINT32 DomainLength);
+
+typedef struct
+{
+	psSamLookupUserA LookupUserA;
+	void* context;
+} WINPR_SAM_BACKEND;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -52,6 +62,15 @@ extern "C"
 	WINPR_API WINPR_SAM* SamOpen(const char* filename, BOOL readOnly);
 	WINPR_API void SamClose(WINPR_SAM* sam);
 
+	/**
+	 * @brief Replaces the SAM file for all lookups of the process
+	 *
+	 * @param backend The backend to use or \b NULL to restore the SAM file lookup
+	 *
+	 * @return \b TRUE for success, \b FALSE otherwise
+	 */
+	WINPR_API BOOL SamSetBackend(const WINPR_SAM_BACKEND* backend);
+
 #ifdef __cplusplus
 }
 #endif
@@ -817,6 +817,23 @@ extern "C"
 
 	/* StreamPool */
 
+	/** \brief Usage counters of a StreamPool or BufferPool
+	 *
+	 *  \var available Items cached in the pool and ready to be taken
+	 *  \var used Items currently handed out
+	 *  \var allocated Items allocated by the pool and not yet freed
+	 *  \var hits Takes served from the cache
+	 *  \var misses Takes that had to allocate
+	 */
+	typedef struct
+	{
+		size_t available;
+		size_t used;
+		size_t allocated;
+		UINT64 hits;
+		UINT64 misses;
+	} wPoolStatistics;
+
 	WINPR_API void StreamPool_Return(wStreamPool* pool, wStream* s);
 
 	WINPR_API wStream* StreamPool_Take(wStreamPool* pool, size_t size);
@@ -835,6 +852,8 @@ extern "C"
 
 	WINPR_API char* StreamPool_GetStatistics(wStreamPool* pool, char* buffer, size_t size);
 
+	WINPR_API BOOL StreamPool_QueryStatistics(wStreamPool* pool, wPoolStatistics* stats);
+
 #ifdef __cplusplus
 }
 #endif
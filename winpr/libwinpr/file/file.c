@@ -45,6 +45,7 @@
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #ifdef ANDROID
 #include <sys/vfs.h>
@@ -199,6 +200,88 @@ static BOOL FileSetFilePointerEx(HANDLE hFile, LARGE_INTEGER liDistanceToMove,
 	return TRUE;
 }
 
+static off_t FileOverlappedOffset(const OVERLAPPED* lpOverlapped)
+{
+	WINPR_ASSERT(lpOverlapped);
+	return (off_t)((((UINT64)lpOverlapped->OffsetHigh) << 32) | lpOverlapped->Offset);
+}
+
+/*
+ * Positional I/O as done by ReadFile/WriteFile with an OVERLAPPED structure on a
+ * synchronous handle. The operation completes before returning and does not use or move
+ * the file pointer, so several threads may do positional I/O on the same handle.
+ */
+static BOOL FileReadAt(WINPR_FILE* file, LPVOID lpBuffer, DWORD nNumberOfBytesToRead,
+                       LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+{
+	ssize_t io_status = 0;
+
+	/* Write back data buffered by the stream so the descriptor sees it */
+	if (fflush(file->fp) != 0)
+	{
+		SetLastError(map_posix_err(errno));
+		return FALSE;
+	}
+
+	do
+	{
+		io_status = pread(fileno(file->fp), lpBuffer, nNumberOfBytesToRead,
+		                  FileOverlappedOffset(lpOverlapped));
+	} while ((io_status < 0) && (errno == EINTR));
+
+	if (io_status < 0)
+	{
+		SetLastError(map_posix_err(errno));
+		return FALSE;
+	}
+
+	lpOverlapped->Internal = 0;
+	lpOverlapped->InternalHigh = (ULONG_PTR)io_status;
+
+	if (lpNumberOfBytesRead)
+		*lpNumberOfBytesRead = (DWORD)io_status;
+
+	if ((io_status == 0) && (nNumberOfBytesToRead > 0))
+	{
+		SetLastError(ERROR_HANDLE_EOF);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL FileWriteAt(WINPR_FILE* file, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite,
+                        LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped)
+{
+	ssize_t io_status = 0;
+
+	if (fflush(file->fp) != 0)
+	{
+		SetLastError(map_posix_err(errno));
+		return FALSE;
+	}
+
+	do
+	{
+		io_status = pwrite(fileno(file->fp), lpBuffer, nNumberOfBytesToWrite,
+		                   FileOverlappedOffset(lpOverlapped));
+	} while ((io_status < 0) && (errno == EINTR));
+
+	if (io_status < 0)
+	{
+		SetLastError(map_posix_err(errno));
+		return FALSE;
+	}
+
+	lpOverlapped->Internal = 0;
+	lpOverlapped->InternalHigh = (ULONG_PTR)io_status;
+
+	if (lpNumberOfBytesWritten)
+		*lpNumberOfBytesWritten = (DWORD)io_status;
+
+	return TRUE;
+}
+
 static BOOL FileRead(PVOID Object, LPVOID lpBuffer, DWORD nNumberOfBytesToRead,
                      LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
 {
@@ -206,16 +289,13 @@ static BOOL FileRead(PVOID Object, LPVOID lpBuffer, DWORD nNumberOfBytesToRead,
 	WINPR_FILE* file = NULL;
 	BOOL status = TRUE;
 
-	if (lpOverlapped)
-	{
-		WLog_ERR(TAG, "WinPR does not support the lpOverlapped parameter");
-		SetLastError(ERROR_NOT_SUPPORTED);
-		return FALSE;
-	}
-
 	if (!Object)
 		return FALSE;
 
+	if (lpOverlapped)
+		return FileReadAt((WINPR_FILE*)Object, lpBuffer, nNumberOfBytesToRead,
+		                  lpNumberOfBytesRead, lpOverlapped);
+
 	file = (WINPR_FILE*)Object;
 	clearerr(file->fp);
 	io_status = fread(lpBuffer, 1, nNumberOfBytesToRead, file->fp);
@@ -246,16 +326,13 @@ static BOOL FileWrite(PVOID Object, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrit
 	size_t io_status = 0;
 	WINPR_FILE* file = NULL;
 
-	if (lpOverlapped)
-	{
-		WLog_ERR(TAG, "WinPR does not support the lpOverlapped parameter");
-		SetLastError(ERROR_NOT_SUPPORTED);
-		return FALSE;
-	}
-
 	if (!Object)
 		return FALSE;
 
+	if (lpOverlapped)
+		return FileWriteAt((WINPR_FILE*)Object, lpBuffer, nNumberOfBytesToWrite,
+		                   lpNumberOfBytesWritten, lpOverlapped);
+
 	file = (WINPR_FILE*)Object;
 
 	clearerr(file->fp);
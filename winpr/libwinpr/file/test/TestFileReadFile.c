@@ -2,9 +2,97 @@
 #include <stdio.h>
 #include <winpr/crt.h>
 #include <winpr/file.h>
+#include <winpr/path.h>
 #include <winpr/windows.h>
+#include <winpr/sysinfo.h>
+
+static BOOL test_read_at(HANDLE handle, UINT64 offset, const char* expect, DWORD length)
+{
+	char buffer[64] = { 0 };
+	DWORD read = 0;
+	OVERLAPPED overlapped = { 0 };
+
+	overlapped.Offset = offset & 0xFFFFFFFF;
+	overlapped.OffsetHigh = offset >> 32;
+
+	if (!ReadFile(handle, buffer, length, &read, &overlapped))
+		return FALSE;
+
+	return (read == length) && (memcmp(buffer, expect, length) == 0);
+}
 
 int TestFileReadFile(int argc, char* argv[])
 {
-	return 0;
+	HANDLE handle = NULL;
+	DWORD written = 0;
+	DWORD read = 0;
+	char cmp[8] = { 0 };
+	const char buffer[] = "0123456789";
+	OVERLAPPED overlapped = { 0 };
+	char sname[8192];
+	LPSTR name = NULL;
+	int rc = 0;
+	SYSTEMTIME systemTime;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+	GetSystemTime(&systemTime);
+	sprintf_s(sname, sizeof(sname),
+	          "ReadFile-%04" PRIu16 "%02" PRIu16 "%02" PRIu16 "%02" PRIu16 "%02" PRIu16
+	          "%02" PRIu16 "%04" PRIu16,
+	          systemTime.wYear, systemTime.wMonth, systemTime.wDay, systemTime.wHour,
+	          systemTime.wMinute, systemTime.wSecond, systemTime.wMilliseconds);
+	name = GetKnownSubPath(KNOWN_PATH_TEMP, sname);
+
+	if (!name)
+		return -1;
+
+	handle = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_NEW,
+	                     FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (!handle || (handle == INVALID_HANDLE_VALUE))
+	{
+		free(name);
+		return -1;
+	}
+
+	if (!WriteFile(handle, buffer, sizeof(buffer) - 1, &written, NULL))
+		rc = -1;
+
+	/* Positional reads do not depend on the file pointer */
+	if (!test_read_at(handle, 5, "56789", 5))
+		rc = -1;
+
+	if (!test_read_at(handle, 2, "234", 3))
+		rc = -1;
+
+	/* Positional writes go through data buffered by earlier sequential writes */
+	overlapped.Offset = 4;
+
+	if (!WriteFile(handle, "ab", 2, &written, &overlapped) || (written != 2))
+		rc = -1;
+
+	if (!test_read_at(handle, 3, "3ab6", 4))
+		rc = -1;
+
+	/* Reading at the end of the file fails with ERROR_HANDLE_EOF */
+	overlapped.Offset = sizeof(buffer) - 1;
+
+	if (ReadFile(handle, cmp, sizeof(cmp), &read, &overlapped) ||
+	    (GetLastError() != ERROR_HANDLE_EOF) || (read != 0))
+		rc = -1;
+
+	/* A short read returns what is left */
+	overlapped.Offset = 7;
+
+	if (!ReadFile(handle, cmp, sizeof(cmp), &read, &overlapped) || (read != 3))
+		rc = -1;
+
+	if (!CloseHandle(handle))
+		rc = -1;
+
+	if (!winpr_DeleteFile(name))
+		rc = -1;
+
+	free(name);
+	return rc;
 }
@@ -19,7 +19,9 @@
 
 #include <winpr/config.h>
 
+#include <winpr/assert.h>
 #include <winpr/crt.h>
+#include <winpr/interlocked.h>
 #include <winpr/sysinfo.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
@@ -53,45 +55,269 @@ static TP_POOL DEFAULT_POOL = {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
 	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
 	NULL, /* HANDLE TerminateEvent */
-	NULL, /* wCountdownEvent* WorkComplete */
+	0,    /* LONG Terminate */
+	NULL, /* TP_WORK_QUEUE* Queues */
+	0,    /* DWORD QueueCount */
+	0,    /* LONG NextQueue */
+	0,    /* LONG NextWorker */
+	0,    /* LONG Pending */
+	0,    /* LONG IdleCount */
+	{ 0 }, /* CRITICAL_SECTION IdleLock */
+	FALSE, /* BOOL IdleLockInitialized */
+	NULL, /* TP_WORKER* IdleWorkers */
 };
 
-static DWORD WINAPI thread_pool_work_func(LPVOID arg)
+static BOOL thread_pool_queue_push(TP_WORK_QUEUE* queue, PTP_WORK work)
 {
-	DWORD status = 0;
-	PTP_POOL pool = NULL;
-	PTP_WORK work = NULL;
-	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance = NULL;
+	BOOL rc = FALSE;
 
-	pool = (PTP_POOL)arg;
+	EnterCriticalSection(&queue->Lock);
 
-	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	if (queue->Count == queue->Capacity)
+	{
+		const size_t capacity = queue->Capacity ? queue->Capacity * 2 : 32;
+		TP_CALLBACK_INSTANCE* items =
+		    (TP_CALLBACK_INSTANCE*)calloc(capacity, sizeof(TP_CALLBACK_INSTANCE));
+
+		if (!items)
+			goto fail;
+
+		for (size_t x = 0; x < queue->Count; x++)
+			items[x] = queue->Items[(queue->Head + x) % queue->Capacity];
+
+		free(queue->Items);
+		queue->Items = items;
+		queue->Capacity = capacity;
+		queue->Head = 0;
+	}
+
+	queue->Items[(queue->Head + queue->Count) % queue->Capacity].Work = work;
+	queue->Count++;
+	rc = TRUE;
+fail:
+	LeaveCriticalSection(&queue->Lock);
+	return rc;
+}
+
+static BOOL thread_pool_queue_pop(TP_WORK_QUEUE* queue, BOOL steal,
+                                  TP_CALLBACK_INSTANCE* instance)
+{
+	BOOL rc = FALSE;
 
-	while (1)
+	EnterCriticalSection(&queue->Lock);
+
+	if (queue->Count > 0)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		queue->Count--;
 
-		if (status == WAIT_OBJECT_0)
-			break;
+		if (steal)
+		{
+			*instance = queue->Items[queue->Head];
+			queue->Head = (queue->Head + 1) % queue->Capacity;
+		}
+		else
+			*instance = queue->Items[(queue->Head + queue->Count) % queue->Capacity];
 
-		if (status != (WAIT_OBJECT_0 + 1))
-			break;
+		rc = TRUE;
+	}
+
+	LeaveCriticalSection(&queue->Lock);
+	return rc;
+}
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE)Queue_Dequeue(pool->PendingQueue);
+/* Removes the queued callbacks of work, returns how many were removed */
+static size_t thread_pool_queue_cancel(TP_WORK_QUEUE* queue, PTP_WORK work)
+{
+	size_t removed = 0;
+
+	EnterCriticalSection(&queue->Lock);
 
-		if (callbackInstance)
+	for (size_t x = 0; x < queue->Count; x++)
+	{
+		const TP_CALLBACK_INSTANCE item = queue->Items[(queue->Head + x) % queue->Capacity];
+
+		if (item.Work == work)
+			removed++;
+		else if (removed > 0)
+			queue->Items[(queue->Head + x - removed) % queue->Capacity] = item;
+	}
+
+	queue->Count -= removed;
+	LeaveCriticalSection(&queue->Lock);
+	return removed;
+}
+
+static BOOL thread_pool_take(PTP_POOL pool, DWORD home, TP_CALLBACK_INSTANCE* instance)
+{
+	if (InterlockedCompareExchange(&pool->Pending, 0, 0) <= 0)
+		return FALSE;
+
+	for (DWORD x = 0; x < pool->QueueCount; x++)
+	{
+		TP_WORK_QUEUE* queue = &pool->Queues[(home + x) % pool->QueueCount];
+
+		if (thread_pool_queue_pop(queue, x != 0, instance))
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			InterlockedDecrement(&pool->Pending);
+			return TRUE;
 		}
 	}
 
+	return FALSE;
+}
+
+/* Publish the worker as idle, fails if work was queued in the meantime */
+static BOOL thread_pool_park(TP_WORKER* worker)
+{
+	PTP_POOL pool = worker->Pool;
+	BOOL park = TRUE;
+
+	EnterCriticalSection(&pool->IdleLock);
+	worker->NextIdle = pool->IdleWorkers;
+	worker->Idle = TRUE;
+	pool->IdleWorkers = worker;
+	InterlockedIncrement(&pool->IdleCount);
+
+	if ((InterlockedCompareExchange(&pool->Pending, 0, 0) > 0) ||
+	    InterlockedCompareExchange(&pool->Terminate, 0, 0))
+	{
+		pool->IdleWorkers = worker->NextIdle;
+		worker->NextIdle = NULL;
+		worker->Idle = FALSE;
+		InterlockedDecrement(&pool->IdleCount);
+		park = FALSE;
+	}
+
+	LeaveCriticalSection(&pool->IdleLock);
+	return park;
+}
+
+static void thread_pool_unpark(TP_WORKER* worker)
+{
+	PTP_POOL pool = worker->Pool;
+
+	EnterCriticalSection(&pool->IdleLock);
+
+	if (worker->Idle)
+	{
+		TP_WORKER** cur = &pool->IdleWorkers;
+
+		while (*cur && (*cur != worker))
+			cur = &(*cur)->NextIdle;
+
+		if (*cur)
+			*cur = worker->NextIdle;
+
+		worker->NextIdle = NULL;
+		worker->Idle = FALSE;
+		InterlockedDecrement(&pool->IdleCount);
+	}
+
+	LeaveCriticalSection(&pool->IdleLock);
+}
+
+static void thread_pool_wake(PTP_POOL pool)
+{
+	if (InterlockedCompareExchange(&pool->IdleCount, 0, 0) <= 0)
+		return;
+
+	EnterCriticalSection(&pool->IdleLock);
+
+	TP_WORKER* worker = pool->IdleWorkers;
+
+	if (worker)
+	{
+		pool->IdleWorkers = worker->NextIdle;
+		worker->NextIdle = NULL;
+		worker->Idle = FALSE;
+		InterlockedDecrement(&pool->IdleCount);
+		SetEvent(worker->Event);
+	}
+
+	LeaveCriticalSection(&pool->IdleLock);
+}
+
+static void thread_pool_work_done(PTP_WORK work)
+{
+	/* The waiter synchronizes on the lock, work must not be touched after it is released */
+	EnterCriticalSection(&work->Lock);
+	WINPR_ASSERT(work->Pending > 0);
+	work->Pending--;
+
+	if ((work->Pending == 0) && work->Done)
+		SetEvent(work->Done);
+
+	LeaveCriticalSection(&work->Lock);
+}
+
+void ThreadpoolCancelWork(PTP_POOL pool, PTP_WORK work)
+{
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(work);
+
+	for (DWORD x = 0; x < pool->QueueCount; x++)
+	{
+		const size_t removed = thread_pool_queue_cancel(&pool->Queues[x], work);
+
+		for (size_t y = 0; y < removed; y++)
+		{
+			InterlockedDecrement(&pool->Pending);
+			thread_pool_work_done(work);
+		}
+	}
+}
+
+BOOL ThreadpoolEnqueueWork(PTP_POOL pool, PTP_WORK work)
+{
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(pool->QueueCount > 0);
+
+	const DWORD index = (DWORD)InterlockedIncrement(&pool->NextQueue) % pool->QueueCount;
+
+	if (!thread_pool_queue_push(&pool->Queues[index], work))
+		return FALSE;
+
+	/* Pairs with thread_pool_park: either the worker sees the work or we see the worker */
+	InterlockedIncrement(&pool->Pending);
+	thread_pool_wake(pool);
+	return TRUE;
+}
+
+static DWORD WINAPI thread_pool_work_func(LPVOID arg)
+{
+	TP_WORKER* worker = (TP_WORKER*)arg;
+	PTP_POOL pool = worker->Pool;
+	HANDLE events[2];
+
+	events[0] = pool->TerminateEvent;
+	events[1] = worker->Event;
+
+	while (!InterlockedCompareExchange(&pool->Terminate, 0, 0))
+	{
+		TP_CALLBACK_INSTANCE callbackInstance = { 0 };
+
+		if (thread_pool_take(pool, worker->Home, &callbackInstance))
+		{
+			PTP_WORK work = callbackInstance.Work;
+			work->WorkCallback(&callbackInstance, work->CallbackParameter, work);
+			thread_pool_work_done(work);
+			continue;
+		}
+
+		if (!thread_pool_park(worker))
+			continue;
+
+		if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != (WAIT_OBJECT_0 + 1))
+			break;
+
+		/* The waker removed us from the idle list, nobody sets the event before we park again */
+		ResetEvent(worker->Event);
+	}
+
+	thread_pool_unpark(worker);
+	CloseHandle(worker->Event);
+	free(worker);
 	ExitThread(0);
 	return 0;
 }
@@ -110,25 +336,39 @@ static BOOL InitializeThreadpool(PTP_POOL pool)
 	if (pool->Threads)
 		return TRUE;
 
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
+	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
 		goto fail;
 
-	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail;
+	if (!pool->IdleLockInitialized)
+	{
+		if (!InitializeCriticalSectionAndSpinCount(&pool->IdleLock, 4000))
+			goto fail;
 
-	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		pool->IdleLockInitialized = TRUE;
+	}
+
+	SYSTEM_INFO info = { 0 };
+	GetSystemInfo(&info);
+	if (info.dwNumberOfProcessors < 1)
+		info.dwNumberOfProcessors = 1;
+
+	if (!(pool->Queues = (TP_WORK_QUEUE*)calloc(info.dwNumberOfProcessors, sizeof(TP_WORK_QUEUE))))
 		goto fail;
 
+	for (; pool->QueueCount < info.dwNumberOfProcessors; pool->QueueCount++)
+	{
+		TP_WORK_QUEUE* queue = &pool->Queues[pool->QueueCount];
+
+		if (!InitializeCriticalSectionAndSpinCount(&queue->Lock, 4000))
+			goto fail;
+	}
+
 	if (!(pool->Threads = ArrayList_New(TRUE)))
 		goto fail;
 
 	obj = ArrayList_Object(pool->Threads);
 	obj->fnObjectFree = threads_close;
 
-	SYSTEM_INFO info = { 0 };
-	GetSystemInfo(&info);
-	if (info.dwNumberOfProcessors < 1)
-		info.dwNumberOfProcessors = 1;
 	if (!SetThreadpoolThreadMinimum(pool, info.dwNumberOfProcessors))
 		goto fail;
 	SetThreadpoolThreadMaximum(pool, info.dwNumberOfProcessors);
@@ -183,12 +423,31 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
+	InterlockedExchange(&ptpp->Terminate, TRUE);
+	if (ptpp->TerminateEvent)
+		SetEvent(ptpp->TerminateEvent);
 
 	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
-	CountdownEvent_Free(ptpp->WorkComplete);
-	CloseHandle(ptpp->TerminateEvent);
+
+	/* The workers are gone, callbacks still queued will never run. Complete them so waiting for
+	 * or closing their work objects does not block. */
+	for (DWORD x = 0; x < ptpp->QueueCount; x++)
+	{
+		TP_WORK_QUEUE* queue = &ptpp->Queues[x];
+
+		for (size_t y = 0; y < queue->Count; y++)
+			thread_pool_work_done(queue->Items[(queue->Head + y) % queue->Capacity].Work);
+
+		DeleteCriticalSection(&queue->Lock);
+		free(queue->Items);
+	}
+	free(ptpp->Queues);
+
+	if (ptpp->IdleLockInitialized)
+		DeleteCriticalSection(&ptpp->IdleLock);
+
+	if (ptpp->TerminateEvent)
+		CloseHandle(ptpp->TerminateEvent);
 
 	{
 		TP_POOL empty = { 0 };
@@ -212,9 +471,26 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 	ArrayList_Lock(ptpp->Threads);
 	while (ArrayList_Count(ptpp->Threads) < ptpp->Minimum)
 	{
-		HANDLE thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)ptpp, 0, NULL);
+		TP_WORKER* worker = (TP_WORKER*)calloc(1, sizeof(TP_WORKER));
+		if (!worker)
+			goto fail;
+
+		worker->Pool = ptpp;
+		worker->Home = (DWORD)InterlockedIncrement(&ptpp->NextWorker) % ptpp->QueueCount;
+		worker->Event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!worker->Event)
+		{
+			free(worker);
+			goto fail;
+		}
+
+		HANDLE thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)worker, 0, NULL);
 		if (!thread)
+		{
+			CloseHandle(worker->Event);
+			free(worker);
 			goto fail;
+		}
 
 		if (!ArrayList_Append(ptpp->Threads, thread))
 		{
@@ -245,9 +521,11 @@ VOID winpr_SetThreadpoolThreadMaximum(PTP_POOL ptpp, DWORD cthrdMost)
 	ArrayList_Lock(ptpp->Threads);
 	if (ArrayList_Count(ptpp->Threads) > ptpp->Maximum)
 	{
+		InterlockedExchange(&ptpp->Terminate, TRUE);
 		SetEvent(ptpp->TerminateEvent);
 		ArrayList_Clear(ptpp->Threads);
 		ResetEvent(ptpp->TerminateEvent);
+		InterlockedExchange(&ptpp->Terminate, FALSE);
 	}
 	ArrayList_Unlock(ptpp->Threads);
 	winpr_SetThreadpoolThreadMinimum(ptpp, ptpp->Minimum);
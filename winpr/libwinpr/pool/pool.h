@@ -33,14 +33,43 @@ struct S_TP_CALLBACK_INSTANCE
 	PTP_WORK Work;
 };
 
+typedef struct S_TP_WORKER TP_WORKER;
+
+/* Per worker deque, the owner pops from the tail, idle workers steal from the head */
+typedef struct
+{
+	CRITICAL_SECTION Lock;
+	TP_CALLBACK_INSTANCE* Items;
+	size_t Capacity;
+	size_t Head;
+	size_t Count;
+} TP_WORK_QUEUE;
+
+struct S_TP_WORKER
+{
+	PTP_POOL Pool;
+	HANDLE Event;
+	DWORD Home;
+	BOOL Idle;
+	TP_WORKER* NextIdle;
+};
+
 struct S_TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
 	wArrayList* Threads;
-	wQueue* PendingQueue;
 	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	LONG Terminate;
+	TP_WORK_QUEUE* Queues;
+	DWORD QueueCount;
+	LONG NextQueue;
+	LONG NextWorker;
+	LONG Pending;
+	LONG IdleCount;
+	CRITICAL_SECTION IdleLock;
+	BOOL IdleLockInitialized;
+	TP_WORKER* IdleWorkers;
 };
 
 struct S_TP_WORK
@@ -48,6 +77,9 @@ struct S_TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	CRITICAL_SECTION Lock;
+	ULONG Pending;
+	HANDLE Done;
 };
 
 struct S_TP_TIMER
@@ -77,14 +109,43 @@ struct S_TP_CALLBACK_INSTANCE
 	PTP_WORK Work;
 };
 
+typedef struct S_TP_WORKER TP_WORKER;
+
+/* Per worker deque, the owner pops from the tail, idle workers steal from the head */
+typedef struct
+{
+	CRITICAL_SECTION Lock;
+	TP_CALLBACK_INSTANCE* Items;
+	size_t Capacity;
+	size_t Head;
+	size_t Count;
+} TP_WORK_QUEUE;
+
+struct S_TP_WORKER
+{
+	PTP_POOL Pool;
+	HANDLE Event;
+	DWORD Home;
+	BOOL Idle;
+	TP_WORKER* NextIdle;
+};
+
 struct S_TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
 	wArrayList* Threads;
-	wQueue* PendingQueue;
 	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	LONG Terminate;
+	TP_WORK_QUEUE* Queues;
+	DWORD QueueCount;
+	LONG NextQueue;
+	LONG NextWorker;
+	LONG Pending;
+	LONG IdleCount;
+	CRITICAL_SECTION IdleLock;
+	BOOL IdleLockInitialized;
+	TP_WORKER* IdleWorkers;
 };
 
 struct S_TP_WORK
@@ -92,6 +153,9 @@ struct S_TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	CRITICAL_SECTION Lock;
+	ULONG Pending;
+	HANDLE Done;
 };
 
 struct S_TP_TIMER
@@ -118,5 +182,7 @@ struct S_TP_CLEANUP_GROUP
 #endif
 
 PTP_POOL GetDefaultThreadpool(void);
+BOOL ThreadpoolEnqueueWork(PTP_POOL pool, PTP_WORK work);
+void ThreadpoolCancelWork(PTP_POOL pool, PTP_WORK work);
 
 #endif /* WINPR_POOL_PRIVATE_H */
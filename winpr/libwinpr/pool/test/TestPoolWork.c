@@ -3,8 +3,10 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
 
 static LONG count = 0;
+static LONG tiles = 0;
 
 static void CALLBACK test_WorkCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
 {
@@ -120,6 +122,247 @@ fail:
 	return rc;
 }
 
+static void CALLBACK test_TileCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	BYTE* tile = (BYTE*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	/* Roughly the memory traffic of decoding one 64x64 tile */
+	for (int pass = 0; pass < 4; pass++)
+	{
+		for (size_t x = 0; x < 64 * 64 * 4; x++)
+			tile[x] = (BYTE)(tile[x] * 3 + pass);
+	}
+
+	InterlockedIncrement(&tiles);
+}
+
+static BOOL test_tiles(DWORD threads)
+{
+	const size_t nbTiles = 256;
+	const size_t nbFrames = 4;
+	BOOL rc = FALSE;
+	PTP_POOL pool = NULL;
+	PTP_WORK* works = NULL;
+	BYTE* buffer = NULL;
+	TP_CALLBACK_ENVIRON environment;
+
+	if (!(pool = CreateThreadpool(NULL)))
+		return FALSE;
+
+	InitializeThreadpoolEnvironment(&environment);
+
+	if (!SetThreadpoolThreadMinimum(pool, threads))
+		goto fail;
+
+	SetThreadpoolThreadMaximum(pool, threads);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	works = (PTP_WORK*)calloc(nbTiles, sizeof(PTP_WORK));
+	buffer = (BYTE*)calloc(nbTiles, 64 * 64 * 4);
+
+	if (!works || !buffer)
+		goto fail;
+
+	for (size_t x = 0; x < nbTiles; x++)
+	{
+		works[x] = CreateThreadpoolWork(test_TileCallback, &buffer[x * 64 * 64 * 4], &environment);
+
+		if (!works[x])
+			goto fail;
+	}
+
+	InterlockedExchange(&tiles, 0);
+	const UINT64 start = GetTickCount64();
+
+	for (size_t frame = 0; frame < nbFrames; frame++)
+	{
+		for (size_t x = 0; x < nbTiles; x++)
+			SubmitThreadpoolWork(works[x]);
+
+		for (size_t x = 0; x < nbTiles; x++)
+			WaitForThreadpoolWorkCallbacks(works[x], FALSE);
+
+		if (InterlockedCompareExchange(&tiles, 0, 0) != (LONG)((frame + 1) * nbTiles))
+		{
+			printf("frame %" PRIuz ": %" PRId32 " tiles completed\n", frame, tiles);
+			goto fail;
+		}
+	}
+
+	printf("%2" PRIu32 " threads: %" PRIuz " tiles in %" PRIu64 "ms\n", threads, nbTiles * nbFrames,
+	       GetTickCount64() - start);
+	rc = TRUE;
+fail:
+
+	if (works)
+	{
+		for (size_t x = 0; x < nbTiles; x++)
+		{
+			if (works[x])
+				CloseThreadpoolWork(works[x]);
+		}
+	}
+
+	free(works);
+	free(buffer);
+	DestroyThreadpoolEnvironment(&environment);
+	CloseThreadpool(pool);
+	return rc;
+}
+
+static BOOL test3(void)
+{
+	printf("Tile fan-out\n");
+
+	for (DWORD threads = 1; threads <= 64; threads *= 2)
+	{
+		if (!test_tiles(threads))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static LONG cancelled = 0;
+
+static void CALLBACK test_BlockCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                        PTP_WORK work)
+{
+	HANDLE* events = (HANDLE*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	SetEvent(events[0]);
+	(void)WaitForSingleObject(events[1], INFINITE);
+}
+
+static void CALLBACK test_CancelCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                         PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(work);
+
+	InterlockedIncrement(&cancelled);
+}
+
+static DWORD WINAPI test_release_thread(LPVOID arg)
+{
+	Sleep(100);
+	SetEvent((HANDLE)arg);
+	return 0;
+}
+
+/* Callbacks queued behind a blocked worker must be dropped, not waited for, when cancelled,
+ * when their work object is closed or when the pool is closed */
+static BOOL test_cancel(void)
+{
+	BOOL rc = FALSE;
+	PTP_POOL pool = NULL;
+	PTP_WORK block = NULL;
+	PTP_WORK queued = NULL;
+	PTP_WORK closed = NULL;
+	HANDLE thread = NULL;
+	HANDLE events[2] = { CreateEvent(NULL, TRUE, FALSE, NULL),
+		                 CreateEvent(NULL, TRUE, FALSE, NULL) };
+	TP_CALLBACK_ENVIRON environment;
+
+	printf("Cancellation\n");
+	InitializeThreadpoolEnvironment(&environment);
+
+	if (!events[0] || !events[1] || !(pool = CreateThreadpool(NULL)))
+		goto fail;
+
+	if (!SetThreadpoolThreadMinimum(pool, 1))
+		goto fail;
+
+	SetThreadpoolThreadMaximum(pool, 1);
+	SetThreadpoolCallbackPool(&environment, pool);
+	block = CreateThreadpoolWork(test_BlockCallback, events, &environment);
+	queued = CreateThreadpoolWork(test_CancelCallback, NULL, &environment);
+	closed = CreateThreadpoolWork(test_CancelCallback, NULL, &environment);
+
+	if (!block || !queued || !closed)
+		goto fail;
+
+	InterlockedExchange(&cancelled, 0);
+	SubmitThreadpoolWork(block);
+
+	if (WaitForSingleObject(events[0], INFINITE) != WAIT_OBJECT_0)
+		goto fail;
+
+	for (size_t x = 0; x < 8; x++)
+	{
+		SubmitThreadpoolWork(queued);
+		SubmitThreadpoolWork(closed);
+	}
+
+	/* The only worker is blocked, so none of these started */
+	WaitForThreadpoolWorkCallbacks(queued, TRUE);
+	CloseThreadpoolWork(closed);
+	closed = NULL;
+
+	for (size_t x = 0; x < 8; x++)
+		SubmitThreadpoolWork(queued);
+
+	/* The worker is released after the pool started to terminate */
+	thread = CreateThread(NULL, 0, test_release_thread, events[1], 0, NULL);
+
+	if (!thread)
+		goto fail;
+
+	CloseThreadpool(pool);
+	pool = NULL;
+
+	/* Both return although the callbacks queued at close never ran */
+	WaitForThreadpoolWorkCallbacks(queued, FALSE);
+	CloseThreadpoolWork(queued);
+	queued = NULL;
+
+	CloseThreadpoolWork(block);
+	block = NULL;
+
+	if (InterlockedCompareExchange(&cancelled, 0, 0) != 0)
+	{
+		printf("%" PRId32 " cancelled callbacks ran\n", cancelled);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (events[1])
+		SetEvent(events[1]);
+
+	if (thread)
+	{
+		(void)WaitForSingleObject(thread, INFINITE);
+		(void)CloseHandle(thread);
+	}
+
+	if (closed)
+		CloseThreadpoolWork(closed);
+	if (queued)
+		CloseThreadpoolWork(queued);
+	if (block)
+		CloseThreadpoolWork(block);
+	if (pool)
+		CloseThreadpool(pool);
+
+	DestroyThreadpoolEnvironment(&environment);
+
+	for (size_t x = 0; x < ARRAYSIZE(events); x++)
+	{
+		if (events[x])
+			(void)CloseHandle(events[x]);
+	}
+
+	return rc;
+}
+
 int TestPoolWork(int argc, char* argv[])
 {
 
@@ -132,5 +375,11 @@ int TestPoolWork(int argc, char* argv[])
 	if (!test2())
 		return -1;
 
+	if (!test3())
+		return -1;
+
+	if (!test_cancel())
+		return -1;
+
 	return 0;
 }
@@ -83,6 +83,12 @@ PTP_WORK winpr_CreateThreadpoolWork(PTP_WORK_CALLBACK pfnwk, PVOID pv, PTP_CALLB
 
 	if (work)
 	{
+		if (!InitializeCriticalSectionAndSpinCount(&work->Lock, 4000))
+		{
+			free(work);
+			return NULL;
+		}
+
 		if (!pcbe)
 		{
 			pcbe = &DEFAULT_CALLBACK_ENVIRONMENT;
@@ -122,13 +128,17 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 		ArrayList_Remove(pwk->CallbackEnvironment->CleanupGroup->groups, pwk);
 
 #endif
+	/* Callbacks that did not start are dropped, running ones still reference the work object */
+	winpr_WaitForThreadpoolWorkCallbacks(pwk, TRUE);
+	DeleteCriticalSection(&pwk->Lock);
+	if (pwk->Done)
+		CloseHandle(pwk->Done);
 	free(pwk);
 }
 
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
 	PTP_POOL pool = NULL;
-	PTP_CALLBACK_INSTANCE callbackInstance = NULL;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 
@@ -143,16 +153,20 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 	WINPR_ASSERT(pwk);
 	WINPR_ASSERT(pwk->CallbackEnvironment);
 	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE)calloc(1, sizeof(TP_CALLBACK_INSTANCE));
 
-	if (callbackInstance)
+	EnterCriticalSection(&pwk->Lock);
+	pwk->Pending++;
+	LeaveCriticalSection(&pwk->Lock);
+
+	if (!ThreadpoolEnqueueWork(pool, pwk))
 	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		if (!Queue_Enqueue(pool->PendingQueue, callbackInstance))
-			free(callbackInstance);
+		WLog_ERR(TAG, "failed to queue work callback");
+		EnterCriticalSection(&pwk->Lock);
+		pwk->Pending--;
+		if ((pwk->Pending == 0) && pwk->Done)
+			SetEvent(pwk->Done);
+		LeaveCriticalSection(&pwk->Lock);
 	}
-	// NOLINTNEXTLINE(clang-analyzer-unix.Malloc): Queue_Enqueue takes ownership of callbackInstance
 }
 
 BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
@@ -172,7 +186,6 @@ BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
 VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallbacks)
 {
 	HANDLE event = NULL;
-	PTP_POOL pool = NULL;
 
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
@@ -187,13 +200,50 @@ VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallb
 	WINPR_ASSERT(pwk);
 	WINPR_ASSERT(pwk->CallbackEnvironment);
 
-	pool = pwk->CallbackEnvironment->Pool;
-	WINPR_ASSERT(pool);
+	if (fCancelPendingCallbacks)
+	{
+		EnterCriticalSection(&pwk->Lock);
+		const BOOL pending = pwk->Pending > 0;
+		LeaveCriticalSection(&pwk->Lock);
+
+		/* Without pending callbacks the pool is not touched, it may be closed already */
+		if (pending)
+			ThreadpoolCancelWork(pwk->CallbackEnvironment->Pool, pwk);
+	}
+
+	/* Only callbacks of this work object are waited for, the completion event is created on
+	 * first use and reused for later submissions */
+	EnterCriticalSection(&pwk->Lock);
 
-	event = CountdownEvent_WaitHandle(pool->WorkComplete);
+	if (pwk->Pending > 0)
+	{
+		if (!pwk->Done)
+			pwk->Done = CreateEvent(NULL, TRUE, FALSE, NULL);
+		else
+			ResetEvent(pwk->Done);
+
+		event = pwk->Done;
+
+		/* Without an event fall back to polling, the caller may free the work object */
+		while (!event && (pwk->Pending > 0))
+		{
+			LeaveCriticalSection(&pwk->Lock);
+			Sleep(1);
+			EnterCriticalSection(&pwk->Lock);
+		}
+	}
+
+	LeaveCriticalSection(&pwk->Lock);
+
+	if (!event)
+		return;
 
 	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
 		WLog_ERR(TAG, "error waiting on work completion");
+
+	/* The completing thread signals with the lock held, wait until it released it */
+	EnterCriticalSection(&pwk->Lock);
+	LeaveCriticalSection(&pwk->Lock);
 }
 
 #endif /* WINPR_THREAD_POOL defined */
@@ -21,12 +21,28 @@
 
 #include <winpr/crt.h>
 
+#include <winpr/interlocked.h>
 #include <winpr/collections.h>
 
-typedef struct
+#include "SizeClassCache.h"
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#endif
+
+/* Placed in front of variable size buffers, padded to keep the buffer aligned */
+typedef struct s_wBufferPoolItem
 {
+	wBufferPool* pool;
 	SSIZE_T size;
-	void* buffer;
+	size_t sizeClass;
+	LONG volatile used;
+	struct s_wBufferPoolItem* prev;
+	struct s_wBufferPoolItem* next;
 } wBufferPoolItem;
 
 struct s_wBufferPool
@@ -36,17 +52,12 @@ struct s_wBufferPool
 	BOOL synchronized;
 	CRITICAL_SECTION lock;
 
-	SSIZE_T size;
-	SSIZE_T capacity;
-	void** array;
-
-	SSIZE_T aSize;
-	SSIZE_T aCapacity;
-	wBufferPoolItem* aArray;
+	wSizeClassCache* cache;
+	size_t headerSize;
+	size_t allocated;
 
-	SSIZE_T uSize;
-	SSIZE_T uCapacity;
-	wBufferPoolItem* uArray;
+	/* All variable size buffers, only touched when allocating or freeing */
+	wBufferPoolItem* items;
 };
 
 static BOOL BufferPool_Lock(wBufferPool* pool)
@@ -78,71 +89,44 @@ static BOOL BufferPool_Unlock(wBufferPool* pool)
  * Methods
  */
 
-static BOOL BufferPool_ShiftAvailable(wBufferPool* pool, size_t index, int count)
+static void* BufferPool_Alloc(wBufferPool* pool, size_t size)
 {
-	if (count > 0)
-	{
-		if (pool->aSize + count > pool->aCapacity)
-		{
-			wBufferPoolItem* newArray = NULL;
-			SSIZE_T newCapacity = pool->aCapacity * 2;
-
-			if (pool->alignment > 0)
-				newArray = (wBufferPoolItem*)winpr_aligned_realloc(
-				    pool->aArray, sizeof(wBufferPoolItem) * newCapacity, pool->alignment);
-			else
-				newArray =
-				    (wBufferPoolItem*)realloc(pool->aArray, sizeof(wBufferPoolItem) * newCapacity);
-			if (!newArray)
-				return FALSE;
-			pool->aArray = newArray;
-			pool->aCapacity = newCapacity;
-		}
+	if (pool->alignment)
+		return winpr_aligned_malloc(size, pool->alignment);
+	return malloc(size);
+}
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index],
-		           (pool->aSize - index) * sizeof(wBufferPoolItem));
-		pool->aSize += count;
-	}
-	else if (count < 0)
-	{
-		MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-		           (pool->aSize - index) * sizeof(wBufferPoolItem));
-		pool->aSize += count;
-	}
-	return TRUE;
+static void BufferPool_Dealloc(wBufferPool* pool, void* ptr)
+{
+	if (pool->alignment)
+		winpr_aligned_free(ptr);
+	else
+		free(ptr);
 }
 
-static BOOL BufferPool_ShiftUsed(wBufferPool* pool, SSIZE_T index, SSIZE_T count)
+static wBufferPoolItem* BufferPool_Item(wBufferPool* pool, const void* buffer)
 {
-	if (count > 0)
-	{
-		if (pool->uSize + count > pool->uCapacity)
-		{
-			SSIZE_T newUCapacity = pool->uCapacity * 2;
-			wBufferPoolItem* newUArray = NULL;
-			if (pool->alignment > 0)
-				newUArray = (wBufferPoolItem*)winpr_aligned_realloc(
-				    pool->uArray, sizeof(wBufferPoolItem) * newUCapacity, pool->alignment);
-			else
-				newUArray =
-				    (wBufferPoolItem*)realloc(pool->uArray, sizeof(wBufferPoolItem) * newUCapacity);
-			if (!newUArray)
-				return FALSE;
-			pool->uCapacity = newUCapacity;
-			pool->uArray = newUArray;
-		}
+	return (wBufferPoolItem*)((const BYTE*)buffer - pool->headerSize);
+}
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index],
-		           (pool->uSize - index) * sizeof(wBufferPoolItem));
-		pool->uSize += count;
-	}
-	else if (count < 0)
-	{
-		MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-		           (pool->uSize - index) * sizeof(wBufferPoolItem));
-		pool->uSize += count;
-	}
-	return TRUE;
+static void* BufferPool_ItemBuffer(wBufferPool* pool, wBufferPoolItem* item)
+{
+	return (BYTE*)item + pool->headerSize;
+}
+
+static void BufferPool_FreeItem(wBufferPool* pool, wBufferPoolItem* item)
+{
+	BufferPool_Lock(pool);
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		pool->items = item->next;
+	if (item->next)
+		item->next->prev = item->prev;
+	pool->allocated--;
+	BufferPool_Unlock(pool);
+
+	BufferPool_Dealloc(pool, item);
 }
 
 /**
@@ -151,24 +135,19 @@ static BOOL BufferPool_ShiftUsed(wBufferPool* pool, SSIZE_T index, SSIZE_T count
 
 SSIZE_T BufferPool_GetPoolSize(wBufferPool* pool)
 {
-	SSIZE_T size = 0;
+	wPoolStatistics stats = { 0 };
 
-	BufferPool_Lock(pool);
+	if (!BufferPool_QueryStatistics(pool, &stats))
+		return -1;
 
 	if (pool->fixedSize)
 	{
 		/* fixed size buffers */
-		size = pool->size;
-	}
-	else
-	{
-		/* variable size buffers */
-		size = pool->uSize;
+		return (SSIZE_T)stats.available;
 	}
 
-	BufferPool_Unlock(pool);
-
-	return size;
+	/* variable size buffers */
+	return (SSIZE_T)stats.used;
 }
 
 /**
@@ -177,35 +156,26 @@ SSIZE_T BufferPool_GetPoolSize(wBufferPool* pool)
 
 SSIZE_T BufferPool_GetBufferSize(wBufferPool* pool, const void* buffer)
 {
-	SSIZE_T size = 0;
-	BOOL found = FALSE;
-
-	BufferPool_Lock(pool);
+	if (!pool)
+		return -1;
 
 	if (pool->fixedSize)
 	{
 		/* fixed size buffers */
-		size = pool->fixedSize;
-		found = TRUE;
+		return pool->fixedSize;
 	}
-	else
-	{
-		/* variable size buffers */
 
-		for (SSIZE_T index = 0; index < pool->uSize; index++)
-		{
-			if (pool->uArray[index].buffer == buffer)
-			{
-				size = pool->uArray[index].size;
-				found = TRUE;
-				break;
-			}
-		}
-	}
+	/* variable size buffers */
+	if (!buffer)
+		return -1;
 
-	BufferPool_Unlock(pool);
+	/* Like BufferPool_Return only buffers of this pool are accepted */
+	const wBufferPoolItem* item = BufferPool_Item(pool, buffer);
 
-	return (found) ? size : -1;
+	WINPR_ASSERT(item->pool == pool);
+	if ((item->pool != pool) || !item->used)
+		return -1;
+	return item->size;
 }
 
 /**
@@ -214,209 +184,116 @@ SSIZE_T BufferPool_GetBufferSize(wBufferPool* pool, const void* buffer)
 
 void* BufferPool_Take(wBufferPool* pool, SSIZE_T size)
 {
-	SSIZE_T maxSize = 0;
-	SSIZE_T maxIndex = 0;
-	SSIZE_T foundIndex = -1;
-	BOOL found = FALSE;
-	void* buffer = NULL;
-
-	BufferPool_Lock(pool);
+	if (!pool)
+		return NULL;
 
 	if (pool->fixedSize)
 	{
-		/* fixed size buffers */
-
-		if (pool->size > 0)
-			buffer = pool->array[--(pool->size)];
+		/* fixed size buffers, all kept in the first class */
+		void* buffer = SizeClassCache_Pop(pool->cache, 0, 0);
 
 		if (!buffer)
 		{
-			if (pool->alignment)
-				buffer = winpr_aligned_malloc(pool->fixedSize, pool->alignment);
-			else
-				buffer = malloc(pool->fixedSize);
-		}
+			buffer = BufferPool_Alloc(pool, (size_t)pool->fixedSize);
+			if (!buffer)
+				return NULL;
 
-		if (!buffer)
-			goto out_error;
-	}
-	else
-	{
-		/* variable size buffers */
-
-		maxSize = 0;
-		maxIndex = 0;
-
-		if (size < 1)
-			size = pool->fixedSize;
-
-		for (SSIZE_T index = 0; index < pool->aSize; index++)
-		{
-			if (pool->aArray[index].size > maxSize)
-			{
-				maxIndex = index;
-				maxSize = pool->aArray[index].size;
-			}
-
-			if (pool->aArray[index].size >= size)
-			{
-				foundIndex = index;
-				found = TRUE;
-				break;
-			}
+			BufferPool_Lock(pool);
+			pool->allocated++;
+			BufferPool_Unlock(pool);
 		}
 
-		if (!found && maxSize)
-		{
-			foundIndex = maxIndex;
-			found = TRUE;
-		}
-
-		if (!found)
-		{
-			if (!size)
-				buffer = NULL;
-			else
-			{
-				if (pool->alignment)
-					buffer = winpr_aligned_malloc(size, pool->alignment);
-				else
-					buffer = malloc(size);
-
-				if (!buffer)
-					goto out_error;
-			}
-		}
-		else
-		{
-			buffer = pool->aArray[foundIndex].buffer;
-
-			if (maxSize < size)
-			{
-				void* newBuffer = NULL;
-				if (pool->alignment)
-					newBuffer = winpr_aligned_realloc(buffer, size, pool->alignment);
-				else
-					newBuffer = realloc(buffer, size);
-
-				if (!newBuffer)
-					goto out_error_no_free;
-
-				buffer = newBuffer;
-			}
+		return buffer;
+	}
 
-			if (!BufferPool_ShiftAvailable(pool, foundIndex, -1))
-				goto out_error;
-		}
+	/* variable size buffers */
+	if (size < 1)
+		return NULL;
 
-		if (!buffer)
-			goto out_error;
+	const size_t sizeClass = SizeClass_FromSize((size_t)size);
+	wBufferPoolItem* item = NULL;
 
-		if (pool->uSize + 1 > pool->uCapacity)
-		{
-			size_t newUCapacity = pool->uCapacity * 2;
-			wBufferPoolItem* newUArray =
-			    (wBufferPoolItem*)realloc(pool->uArray, sizeof(wBufferPoolItem) * newUCapacity);
-			if (!newUArray)
-				goto out_error;
-
-			pool->uCapacity = newUCapacity;
-			pool->uArray = newUArray;
-		}
+	if (sizeClass < SIZE_CLASS_COUNT)
+		item = SizeClassCache_Pop(pool->cache, sizeClass, sizeClass + 1);
 
-		pool->uArray[pool->uSize].buffer = buffer;
-		pool->uArray[pool->uSize].size = size;
-		(pool->uSize)++;
+	if (!item)
+	{
+		const size_t capacity =
+		    (sizeClass < SIZE_CLASS_COUNT) ? SizeClass_Size(sizeClass) : (size_t)size;
+
+		if (capacity > SIZE_MAX - pool->headerSize)
+			return NULL;
+
+		item = BufferPool_Alloc(pool, pool->headerSize + capacity);
+		if (!item)
+			return NULL;
+
+		ZeroMemory(item, sizeof(wBufferPoolItem));
+		item->pool = pool;
+		item->sizeClass = sizeClass;
+
+		BufferPool_Lock(pool);
+		item->next = pool->items;
+		if (item->next)
+			item->next->prev = item;
+		pool->items = item;
+		pool->allocated++;
+		BufferPool_Unlock(pool);
 	}
 
-	BufferPool_Unlock(pool);
-
-	return buffer;
-
-out_error:
-	if (pool->alignment)
-		winpr_aligned_free(buffer);
-	else
-		free(buffer);
-out_error_no_free:
-	BufferPool_Unlock(pool);
-	return NULL;
+	item->size = size;
+	InterlockedExchange(&item->used, 1);
+	return BufferPool_ItemBuffer(pool, item);
 }
 
 /**
  * Returns a buffer to the pool.
+ *
+ * Only buffers taken from this pool may be returned. A variable size pool finds the item from
+ * the header in front of the buffer, any other pointer is read out of bounds.
  */
 
 BOOL BufferPool_Return(wBufferPool* pool, void* buffer)
 {
-	BOOL rc = FALSE;
-	SSIZE_T size = 0;
-	BOOL found = FALSE;
+	if (!pool)
+		return FALSE;
 
-	BufferPool_Lock(pool);
+	if (!buffer)
+		return TRUE;
 
 	if (pool->fixedSize)
 	{
 		/* fixed size buffers */
+		if (SizeClassCache_Push(pool->cache, 0, buffer))
+			return TRUE;
 
-		if ((pool->size + 1) >= pool->capacity)
-		{
-			SSIZE_T newCapacity = pool->capacity * 2;
-			void** newArray = (void**)realloc(pool->array, sizeof(void*) * newCapacity);
-			if (!newArray)
-				goto out_error;
-
-			pool->capacity = newCapacity;
-			pool->array = newArray;
-		}
-
-		pool->array[(pool->size)++] = buffer;
+		BufferPool_Lock(pool);
+		pool->allocated--;
+		BufferPool_Unlock(pool);
+		BufferPool_Dealloc(pool, buffer);
+		return FALSE;
 	}
-	else
-	{
-		/* variable size buffers */
 
-		SSIZE_T index = 0;
-		for (; index < pool->uSize; index++)
-		{
-			if (pool->uArray[index].buffer == buffer)
-			{
-				found = TRUE;
-				break;
-			}
-		}
+	/* variable size buffers */
+	wBufferPoolItem* item = BufferPool_Item(pool, buffer);
 
-		if (found)
-		{
-			size = pool->uArray[index].size;
-			if (!BufferPool_ShiftUsed(pool, index, -1))
-				goto out_error;
-		}
+	WINPR_ASSERT(item->pool == pool);
+	if (item->pool != pool)
+		return FALSE;
 
-		if (size)
-		{
-			if ((pool->aSize + 1) >= pool->aCapacity)
-			{
-				SSIZE_T newCapacity = pool->aCapacity * 2;
-				wBufferPoolItem* newArray =
-				    (wBufferPoolItem*)realloc(pool->aArray, sizeof(wBufferPoolItem) * newCapacity);
-				if (!newArray)
-					goto out_error;
-
-				pool->aCapacity = newCapacity;
-				pool->aArray = newArray;
-			}
-
-			pool->aArray[pool->aSize].buffer = buffer;
-			pool->aArray[pool->aSize].size = size;
-			(pool->aSize)++;
-		}
-	}
+	/* A buffer returned twice is only cached once */
+	if (InterlockedCompareExchange(&item->used, 0, 1) != 1)
+		return TRUE;
 
-	rc = TRUE;
-out_error:
-	BufferPool_Unlock(pool);
-	return rc;
+	if ((item->sizeClass >= SIZE_CLASS_COUNT) ||
+	    !SizeClassCache_Push(pool->cache, item->sizeClass, item))
+		BufferPool_FreeItem(pool, item);
+	return TRUE;
+}
+
+static void BufferPool_DiscardAligned(void* buffer)
+{
+	winpr_aligned_free(buffer);
 }
 
 /**
@@ -425,50 +302,55 @@ out_error:
 
 void BufferPool_Clear(wBufferPool* pool)
 {
+	wSizeClassCacheStatistics stats = { 0 };
+
 	BufferPool_Lock(pool);
 
 	if (pool->fixedSize)
 	{
-		/* fixed size buffers */
-
-		while (pool->size > 0)
-		{
-			(pool->size)--;
-
-			if (pool->alignment)
-				winpr_aligned_free(pool->array[pool->size]);
-			else
-				free(pool->array[pool->size]);
-		}
+		/* fixed size buffers, the ones in use are not tracked */
+		SizeClassCache_GetStatistics(pool->cache, &stats);
+		SizeClassCache_Reset(pool->cache, pool->alignment ? BufferPool_DiscardAligned : free);
+		pool->allocated -= MIN(pool->allocated, stats.available);
 	}
 	else
 	{
 		/* variable size buffers */
+		SizeClassCache_Reset(pool->cache, NULL);
 
-		while (pool->aSize > 0)
+		while (pool->items)
 		{
-			(pool->aSize)--;
+			wBufferPoolItem* item = pool->items;
 
-			if (pool->alignment)
-				winpr_aligned_free(pool->aArray[pool->aSize].buffer);
-			else
-				free(pool->aArray[pool->aSize].buffer);
+			pool->items = item->next;
+			BufferPool_Dealloc(pool, item);
 		}
 
-		while (pool->uSize > 0)
-		{
-			(pool->uSize)--;
-
-			if (pool->alignment)
-				winpr_aligned_free(pool->uArray[pool->uSize].buffer);
-			else
-				free(pool->uArray[pool->uSize].buffer);
-		}
+		pool->allocated = 0;
 	}
 
 	BufferPool_Unlock(pool);
 }
 
+BOOL BufferPool_QueryStatistics(wBufferPool* pool, wPoolStatistics* stats)
+{
+	wSizeClassCacheStatistics cache = { 0 };
+
+	if (!pool || !stats)
+		return FALSE;
+
+	BufferPool_Lock(pool);
+	SizeClassCache_GetStatistics(pool->cache, &cache);
+	stats->allocated = pool->allocated;
+	BufferPool_Unlock(pool);
+
+	stats->available = cache.available;
+	stats->used = stats->allocated - MIN(stats->allocated, cache.available);
+	stats->hits = cache.hits;
+	stats->misses = cache.misses;
+	return TRUE;
+}
+
 /**
  * Construction, Destruction
  */
@@ -492,32 +374,17 @@ wBufferPool* BufferPool_New(BOOL synchronized, SSIZE_T fixedSize, DWORD alignmen
 		if (pool->synchronized)
 			InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
 
-		if (pool->fixedSize)
-		{
-			/* fixed size buffers */
-
-			pool->size = 0;
-			pool->capacity = 32;
-			pool->array = (void**)calloc(pool->capacity, sizeof(void*));
-			if (!pool->array)
-				goto out_error;
-		}
-		else
+		if (!pool->fixedSize)
 		{
 			/* variable size buffers */
+			const size_t align = MAX(alignment, 16);
 
-			pool->aSize = 0;
-			pool->aCapacity = 32;
-			pool->aArray = (wBufferPoolItem*)calloc(pool->aCapacity, sizeof(wBufferPoolItem));
-			if (!pool->aArray)
-				goto out_error;
-
-			pool->uSize = 0;
-			pool->uCapacity = 32;
-			pool->uArray = (wBufferPoolItem*)calloc(pool->uCapacity, sizeof(wBufferPoolItem));
-			if (!pool->uArray)
-				goto out_error;
+			pool->headerSize = (sizeof(wBufferPoolItem) + align - 1) / align * align;
 		}
+
+		pool->cache = SizeClassCache_New(synchronized);
+		if (!pool->cache)
+			goto out_error;
 	}
 
 	return pool;
@@ -534,24 +401,13 @@ void BufferPool_Free(wBufferPool* pool)
 {
 	if (pool)
 	{
-		BufferPool_Clear(pool);
+		if (pool->cache)
+			BufferPool_Clear(pool);
 
 		if (pool->synchronized)
 			DeleteCriticalSection(&pool->lock);
 
-		if (pool->fixedSize)
-		{
-			/* fixed size buffers */
-
-			free(pool->array);
-		}
-		else
-		{
-			/* variable size buffers */
-
-			free(pool->aArray);
-			free(pool->uArray);
-		}
+		SizeClassCache_Free(pool->cache);
 
 		free(pool);
 	}
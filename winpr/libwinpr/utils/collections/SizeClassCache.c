@@ -0,0 +1,273 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Size Class Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+
+#include "SizeClassCache.h"
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#define SIZE_CLASS_CACHE_MAGAZINES 8
+
+typedef struct
+{
+	void** items;
+	size_t count;
+	size_t capacity;
+} wSizeClassStack;
+
+typedef struct
+{
+	CRITICAL_SECTION lock;
+	size_t count;
+	UINT64 hits;
+	UINT64 misses;
+	wSizeClassStack classes[SIZE_CLASS_COUNT];
+} wSizeClassMagazine;
+
+struct s_wSizeClassCache
+{
+	BOOL synchronized;
+	size_t numMagazines;
+	wSizeClassMagazine magazines[SIZE_CLASS_CACHE_MAGAZINES];
+};
+
+static LONG volatile g_NextThreadSlot = 0;
+static WINPR_TLS LONG g_ThreadSlot = 0;
+
+size_t SizeClass_FromSize(size_t size)
+{
+	for (size_t x = 0; x < SIZE_CLASS_COUNT; x++)
+	{
+		if (SizeClass_Size(x) >= size)
+			return x;
+	}
+
+	return SIZE_CLASS_COUNT;
+}
+
+size_t SizeClass_FromCapacity(size_t capacity)
+{
+	if (capacity < SizeClass_Size(0))
+		return SIZE_CLASS_COUNT;
+
+	for (size_t x = 1; x < SIZE_CLASS_COUNT; x++)
+	{
+		if (SizeClass_Size(x) > capacity)
+			return x - 1;
+	}
+
+	return SIZE_CLASS_COUNT - 1;
+}
+
+size_t SizeClass_Size(size_t sizeClass)
+{
+	WINPR_ASSERT(sizeClass < SIZE_CLASS_COUNT);
+	return (size_t)1 << (SIZE_CLASS_MIN_SHIFT + sizeClass);
+}
+
+/* Threads are numbered on first use, which spreads them evenly over the magazines */
+static wSizeClassMagazine* SizeClassCache_OwnMagazine(wSizeClassCache* cache, size_t* index)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(index);
+
+	if (g_ThreadSlot == 0)
+		g_ThreadSlot = InterlockedIncrement(&g_NextThreadSlot);
+
+	*index = (size_t)g_ThreadSlot % cache->numMagazines;
+	return &cache->magazines[*index];
+}
+
+static void SizeClassCache_Lock(wSizeClassCache* cache, wSizeClassMagazine* magazine)
+{
+	if (cache->synchronized)
+		EnterCriticalSection(&magazine->lock);
+}
+
+static void SizeClassCache_Unlock(wSizeClassCache* cache, wSizeClassMagazine* magazine)
+{
+	if (cache->synchronized)
+		LeaveCriticalSection(&magazine->lock);
+}
+
+static void* SizeClassCache_PopMagazine(wSizeClassMagazine* magazine, size_t sizeClass,
+                                        size_t maxClass)
+{
+	if (magazine->count == 0)
+		return NULL;
+
+	for (size_t x = sizeClass; x <= maxClass; x++)
+	{
+		wSizeClassStack* stack = &magazine->classes[x];
+
+		if (stack->count > 0)
+		{
+			magazine->count--;
+			magazine->hits++;
+			return stack->items[--stack->count];
+		}
+	}
+
+	return NULL;
+}
+
+void* SizeClassCache_Pop(wSizeClassCache* cache, size_t sizeClass, size_t maxClass)
+{
+	void* item = NULL;
+	size_t own = 0;
+	wSizeClassMagazine* magazine = SizeClassCache_OwnMagazine(cache, &own);
+
+	maxClass = MIN(maxClass, SIZE_CLASS_COUNT - 1);
+
+	for (size_t x = 0; (sizeClass <= maxClass) && (x < cache->numMagazines); x++)
+	{
+		wSizeClassMagazine* cur = &cache->magazines[(own + x) % cache->numMagazines];
+
+		SizeClassCache_Lock(cache, cur);
+		item = SizeClassCache_PopMagazine(cur, sizeClass, maxClass);
+		SizeClassCache_Unlock(cache, cur);
+
+		if (item)
+			return item;
+	}
+
+	SizeClassCache_Lock(cache, magazine);
+	magazine->misses++;
+	SizeClassCache_Unlock(cache, magazine);
+	return NULL;
+}
+
+BOOL SizeClassCache_Push(wSizeClassCache* cache, size_t sizeClass, void* item)
+{
+	BOOL rc = FALSE;
+	size_t own = 0;
+	wSizeClassMagazine* magazine = SizeClassCache_OwnMagazine(cache, &own);
+
+	WINPR_ASSERT(sizeClass < SIZE_CLASS_COUNT);
+
+	SizeClassCache_Lock(cache, magazine);
+
+	wSizeClassStack* stack = &magazine->classes[sizeClass];
+
+	if (stack->count == stack->capacity)
+	{
+		const size_t capacity = (stack->capacity > 0) ? stack->capacity * 2 : 8;
+		void** items = realloc(stack->items, capacity * sizeof(void*));
+
+		if (!items)
+			goto out;
+
+		stack->items = items;
+		stack->capacity = capacity;
+	}
+
+	stack->items[stack->count++] = item;
+	magazine->count++;
+	rc = TRUE;
+out:
+	SizeClassCache_Unlock(cache, magazine);
+	return rc;
+}
+
+void SizeClassCache_Reset(wSizeClassCache* cache, void (*discard)(void* item))
+{
+	WINPR_ASSERT(cache);
+
+	for (size_t x = 0; x < cache->numMagazines; x++)
+	{
+		wSizeClassMagazine* magazine = &cache->magazines[x];
+
+		SizeClassCache_Lock(cache, magazine);
+		for (size_t y = 0; y < SIZE_CLASS_COUNT; y++)
+		{
+			wSizeClassStack* stack = &magazine->classes[y];
+
+			while (discard && (stack->count > 0))
+				discard(stack->items[--stack->count]);
+			stack->count = 0;
+		}
+		magazine->count = 0;
+		SizeClassCache_Unlock(cache, magazine);
+	}
+}
+
+void SizeClassCache_GetStatistics(wSizeClassCache* cache, wSizeClassCacheStatistics* stats)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(stats);
+
+	stats->available = 0;
+	stats->hits = 0;
+	stats->misses = 0;
+
+	for (size_t x = 0; x < cache->numMagazines; x++)
+	{
+		wSizeClassMagazine* magazine = &cache->magazines[x];
+
+		SizeClassCache_Lock(cache, magazine);
+		stats->available += magazine->count;
+		stats->hits += magazine->hits;
+		stats->misses += magazine->misses;
+		SizeClassCache_Unlock(cache, magazine);
+	}
+}
+
+void SizeClassCache_Free(wSizeClassCache* cache)
+{
+	if (!cache)
+		return;
+
+	for (size_t x = 0; x < cache->numMagazines; x++)
+	{
+		wSizeClassMagazine* magazine = &cache->magazines[x];
+
+		for (size_t y = 0; y < SIZE_CLASS_COUNT; y++)
+			free(magazine->classes[y].items);
+
+		if (cache->synchronized)
+			DeleteCriticalSection(&magazine->lock);
+	}
+
+	free(cache);
+}
+
+wSizeClassCache* SizeClassCache_New(BOOL synchronized)
+{
+	wSizeClassCache* cache = (wSizeClassCache*)calloc(1, sizeof(wSizeClassCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->synchronized = synchronized;
+	cache->numMagazines = synchronized ? SIZE_CLASS_CACHE_MAGAZINES : 1;
+
+	if (synchronized)
+	{
+		for (size_t x = 0; x < cache->numMagazines; x++)
+			InitializeCriticalSectionAndSpinCount(&cache->magazines[x].lock, 4000);
+	}
+
+	return cache;
+}
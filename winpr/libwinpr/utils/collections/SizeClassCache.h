@@ -0,0 +1,68 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Size Class Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WINPR_UTILS_COLLECTIONS_SIZE_CLASS_CACHE_H
+#define WINPR_UTILS_COLLECTIONS_SIZE_CLASS_CACHE_H
+
+#include <winpr/winpr.h>
+#include <winpr/wtypes.h>
+
+/**
+ * Free items of StreamPool and BufferPool, sorted into power of two size classes.
+ *
+ * Class n holds items of at least 2^(SIZE_CLASS_MIN_SHIFT + n) bytes, 32 bytes up to 2 GiB.
+ * Items are kept in magazines, one per thread slot, so threads taking and returning items
+ * do not contend on a single lock. A take that finds its own magazine empty looks into the
+ * others before the caller has to allocate.
+ */
+#define SIZE_CLASS_MIN_SHIFT 5
+#define SIZE_CLASS_COUNT 27
+
+typedef struct s_wSizeClassCache wSizeClassCache;
+
+typedef struct
+{
+	size_t available;
+	UINT64 hits;
+	UINT64 misses;
+} wSizeClassCacheStatistics;
+
+/* Smallest class whose items can hold size bytes, SIZE_CLASS_COUNT if no class can */
+WINPR_LOCAL size_t SizeClass_FromSize(size_t size);
+
+/* Class an item with the given capacity belongs to, SIZE_CLASS_COUNT if it is too small */
+WINPR_LOCAL size_t SizeClass_FromCapacity(size_t capacity);
+
+/* Allocation size of items of a class */
+WINPR_LOCAL size_t SizeClass_Size(size_t sizeClass);
+
+/* Pops an item of class sizeClass up to maxClass, NULL if the caller has to allocate */
+WINPR_LOCAL void* SizeClassCache_Pop(wSizeClassCache* cache, size_t sizeClass, size_t maxClass);
+WINPR_LOCAL BOOL SizeClassCache_Push(wSizeClassCache* cache, size_t sizeClass, void* item);
+
+/* Empties the cache, handing every cached item to discard if it is set */
+WINPR_LOCAL void SizeClassCache_Reset(wSizeClassCache* cache, void (*discard)(void* item));
+
+WINPR_LOCAL void SizeClassCache_GetStatistics(wSizeClassCache* cache,
+                                              wSizeClassCacheStatistics* stats);
+
+WINPR_LOCAL void SizeClassCache_Free(wSizeClassCache* cache);
+
+WINPR_ATTR_MALLOC(SizeClassCache_Free, 1)
+WINPR_LOCAL wSizeClassCache* SizeClassCache_New(BOOL synchronized);
+
+#endif /* WINPR_UTILS_COLLECTIONS_SIZE_CLASS_CACHE_H */
@@ -22,19 +22,36 @@
 #include <winpr/crt.h>
 #include <winpr/wlog.h>
 
+#include <winpr/interlocked.h>
 #include <winpr/collections.h>
 
 #include "../stream.h"
+#include "SizeClassCache.h"
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#endif
+
+/* The stream is the first member so a pooled wStream* is also its entry */
+typedef struct s_wStreamPoolEntry
+{
+	wStream s;
+	struct s_wStreamPoolEntry* prev;
+	struct s_wStreamPoolEntry* next;
+	LONG volatile used;
+} wStreamPoolEntry;
 
 struct s_wStreamPool
 {
-	size_t aSize;
-	size_t aCapacity;
-	wStream** aArray;
+	wSizeClassCache* cache;
 
-	size_t uSize;
-	size_t uCapacity;
-	wStream** uArray;
+	/* All streams allocated by the pool, only touched when allocating or freeing */
+	wStreamPoolEntry* entries;
+	size_t allocated;
 
 	CRITICAL_SECTION lock;
 	BOOL synchronized;
@@ -63,122 +80,61 @@ static INLINE void StreamPool_Unlock(wStreamPool* pool)
 		LeaveCriticalSection(&pool->lock);
 }
 
-static BOOL StreamPool_EnsureCapacity(wStreamPool* pool, size_t count, BOOL usedOrAvailable)
-{
-	size_t new_cap = 0;
-	size_t* cap = NULL;
-	size_t* size = NULL;
-	wStream*** array = NULL;
-
-	WINPR_ASSERT(pool);
-
-	cap = (usedOrAvailable) ? &pool->uCapacity : &pool->aCapacity;
-	size = (usedOrAvailable) ? &pool->uSize : &pool->aSize;
-	array = (usedOrAvailable) ? &pool->uArray : &pool->aArray;
-	if (*cap == 0)
-		new_cap = *size + count;
-	else if (*size + count > *cap)
-		new_cap = *cap * 2;
-	else if ((*size + count) < *cap / 3)
-		new_cap = *cap / 2;
-
-	if (new_cap > 0)
-	{
-		wStream** new_arr = NULL;
-
-		if (*cap < *size + count)
-			*cap += count;
-
-		new_arr = (wStream**)realloc(*array, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			return FALSE;
-		*cap = new_cap;
-		*array = new_arr;
-	}
-	return TRUE;
-}
-
 /**
  * Methods
  */
 
-static void StreamPool_ShiftUsed(wStreamPool* pool, size_t index, INT64 count)
+static void StreamPool_FreeEntry(wStreamPoolEntry* entry)
 {
-	WINPR_ASSERT(pool);
-	if (count > 0)
-	{
-		const size_t pcount = (size_t)count;
-		StreamPool_EnsureCapacity(pool, pcount, TRUE);
-
-		MoveMemory(&pool->uArray[index + pcount], &pool->uArray[index],
-		           (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += pcount;
-	}
-	else if (count < 0)
-	{
-		const size_t pcount = (size_t)-count;
-		const size_t off = index + pcount;
-		if (pool->uSize > off)
-		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index + pcount],
-			           (pool->uSize - index - pcount) * sizeof(wStream*));
-		}
+	WINPR_ASSERT(entry);
 
-		pool->uSize -= pcount;
-	}
+	if (entry->s.isOwner)
+		free(entry->s.buffer);
+	free(entry);
 }
 
-/**
- * Adds a used stream to the pool.
- */
-
-static void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+static wStreamPoolEntry* StreamPool_NewEntry(wStreamPool* pool, size_t capacity)
 {
-	StreamPool_EnsureCapacity(pool, 1, TRUE);
-	pool->uArray[(pool->uSize)++] = s;
-}
+	wStreamPoolEntry* entry = (wStreamPoolEntry*)calloc(1, sizeof(wStreamPoolEntry));
 
-/**
- * Removes a used stream from the pool.
- */
+	if (!entry)
+		return NULL;
 
-static void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
-{
-	WINPR_ASSERT(pool);
-	for (size_t index = 0; index < pool->uSize; index++)
+	entry->s.buffer = (BYTE*)malloc(capacity);
+
+	if (!entry->s.buffer)
 	{
-		if (pool->uArray[index] == s)
-		{
-			StreamPool_ShiftUsed(pool, index, -1);
-			break;
-		}
+		free(entry);
+		return NULL;
 	}
+
+	entry->s.capacity = capacity;
+	entry->s.isAllocatedStream = TRUE;
+	entry->s.isOwner = TRUE;
+
+	StreamPool_Lock(pool);
+	entry->next = pool->entries;
+	if (entry->next)
+		entry->next->prev = entry;
+	pool->entries = entry;
+	pool->allocated++;
+	StreamPool_Unlock(pool);
+	return entry;
 }
 
-static void StreamPool_ShiftAvailable(wStreamPool* pool, size_t index, INT64 count)
+static void StreamPool_DeleteEntry(wStreamPool* pool, wStreamPoolEntry* entry)
 {
-	WINPR_ASSERT(pool);
-	if (count > 0)
-	{
-		const size_t pcount = (size_t)count;
-
-		StreamPool_EnsureCapacity(pool, pcount, FALSE);
-		MoveMemory(&pool->aArray[index + pcount], &pool->aArray[index],
-		           (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += pcount;
-	}
-	else if (count < 0)
-	{
-		const size_t pcount = (size_t)-count;
-		const size_t off = index + pcount;
-		if (pool->aSize > off)
-		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index + pcount],
-			           (pool->aSize - index - pcount) * sizeof(wStream*));
-		}
+	StreamPool_Lock(pool);
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		pool->entries = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	pool->allocated--;
+	StreamPool_Unlock(pool);
 
-		pool->aSize -= pcount;
-	}
+	StreamPool_FreeEntry(entry);
 }
 
 /**
@@ -187,48 +143,34 @@ static void StreamPool_ShiftAvailable(wStreamPool* pool, size_t index, INT64 cou
 
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
-	SSIZE_T foundIndex = -1;
-	wStream* s = NULL;
-
-	StreamPool_Lock(pool);
+	WINPR_ASSERT(pool);
 
 	if (size == 0)
 		size = pool->defaultSize;
 
-	for (size_t index = 0; index < pool->aSize; index++)
-	{
-		s = pool->aArray[index];
+	/* Streams up to two classes larger are handed out before allocating a new one */
+	const size_t sizeClass = SizeClass_FromSize(size);
+	wStreamPoolEntry* entry = NULL;
 
-		if (Stream_Capacity(s) >= size)
-		{
-			foundIndex = index;
-			break;
-		}
-	}
+	if (sizeClass < SIZE_CLASS_COUNT)
+		entry = SizeClassCache_Pop(pool->cache, sizeClass, sizeClass + 2);
 
-	if (foundIndex < 0)
+	if (!entry)
 	{
-		s = Stream_New(NULL, size);
-		if (!s)
-			goto out_fail;
-	}
-	else if (s)
-	{
-		Stream_SetPosition(s, 0);
-		Stream_SetLength(s, Stream_Capacity(s));
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
-	}
+		const size_t capacity =
+		    (sizeClass < SIZE_CLASS_COUNT) ? SizeClass_Size(sizeClass) : MAX(size, 1);
 
-	if (s)
-	{
-		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
+		entry = StreamPool_NewEntry(pool, capacity);
+		if (!entry)
+			return NULL;
 	}
 
-out_fail:
-	StreamPool_Unlock(pool);
-
+	wStream* s = &entry->s;
+	Stream_SetPosition(s, 0);
+	Stream_SetLength(s, Stream_Capacity(s));
+	s->pool = pool;
+	s->count = 1;
+	InterlockedExchange(&entry->used, 1);
 	return s;
 }
 
@@ -236,39 +178,27 @@ out_fail:
  * Returns an object to the pool.
  */
 
-static void StreamPool_Remove(wStreamPool* pool, wStream* s)
-{
-	StreamPool_EnsureCapacity(pool, 1, FALSE);
-	Stream_EnsureValidity(s);
-	for (size_t x = 0; x < pool->aSize; x++)
-	{
-		wStream* cs = pool->aArray[x];
-
-		WINPR_ASSERT(cs != s);
-	}
-	pool->aArray[(pool->aSize)++] = s;
-	StreamPool_RemoveUsed(pool, s);
-}
-
-static void StreamPool_ReleaseOrReturn(wStreamPool* pool, wStream* s)
-{
-	StreamPool_Lock(pool);
-	if (s->count > 0)
-		s->count--;
-	if (s->count == 0)
-		StreamPool_Remove(pool, s);
-	StreamPool_Unlock(pool);
-}
-
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
 	WINPR_ASSERT(pool);
 	if (!s)
 		return;
 
-	StreamPool_Lock(pool);
-	StreamPool_Remove(pool, s);
-	StreamPool_Unlock(pool);
+	wStreamPoolEntry* entry = (wStreamPoolEntry*)s;
+
+	WINPR_ASSERT(s->pool == pool);
+	Stream_EnsureValidity(s);
+
+	/* A stream returned twice is only cached once */
+	if (InterlockedCompareExchange(&entry->used, 0, 1) != 1)
+		return;
+
+	/* The stream might have grown while in use, cache it by what it can hold now */
+	const size_t sizeClass = SizeClass_FromCapacity(Stream_Capacity(s));
+
+	if (!s->isOwner || (sizeClass >= SIZE_CLASS_COUNT) ||
+	    !SizeClassCache_Push(pool->cache, sizeClass, entry))
+		StreamPool_DeleteEntry(pool, entry);
 }
 
 /**
@@ -279,11 +209,7 @@ void Stream_AddRef(wStream* s)
 {
 	WINPR_ASSERT(s);
 	if (s->pool)
-	{
-		StreamPool_Lock(s->pool);
-		s->count++;
-		StreamPool_Unlock(s->pool);
-	}
+		InterlockedIncrement((LONG volatile*)&s->count);
 }
 
 /**
@@ -293,8 +219,25 @@ void Stream_AddRef(wStream* s)
 void Stream_Release(wStream* s)
 {
 	WINPR_ASSERT(s);
-	if (s->pool)
-		StreamPool_ReleaseOrReturn(s->pool, s);
+	if (!s->pool)
+		return;
+
+	LONG volatile* count = (LONG volatile*)&s->count;
+	LONG current = *count;
+
+	while (current > 0)
+	{
+		const LONG previous = InterlockedCompareExchange(count, current - 1, current);
+
+		if (previous == current)
+		{
+			if (current == 1)
+				StreamPool_Return(s->pool, s);
+			return;
+		}
+
+		current = previous;
+	}
 }
 
 /**
@@ -304,24 +247,26 @@ void Stream_Release(wStream* s)
 wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr)
 {
 	wStream* s = NULL;
-	BOOL found = FALSE;
 
 	StreamPool_Lock(pool);
 
-	for (size_t index = 0; index < pool->uSize; index++)
+	for (wStreamPoolEntry* entry = pool->entries; entry; entry = entry->next)
 	{
-		s = pool->uArray[index];
+		wStream* cur = &entry->s;
+
+		if (!entry->used)
+			continue;
 
-		if ((ptr >= Stream_Buffer(s)) && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
+		if ((ptr >= Stream_Buffer(cur)) && (ptr < (Stream_Buffer(cur) + Stream_Capacity(cur))))
 		{
-			found = TRUE;
+			s = cur;
 			break;
 		}
 	}
 
 	StreamPool_Unlock(pool);
 
-	return (found) ? s : NULL;
+	return s;
 }
 
 /**
@@ -332,18 +277,18 @@ void StreamPool_Clear(wStreamPool* pool)
 {
 	StreamPool_Lock(pool);
 
-	while (pool->aSize > 0)
-	{
-		wStream* s = pool->aArray[--pool->aSize];
-		Stream_Free(s, s->isAllocatedStream);
-	}
+	SizeClassCache_Reset(pool->cache, NULL);
 
-	while (pool->uSize > 0)
+	while (pool->entries)
 	{
-		wStream* s = pool->uArray[--pool->uSize];
-		Stream_Free(s, s->isAllocatedStream);
+		wStreamPoolEntry* entry = pool->entries;
+
+		pool->entries = entry->next;
+		StreamPool_FreeEntry(entry);
 	}
 
+	pool->allocated = 0;
+
 	StreamPool_Unlock(pool);
 }
 
@@ -362,12 +307,11 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
 
-		if (!StreamPool_EnsureCapacity(pool, 32, FALSE))
-			goto fail;
-		if (!StreamPool_EnsureCapacity(pool, 32, TRUE))
-			goto fail;
-
 		InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
+
+		pool->cache = SizeClassCache_New(synchronized);
+		if (!pool->cache)
+			goto fail;
 	}
 
 	return pool;
@@ -383,26 +327,53 @@ void StreamPool_Free(wStreamPool* pool)
 {
 	if (pool)
 	{
-		StreamPool_Clear(pool);
+		if (pool->cache)
+			StreamPool_Clear(pool);
 
 		DeleteCriticalSection(&pool->lock);
 
-		free(pool->aArray);
-		free(pool->uArray);
+		SizeClassCache_Free(pool->cache);
 
 		free(pool);
 	}
 }
 
+BOOL StreamPool_QueryStatistics(wStreamPool* pool, wPoolStatistics* stats)
+{
+	wSizeClassCacheStatistics cache = { 0 };
+
+	if (!pool || !stats)
+		return FALSE;
+
+	StreamPool_Lock(pool);
+	SizeClassCache_GetStatistics(pool->cache, &cache);
+	stats->allocated = pool->allocated;
+	StreamPool_Unlock(pool);
+
+	stats->available = cache.available;
+	stats->used = stats->allocated - MIN(stats->allocated, cache.available);
+	stats->hits = cache.hits;
+	stats->misses = cache.misses;
+	return TRUE;
+}
+
 char* StreamPool_GetStatistics(wStreamPool* pool, char* buffer, size_t size)
 {
+	wPoolStatistics stats = { 0 };
+
 	WINPR_ASSERT(pool);
 
 	if (!buffer || (size < 1))
 		return NULL;
+	if (!StreamPool_QueryStatistics(pool, &stats))
+		return NULL;
+
+	/* Keep the format of the array based pool, the streams are no longer kept in arrays so
+	 * both capacities are the number of streams allocated. Hit rates are only available from
+	 * StreamPool_QueryStatistics. */
 	_snprintf(buffer, size - 1,
 	          "aSize    =%" PRIuz ", uSize    =%" PRIuz "aCapacity=%" PRIuz ", uCapacity=%" PRIuz,
-	          pool->aSize, pool->uSize, pool->aCapacity, pool->uCapacity);
+	          stats.available, stats.used, stats.allocated, stats.allocated);
 	buffer[size - 1] = '\0';
 	return buffer;
 }
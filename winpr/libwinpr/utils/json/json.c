@@ -623,8 +623,8 @@ BOOL WINPR_JSON_AddItemToArray(WINPR_JSON* array, WINPR_JSON* item)
 #elif defined(WITH_CJSON)
 	return cJSON_AddItemToArray((cJSON*)array, (cJSON*)item);
 #else
-	WINPR_UNUSED(object);
-	WINPR_UNUSED(name);
+	WINPR_UNUSED(array);
+	WINPR_UNUSED(item);
 	return FALSE;
 #endif
 }
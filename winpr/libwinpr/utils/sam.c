@@ -28,9 +28,16 @@
 #include <winpr/sam.h>
 #include <winpr/print.h>
 #include <winpr/file.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
 
 #include "../log.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #ifdef WINPR_HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -45,39 +52,215 @@
 struct winpr_sam
 {
 	FILE* fp;
+	char* filename;
 	char* line;
 	char* buffer;
 	char* context;
 	BOOL readOnly;
 };
 
-static WINPR_SAM_ENTRY* SamEntryFromDataA(LPCSTR User, DWORD UserLength, LPCSTR Domain,
-                                          DWORD DomainLength)
+/* File systems update timestamps with a coarse clock, a snapshot of a file modified within this
+ * window of parsing it might miss a later rewrite with the same size and timestamps */
+#define WINPR_SAM_RACY_WINDOW_NS (2ull * 1000000000ull)
+
+typedef struct
 {
-	WINPR_SAM_ENTRY* entry = calloc(1, sizeof(WINPR_SAM_ENTRY));
-	if (!entry)
-		return NULL;
-	if (User && (UserLength > 0))
-		entry->User = _strdup(User);
-	entry->UserLength = UserLength;
-	if (Domain && (DomainLength > 0))
-		entry->Domain = _strdup(Domain);
-	entry->DomainLength = DomainLength;
-	return entry;
+	UINT64 inode;
+	INT64 size;
+	INT64 mtime; /* nanoseconds */
+	INT64 ctime; /* nanoseconds */
+} WINPR_SAM_FILE_STAMP;
+
+/* Immutable snapshot of a SAM file, entries are keyed by "User:Domain".
+ * Neither field may contain a ':' so the key is unambiguous. */
+typedef struct
+{
+	volatile LONG refCount;
+	WINPR_SAM_FILE_STAMP stamp;
+	BOOL racy;
+	wHashTable* entries;
+} WINPR_SAM_INDEX;
+
+static INIT_ONCE g_SamOnce = INIT_ONCE_STATIC_INIT;
+static wListDictionary* g_SamIndexes = NULL;
+static WINPR_SAM_BACKEND g_SamBackend = { 0 };
+
+static void SamIndexRelease(WINPR_SAM_INDEX* index)
+{
+	if (!index)
+		return;
+
+	if (InterlockedDecrement(&index->refCount) > 0)
+		return;
+
+	HashTable_Free(index->entries);
+	free(index);
+}
+
+static void SamIndexValueFree(void* obj)
+{
+	SamIndexRelease(obj);
 }
 
-static BOOL SamAreEntriesEqual(const WINPR_SAM_ENTRY* a, const WINPR_SAM_ENTRY* b)
+static void SamIndexEntryFree(void* obj)
 {
-	if (!a || !b)
+	SamFreeEntry(NULL, obj);
+}
+
+static void* SamIndexKeyNew(const void* key)
+{
+	return _strdup(key);
+}
+
+static BOOL SamIndexKeyEquals(const void* a, const void* b)
+{
+	return strcmp(a, b) == 0;
+}
+
+static BOOL CALLBACK SamInitIndexes(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+	g_SamIndexes = ListDictionary_New(TRUE);
+
+	if (!g_SamIndexes)
 		return FALSE;
-	if (a->UserLength != b->UserLength)
+
+	wObject* obj = ListDictionary_KeyObject(g_SamIndexes);
+	obj->fnObjectNew = SamIndexKeyNew;
+	obj->fnObjectFree = free;
+	obj->fnObjectEquals = SamIndexKeyEquals;
+	obj = ListDictionary_ValueObject(g_SamIndexes);
+	obj->fnObjectFree = SamIndexValueFree;
+	return TRUE;
+}
+
+static BOOL SamInit(void)
+{
+	if (!InitOnceExecuteOnce(&g_SamOnce, SamInitIndexes, NULL, NULL))
 		return FALSE;
-	if (a->DomainLength != b->DomainLength)
+
+	return g_SamIndexes != NULL;
+}
+
+static BOOL SamGetBackend(WINPR_SAM_BACKEND* backend)
+{
+	WINPR_ASSERT(backend);
+
+	if (!SamInit())
 		return FALSE;
-	if (strncmp(a->User, b->User, a->UserLength) != 0)
+
+	ListDictionary_Lock(g_SamIndexes);
+	*backend = g_SamBackend;
+	ListDictionary_Unlock(g_SamIndexes);
+	return backend->LookupUserA != NULL;
+}
+
+BOOL SamSetBackend(const WINPR_SAM_BACKEND* backend)
+{
+	const WINPR_SAM_BACKEND empty = { 0 };
+
+	if (!SamInit())
 		return FALSE;
-	if (strncmp(a->Domain, b->Domain, a->DomainLength) != 0)
+
+	ListDictionary_Lock(g_SamIndexes);
+	g_SamBackend = backend ? *backend : empty;
+	ListDictionary_Unlock(g_SamIndexes);
+	return TRUE;
+}
+
+static char* SamIndexKey(LPCSTR User, UINT32 UserLength, LPCSTR Domain, UINT32 DomainLength)
+{
+	/* Names with an embedded NUL can not match an entry of the file */
+	if ((UserLength > 0) && (!User || (strnlen(User, UserLength) != UserLength)))
+		return NULL;
+
+	if ((DomainLength > 0) && (!Domain || (strnlen(Domain, DomainLength) != DomainLength)))
+		return NULL;
+
+	char* key = calloc(1ull * UserLength + DomainLength + 2, sizeof(char));
+
+	if (!key)
+		return NULL;
+
+	if (UserLength > 0)
+		memcpy(key, User, UserLength);
+
+	key[UserLength] = ':';
+
+	if (DomainLength > 0)
+		memcpy(&key[UserLength + 1], Domain, DomainLength);
+
+	return key;
+}
+
+static WINPR_SAM_ENTRY* SamEntryCopy(const WINPR_SAM_ENTRY* entry)
+{
+	WINPR_ASSERT(entry);
+	WINPR_SAM_ENTRY* copy = calloc(1, sizeof(WINPR_SAM_ENTRY));
+
+	if (!copy)
+		return NULL;
+
+	if (entry->UserLength > 0)
+	{
+		copy->User = _strdup(entry->User);
+
+		if (!copy->User)
+			goto fail;
+
+		copy->UserLength = entry->UserLength;
+	}
+
+	if (entry->DomainLength > 0)
+	{
+		copy->Domain = _strdup(entry->Domain);
+
+		if (!copy->Domain)
+			goto fail;
+
+		copy->DomainLength = entry->DomainLength;
+	}
+
+	CopyMemory(copy->LmHash, entry->LmHash, sizeof(copy->LmHash));
+	CopyMemory(copy->NtHash, entry->NtHash, sizeof(copy->NtHash));
+	return copy;
+fail:
+	SamFreeEntry(NULL, copy);
+	return NULL;
+}
+
+static BOOL SamGetFileStamp(FILE* fp, WINPR_SAM_FILE_STAMP* stamp)
+{
+	WINPR_ASSERT(fp);
+	WINPR_ASSERT(stamp);
+
+#ifdef _WIN32
+	struct _stat64 st = { 0 };
+
+	if (_fstat64(_fileno(fp), &st) != 0)
+		return FALSE;
+#else
+	struct stat st = { 0 };
+
+	if (fstat(fileno(fp), &st) != 0)
 		return FALSE;
+#endif
+
+	stamp->inode = (UINT64)st.st_ino;
+	stamp->size = (INT64)st.st_size;
+#if defined(_WIN32)
+	stamp->mtime = (INT64)st.st_mtime * 1000000000ll;
+	stamp->ctime = (INT64)st.st_ctime * 1000000000ll;
+#elif defined(__APPLE__)
+	stamp->mtime = (INT64)st.st_mtimespec.tv_sec * 1000000000ll + st.st_mtimespec.tv_nsec;
+	stamp->ctime = (INT64)st.st_ctimespec.tv_sec * 1000000000ll + st.st_ctimespec.tv_nsec;
+#else
+	stamp->mtime = (INT64)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+	stamp->ctime = (INT64)st.st_ctim.tv_sec * 1000000000ll + st.st_ctim.tv_nsec;
+#endif
 	return TRUE;
 }
 
@@ -85,6 +268,7 @@ WINPR_SAM* SamOpen(const char* filename, BOOL readOnly)
 {
 	FILE* fp = NULL;
 	WINPR_SAM* sam = NULL;
+	WINPR_SAM_BACKEND backend = { 0 };
 
 	if (!filename)
 		filename = WINPR_SAM_FILE;
@@ -99,26 +283,31 @@ WINPR_SAM* SamOpen(const char* filename, BOOL readOnly)
 			fp = winpr_fopen(filename, "w+");
 	}
 
-	if (fp)
-	{
-		sam = (WINPR_SAM*)calloc(1, sizeof(WINPR_SAM));
-
-		if (!sam)
-		{
-			fclose(fp);
-			return NULL;
-		}
-
-		sam->readOnly = readOnly;
-		sam->fp = fp;
-	}
-	else
+	/* Lookups are answered by the backend, the SAM file is optional then */
+	if (!fp && !SamGetBackend(&backend))
 	{
 		WLog_DBG(TAG, "Could not open SAM file!");
 		return NULL;
 	}
 
+	sam = (WINPR_SAM*)calloc(1, sizeof(WINPR_SAM));
+
+	if (!sam)
+		goto fail;
+
+	sam->filename = _strdup(filename);
+
+	if (!sam->filename)
+		goto fail;
+
+	sam->readOnly = readOnly;
+	sam->fp = fp;
 	return sam;
+fail:
+	if (fp)
+		fclose(fp);
+	free(sam);
+	return NULL;
 }
 
 static BOOL SamLookupStart(WINPR_SAM* sam)
@@ -277,56 +466,147 @@ void SamResetEntry(WINPR_SAM_ENTRY* entry)
 	ZeroMemory(entry->NtHash, sizeof(entry->NtHash));
 }
 
-WINPR_SAM_ENTRY* SamLookupUserA(WINPR_SAM* sam, LPCSTR User, UINT32 UserLength, LPCSTR Domain,
-                                UINT32 DomainLength)
+static WINPR_SAM_INDEX* SamIndexNew(WINPR_SAM* sam, const WINPR_SAM_FILE_STAMP* stamp)
 {
-	size_t length = 0;
-	BOOL found = FALSE;
-	WINPR_SAM_ENTRY* search = SamEntryFromDataA(User, UserLength, Domain, DomainLength);
-	WINPR_SAM_ENTRY* entry = (WINPR_SAM_ENTRY*)calloc(1, sizeof(WINPR_SAM_ENTRY));
+	WINPR_ASSERT(sam);
+	WINPR_ASSERT(stamp);
+	WINPR_SAM_INDEX* index = (WINPR_SAM_INDEX*)calloc(1, sizeof(WINPR_SAM_INDEX));
+
+	if (!index)
+		return NULL;
 
-	if (!entry || !search)
+	/* A snapshot of a recently modified file is only used once, like git's racily clean index */
+	const INT64 now = (INT64)winpr_GetUnixTimeNS();
+	index->refCount = 1;
+	index->stamp = *stamp;
+	index->racy = (stamp->mtime > now - (INT64)WINPR_SAM_RACY_WINDOW_NS) ||
+	              (stamp->ctime > now - (INT64)WINPR_SAM_RACY_WINDOW_NS);
+	index->entries = HashTable_New(FALSE);
+
+	if (!index->entries || !HashTable_SetupForStringData(index->entries, FALSE))
 		goto fail;
 
+	wObject* obj = HashTable_ValueObject(index->entries);
+	obj->fnObjectFree = SamIndexEntryFree;
+
 	if (!SamLookupStart(sam))
+	{
+		/* An empty file has no entries, a file that could not be read must not look like one */
+		if (stamp->size == 0)
+			return index;
+
+		WLog_ERR(TAG, "Failed to read SAM file %s", sam->filename);
 		goto fail;
+	}
 
 	while (sam->line != NULL)
 	{
-		length = strlen(sam->line);
-
-		if (length > 1)
+		if ((strlen(sam->line) > 1) && (sam->line[0] != '#'))
 		{
-			if (sam->line[0] != '#')
+			WINPR_SAM_ENTRY* entry = (WINPR_SAM_ENTRY*)calloc(1, sizeof(WINPR_SAM_ENTRY));
+
+			if (!entry)
+				goto fail_lookup;
+
+			/* Entries following a malformed line were never found by a lookup */
+			if (!SamReadEntry(sam, entry))
 			{
-				if (!SamReadEntry(sam, entry))
-				{
-					goto out_fail;
-				}
-
-				if (SamAreEntriesEqual(entry, search))
-				{
-					found = 1;
-					break;
-				}
+				WLog_WARN(TAG, "Malformed SAM entry, ignoring the remaining file");
+				free(entry);
+				break;
 			}
+
+			char* key =
+			    SamIndexKey(entry->User, entry->UserLength, entry->Domain, entry->DomainLength);
+
+			/* The first entry of a user wins */
+			if (!key || HashTable_Contains(index->entries, key) ||
+			    !HashTable_Insert(index->entries, key, entry))
+				SamFreeEntry(sam, entry);
+
+			free(key);
 		}
 
-		SamResetEntry(entry);
 		sam->line = strtok_s(NULL, "\n", &sam->context);
 	}
 
-out_fail:
+	SamLookupFinish(sam);
+	return index;
+
+fail_lookup:
 	SamLookupFinish(sam);
 fail:
-	SamFreeEntry(sam, search);
+	SamIndexRelease(index);
+	return NULL;
+}
 
-	if (!found)
-	{
-		SamFreeEntry(sam, entry);
+/* Returns a reference to the index of the SAM file, rebuilt if the file changed */
+static WINPR_SAM_INDEX* SamIndexAcquire(WINPR_SAM* sam)
+{
+	WINPR_SAM_FILE_STAMP stamp = { 0 };
+	WINPR_SAM_INDEX* index = NULL;
+
+	WINPR_ASSERT(sam);
+
+	if (!sam->fp || !SamInit() || !SamGetFileStamp(sam->fp, &stamp))
+		return NULL;
+
+	ListDictionary_Lock(g_SamIndexes);
+	index = ListDictionary_GetItemValue(g_SamIndexes, sam->filename);
+
+	if (index && !index->racy && (memcmp(&index->stamp, &stamp, sizeof(stamp)) == 0))
+		InterlockedIncrement(&index->refCount);
+	else
+		index = NULL;
+
+	ListDictionary_Unlock(g_SamIndexes);
+
+	if (index)
+		return index;
+
+	/* Parse outside of the lock, concurrent lookups keep using the previous snapshot */
+	index = SamIndexNew(sam, &stamp);
+
+	if (!index)
 		return NULL;
+
+	ListDictionary_Lock(g_SamIndexes);
+	InterlockedIncrement(&index->refCount);
+
+	if (ListDictionary_Contains(g_SamIndexes, sam->filename))
+		ListDictionary_SetItemValue(g_SamIndexes, sam->filename, index);
+	else if (!ListDictionary_Add(g_SamIndexes, sam->filename, index))
+		InterlockedDecrement(&index->refCount);
+
+	ListDictionary_Unlock(g_SamIndexes);
+	return index;
+}
+
+WINPR_SAM_ENTRY* SamLookupUserA(WINPR_SAM* sam, LPCSTR User, UINT32 UserLength, LPCSTR Domain,
+                                UINT32 DomainLength)
+{
+	WINPR_SAM_BACKEND backend = { 0 };
+	WINPR_SAM_ENTRY* entry = NULL;
+
+	if (!sam)
+		return NULL;
+
+	if (SamGetBackend(&backend))
+		return backend.LookupUserA(backend.context, User, UserLength, Domain, DomainLength);
+
+	char* key = SamIndexKey(User, UserLength, Domain, DomainLength);
+	WINPR_SAM_INDEX* index = SamIndexAcquire(sam);
+
+	if (key && index)
+	{
+		const WINPR_SAM_ENTRY* cached = HashTable_GetItemValue(index->entries, key);
+
+		if (cached)
+			entry = SamEntryCopy(cached);
 	}
 
+	SamIndexRelease(index);
+	free(key);
 	return entry;
 }
 
@@ -361,6 +641,7 @@ void SamClose(WINPR_SAM* sam)
 	{
 		if (sam->fp)
 			fclose(sam->fp);
+		free(sam->filename);
 		free(sam);
 	}
 }
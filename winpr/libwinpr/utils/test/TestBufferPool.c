@@ -60,6 +60,39 @@ int TestBufferPool(int argc, char* argv[])
 		return -1;
 	}
 
+	/* The returned buffer is reused for a request of the same size class */
+	Buffers[3] = BufferPool_Take(pool, 1500);
+
+	if (Buffers[3] != Buffers[1])
+	{
+		printf("BufferPool_Take failure: returned buffer not reused\n");
+		return -1;
+	}
+
+	BufferSize = BufferPool_GetBufferSize(pool, Buffers[3]);
+
+	if (BufferSize != 1500)
+	{
+		printf("BufferPool_GetBufferSize failure: Actual: %d Expected: 1500\n", BufferSize);
+		return -1;
+	}
+
+	{
+		wPoolStatistics stats = { 0 };
+
+		if (!BufferPool_QueryStatistics(pool, &stats))
+			return -1;
+
+		if ((stats.used != 3) || (stats.available != 0) || (stats.hits != 1) ||
+		    (stats.misses != 3))
+		{
+			printf("BufferPool_QueryStatistics failure: used=%" PRIuz " available=%" PRIuz
+			       " hits=%" PRIu64 " misses=%" PRIu64 "\n",
+			       stats.used, stats.available, stats.hits, stats.misses);
+			return -1;
+		}
+	}
+
 	BufferPool_Clear(pool);
 
 	BufferPool_Free(pool);
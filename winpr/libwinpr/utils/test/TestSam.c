@@ -0,0 +1,182 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/print.h>
+#include <winpr/sam.h>
+#include <winpr/sysinfo.h>
+
+static const char TEST_NT_HASH_1[] = "7f6bc5bfa3c8f5ac42ab8b2fefe5e1ad";
+static const char TEST_NT_HASH_2[] = "8846f7eaee8fb117ad06bdd830b7586c";
+
+static BOOL test_sam_write(const char* filename, const char* hash)
+{
+	FILE* fp = winpr_fopen(filename, "w");
+
+	if (!fp)
+		return FALSE;
+
+	(void)fprintf(fp, "# test SAM file\n");
+	(void)fprintf(fp, "Alice::%s:%s:::\n", hash, hash);
+	(void)fprintf(fp, "Bob:CONTOSO::%s:::\n", hash);
+	(void)fprintf(fp, "Alice::::::\n");
+	(void)fclose(fp);
+	return TRUE;
+}
+
+static BOOL test_sam_expect(WINPR_SAM* sam, const char* user, const char* domain,
+                            const char* hash)
+{
+	BYTE expected[16] = { 0 };
+	const UINT32 domainLength = domain ? (UINT32)strlen(domain) : 0;
+	WINPR_SAM_ENTRY* entry = SamLookupUserA(sam, user, (UINT32)strlen(user), domain, domainLength);
+	BOOL rc = FALSE;
+
+	if (!hash)
+	{
+		rc = (entry == NULL);
+		goto out;
+	}
+
+	if (!entry)
+		goto out;
+
+	winpr_HexStringToBinBuffer(hash, strlen(hash), expected, sizeof(expected));
+	rc = (memcmp(entry->NtHash, expected, sizeof(expected)) == 0) &&
+	     (entry->UserLength == strlen(user)) && (strcmp(entry->User, user) == 0);
+
+out:
+	if (!rc)
+		(void)fprintf(stderr, "[%s] unexpected result for %s@%s\n", __func__, user,
+		              domain ? domain : "");
+
+	SamFreeEntry(sam, entry);
+	return rc;
+}
+
+static BOOL test_sam_file(const char* filename)
+{
+	BOOL rc = FALSE;
+	WINPR_SAM* sam = NULL;
+	FILE* fp = winpr_fopen(filename, "w");
+
+	if (!fp)
+		return FALSE;
+
+	(void)fclose(fp);
+	sam = SamOpen(filename, TRUE);
+
+	if (!sam)
+		return FALSE;
+
+	/* An empty file has no users, they are found once written */
+	if (!test_sam_expect(sam, "Alice", NULL, NULL))
+		goto fail;
+
+	if (!test_sam_write(filename, TEST_NT_HASH_1))
+		goto fail;
+
+	/* The first entry of a user wins, the domain has to match */
+	if (!test_sam_expect(sam, "Alice", NULL, TEST_NT_HASH_1) ||
+	    !test_sam_expect(sam, "Bob", "CONTOSO", TEST_NT_HASH_1) ||
+	    !test_sam_expect(sam, "Bob", NULL, NULL) || !test_sam_expect(sam, "Bo", "CONTOSO", NULL) ||
+	    !test_sam_expect(sam, "Carol", NULL, NULL))
+		goto fail;
+
+	/* A file rewritten in place with the same size is picked up by the next lookup, even
+	 * within the timestamp granularity of the file system */
+	if (!test_sam_write(filename, TEST_NT_HASH_2))
+		goto fail;
+
+	if (!test_sam_expect(sam, "Alice", NULL, TEST_NT_HASH_2) ||
+	    !test_sam_expect(sam, "Bob", "CONTOSO", TEST_NT_HASH_2))
+		goto fail;
+
+	if (!test_sam_write(filename, TEST_NT_HASH_1))
+		goto fail;
+
+	if (!test_sam_expect(sam, "Alice", NULL, TEST_NT_HASH_1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	SamClose(sam);
+	return rc;
+}
+
+static WINPR_SAM_ENTRY* test_sam_backend_lookup(void* context, LPCSTR User, UINT32 UserLength,
+                                                LPCSTR Domain, UINT32 DomainLength)
+{
+	WINPR_SAM_ENTRY* entry = NULL;
+	WINPR_UNUSED(Domain);
+	WINPR_UNUSED(DomainLength);
+
+	if ((UserLength != strlen(context)) || (strncmp(User, context, UserLength) != 0))
+		return NULL;
+
+	entry = calloc(1, sizeof(WINPR_SAM_ENTRY));
+
+	if (!entry)
+		return NULL;
+
+	entry->User = _strdup(context);
+	entry->UserLength = UserLength;
+	winpr_HexStringToBinBuffer(TEST_NT_HASH_2, strlen(TEST_NT_HASH_2), entry->NtHash,
+	                           sizeof(entry->NtHash));
+	return entry;
+}
+
+static BOOL test_sam_backend(const char* filename)
+{
+	BOOL rc = FALSE;
+	WINPR_SAM_BACKEND backend = { test_sam_backend_lookup, "Dave" };
+
+	if (!SamSetBackend(&backend))
+		return FALSE;
+
+	/* With a backend the SAM file is not required */
+	WINPR_SAM* sam = SamOpen(filename, TRUE);
+
+	if (!sam)
+		goto fail;
+
+	if (!test_sam_expect(sam, "Dave", NULL, TEST_NT_HASH_2) ||
+	    !test_sam_expect(sam, "Alice", NULL, NULL))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	SamClose(sam);
+	SamSetBackend(NULL);
+	return rc;
+}
+
+int TestSam(int argc, char* argv[])
+{
+	int rc = -1;
+	char name[64] = { 0 };
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	(void)_snprintf(name, sizeof(name), "TestSam-%" PRIu64, GetTickCount64());
+	char* filename = GetKnownSubPath(KNOWN_PATH_TEMP, name);
+
+	if (!filename)
+		return -1;
+
+	if (!test_sam_file(filename))
+		goto fail;
+
+	if (!winpr_DeleteFile(filename))
+		goto fail;
+
+	if (!test_sam_backend(filename))
+		goto fail;
+
+	rc = 0;
+fail:
+	winpr_DeleteFile(filename);
+	free(filename);
+	return rc;
+}
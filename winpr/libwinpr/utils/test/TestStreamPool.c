@@ -72,6 +72,36 @@ int TestStreamPool(int argc, char* argv[])
 
 	printf("%s\n", StreamPool_GetStatistics(pool, buffer, sizeof(buffer)));
 
+	/* Released streams are handed out again, whatever size they grew to */
+	{
+		wPoolStatistics stats = { 0 };
+
+		if (!Stream_EnsureCapacity(s[2], 3 * BUFFER_SIZE))
+			return -1;
+
+		Stream_Release(s[2]);
+		Stream_Release(s[3]);
+		Stream_Release(s[4]);
+
+		if (!StreamPool_QueryStatistics(pool, &stats))
+			return -1;
+
+		if ((stats.available != 3) || (stats.used != 0) || (stats.allocated != 3))
+		{
+			printf("StreamPool_QueryStatistics failure: available=%" PRIuz " used=%" PRIuz
+			       " allocated=%" PRIuz "\n",
+			       stats.available, stats.used, stats.allocated);
+			return -1;
+		}
+
+		s[0] = StreamPool_Take(pool, 2 * BUFFER_SIZE);
+
+		if (!s[0] || (s[0] != s[2]) || (Stream_Capacity(s[0]) < 2 * BUFFER_SIZE))
+			return -1;
+
+		Stream_Release(s[0]);
+	}
+
 	StreamPool_Free(pool);
 
 	return 0;